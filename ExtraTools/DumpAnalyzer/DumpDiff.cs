@@ -0,0 +1,499 @@
+﻿/*
+ * Process Hacker -
+ *   dump comparison
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.Collections.Generic;
+using ProcessHacker;
+using ProcessHacker.Native.Api;
+
+namespace DumpAnalyzer
+{
+    public enum DumpDiffKind
+    {
+        Added,
+        Removed,
+        Changed
+    }
+
+    public enum DumpDiffCategory
+    {
+        Process,
+        Counter,
+        Handle,
+        Module,
+        Service
+    }
+
+    /// <summary>
+    /// Describes a difference between two dumps.
+    /// </summary>
+    public sealed class DumpDiffEntry
+    {
+        public DumpDiffKind Kind;
+        public DumpDiffCategory Category;
+        /// <summary>
+        /// The ID of the process, or 0 for services.
+        /// </summary>
+        public int ProcessId;
+        public string ProcessName;
+        /// <summary>
+        /// A description of the process, handle, module or service, or the 
+        /// name of the counter which changed.
+        /// </summary>
+        public string Item;
+        public long OldValue;
+        public long NewValue;
+    }
+
+    /// <summary>
+    /// Compares two dumps.
+    /// </summary>
+    /// <remarks>
+    /// <para>
+    /// Processes are matched by process ID, creation time and image file 
+    /// name, so a process ID which was reused shows up as one process 
+    /// being removed and another being added. Handles are matched by 
+    /// handle value and object address and modules by base address and 
+    /// file name.
+    /// </para>
+    /// <para>
+    /// Only the process keys of both dumps are kept in memory. The two 
+    /// key lists are merged in sorted order, and for each matching pair 
+    /// of processes the handle and module tables are sorted and merged. 
+    /// Memory usage is therefore bounded by the largest process rather 
+    /// than by the size of the dumps. The entry passed to the callback 
+    /// is reused and must not be kept.
+    /// </para>
+    /// </remarks>
+    public unsafe sealed class DumpDiff
+    {
+        private struct HandleKey : IComparable<HandleKey>
+        {
+            public int Handle;
+            public long Object;
+            public int Index;
+
+            public int CompareTo(HandleKey other)
+            {
+                int result = this.Handle.CompareTo(other.Handle);
+
+                if (result != 0)
+                    return result;
+
+                return this.Object.CompareTo(other.Object);
+            }
+        }
+
+        private struct ModuleKey : IComparable<ModuleKey>
+        {
+            public long BaseAddress;
+            public string FileName;
+            public int Index;
+
+            public int CompareTo(ModuleKey other)
+            {
+                int result = this.BaseAddress.CompareTo(other.BaseAddress);
+
+                if (result != 0)
+                    return result;
+
+                return string.Compare(this.FileName, other.FileName, StringComparison.OrdinalIgnoreCase);
+            }
+        }
+
+        private static readonly string[] ServiceFields = new string[] { "State", "ProcessId", "StartType" };
+
+        private readonly DumpFile _oldDump;
+        private readonly DumpFile _newDump;
+        private readonly DumpDiffEntry _entry = new DumpDiffEntry();
+        private Action<DumpDiffEntry> _callback;
+
+        public DumpDiff(DumpFile oldDump, DumpFile newDump)
+        {
+            _oldDump = oldDump;
+            _newDump = newDump;
+
+            this.CompareHandles = true;
+            this.CompareModules = true;
+            this.CompareServices = true;
+        }
+
+        /// <summary>
+        /// Gets or sets a function which selects the processes to compare.
+        /// </summary>
+        public Predicate<DumpProcess> ProcessFilter { get; set; }
+
+        /// <summary>
+        /// Gets or sets the handle type to compare, or null for all types.
+        /// </summary>
+        public string HandleTypeFilter { get; set; }
+
+        /// <summary>
+        /// Gets or sets whether individual handles are compared. Handle 
+        /// counts are always compared.
+        /// </summary>
+        public bool CompareHandles { get; set; }
+
+        /// <summary>
+        /// Gets or sets whether individual modules are compared. Module 
+        /// counts are always compared.
+        /// </summary>
+        public bool CompareModules { get; set; }
+
+        public bool CompareServices { get; set; }
+
+        /// <summary>
+        /// Compares the dumps.
+        /// </summary>
+        /// <param name="callback">A function which is called for each difference.</param>
+        public void Compare(Action<DumpDiffEntry> callback)
+        {
+            List<DumpProcessKey> oldKeys = _oldDump.GetProcessKeys(this.ProcessFilter);
+            List<DumpProcessKey> newKeys = _newDump.GetProcessKeys(this.ProcessFilter);
+            int i = 0;
+            int j = 0;
+
+            _callback = callback;
+
+            while (i < oldKeys.Count || j < newKeys.Count)
+            {
+                int result;
+
+                if (i == oldKeys.Count)
+                    result = 1;
+                else if (j == newKeys.Count)
+                    result = -1;
+                else
+                    result = oldKeys[i].CompareTo(newKeys[j]);
+
+                if (result < 0)
+                {
+                    this.ReportProcess(DumpDiffKind.Removed, oldKeys[i++]);
+                }
+                else if (result > 0)
+                {
+                    this.ReportProcess(DumpDiffKind.Added, newKeys[j++]);
+                }
+                else
+                {
+                    DumpProcessKey oldKey = oldKeys[i++];
+                    DumpProcessKey newKey = newKeys[j++];
+
+                    _oldDump.OpenProcess(oldKey.ObjectName, oldProcess =>
+                        _newDump.OpenProcess(newKey.ObjectName, newProcess =>
+                            this.CompareProcess(oldProcess, newProcess)));
+                }
+            }
+
+            if (this.CompareServices)
+                this.CompareServiceList();
+
+            _callback = null;
+        }
+
+        private void Report(DumpDiffKind kind, DumpDiffCategory category, string item, long oldValue, long newValue)
+        {
+            _entry.Kind = kind;
+            _entry.Category = category;
+            _entry.Item = item;
+            _entry.OldValue = oldValue;
+            _entry.NewValue = newValue;
+
+            _callback(_entry);
+        }
+
+        private void ReportCounter(string name, long oldValue, long newValue)
+        {
+            if (oldValue != newValue)
+                this.Report(DumpDiffKind.Changed, DumpDiffCategory.Counter, name, oldValue, newValue);
+        }
+
+        private void ReportProcess(DumpDiffKind kind, DumpProcessKey key)
+        {
+            _entry.ProcessId = key.ProcessId;
+            _entry.ProcessName = key.Name;
+
+            this.Report(kind, DumpDiffCategory.Process, key.Image, 0, 0);
+        }
+
+        private void CompareProcess(DumpProcess oldProcess, DumpProcess newProcess)
+        {
+            VmCountersEx64 oldVm, newVm;
+            IoCounters oldIo, newIo;
+
+            _entry.ProcessId = newProcess.ProcessId;
+            _entry.ProcessName = newProcess.Name;
+
+            if (oldProcess.ReadVmCounters(out oldVm) && newProcess.ReadVmCounters(out newVm))
+            {
+                this.ReportCounter("PrivateBytes", oldVm.PagefileUsage, newVm.PagefileUsage);
+                this.ReportCounter("WorkingSet", oldVm.WorkingSetSize, newVm.WorkingSetSize);
+                this.ReportCounter("VirtualSize", oldVm.VirtualSize, newVm.VirtualSize);
+                this.ReportCounter("PagedPool", oldVm.QuotaPagedPoolUsage, newVm.QuotaPagedPoolUsage);
+                this.ReportCounter("NonPagedPool", oldVm.QuotaNonPagedPoolUsage, newVm.QuotaNonPagedPoolUsage);
+                this.ReportCounter("PageFaults", oldVm.PageFaultCount, newVm.PageFaultCount);
+            }
+
+            if (oldProcess.ReadIoCounters(out oldIo) && newProcess.ReadIoCounters(out newIo))
+            {
+                this.ReportCounter("IoReads", (long)oldIo.ReadOperationCount, (long)newIo.ReadOperationCount);
+                this.ReportCounter("IoWrites", (long)oldIo.WriteOperationCount, (long)newIo.WriteOperationCount);
+                this.ReportCounter("IoReadBytes", (long)oldIo.ReadTransferCount, (long)newIo.ReadTransferCount);
+                this.ReportCounter("IoWriteBytes", (long)oldIo.WriteTransferCount, (long)newIo.WriteTransferCount);
+            }
+
+            using (DumpTableReader oldHandles = oldProcess.OpenHandleTable())
+            using (DumpTableReader newHandles = newProcess.OpenHandleTable())
+            {
+                if (oldHandles != null && newHandles != null)
+                {
+                    this.ReportCounter("Handles", oldHandles.RecordCount, newHandles.RecordCount);
+
+                    if (this.CompareHandles)
+                        this.CompareHandleTables(oldHandles, newHandles);
+                }
+            }
+
+            using (DumpTableReader oldModules = oldProcess.OpenModuleTable())
+            using (DumpTableReader newModules = newProcess.OpenModuleTable())
+            {
+                if (oldModules != null && newModules != null)
+                {
+                    this.ReportCounter("Modules", oldModules.RecordCount, newModules.RecordCount);
+
+                    if (this.CompareModules)
+                        this.CompareModuleTables(oldModules, newModules);
+                }
+            }
+        }
+
+        private static HandleKey[] GetHandleKeys(DumpTableReader table)
+        {
+            HandleKey[] keys = new HandleKey[table.RecordCount];
+
+            for (int i = 0; i < keys.Length; i++)
+            {
+                DumpHandleRecord* record = (DumpHandleRecord*)table.GetRecord(i);
+
+                keys[i].Handle = record->Handle;
+                keys[i].Object = record->Object;
+                keys[i].Index = i;
+            }
+
+            Array.Sort(keys);
+
+            return keys;
+        }
+
+        private void CompareHandleTables(DumpTableReader oldTable, DumpTableReader newTable)
+        {
+            HandleKey[] oldKeys = GetHandleKeys(oldTable);
+            HandleKey[] newKeys = GetHandleKeys(newTable);
+            int i = 0;
+            int j = 0;
+
+            while (i < oldKeys.Length || j < newKeys.Length)
+            {
+                int result;
+
+                if (i == oldKeys.Length)
+                    result = 1;
+                else if (j == newKeys.Length)
+                    result = -1;
+                else
+                    result = oldKeys[i].CompareTo(newKeys[j]);
+
+                if (result < 0)
+                {
+                    this.ReportHandle(DumpDiffKind.Removed, oldTable, oldKeys[i++].Index);
+                }
+                else if (result > 0)
+                {
+                    this.ReportHandle(DumpDiffKind.Added, newTable, newKeys[j++].Index);
+                }
+                else
+                {
+                    i++;
+                    j++;
+                }
+            }
+        }
+
+        private void ReportHandle(DumpDiffKind kind, DumpTableReader table, int index)
+        {
+            DumpHandleRecord* record = (DumpHandleRecord*)table.GetRecord(index);
+            string typeName = table.GetString(record->TypeName);
+
+            if (this.HandleTypeFilter != null &&
+                !string.Equals(typeName, this.HandleTypeFilter, StringComparison.OrdinalIgnoreCase))
+                return;
+
+            this.Report(
+                kind,
+                DumpDiffCategory.Handle,
+                "0x" + record->Handle.ToString("x") + "\t" + typeName + "\t" + table.GetString(record->ObjectName),
+                0,
+                0
+                );
+        }
+
+        private static ModuleKey[] GetModuleKeys(DumpTableReader table)
+        {
+            ModuleKey[] keys = new ModuleKey[table.RecordCount];
+
+            for (int i = 0; i < keys.Length; i++)
+            {
+                DumpModuleRecord* record = (DumpModuleRecord*)table.GetRecord(i);
+
+                keys[i].BaseAddress = record->BaseAddress;
+                keys[i].FileName = table.GetString(record->FileName);
+                keys[i].Index = i;
+            }
+
+            Array.Sort(keys);
+
+            return keys;
+        }
+
+        private void CompareModuleTables(DumpTableReader oldTable, DumpTableReader newTable)
+        {
+            ModuleKey[] oldKeys = GetModuleKeys(oldTable);
+            ModuleKey[] newKeys = GetModuleKeys(newTable);
+            int i = 0;
+            int j = 0;
+
+            while (i < oldKeys.Length || j < newKeys.Length)
+            {
+                int result;
+
+                if (i == oldKeys.Length)
+                    result = 1;
+                else if (j == newKeys.Length)
+                    result = -1;
+                else
+                    result = oldKeys[i].CompareTo(newKeys[j]);
+
+                if (result < 0)
+                {
+                    this.ReportModule(DumpDiffKind.Removed, oldKeys[i++]);
+                }
+                else if (result > 0)
+                {
+                    this.ReportModule(DumpDiffKind.Added, newKeys[j++]);
+                }
+                else
+                {
+                    i++;
+                    j++;
+                }
+            }
+        }
+
+        private void ReportModule(DumpDiffKind kind, ModuleKey key)
+        {
+            this.Report(
+                kind,
+                DumpDiffCategory.Module,
+                "0x" + key.BaseAddress.ToString("x") + "\t" + key.FileName,
+                0,
+                0
+                );
+        }
+
+        private static List<IDictionary<string, string>> GetServices(DumpFile dump)
+        {
+            List<IDictionary<string, string>> services = new List<IDictionary<string, string>>();
+
+            dump.EnumServices(service =>
+            {
+                services.Add(service);
+                return true;
+            });
+
+            services.Sort((s1, s2) => CompareServiceNames(s1, s2));
+
+            return services;
+        }
+
+        private static int CompareServiceNames(IDictionary<string, string> s1, IDictionary<string, string> s2)
+        {
+            return string.Compare(
+                DumpFile.GetString(s1, "Name"),
+                DumpFile.GetString(s2, "Name"),
+                StringComparison.OrdinalIgnoreCase
+                );
+        }
+
+        private void CompareServiceList()
+        {
+            // There are only a few hundred services, so we just read them all.
+            List<IDictionary<string, string>> oldServices = GetServices(_oldDump);
+            List<IDictionary<string, string>> newServices = GetServices(_newDump);
+            int i = 0;
+            int j = 0;
+
+            _entry.ProcessId = 0;
+            _entry.ProcessName = null;
+
+            while (i < oldServices.Count || j < newServices.Count)
+            {
+                int result;
+
+                if (i == oldServices.Count)
+                    result = 1;
+                else if (j == newServices.Count)
+                    result = -1;
+                else
+                    result = CompareServiceNames(oldServices[i], newServices[j]);
+
+                if (result < 0)
+                {
+                    this.Report(DumpDiffKind.Removed, DumpDiffCategory.Service,
+                        DumpFile.GetString(oldServices[i++], "Name"), 0, 0);
+                }
+                else if (result > 0)
+                {
+                    this.Report(DumpDiffKind.Added, DumpDiffCategory.Service,
+                        DumpFile.GetString(newServices[j++], "Name"), 0, 0);
+                }
+                else
+                {
+                    this.CompareService(oldServices[i++], newServices[j++]);
+                }
+            }
+        }
+
+        private void CompareService(IDictionary<string, string> oldService, IDictionary<string, string> newService)
+        {
+            string name = DumpFile.GetString(newService, "Name");
+
+            foreach (string field in ServiceFields)
+            {
+                long oldValue = DumpFile.ParseInt64(oldService, field);
+                long newValue = DumpFile.ParseInt64(newService, field);
+
+                if (oldValue != newValue)
+                    this.Report(DumpDiffKind.Changed, DumpDiffCategory.Service, name + "\t" + field, oldValue, newValue);
+            }
+        }
+    }
+}
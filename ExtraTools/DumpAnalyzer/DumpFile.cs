@@ -0,0 +1,468 @@
+﻿/*
+ * Process Hacker -
+ *   dump file reader
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.Collections.Generic;
+using System.Globalization;
+using System.Runtime.InteropServices;
+using System.Text;
+using ProcessHacker;
+using ProcessHacker.Native.Api;
+using ProcessHacker.Native.Mfs;
+
+namespace DumpAnalyzer
+{
+    public struct DumpHandle
+    {
+        public long Object;
+        public int Handle;
+        public int GrantedAccess;
+        public string TypeName;
+        public string ObjectName;
+    }
+
+    public struct DumpModule
+    {
+        public long BaseAddress;
+        public int Size;
+        public string Name;
+        public string FileName;
+        public string FileDescription;
+        public string FileCompanyName;
+        public string FileVersion;
+    }
+
+    /// <summary>
+    /// Identifies a process in a dump. Processes in different dumps are 
+    /// considered to be the same if their keys are equal.
+    /// </summary>
+    public struct DumpProcessKey : IComparable<DumpProcessKey>
+    {
+        public int ProcessId;
+        public long StartTime;
+        public string Image;
+        public string Name;
+        /// <summary>
+        /// The name of the process object in the dump.
+        /// </summary>
+        public string ObjectName;
+
+        public int CompareTo(DumpProcessKey other)
+        {
+            int result;
+
+            result = this.ProcessId.CompareTo(other.ProcessId);
+
+            if (result != 0)
+                return result;
+
+            result = this.StartTime.CompareTo(other.StartTime);
+
+            if (result != 0)
+                return result;
+
+            return string.Compare(this.Image, other.Image, StringComparison.OrdinalIgnoreCase);
+        }
+    }
+
+    /// <summary>
+    /// Represents a process read from a dump file. The object is only valid 
+    /// inside the callback passed to <see cref="DumpFile.EnumProcesses"/>.
+    /// </summary>
+    public sealed class DumpProcess
+    {
+        private readonly MemoryObject _mo;
+        private readonly IDictionary<string, string> _general;
+
+        internal DumpProcess(MemoryObject mo, IDictionary<string, string> general)
+        {
+            _mo = mo;
+            _general = general;
+
+            this.ProcessId = DumpFile.ParseInt32(general, "ProcessId");
+            this.ParentPid = DumpFile.ParseInt32(general, "ParentPid");
+            this.StartTime = DumpFile.ParseInt64(general, "StartTime");
+            this.Name = DumpFile.GetString(general, "Name");
+            this.FileName = DumpFile.GetString(general, "FileName");
+            this.UserName = DumpFile.GetString(general, "UserName");
+        }
+
+        public int ProcessId { get; private set; }
+        public int ParentPid { get; private set; }
+        /// <summary>
+        /// The creation time of the process as a file time, or 0 if unknown.
+        /// </summary>
+        public long StartTime { get; private set; }
+        public string Name { get; private set; }
+        public string FileName { get; private set; }
+        public string UserName { get; private set; }
+
+        public IDictionary<string, string> General
+        {
+            get { return _general; }
+        }
+
+        public DumpProcessKey Key
+        {
+            get
+            {
+                DumpProcessKey key;
+
+                key.ProcessId = this.ProcessId;
+                key.StartTime = this.StartTime;
+                key.Image = !string.IsNullOrEmpty(this.FileName) ? this.FileName : this.Name;
+                key.Name = this.Name;
+                key.ObjectName = _mo.Name;
+
+                return key;
+            }
+        }
+
+        /// <summary>
+        /// Reads a structure stored as the data of a child object.
+        /// </summary>
+        /// <returns>Whether the structure was present.</returns>
+        public unsafe bool ReadStruct<T>(string name, int size, out T s) where T : struct
+        {
+            s = default(T);
+
+            using (MemoryObject mo = _mo.GetChild(name))
+            {
+                if (mo == null)
+                    return false;
+
+                byte[] data = mo.ReadData();
+
+                if (data.Length < size)
+                    return false;
+
+                fixed (byte* dataPtr = data)
+                    s = (T)Marshal.PtrToStructure(new IntPtr(dataPtr), typeof(T));
+            }
+
+            return true;
+        }
+
+        public bool ReadVmCounters(out VmCountersEx64 counters)
+        {
+            return this.ReadStruct("VmCounters", VmCountersEx64.SizeOf, out counters);
+        }
+
+        public bool ReadIoCounters(out IoCounters counters)
+        {
+            return this.ReadStruct("IoCounters", IoCounters.SizeOf, out counters);
+        }
+
+        /// <summary>
+        /// Opens the handle table of the process.
+        /// </summary>
+        /// <returns>The table, or null if the process has no handle table.</returns>
+        public DumpTableReader OpenHandleTable()
+        {
+            return OpenTable(_mo, "HandleTable", DumpHandleRecord.SizeOf);
+        }
+
+        /// <summary>
+        /// Opens the module table of the process.
+        /// </summary>
+        /// <returns>The table, or null if the process has no module table.</returns>
+        public DumpTableReader OpenModuleTable()
+        {
+            return OpenTable(_mo, "ModuleTable", DumpModuleRecord.SizeOf);
+        }
+
+        public unsafe void EnumHandles(Action<DumpHandle> callback)
+        {
+            using (DumpTableReader table = this.OpenHandleTable())
+            {
+                if (table == null)
+                    return;
+
+                for (int i = 0; i < table.RecordCount; i++)
+                {
+                    DumpHandleRecord* record = (DumpHandleRecord*)table.GetRecord(i);
+                    DumpHandle handle;
+
+                    handle.Object = record->Object;
+                    handle.Handle = record->Handle;
+                    handle.GrantedAccess = record->GrantedAccess;
+                    handle.TypeName = table.GetString(record->TypeName);
+                    handle.ObjectName = table.GetString(record->ObjectName);
+
+                    callback(handle);
+                }
+            }
+        }
+
+        public unsafe void EnumModules(Action<DumpModule> callback)
+        {
+            using (DumpTableReader table = this.OpenModuleTable())
+            {
+                if (table == null)
+                    return;
+
+                for (int i = 0; i < table.RecordCount; i++)
+                {
+                    DumpModuleRecord* record = (DumpModuleRecord*)table.GetRecord(i);
+                    DumpModule module;
+
+                    module.BaseAddress = record->BaseAddress;
+                    module.Size = record->Size;
+                    module.Name = table.GetString(record->Name);
+                    module.FileName = table.GetString(record->FileName);
+                    module.FileDescription = table.GetString(record->FileDescription);
+                    module.FileCompanyName = table.GetString(record->FileCompanyName);
+                    module.FileVersion = table.GetString(record->FileVersion);
+
+                    callback(module);
+                }
+            }
+        }
+
+        private static DumpTableReader OpenTable(MemoryObject processMo, string name, int recordSize)
+        {
+            using (MemoryObject mo = processMo.GetChild(name))
+            {
+                if (mo == null)
+                    return null;
+
+                return DumpTableReader.Open(mo, recordSize);
+            }
+        }
+    }
+
+    /// <summary>
+    /// Reads a dump file created by Process Hacker.
+    /// </summary>
+    /// <remarks>
+    /// Processes are read one at a time and nothing is kept after the 
+    /// callback returns, so memory usage does not depend on the size of 
+    /// the dump.
+    /// </remarks>
+    public sealed class DumpFile : IDisposable
+    {
+        private readonly string _fileName;
+        private readonly MemoryFileSystem _mfs;
+
+        public DumpFile(string fileName)
+            : this(new MemoryFileSystem(fileName, MfsOpenMode.Open, true))
+        {
+            _fileName = fileName;
+        }
+
+        /// <summary>
+        /// Reads a dump from a file system which is already open. The 
+        /// file system is disposed with the dump file.
+        /// </summary>
+        public DumpFile(MemoryFileSystem mfs)
+        {
+            _mfs = mfs;
+        }
+
+        public void Dispose()
+        {
+            _mfs.Dispose();
+        }
+
+        public string FileName
+        {
+            get { return _fileName; }
+        }
+
+        public IDictionary<string, string> GetSystemInformation()
+        {
+            using (MemoryObject mo = _mfs.RootObject.GetChild("SystemInformation"))
+            {
+                if (mo == null)
+                    return new Dictionary<string, string>();
+
+                return GetDictionary(mo);
+            }
+        }
+
+        /// <summary>
+        /// Calls a function for each process in the dump.
+        /// </summary>
+        /// <param name="callback">A function which returns false to stop enumerating.</param>
+        public void EnumProcesses(Func<DumpProcess, bool> callback)
+        {
+            using (MemoryObject processesMo = _mfs.RootObject.GetChild("Processes"))
+            {
+                if (processesMo == null)
+                    return;
+
+                processesMo.EnumChildren(mo =>
+                {
+                    using (mo)
+                    {
+                        DumpProcess process = ReadProcess(mo);
+
+                        if (process == null)
+                            return true;
+
+                        return callback(process);
+                    }
+                });
+            }
+        }
+
+        /// <summary>
+        /// Gets the keys of the processes in the dump, sorted.
+        /// </summary>
+        /// <param name="filter">A function which selects processes, or null to include all processes.</param>
+        public List<DumpProcessKey> GetProcessKeys(Predicate<DumpProcess> filter)
+        {
+            List<DumpProcessKey> keys = new List<DumpProcessKey>();
+
+            this.EnumProcesses(process =>
+            {
+                if (filter == null || filter(process))
+                    keys.Add(process.Key);
+
+                return true;
+            });
+
+            keys.Sort();
+
+            return keys;
+        }
+
+        /// <summary>
+        /// Reads a single process.
+        /// </summary>
+        /// <param name="objectName">The object name from the process key.</param>
+        /// <param name="callback">A function which is called with the process.</param>
+        /// <returns>Whether the process was found.</returns>
+        public bool OpenProcess(string objectName, Action<DumpProcess> callback)
+        {
+            using (MemoryObject processesMo = _mfs.RootObject.GetChild("Processes"))
+            {
+                if (processesMo == null)
+                    return false;
+
+                using (MemoryObject mo = processesMo.GetChild(objectName))
+                {
+                    DumpProcess process;
+
+                    if (mo == null || (process = ReadProcess(mo)) == null)
+                        return false;
+
+                    callback(process);
+
+                    return true;
+                }
+            }
+        }
+
+        private static DumpProcess ReadProcess(MemoryObject mo)
+        {
+            using (MemoryObject generalMo = mo.GetChild("General"))
+            {
+                if (generalMo == null)
+                    return null;
+
+                return new DumpProcess(mo, GetDictionary(generalMo));
+            }
+        }
+
+        /// <summary>
+        /// Calls a function for each service in the dump.
+        /// </summary>
+        /// <param name="callback">A function which returns false to stop enumerating.</param>
+        public void EnumServices(Func<IDictionary<string, string>, bool> callback)
+        {
+            using (MemoryObject servicesMo = _mfs.RootObject.GetChild("Services"))
+            {
+                if (servicesMo == null)
+                    return;
+
+                servicesMo.EnumChildren(mo =>
+                {
+                    using (mo)
+                        return callback(GetDictionary(mo));
+                });
+            }
+        }
+
+        // The following functions match the ones in ProcessHacker's Dump class, 
+        // which we can't use because it depends on Windows Forms.
+
+        public static IDictionary<string, string> GetDictionary(MemoryObject mo)
+        {
+            Dictionary<string, string> dict = new Dictionary<string, string>();
+            string str = Encoding.Unicode.GetString(mo.ReadData());
+            int i = 0;
+
+            while (i < str.Length)
+            {
+                int equalsIndex = str.IndexOf('=', i);
+
+                if (equalsIndex == -1)
+                    break;
+
+                int nullIndex = str.IndexOf('\0', equalsIndex + 1);
+
+                if (nullIndex == -1)
+                    break;
+
+                dict[str.Substring(i, equalsIndex - i)] = str.Substring(equalsIndex + 1, nullIndex - equalsIndex - 1);
+                i = nullIndex + 1;
+            }
+
+            return dict;
+        }
+
+        public static string GetString(IDictionary<string, string> dict, string key)
+        {
+            string value;
+
+            if (dict.TryGetValue(key, out value))
+                return value;
+            else
+                return "";
+        }
+
+        public static int ParseInt32(IDictionary<string, string> dict, string key)
+        {
+            string value;
+            int result;
+
+            if (dict.TryGetValue(key, out value) &&
+                int.TryParse(value, NumberStyles.AllowHexSpecifier, CultureInfo.InvariantCulture, out result))
+                return result;
+            else
+                return 0;
+        }
+
+        public static long ParseInt64(IDictionary<string, string> dict, string key)
+        {
+            string value;
+            long result;
+
+            if (dict.TryGetValue(key, out value) &&
+                long.TryParse(value, NumberStyles.AllowHexSpecifier, CultureInfo.InvariantCulture, out result))
+                return result;
+            else
+                return 0;
+        }
+    }
+}
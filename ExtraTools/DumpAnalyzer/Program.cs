@@ -0,0 +1,456 @@
+﻿/*
+ * Process Hacker -
+ *   command line dump analyzer
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.Collections.Generic;
+using System.IO;
+using ProcessHacker.Common;
+
+namespace DumpAnalyzer
+{
+    static class Program
+    {
+        private class Options
+        {
+            public int Pid = -1;
+            public string Name;
+            public string Type;
+            public int Top = 20;
+            public bool Summary;
+            public List<string> Files = new List<string>();
+        }
+
+        private static TextWriter _output;
+
+        static int Main(string[] args)
+        {
+            Options options;
+
+            if (args.Length < 2 || (options = ParseOptions(args)) == null || options.Files.Count == 0)
+            {
+                PrintUsage();
+                return 1;
+            }
+
+            // Console output is flushed after every write by default, which 
+            // is far too slow for large dumps.
+            _output = new StreamWriter(Console.OpenStandardOutput());
+
+            try
+            {
+                switch (args[0].ToLowerInvariant())
+                {
+                    case "processes":
+                        ListProcesses(options);
+                        break;
+                    case "handles":
+                        ListHandles(options);
+                        break;
+                    case "handletypes":
+                        AggregateHandleTypes(options);
+                        break;
+                    case "modules":
+                        AggregateModules(options);
+                        break;
+                    case "diff":
+                        if (options.Files.Count != 2)
+                        {
+                            PrintUsage();
+                            return 1;
+                        }
+
+                        Diff(options);
+                        break;
+                    default:
+                        PrintUsage();
+                        return 1;
+                }
+            }
+            catch (Exception ex)
+            {
+                _output.Flush();
+                Console.Error.WriteLine("Error: " + ex.Message);
+                return 2;
+            }
+            finally
+            {
+                _output.Flush();
+            }
+
+            return 0;
+        }
+
+        private static void PrintUsage()
+        {
+            Console.Error.WriteLine("Usage: DumpAnalyzer <command> [options] <dump file>...");
+            Console.Error.WriteLine();
+            Console.Error.WriteLine("Commands:");
+            Console.Error.WriteLine("  processes    Lists processes.");
+            Console.Error.WriteLine("  handles      Lists handles.");
+            Console.Error.WriteLine("  handletypes  Lists the most common handle types for each process.");
+            Console.Error.WriteLine("  modules      Lists the files loaded by processes in all dumps.");
+            Console.Error.WriteLine("  diff         Compares two dumps: diff [options] <old dump> <new dump>");
+            Console.Error.WriteLine();
+            Console.Error.WriteLine("Options:");
+            Console.Error.WriteLine("  -pid <pid>     Only includes the process with the specified ID.");
+            Console.Error.WriteLine("  -name <name>   Only includes processes (or modules) whose name matches.");
+            Console.Error.WriteLine("  -type <type>   Only includes handles of the specified type.");
+            Console.Error.WriteLine("  -top <count>   The number of rows to show for handletypes.");
+            Console.Error.WriteLine("  -summary       Only shows process, counter and service changes for diff.");
+            Console.Error.WriteLine();
+            Console.Error.WriteLine("Names may contain the wildcards * and ?. Output is tab-separated.");
+        }
+
+        private static Options ParseOptions(string[] args)
+        {
+            Options options = new Options();
+
+            for (int i = 1; i < args.Length; i++)
+            {
+                string arg = args[i];
+
+                if (arg.Equals("-summary", StringComparison.OrdinalIgnoreCase))
+                {
+                    options.Summary = true;
+                }
+                else if (arg.StartsWith("-") && arg.Length > 1)
+                {
+                    if (i + 1 >= args.Length)
+                        return null;
+
+                    string value = args[++i];
+
+                    switch (arg.ToLowerInvariant())
+                    {
+                        case "-pid":
+                            if (!int.TryParse(value, out options.Pid))
+                                return null;
+                            break;
+                        case "-name":
+                            options.Name = value.ToLowerInvariant();
+                            break;
+                        case "-type":
+                            options.Type = value;
+                            break;
+                        case "-top":
+                            if (!int.TryParse(value, out options.Top) || options.Top <= 0)
+                                return null;
+                            break;
+                        default:
+                            return null;
+                    }
+                }
+                else
+                {
+                    options.Files.Add(arg);
+                }
+            }
+
+            return options;
+        }
+
+        private static bool MatchName(string pattern, string name)
+        {
+            if (pattern == null)
+                return true;
+
+            return Utils.MatchWildcards(pattern, (name ?? "").ToLowerInvariant());
+        }
+
+        private static bool MatchProcess(Options options, DumpProcess process)
+        {
+            if (options.Pid != -1 && process.ProcessId != options.Pid)
+                return false;
+
+            return MatchName(options.Name, process.Name);
+        }
+
+        /// <summary>
+        /// Calls a function for each process in each dump which matches 
+        /// the filter options.
+        /// </summary>
+        private static void EnumProcesses(Options options, Action<DumpFile, DumpProcess> callback)
+        {
+            foreach (string fileName in options.Files)
+            {
+                using (DumpFile dump = new DumpFile(fileName))
+                {
+                    dump.EnumProcesses(process =>
+                    {
+                        if (MatchProcess(options, process))
+                            callback(dump, process);
+
+                        return true;
+                    });
+                }
+            }
+        }
+
+        private static string GetPrefix(Options options, DumpFile dump)
+        {
+            // Only say which dump a row came from if there's more than one.
+            if (options.Files.Count > 1)
+                return dump.FileName + "\t";
+            else
+                return "";
+        }
+
+        private static void ListProcesses(Options options)
+        {
+            EnumProcesses(options, (dump, process) =>
+            {
+                _output.WriteLine(
+                    GetPrefix(options, dump) +
+                    process.ProcessId.ToString() + "\t" +
+                    process.ParentPid.ToString() + "\t" +
+                    process.Name + "\t" +
+                    process.UserName + "\t" +
+                    process.FileName
+                    );
+            });
+        }
+
+        private static void ListHandles(Options options)
+        {
+            EnumProcesses(options, (dump, process) =>
+            {
+                string prefix = GetPrefix(options, dump) + process.ProcessId.ToString() + "\t" + process.Name + "\t";
+
+                process.EnumHandles(handle =>
+                {
+                    if (options.Type != null &&
+                        !string.Equals(handle.TypeName, options.Type, StringComparison.OrdinalIgnoreCase))
+                        return;
+
+                    _output.WriteLine(
+                        prefix +
+                        "0x" + handle.Handle.ToString("x") + "\t" +
+                        handle.TypeName + "\t" +
+                        "0x" + handle.GrantedAccess.ToString("x") + "\t" +
+                        handle.ObjectName
+                        );
+                });
+            });
+        }
+
+        private class HandleTypeCount
+        {
+            public string Prefix;
+            public string TypeName;
+            public int Count;
+        }
+
+        private static void AggregateHandleTypes(Options options)
+        {
+            List<HandleTypeCount> counts = new List<HandleTypeCount>();
+            Dictionary<string, HandleTypeCount> processCounts = new Dictionary<string, HandleTypeCount>();
+
+            EnumProcesses(options, (dump, process) =>
+            {
+                string prefix = GetPrefix(options, dump) + process.ProcessId.ToString() + "\t" + process.Name + "\t";
+
+                processCounts.Clear();
+
+                process.EnumHandles(handle =>
+                {
+                    HandleTypeCount count;
+                    string typeName = handle.TypeName ?? "";
+
+                    if (options.Type != null &&
+                        !string.Equals(typeName, options.Type, StringComparison.OrdinalIgnoreCase))
+                        return;
+
+                    if (!processCounts.TryGetValue(typeName, out count))
+                    {
+                        count = new HandleTypeCount { Prefix = prefix, TypeName = typeName };
+                        processCounts.Add(typeName, count);
+                        counts.Add(count);
+                    }
+
+                    count.Count++;
+                });
+
+                // Only keep the rows we might print.
+                if (counts.Count > options.Top * 4)
+                    TrimCounts(counts, options.Top);
+            });
+
+            TrimCounts(counts, options.Top);
+
+            foreach (HandleTypeCount count in counts)
+                _output.WriteLine(count.Prefix + count.TypeName + "\t" + count.Count.ToString());
+        }
+
+        private static void TrimCounts(List<HandleTypeCount> counts, int top)
+        {
+            counts.Sort((c1, c2) => c2.Count.CompareTo(c1.Count));
+
+            if (counts.Count > top)
+                counts.RemoveRange(top, counts.Count - top);
+        }
+
+        private class ModuleStatistics
+        {
+            public string FileName;
+            public int Dumps;
+            public int Processes;
+            public List<string> Versions = new List<string>();
+            public DumpFile LastDump;
+        }
+
+        private static void AggregateModules(Options options)
+        {
+            Dictionary<string, ModuleStatistics> modules = new Dictionary<string, ModuleStatistics>(StringComparer.OrdinalIgnoreCase);
+            string namePattern = options.Name;
+
+            // The name filter applies to modules here, not processes.
+            options.Name = null;
+
+            EnumProcesses(options, (dump, process) =>
+            {
+                process.EnumModules(module =>
+                {
+                    ModuleStatistics statistics;
+                    string fileName = module.FileName ?? module.Name ?? "";
+
+                    if (!MatchName(namePattern, module.Name))
+                        return;
+
+                    if (!modules.TryGetValue(fileName, out statistics))
+                    {
+                        statistics = new ModuleStatistics { FileName = fileName };
+                        modules.Add(fileName, statistics);
+                    }
+
+                    if (statistics.LastDump != dump)
+                    {
+                        statistics.LastDump = dump;
+                        statistics.Dumps++;
+                    }
+
+                    statistics.Processes++;
+
+                    if (!string.IsNullOrEmpty(module.FileVersion) && !statistics.Versions.Contains(module.FileVersion))
+                        statistics.Versions.Add(module.FileVersion);
+                });
+            });
+
+            List<ModuleStatistics> list = new List<ModuleStatistics>(modules.Values);
+
+            list.Sort((s1, s2) =>
+            {
+                int result = s2.Processes.CompareTo(s1.Processes);
+
+                if (result == 0)
+                    result = string.Compare(s1.FileName, s2.FileName, StringComparison.OrdinalIgnoreCase);
+
+                return result;
+            });
+
+            foreach (ModuleStatistics statistics in list)
+            {
+                _output.WriteLine(
+                    statistics.Processes.ToString() + "\t" +
+                    statistics.Dumps.ToString() + "\t" +
+                    string.Join(", ", statistics.Versions.ToArray()) + "\t" +
+                    statistics.FileName
+                    );
+            }
+        }
+
+        private static void Diff(Options options)
+        {
+            // Added, removed.
+            int[,] totals = new int[Enum.GetValues(typeof(DumpDiffCategory)).Length, 2];
+
+            using (DumpFile oldDump = new DumpFile(options.Files[0]))
+            using (DumpFile newDump = new DumpFile(options.Files[1]))
+            {
+                DumpDiff diff = new DumpDiff(oldDump, newDump);
+
+                if (options.Pid != -1 || options.Name != null)
+                {
+                    diff.ProcessFilter = process => MatchProcess(options, process);
+                    diff.CompareServices = false;
+                }
+
+                diff.HandleTypeFilter = options.Type;
+                diff.CompareHandles = !options.Summary;
+                diff.CompareModules = !options.Summary;
+
+                diff.Compare(entry =>
+                {
+                    string kind;
+
+                    switch (entry.Kind)
+                    {
+                        case DumpDiffKind.Added:
+                            kind = "+";
+                            totals[(int)entry.Category, 0]++;
+                            break;
+                        case DumpDiffKind.Removed:
+                            kind = "-";
+                            totals[(int)entry.Category, 1]++;
+                            break;
+                        default:
+                            kind = "~";
+                            break;
+                    }
+
+                    string line = kind + "\t" + entry.Category.ToString().ToLowerInvariant() + "\t";
+
+                    if (entry.Category != DumpDiffCategory.Service)
+                        line += entry.ProcessId.ToString() + "\t" + entry.ProcessName + "\t";
+
+                    line += entry.Item;
+
+                    if (entry.Kind == DumpDiffKind.Changed)
+                    {
+                        long delta = entry.NewValue - entry.OldValue;
+
+                        line += "\t" + entry.OldValue.ToString() + "\t" + entry.NewValue.ToString() + "\t" +
+                            (delta > 0 ? "+" : "") + delta.ToString();
+                    }
+
+                    _output.WriteLine(line);
+                });
+            }
+
+            _output.Flush();
+
+            // Keep the summary out of the way of anything processing the output.
+            PrintDiffTotals("Processes", totals, DumpDiffCategory.Process);
+            PrintDiffTotals("Handles", totals, DumpDiffCategory.Handle);
+            PrintDiffTotals("Modules", totals, DumpDiffCategory.Module);
+            PrintDiffTotals("Services", totals, DumpDiffCategory.Service);
+        }
+
+        private static void PrintDiffTotals(string text, int[,] totals, DumpDiffCategory category)
+        {
+            Console.Error.WriteLine(
+                text + ": " +
+                totals[(int)category, 0].ToString() + " added, " +
+                totals[(int)category, 1].ToString() + " removed"
+                );
+        }
+    }
+}
@@ -32,6 +32,8 @@
             System.ComponentModel.ComponentResourceManager resources = new System.ComponentModel.ComponentResourceManager(typeof(MainWindow));
             this.mainMenu = new System.Windows.Forms.MainMenu(this.components);
             this.hackerMenuItem = new System.Windows.Forms.MenuItem();
+            this.openHackerMenuItem = new System.Windows.Forms.MenuItem();
+            this.saveHackerMenuItem = new System.Windows.Forms.MenuItem();
             this.clearHackerMenuItem = new System.Windows.Forms.MenuItem();
             this.exitMenuItem = new System.Windows.Forms.MenuItem();
             this.menuItem1 = new System.Windows.Forms.MenuItem();
@@ -66,19 +68,33 @@
             // 
             this.hackerMenuItem.Index = 0;
             this.hackerMenuItem.MenuItems.AddRange(new System.Windows.Forms.MenuItem[] {
+            this.openHackerMenuItem,
+            this.saveHackerMenuItem,
             this.clearHackerMenuItem,
             this.exitMenuItem});
             this.hackerMenuItem.Text = "Hacker";
             // 
+            // openHackerMenuItem
+            // 
+            this.openHackerMenuItem.Index = 0;
+            this.openHackerMenuItem.Text = "&Open...";
+            this.openHackerMenuItem.Click += new System.EventHandler(this.openHackerMenuItem_Click);
+            // 
+            // saveHackerMenuItem
+            // 
+            this.saveHackerMenuItem.Index = 1;
+            this.saveHackerMenuItem.Text = "&Save As...";
+            this.saveHackerMenuItem.Click += new System.EventHandler(this.saveHackerMenuItem_Click);
+            // 
             // clearHackerMenuItem
             // 
-            this.clearHackerMenuItem.Index = 0;
+            this.clearHackerMenuItem.Index = 2;
             this.clearHackerMenuItem.Text = "Clear";
             this.clearHackerMenuItem.Click += new System.EventHandler(this.clearHackerMenuItem_Click);
             // 
             // exitMenuItem
             // 
-            this.exitMenuItem.Index = 1;
+            this.exitMenuItem.Index = 3;
             this.exitMenuItem.Text = "E&xit";
             this.exitMenuItem.Click += new System.EventHandler(this.exitMenuItem_Click);
             // 
@@ -265,6 +281,8 @@
         private System.Windows.Forms.MenuItem removeAllFiltersMenuItem;
         private System.Windows.Forms.MenuItem addProcessFiltersMenuItem;
         private System.Windows.Forms.MenuItem clearHackerMenuItem;
+        private System.Windows.Forms.MenuItem openHackerMenuItem;
+        private System.Windows.Forms.MenuItem saveHackerMenuItem;
         private System.Windows.Forms.MenuItem menuItem2;
         private System.Windows.Forms.MenuItem addNumberFiltersMenuItem;
         private System.Windows.Forms.MenuItem addKernelModeFiltersMenuItem;
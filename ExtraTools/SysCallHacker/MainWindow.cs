@@ -3,6 +3,7 @@ using System.Collections.Generic;
 using System.ComponentModel;
 using System.Data;
 using System.Drawing;
+using System.IO;
 using System.Runtime.InteropServices;
 using System.Text;
 using System.Windows.Forms;
@@ -27,8 +28,9 @@ namespace SysCallHacker
         }
 
         private SsLogger _logger;
-        private List<LogEvent> _events = new List<LogEvent>();
-        private LogEvent _lastEvent;
+        private TraceFile _trace;
+        private string _tempTraceFileName;
+        private bool _capturing;
         private List<IntPtr> _rules = new List<IntPtr>();
         private Dictionary<int, SystemProcess> _processes;
 
@@ -94,9 +96,12 @@ namespace SysCallHacker
 
             KProcessHacker.Instance = new KProcessHacker();
 
+            _tempTraceFileName = Path.Combine(Path.GetTempPath(), "SysCallHacker-" + ProcessHandle.GetCurrentId().ToString() + ".trace");
+            _trace = TraceFile.Create(_tempTraceFileName);
+
             _logger = new SsLogger(4096, false);
-            _logger.EventBlockReceived += new EventBlockReceivedDelegate(logger_EventBlockReceived);
-            _logger.ArgumentBlockReceived += new ArgumentBlockReceivedDelegate(logger_ArgumentBlockReceived);
+            _logger.EventViewReceived += new EventViewReceivedDelegate(logger_EventViewReceived);
+            _logger.ArgumentViewReceived += new ArgumentViewReceivedDelegate(logger_ArgumentViewReceived);
             _logger.AddProcessIdRule(FilterType.Exclude, ProcessHandle.GetCurrentId());
             _logger.AddPreviousModeRule(FilterType.Include, KProcessorMode.UserMode);
             //_logger.Start();
@@ -106,34 +111,46 @@ namespace SysCallHacker
 
         private void MainWindow_FormClosing(object sender, FormClosingEventArgs e)
         {
+            _logger.Stop();
+            this.CloseTrace();
+
             ProcessHandle.Current.Terminate();
         }
 
-        private void logger_EventBlockReceived(SsEvent eventBlock)
+        private void CloseTrace()
         {
-            LogEvent logEvent = new LogEvent(eventBlock);
+            _trace.Dispose();
 
-            lock (_events)
-                _events.Add(logEvent);
+            if (_trace.FileName == _tempTraceFileName)
+            {
+                try
+                {
+                    File.Delete(_tempTraceFileName);
+                }
+                catch (IOException ex)
+                {
+                    Logging.Log(ex);
+                }
+            }
+        }
 
-            _lastEvent = logEvent;
+        private void logger_EventViewReceived(SsEventView eventBlock)
+        {
+            _trace.AppendBlock(eventBlock.Address, eventBlock.Size, true);
         }
 
-        private void logger_ArgumentBlockReceived(SsData argBlock)
+        private void logger_ArgumentViewReceived(SsArgumentView argBlock)
         {
-            if (_lastEvent != null)
-            {
-                if (argBlock.Index < _lastEvent.Arguments.Length)
-                    _lastEvent.Arguments[argBlock.Index] = argBlock;
-            }
+            _trace.AppendBlock(argBlock.Address, argBlock.Size, false);
         }
 
         private void timerUpdate_Tick(object sender, EventArgs e)
         {
             _processes = Windows.GetProcesses();
 
-            lock (_events)
-                listEvents.VirtualListSize = _events.Count;
+            long eventCount = _trace.EventCount;
+
+            listEvents.VirtualListSize = (int)Math.Min(eventCount, int.MaxValue);
 
             int blocksWritten, blocksDropped;
 
@@ -141,13 +158,22 @@ namespace SysCallHacker
 
             if (blocksWritten > 0 || blocksDropped > 0)
             {
-                lock (_events)
-                {
-                    statusBar.Text = _events.Count.ToString("N0") + " events, " +
-                        blocksWritten.ToString("N0") + " blocks, " +
-                        blocksDropped.ToString("N0") + " dropped (" +
-                        ((double)blocksDropped / (blocksWritten + blocksDropped) * 100).ToString("F2") + "%)";
-                }
+                statusBar.Text = eventCount.ToString("N0") + " events, " +
+                    blocksWritten.ToString("N0") + " blocks, " +
+                    blocksDropped.ToString("N0") + " dropped (" +
+                    ((double)blocksDropped / (blocksWritten + blocksDropped) * 100).ToString("F2") + "%)";
+            }
+
+            if (_logger.OutOfSync)
+            {
+                statusBar.Text = eventCount.ToString("N0") + " events, logging stopped because the buffer is corrupt (" +
+                    _logger.BlocksDiscarded.ToString("N0") + " blocks discarded)";
+            }
+
+            if (_trace.WriteFailed)
+            {
+                statusBar.Text = eventCount.ToString("N0") + " events, the trace could not be written to disk (" +
+                    _trace.DroppedEventCount.ToString("N0") + " events dropped)";
             }
         }
 
@@ -156,8 +182,16 @@ namespace SysCallHacker
             LogEvent logEvent;
             ListViewItem item;
 
-            lock (_events)
-                logEvent = _events[e.ItemIndex];
+            try
+            {
+                logEvent = _trace.GetEvent(e.ItemIndex);
+            }
+            catch (InvalidDataException)
+            {
+                // The chunk containing the event can't be read back.
+                e.Item = new ListViewItem(new string[] { "(unreadable)", "", "", "", "" });
+                return;
+            }
 
             string objectName = "";
 
@@ -192,17 +226,24 @@ namespace SysCallHacker
         {
             if (e.Button == toolBarButtonStart)
             {
+                // A trace which was opened from disk is read-only, so start 
+                // a new capture.
+                if (_trace.FileName != _tempTraceFileName)
+                    this.ReplaceTrace(_tempTraceFileName);
+
                 _logger.Start();
+                _capturing = true;
             }
             else if (e.Button == toolBarButtonStop)
             {
                 _logger.Stop();
+                _capturing = false;
             }
         }
 
         private void ShowProperties(int index)
         {
-            (new EventProperties(_events[index])).ShowDialog();
+            (new EventProperties(_trace.GetEvent(index))).ShowDialog();
         }
 
         private void listEvents_DoubleClick(object sender, EventArgs e)
@@ -210,15 +251,83 @@ namespace SysCallHacker
             this.ShowProperties(listEvents.SelectedIndices[0]);
         }
 
-        private void clearHackerMenuItem_Click(object sender, EventArgs e)
+        private void ReplaceTrace(string fileName)
         {
-            lock (_events)
+            TraceFile trace = null;
+
+            // Open the new trace first so that nothing changes if it is invalid.
+            if (fileName != _tempTraceFileName)
+                trace = TraceFile.Open(fileName);
+
+            // Make sure the logger isn't writing to the old trace.
+            _logger.Stop();
+            listEvents.VirtualListSize = 0;
+            this.CloseTrace();
+
+            if (trace == null)
+                trace = TraceFile.Create(fileName);
+
+            _trace = trace;
+
+            listEvents.VirtualListSize = (int)Math.Min(_trace.EventCount, int.MaxValue);
+
+            // Keep capturing into a new trace (e.g. after Clear). A trace 
+            // opened from disk is read-only, so capturing stops.
+            if (_capturing)
             {
-                listEvents.VirtualListSize = 0;
-                _events.Clear();
+                if (fileName == _tempTraceFileName)
+                    _logger.Start();
+                else
+                    _capturing = false;
             }
         }
 
+        private void openHackerMenuItem_Click(object sender, EventArgs e)
+        {
+            OpenFileDialog ofd = new OpenFileDialog();
+
+            ofd.Filter = "Trace Files (*.trace)|*.trace|All Files (*.*)|*.*";
+
+            if (ofd.ShowDialog() == DialogResult.OK)
+            {
+                try
+                {
+                    this.ReplaceTrace(ofd.FileName);
+                }
+                catch (Exception ex)
+                {
+                    MessageBox.Show(ex.Message, "SysCallHacker", MessageBoxButtons.OK, MessageBoxIcon.Error);
+                }
+            }
+        }
+
+        private void saveHackerMenuItem_Click(object sender, EventArgs e)
+        {
+            SaveFileDialog sfd = new SaveFileDialog();
+
+            sfd.Filter = "Trace Files (*.trace)|*.trace|All Files (*.*)|*.*";
+
+            if (sfd.ShowDialog() == DialogResult.OK)
+            {
+                try
+                {
+                    // The trace file is always complete up to the last 
+                    // chunk written, so it can be copied while capturing.
+                    _trace.Flush();
+                    File.Copy(_trace.FileName, sfd.FileName, true);
+                }
+                catch (Exception ex)
+                {
+                    MessageBox.Show(ex.Message, "SysCallHacker", MessageBoxButtons.OK, MessageBoxIcon.Error);
+                }
+            }
+        }
+
+        private void clearHackerMenuItem_Click(object sender, EventArgs e)
+        {
+            this.ReplaceTrace(_tempTraceFileName);
+        }
+
         private void removeAllFiltersMenuItem_Click(object sender, EventArgs e)
         {
             foreach (var rule in _rules)
@@ -0,0 +1,777 @@
+﻿using System;
+using System.Collections.Generic;
+using System.IO;
+using System.IO.Compression;
+using System.Runtime.InteropServices;
+using System.Threading;
+using ProcessHacker.Common;
+using ProcessHacker.Native;
+using ProcessHacker.Native.SsLogging;
+
+namespace SysCallHacker
+{
+    /// <summary>
+    /// An append-only trace of system service events, stored on disk.
+    /// </summary>
+    /// <remarks>
+    /// <para>
+    /// Blocks are copied from the logging buffer as they are received and
+    /// grouped into chunks. Each chunk starts with an event block and is
+    /// compressed and appended to the file on a background thread. Only
+    /// the chunk being filled, the chunks waiting to be written and a few
+    /// recently decompressed chunks are kept in memory, so the memory
+    /// usage does not grow with the length of the capture.
+    /// </para>
+    /// <para>
+    /// Each chunk header records the range of event numbers and times it
+    /// covers and the processes it contains. This sparse index is rebuilt
+    /// when a trace is opened by scanning the chunk headers. A chunk which
+    /// was only partially written is ignored.
+    /// </para>
+    /// <para>
+    /// If a chunk can't be written, the file is truncated back to the last
+    /// whole chunk and no further chunks are written. The unwritten chunks
+    /// stay in memory so that they can still be displayed, up to a limit.
+    /// Events received after that are dropped and counted.
+    /// </para>
+    /// </remarks>
+    public sealed class TraceFile : IDisposable
+    {
+        private const int Magic = 0x52545353; // SSTR
+        private const int ChunkMagic = 0x4b4e4843; // CHNK
+        private const int Version = 1;
+        private const int FileHeaderSize = 16;
+        private const int ChunkHeaderSize = 108;
+        private const int MaxChunkEvents = 4096;
+        private const int MaxChunkSize = 0x40000;
+        private const int MaxChunkPids = 16;
+        private const int MaxPendingChunks = 16;
+        private const int MaxUnwrittenChunks = 64;
+        private const int CachedChunkCount = 8;
+
+        private static readonly int _eventTimeOffset =
+            Marshal.OffsetOf(typeof(KphSsEventBlock), "Time").ToInt32();
+        private static readonly int _eventClientIdOffset =
+            Marshal.OffsetOf(typeof(KphSsEventBlock), "ClientId").ToInt32();
+
+        private class Chunk
+        {
+            public long Offset = -1;
+            public long FirstEvent;
+            public int EventCount;
+            public long FirstTime;
+            public long LastTime;
+            public int UncompressedSize;
+            public int CompressedSize;
+            public List<int> Pids = new List<int>(); // null if there are too many
+            public byte[] Data; // only while the chunk has not been written
+            public int[] EventOffsets; // only while the chunk is in memory
+
+            public bool ContainsProcess(int pid)
+            {
+                return this.Pids == null || this.Pids.Contains(pid);
+            }
+        }
+
+        private class CachedChunk
+        {
+            public Chunk Chunk;
+            public byte[] Data;
+            public int[] EventOffsets;
+        }
+
+        /// <summary>
+        /// Creates a new trace file for capturing events.
+        /// </summary>
+        /// <param name="fileName">The name of the file. It is overwritten if it exists.</param>
+        public static TraceFile Create(string fileName)
+        {
+            return new TraceFile(fileName, true);
+        }
+
+        /// <summary>
+        /// Opens an existing trace file for reading.
+        /// </summary>
+        /// <param name="fileName">The name of the file.</param>
+        public static TraceFile Open(string fileName)
+        {
+            return new TraceFile(fileName, false);
+        }
+
+        private readonly object _lock = new object();
+        private readonly string _fileName;
+        private readonly bool _writable;
+        private readonly List<Chunk> _chunks = new List<Chunk>();
+        private readonly Queue<Chunk> _pendingChunks = new Queue<Chunk>();
+        private readonly LinkedList<CachedChunk> _cachedChunks = new LinkedList<CachedChunk>();
+        private FileStream _readStream;
+        private FileStream _writeStream;
+        private Thread _writerThread;
+        private bool _disposing;
+        private bool _writeFailed;
+        private int _unwrittenChunkCount;
+        private bool _droppingEvent;
+        private long _droppedEventCount;
+
+        private Chunk _currentChunk;
+        private MemoryStream _currentData;
+        private List<int> _currentOffsets;
+        private long _eventCount;
+
+        private TraceFile(string fileName, bool create)
+        {
+            _fileName = fileName;
+            _writable = create;
+
+            if (create)
+            {
+                // The stream is unbuffered so that a failed write can't
+                // leave data behind which would be written later.
+                _writeStream = new FileStream(fileName, FileMode.Create, FileAccess.Write, FileShare.Read, 1);
+
+                BinaryWriter bw = new BinaryWriter(_writeStream);
+
+                bw.Write(Magic);
+                bw.Write(Version);
+                bw.Write(IntPtr.Size);
+                bw.Write(0);
+                bw.Flush();
+
+                _writerThread = new Thread(this.WriterThreadStart, Utils.SixteenthStackSize);
+                _writerThread.IsBackground = true;
+                _writerThread.Start();
+            }
+
+            _readStream = new FileStream(fileName, FileMode.Open, FileAccess.Read, FileShare.ReadWrite);
+
+            if (!create)
+                this.LoadIndex();
+        }
+
+        /// <summary>
+        /// Gets the number of events in the trace.
+        /// </summary>
+        public long EventCount
+        {
+            get { return Interlocked.Read(ref _eventCount); }
+        }
+
+        public string FileName
+        {
+            get { return _fileName; }
+        }
+
+        /// <summary>
+        /// Gets the number of chunks which have not been written to disk yet.
+        /// </summary>
+        public int PendingChunkCount
+        {
+            get { lock (_lock) return _pendingChunks.Count; }
+        }
+
+        /// <summary>
+        /// Gets whether a chunk could not be written to disk.
+        /// </summary>
+        public bool WriteFailed
+        {
+            get { lock (_lock) return _writeFailed; }
+        }
+
+        /// <summary>
+        /// Gets the number of events which were dropped because they could
+        /// not be written to disk.
+        /// </summary>
+        public long DroppedEventCount
+        {
+            get { return Interlocked.Read(ref _droppedEventCount); }
+        }
+
+        public void Dispose()
+        {
+            if (_writable)
+            {
+                this.Flush();
+
+                lock (_lock)
+                {
+                    _disposing = true;
+                    Monitor.PulseAll(_lock);
+                }
+
+                _writerThread.Join();
+                _writeStream.Dispose();
+            }
+
+            _readStream.Dispose();
+        }
+
+        private void LoadIndex()
+        {
+            BinaryReader br = new BinaryReader(_readStream);
+            long length = _readStream.Length;
+
+            if (length < FileHeaderSize || br.ReadInt32() != Magic || br.ReadInt32() != Version)
+                throw new InvalidDataException("The file is not a system call trace.");
+            if (br.ReadInt32() != IntPtr.Size)
+                throw new InvalidDataException("The trace was captured on a different architecture.");
+
+            long offset = FileHeaderSize;
+
+            while (offset + ChunkHeaderSize <= length)
+            {
+                _readStream.Position = offset;
+
+                if (br.ReadInt32() != ChunkMagic)
+                    break;
+
+                Chunk chunk = new Chunk();
+
+                chunk.Offset = offset;
+                chunk.EventCount = br.ReadInt32();
+                chunk.FirstEvent = br.ReadInt64();
+                chunk.FirstTime = br.ReadInt64();
+                chunk.LastTime = br.ReadInt64();
+                chunk.UncompressedSize = br.ReadInt32();
+                chunk.CompressedSize = br.ReadInt32();
+
+                int pidCount = br.ReadInt32();
+
+                if (pidCount < 0)
+                    chunk.Pids = null;
+
+                for (int i = 0; i < MaxChunkPids; i++)
+                {
+                    int pid = br.ReadInt32();
+
+                    if (i < pidCount)
+                        chunk.Pids.Add(pid);
+                }
+
+                // Stop at a chunk which was not completely written.
+                if (
+                    chunk.FirstEvent != _eventCount ||
+                    chunk.CompressedSize < 0 ||
+                    offset + ChunkHeaderSize + chunk.CompressedSize > length
+                    )
+                    break;
+
+                _chunks.Add(chunk);
+                _eventCount += chunk.EventCount;
+                offset += ChunkHeaderSize + chunk.CompressedSize;
+            }
+        }
+
+        /// <summary>
+        /// Appends a block from the logging buffer to the trace.
+        /// </summary>
+        /// <param name="block">The address of the block.</param>
+        /// <param name="size">The size of the block, in bytes.</param>
+        /// <param name="isEvent">Whether the block is an event block.</param>
+        public void AppendBlock(IntPtr block, int size, bool isEvent)
+        {
+            if (!_writable)
+                throw new InvalidOperationException("The trace is read-only.");
+
+            lock (_lock)
+            {
+                if (isEvent)
+                {
+                    // Start a new chunk if the current one is full. Chunks
+                    // always begin with an event block.
+                    if (
+                        _currentChunk != null &&
+                        (_currentChunk.EventCount >= MaxChunkEvents || _currentData.Length + size > MaxChunkSize)
+                        )
+                        this.SealChunk();
+
+                    // Once the file can't be written, only keep a limited
+                    // number of chunks in memory.
+                    if (_currentChunk == null && _writeFailed && _unwrittenChunkCount >= MaxUnwrittenChunks)
+                    {
+                        _droppingEvent = true;
+                        Interlocked.Increment(ref _droppedEventCount);
+                        return;
+                    }
+
+                    _droppingEvent = false;
+
+                    if (_currentChunk == null)
+                    {
+                        _currentChunk = new Chunk();
+                        _currentChunk.FirstEvent = _eventCount;
+                        _currentChunk.FirstTime = long.MaxValue;
+                        _currentChunk.LastTime = long.MinValue;
+                        _currentOffsets = new List<int>();
+
+                        // The buffer is reused for every chunk.
+                        if (_currentData == null)
+                            _currentData = new MemoryStream(MaxChunkSize);
+                        else
+                            _currentData.SetLength(0);
+                    }
+
+                    long time = Marshal.ReadInt64(block, _eventTimeOffset);
+                    int pid = Marshal.ReadIntPtr(block, _eventClientIdOffset).ToInt32();
+
+                    if (time < _currentChunk.FirstTime)
+                        _currentChunk.FirstTime = time;
+                    if (time > _currentChunk.LastTime)
+                        _currentChunk.LastTime = time;
+
+                    if (_currentChunk.Pids != null && !_currentChunk.Pids.Contains(pid))
+                    {
+                        if (_currentChunk.Pids.Count < MaxChunkPids)
+                            _currentChunk.Pids.Add(pid);
+                        else
+                            _currentChunk.Pids = null;
+                    }
+
+                    _currentOffsets.Add((int)_currentData.Length);
+                    _currentChunk.EventCount++;
+                    Interlocked.Increment(ref _eventCount);
+                }
+                else if (_currentChunk == null || _droppingEvent)
+                {
+                    // An argument block without an event, or one which
+                    // belongs to a dropped event. Ignore it.
+                    return;
+                }
+
+                // Copy the block straight into the chunk buffer.
+                int position = (int)_currentData.Length;
+
+                _currentData.SetLength(position + size);
+                Marshal.Copy(block, _currentData.GetBuffer(), position, size);
+                _currentData.Position = position + size;
+            }
+        }
+
+        /// <summary>
+        /// Writes all buffered events to disk and waits for the writes to complete.
+        /// </summary>
+        public void Flush()
+        {
+            if (!_writable)
+                return;
+
+            lock (_lock)
+            {
+                if (_currentChunk != null)
+                    this.SealChunk();
+
+                while (_pendingChunks.Count > 0)
+                    Monitor.Wait(_lock);
+            }
+        }
+
+        private void SealChunk()
+        {
+            _currentChunk.Data = _currentData.ToArray();
+            _currentChunk.UncompressedSize = _currentChunk.Data.Length;
+            _currentChunk.EventOffsets = _currentOffsets.ToArray();
+            _chunks.Add(_currentChunk);
+            _pendingChunks.Enqueue(_currentChunk);
+            _unwrittenChunkCount++;
+            _currentChunk = null;
+            _currentOffsets = null;
+
+            Monitor.PulseAll(_lock);
+
+            // Block the logger if the disk can't keep up. The driver drops
+            // blocks when the buffer is full, which is better than running
+            // out of memory.
+            while (_pendingChunks.Count > MaxPendingChunks)
+                Monitor.Wait(_lock);
+        }
+
+        private void WriterThreadStart()
+        {
+            while (true)
+            {
+                Chunk chunk;
+                bool writeFailed;
+
+                lock (_lock)
+                {
+                    while (_pendingChunks.Count == 0 && !_disposing)
+                        Monitor.Wait(_lock);
+
+                    if (_pendingChunks.Count == 0)
+                        return;
+
+                    chunk = _pendingChunks.Peek();
+                    writeFailed = _writeFailed;
+                }
+
+                // Chunks after one which could not be written can't be
+                // found when the trace is opened, so they aren't written.
+                if (!writeFailed)
+                    this.WriteChunk(chunk);
+
+                lock (_lock)
+                {
+                    _pendingChunks.Dequeue();
+                    Monitor.PulseAll(_lock);
+                }
+            }
+        }
+
+        private void WriteChunk(Chunk chunk)
+        {
+            long offset = -1;
+
+            try
+            {
+                MemoryStream compressed = new MemoryStream();
+
+                using (DeflateStream ds = new DeflateStream(compressed, CompressionMode.Compress, true))
+                    ds.Write(chunk.Data, 0, chunk.Data.Length);
+
+                // Build the whole chunk first so that it is written with
+                // a single call.
+                MemoryStream record = new MemoryStream(ChunkHeaderSize + (int)compressed.Length);
+                BinaryWriter bw = new BinaryWriter(record);
+
+                bw.Write(ChunkMagic);
+                bw.Write(chunk.EventCount);
+                bw.Write(chunk.FirstEvent);
+                bw.Write(chunk.FirstTime);
+                bw.Write(chunk.LastTime);
+                bw.Write(chunk.UncompressedSize);
+                bw.Write((int)compressed.Length);
+                bw.Write(chunk.Pids != null ? chunk.Pids.Count : -1);
+
+                for (int i = 0; i < MaxChunkPids; i++)
+                    bw.Write(chunk.Pids != null && i < chunk.Pids.Count ? chunk.Pids[i] : 0);
+
+                compressed.WriteTo(record);
+                bw.Flush();
+
+                offset = _writeStream.Position;
+                record.WriteTo(_writeStream);
+                _writeStream.Flush();
+
+                lock (_lock)
+                {
+                    chunk.Offset = offset;
+                    chunk.CompressedSize = (int)compressed.Length;
+                    // The chunk can now be read back from the file.
+                    chunk.Data = null;
+                    chunk.EventOffsets = null;
+                    _unwrittenChunkCount--;
+                }
+            }
+            catch (Exception ex)
+            {
+                // Keep the chunk in memory so that the events can still
+                // be displayed.
+                Logging.Log(ex);
+
+                lock (_lock)
+                    _writeFailed = true;
+
+                // Remove the part of the chunk which was written, so that
+                // the file ends with a whole chunk.
+                if (offset != -1)
+                {
+                    try
+                    {
+                        _writeStream.SetLength(offset);
+                    }
+                    catch (Exception ex2)
+                    {
+                        Logging.Log(ex2);
+                    }
+                }
+            }
+        }
+
+        private int FindChunk(long index)
+        {
+            int low = 0;
+            int high = _chunks.Count - 1;
+
+            while (low <= high)
+            {
+                int mid = (low + high) / 2;
+                Chunk chunk = _chunks[mid];
+
+                if (index < chunk.FirstEvent)
+                    high = mid - 1;
+                else if (index >= chunk.FirstEvent + chunk.EventCount)
+                    low = mid + 1;
+                else
+                    return mid;
+            }
+
+            return -1;
+        }
+
+        /// <summary>
+        /// Gets the number of the first event which occurred at or after
+        /// the specified time, or the number of events if there is none.
+        /// </summary>
+        /// <param name="time">The time.</param>
+        public long FindEvent(DateTime time)
+        {
+            long fileTime = time.ToFileTime();
+
+            lock (_lock)
+            {
+                foreach (Chunk chunk in _chunks)
+                {
+                    if (chunk.LastTime < fileTime)
+                        continue;
+
+                    byte[] data;
+                    int[] offsets;
+
+                    this.GetChunkData(chunk, out data, out offsets);
+
+                    for (int i = 0; i < offsets.Length; i++)
+                    {
+                        if (BitConverter.ToInt64(data, offsets[i] + _eventTimeOffset) >= fileTime)
+                            return chunk.FirstEvent + i;
+                    }
+                }
+
+                if (_currentChunk != null)
+                {
+                    byte[] data = _currentData.GetBuffer();
+
+                    for (int i = 0; i < _currentOffsets.Count; i++)
+                    {
+                        if (BitConverter.ToInt64(data, _currentOffsets[i] + _eventTimeOffset) >= fileTime)
+                            return _currentChunk.FirstEvent + i;
+                    }
+                }
+
+                return _eventCount;
+            }
+        }
+
+        /// <summary>
+        /// Gets the number of the next event generated by a process.
+        /// </summary>
+        /// <param name="start">The number of the event to start searching from.</param>
+        /// <param name="pid">The ID of the process.</param>
+        /// <returns>The number of the event, or -1 if there is none.</returns>
+        public long FindNextEvent(long start, int pid)
+        {
+            lock (_lock)
+            {
+                int chunkIndex = this.FindChunk(start);
+
+                if (chunkIndex != -1)
+                {
+                    for (; chunkIndex < _chunks.Count; chunkIndex++)
+                    {
+                        Chunk chunk = _chunks[chunkIndex];
+
+                        // The index lets us skip chunks which don't
+                        // contain the process without decompressing them.
+                        if (!chunk.ContainsProcess(pid))
+                            continue;
+
+                        byte[] data;
+                        int[] offsets;
+
+                        this.GetChunkData(chunk, out data, out offsets);
+
+                        for (int i = (int)Math.Max(0, start - chunk.FirstEvent); i < offsets.Length; i++)
+                        {
+                            if (ReadInt32(data, offsets[i] + _eventClientIdOffset) == pid)
+                                return chunk.FirstEvent + i;
+                        }
+                    }
+                }
+
+                if (_currentChunk != null && _currentChunk.ContainsProcess(pid))
+                {
+                    byte[] data = _currentData.GetBuffer();
+
+                    for (int i = (int)Math.Max(0, start - _currentChunk.FirstEvent); i < _currentOffsets.Count; i++)
+                    {
+                        if (ReadInt32(data, _currentOffsets[i] + _eventClientIdOffset) == pid)
+                            return _currentChunk.FirstEvent + i;
+                    }
+                }
+
+                return -1;
+            }
+        }
+
+        /// <summary>
+        /// Reads an event and its arguments from the trace.
+        /// </summary>
+        /// <param name="index">The number of the event.</param>
+        public LogEvent GetEvent(long index)
+        {
+            lock (_lock)
+            {
+                byte[] data;
+                int[] offsets;
+                int eventIndex;
+                int chunkIndex = this.FindChunk(index);
+
+                if (chunkIndex != -1)
+                {
+                    Chunk chunk = _chunks[chunkIndex];
+
+                    this.GetChunkData(chunk, out data, out offsets);
+                    eventIndex = (int)(index - chunk.FirstEvent);
+
+                    return ReadEvent(data, offsets[eventIndex], chunk.UncompressedSize);
+                }
+                else if (
+                    _currentChunk != null &&
+                    index >= _currentChunk.FirstEvent &&
+                    index < _currentChunk.FirstEvent + _currentChunk.EventCount
+                    )
+                {
+                    eventIndex = (int)(index - _currentChunk.FirstEvent);
+
+                    return ReadEvent(_currentData.GetBuffer(), _currentOffsets[eventIndex], (int)_currentData.Length);
+                }
+                else
+                {
+                    throw new ArgumentOutOfRangeException("index");
+                }
+            }
+        }
+
+        private void GetChunkData(Chunk chunk, out byte[] data, out int[] offsets)
+        {
+            if (chunk.Data != null)
+            {
+                data = chunk.Data;
+                offsets = chunk.EventOffsets;
+                return;
+            }
+
+            // Look in the cache of recently used chunks.
+            for (LinkedListNode<CachedChunk> node = _cachedChunks.First; node != null; node = node.Next)
+            {
+                if (node.Value.Chunk == chunk)
+                {
+                    _cachedChunks.Remove(node);
+                    _cachedChunks.AddFirst(node);
+                    data = node.Value.Data;
+                    offsets = node.Value.EventOffsets;
+                    return;
+                }
+            }
+
+            byte[] compressed = new byte[chunk.CompressedSize];
+
+            _readStream.Position = chunk.Offset + ChunkHeaderSize;
+
+            if (ReadFully(_readStream, compressed, compressed.Length) != compressed.Length)
+                throw new InvalidDataException("The trace is truncated.");
+
+            data = new byte[chunk.UncompressedSize];
+
+            using (DeflateStream ds = new DeflateStream(new MemoryStream(compressed), CompressionMode.Decompress))
+            {
+                if (ReadFully(ds, data, data.Length) != data.Length)
+                    throw new InvalidDataException("The trace is corrupt.");
+            }
+
+            offsets = GetEventOffsets(data, chunk.EventCount);
+
+            CachedChunk cached = new CachedChunk();
+
+            cached.Chunk = chunk;
+            cached.Data = data;
+            cached.EventOffsets = offsets;
+            _cachedChunks.AddFirst(cached);
+
+            while (_cachedChunks.Count > CachedChunkCount)
+                _cachedChunks.RemoveLast();
+        }
+
+        private static int[] GetEventOffsets(byte[] data, int eventCount)
+        {
+            List<int> offsets = new List<int>(eventCount);
+            int offset = 0;
+
+            while (offset + KphSsBlockHeader.SizeOf <= data.Length)
+            {
+                int size = BitConverter.ToUInt16(data, offset);
+
+                if (size < KphSsBlockHeader.SizeOf)
+                    throw new InvalidDataException("The trace is corrupt.");
+
+                if ((KphSsBlockType)BitConverter.ToUInt16(data, offset + 2) == KphSsBlockType.Event)
+                    offsets.Add(offset);
+
+                offset += size;
+            }
+
+            if (offsets.Count != eventCount)
+                throw new InvalidDataException("The trace is corrupt.");
+
+            return offsets.ToArray();
+        }
+
+        private static LogEvent ReadEvent(byte[] data, int offset, int length)
+        {
+            GCHandle handle = GCHandle.Alloc(data, GCHandleType.Pinned);
+
+            try
+            {
+                IntPtr address = handle.AddrOfPinnedObject();
+                int size = BitConverter.ToUInt16(data, offset);
+                LogEvent logEvent = new LogEvent(SsLogger.ReadEventBlock(new MemoryRegion(address, offset, size)));
+
+                offset += size;
+
+                // Attach the argument blocks which follow the event.
+                while (offset + KphSsBlockHeader.SizeOf <= length)
+                {
+                    size = BitConverter.ToUInt16(data, offset);
+
+                    if (size < KphSsBlockHeader.SizeOf || offset + size > length)
+                        break;
+                    if ((KphSsBlockType)BitConverter.ToUInt16(data, offset + 2) != KphSsBlockType.Argument)
+                        break;
+
+                    SsData argument = SsLogger.ReadArgumentBlock(new MemoryRegion(address, offset, size));
+
+                    if (argument != null && argument.Index < logEvent.Arguments.Length)
+                        logEvent.Arguments[argument.Index] = argument;
+
+                    offset += size;
+                }
+
+                return logEvent;
+            }
+            finally
+            {
+                handle.Free();
+            }
+        }
+
+        private static int ReadInt32(byte[] data, int offset)
+        {
+            return BitConverter.ToInt32(data, offset);
+        }
+
+        private static int ReadFully(Stream stream, byte[] buffer, int count)
+        {
+            int total = 0;
+
+            while (total < count)
+            {
+                int read = stream.Read(buffer, total, count - total);
+
+                if (read == 0)
+                    break;
+
+                total += read;
+            }
+
+            return total;
+        }
+    }
+}
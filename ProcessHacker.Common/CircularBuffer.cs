@@ -54,6 +54,7 @@ namespace ProcessHacker.Common
 #endif
         private int _count;
         private int _index;
+        private long _addCount;
         private T[] _data;
 
         /// <summary>
@@ -92,6 +93,7 @@ namespace ProcessHacker.Common
             _count = buf.ToInt32();
             s.Read(buf, 0, 4);
             _index = buf.ToInt32();
+            _addCount = _count;
 
             _data = new T[_size];
 
@@ -163,6 +165,16 @@ namespace ProcessHacker.Common
             private set { _count = value; }
         }
 
+        /// <summary>
+        /// Gets the total number of elements added to the buffer since 
+        /// it was created or last cleared, including elements which have 
+        /// since been erased.
+        /// </summary>
+        public long AddCount
+        {
+            get { return _addCount; }
+        }
+
         /// <summary>
         /// Gets the maximum number of elements that can be stored in 
         /// the buffer.
@@ -219,6 +231,8 @@ namespace ProcessHacker.Common
 
             if (_count < _size)
                 _count++;
+
+            _addCount++;
         }
 
         /// <summary>
@@ -377,6 +391,7 @@ namespace ProcessHacker.Common
         {
             // Just set the number of elements to zero.
             this.Count = 0;
+            _addCount = 0;
         }
 
         /// <summary>
@@ -20,54 +20,288 @@
  * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+using System;
+using System.Collections.Generic;
 using System.Threading;
 
 namespace ProcessHacker.Common
 {
+    /// <summary>
+    /// Contains counters describing the use of a free list.
+    /// </summary>
+    public struct FreeListStatistics
+    {
+        /// <summary>
+        /// The number of objects allocated.
+        /// </summary>
+        public long Allocations;
+        /// <summary>
+        /// The number of allocations satisfied by a thread's magazines.
+        /// </summary>
+        public long MagazineHits;
+        /// <summary>
+        /// The number of full magazines taken from the depot.
+        /// </summary>
+        public long DepotHits;
+        /// <summary>
+        /// The number of allocations which created a new object.
+        /// </summary>
+        public long NewObjects;
+        /// <summary>
+        /// The number of freed objects which were discarded because 
+        /// the depot was full.
+        /// </summary>
+        public long Discarded;
+    }
+
     /// <summary>
     /// Manages a list of free objects that can be re-used.
     /// </summary>
+    /// <remarks>
+    /// <para>
+    /// Each thread caches free objects in two small magazines, so most 
+    /// allocations and frees don't touch any shared state. Full 
+    /// magazines are exchanged with a shared depot under a lock. The 
+    /// depot holds at most the maximum count of objects; any more are 
+    /// left to the garbage collector.
+    /// </para>
+    /// <para>
+    /// Each thread keeps separate magazines for every free list it 
+    /// uses. They refer to the free list weakly, and the magazines of 
+    /// free lists which have been collected are dropped when the 
+    /// thread next starts using another free list.
+    /// </para>
+    /// </remarks>
     public class FreeList<T> where T : IResettable, new()
     {
-        private readonly T[] _list;
-        private int _freeIndex;
+        private const int DefaultMagazineSize = 16;
+
+        private class Magazine
+        {
+            public readonly T[] Items;
+            public int Count;
+
+            public Magazine(int size)
+            {
+                this.Items = new T[size];
+            }
+
+            public bool IsEmpty
+            {
+                get { return this.Count == 0; }
+            }
+
+            public bool IsFull
+            {
+                get { return this.Count == this.Items.Length; }
+            }
+        }
+
+        private class ThreadCache
+        {
+            public WeakReference Owner;
+            public Magazine Loaded;
+            public Magazine Previous;
+        }
+
+        private class Counters
+        {
+            public long Allocations;
+            public long MagazineHits;
+            public long DepotHits;
+            public long NewObjects;
+            public long Discarded;
+        }
+
+        private static int _nextId;
+
+        // The magazines of each free list used by the current thread, 
+        // keyed by the free list's ID.
+        [ThreadStatic]
+        private static Dictionary<int, ThreadCache> _threadCaches;
+        // The last free list used by the current thread.
+        [ThreadStatic]
+        private static int _lastId;
+        [ThreadStatic]
+        private static ThreadCache _lastCache;
+
+        // IDs start at 1, so 0 never matches _lastId.
+        private readonly int _id = Interlocked.Increment(ref _nextId);
+        private readonly int _magazineSize;
+        private readonly int _maximumCount;
+        // Full magazines.
+        private readonly Magazine[] _depot;
+        private int _depotCount;
+        private readonly Counters _counters;
 
         public FreeList(int maximumCount)
+            : this(maximumCount, false)
+        { }
+
+        /// <summary>
+        /// Creates a free list.
+        /// </summary>
+        /// <param name="maximumCount">The maximum number of objects kept in the shared depot.</param>
+        /// <param name="enableStatistics">Whether to collect statistics.</param>
+        public FreeList(int maximumCount, bool enableStatistics)
         {
-            _list = new T[maximumCount];
+            _maximumCount = maximumCount;
+            _magazineSize = Math.Max(1, Math.Min(DefaultMagazineSize, maximumCount));
+            _depot = new Magazine[Math.Max(1, maximumCount / _magazineSize)];
+
+            if (enableStatistics)
+                _counters = new Counters();
         }
 
+        /// <summary>
+        /// Gets the number of objects in the shared depot.
+        /// </summary>
         public int Count
         {
-            get { return _freeIndex; }
+            get { return _depotCount * _magazineSize; }
         }
 
         public int MaximumCount
         {
-            get { return _list.Length; }
+            get { return _maximumCount; }
+        }
+
+        private ThreadCache GetThreadCache()
+        {
+            // Most threads keep using the same free list.
+            if (_lastId == _id)
+                return _lastCache;
+
+            Dictionary<int, ThreadCache> caches = _threadCaches;
+            ThreadCache cache;
+
+            if (caches == null)
+                _threadCaches = caches = new Dictionary<int, ThreadCache>();
+
+            if (!caches.TryGetValue(_id, out cache))
+            {
+                RemoveDeadCaches(caches);
+
+                cache = new ThreadCache();
+                cache.Owner = new WeakReference(this);
+                cache.Loaded = new Magazine(_magazineSize);
+                cache.Previous = new Magazine(_magazineSize);
+                caches.Add(_id, cache);
+            }
+
+            _lastId = _id;
+            _lastCache = cache;
+
+            return cache;
+        }
+
+        private static void RemoveDeadCaches(Dictionary<int, ThreadCache> caches)
+        {
+            List<int> deadIds = null;
+
+            foreach (KeyValuePair<int, ThreadCache> pair in caches)
+            {
+                if (!pair.Value.Owner.IsAlive)
+                {
+                    if (deadIds == null)
+                        deadIds = new List<int>();
+
+                    deadIds.Add(pair.Key);
+                }
+            }
+
+            if (deadIds == null)
+                return;
+
+            foreach (int id in deadIds)
+            {
+                caches.Remove(id);
+
+                if (_lastId == id)
+                {
+                    _lastId = 0;
+                    _lastCache = null;
+                }
+            }
+        }
+
+        private Magazine GetFullMagazine()
+        {
+            lock (_depot)
+            {
+                if (_depotCount == 0)
+                    return null;
+
+                Magazine magazine = _depot[--_depotCount];
+
+                _depot[_depotCount] = null;
+
+                return magazine;
+            }
+        }
+
+        private bool PutFullMagazine(Magazine magazine)
+        {
+            lock (_depot)
+            {
+                if (_depotCount == _depot.Length)
+                    return false;
+
+                _depot[_depotCount++] = magazine;
+
+                return true;
+            }
         }
 
         public T Allocate()
         {
-            int freeIndex;
+            ThreadCache cache = this.GetThreadCache();
+
+            if (_counters != null)
+                Interlocked.Increment(ref _counters.Allocations);
 
-            while (true)
+            if (cache.Loaded.IsEmpty)
             {
-                freeIndex = _freeIndex;
+                if (!cache.Previous.IsEmpty)
+                {
+                    Magazine temp = cache.Loaded;
 
-                // Check if we have any stored objects.
-                if (freeIndex == 0)
-                    return this.AllocateNew();
+                    cache.Loaded = cache.Previous;
+                    cache.Previous = temp;
 
-                if (Interlocked.CompareExchange(
-                    ref _freeIndex,
-                    freeIndex - 1,
-                    freeIndex
-                    ) == freeIndex)
+                    if (_counters != null)
+                        Interlocked.Increment(ref _counters.MagazineHits);
+                }
+                else
                 {
-                    return _list[freeIndex - 1];
+                    Magazine full = this.GetFullMagazine();
+
+                    if (full == null)
+                    {
+                        if (_counters != null)
+                            Interlocked.Increment(ref _counters.NewObjects);
+
+                        return this.AllocateNew();
+                    }
+
+                    if (_counters != null)
+                        Interlocked.Increment(ref _counters.DepotHits);
+
+                    // The empty magazine is dropped.
+                    cache.Loaded = full;
                 }
             }
+            else if (_counters != null)
+            {
+                Interlocked.Increment(ref _counters.MagazineHits);
+            }
+
+            Magazine loaded = cache.Loaded;
+            T obj = loaded.Items[--loaded.Count];
+
+            loaded.Items[loaded.Count] = default(T);
+
+            return obj;
         }
 
         private T AllocateNew()
@@ -79,26 +313,55 @@ namespace ProcessHacker.Common
 
         public void Free(T obj)
         {
-            int freeIndex;
+            ThreadCache cache = this.GetThreadCache();
 
-            while (true)
+            obj.ResetObject();
+
+            if (cache.Loaded.IsFull)
             {
-                freeIndex = _freeIndex;
+                if (cache.Previous.IsFull)
+                {
+                    if (!this.PutFullMagazine(cache.Previous))
+                    {
+                        // The depot is full. Let the GC have the object.
+                        if (_counters != null)
+                            Interlocked.Increment(ref _counters.Discarded);
 
-                // Check if we have room for another object.
-                if (freeIndex == _list.Length)
-                    return;
+                        return;
+                    }
 
-                if (Interlocked.CompareExchange(
-                    ref _freeIndex,
-                    freeIndex + 1,
-                    freeIndex
-                    ) == freeIndex)
-                {
-                    _list[freeIndex] = obj;
-                    break;
+                    cache.Previous = new Magazine(_magazineSize);
                 }
+
+                Magazine temp = cache.Loaded;
+
+                cache.Loaded = cache.Previous;
+                cache.Previous = temp;
             }
+
+            cache.Loaded.Items[cache.Loaded.Count++] = obj;
+        }
+
+        /// <summary>
+        /// Gets statistics for the free list.
+        /// </summary>
+        /// <returns>
+        /// A structure containing statistics. All fields are zero if 
+        /// statistics were not enabled when the free list was created.
+        /// </returns>
+        public FreeListStatistics GetStatistics()
+        {
+            if (_counters == null)
+                return new FreeListStatistics();
+
+            return new FreeListStatistics
+            {
+                Allocations = Interlocked.Read(ref _counters.Allocations),
+                MagazineHits = Interlocked.Read(ref _counters.MagazineHits),
+                DepotHits = Interlocked.Read(ref _counters.DepotHits),
+                NewObjects = Interlocked.Read(ref _counters.NewObjects),
+                Discarded = Interlocked.Read(ref _counters.Discarded)
+            };
         }
     }
 }
@@ -0,0 +1,729 @@
+﻿/*
+ * Process Hacker -
+ *   memory-mapped performance history file
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.Collections.Generic;
+using System.IO;
+using System.IO.MemoryMappedFiles;
+using System.Runtime.InteropServices;
+using System.Threading;
+using ProcessHacker.Common.Objects;
+
+namespace ProcessHacker.Common
+{
+    // The history file consists of a header, a table of series descriptors
+    // and a data area. Each series (the system or a single process) owns
+    // one column per metric, and each column is a power-of-two ring of
+    // 8-byte samples:
+    //
+    // [header] [series 0] [series 1] ... [series n - 1]
+    // [series 0 metric 0 ring] [series 0 metric 1 ring] ...
+    // [series 1 metric 0 ring] ...
+    //
+    // Samples are only ever appended. A writer stores the values for a tick
+    // and then publishes them by incrementing the series' sample count, so
+    // a crash at any point leaves either the old or the new tick visible,
+    // never a partial one.
+
+    [StructLayout(LayoutKind.Sequential, Pack = 8)]
+    internal struct HistoryFileHeader
+    {
+        public static readonly int SizeOf = Marshal.SizeOf(typeof(HistoryFileHeader));
+
+        public int Magic; // PHH\0
+        public int Version;
+        public int Capacity;
+        public int MetricCount;
+        public int SeriesCapacity;
+        public int Reserved;
+        public long Sequence;
+    }
+
+    [StructLayout(LayoutKind.Sequential, Pack = 8)]
+    internal struct HistorySeriesHeader
+    {
+        public static readonly int SizeOf = Marshal.SizeOf(typeof(HistorySeriesHeader));
+
+        public int Flags;
+        public int Id;
+        public long Key;
+        public long Count;
+        public long LastSequence;
+    }
+
+    /// <summary>
+    /// Describes a series stored in a history file.
+    /// </summary>
+    public struct HistorySeriesInfo
+    {
+        public int Index;
+        public int Id;
+        public long Key;
+        public long Count;
+    }
+
+    /// <summary>
+    /// Provides append-only, crash-safe storage for performance history
+    /// in a memory-mapped file.
+    /// </summary>
+    /// <remarks>
+    /// A series is identified by an ID and a key, for example a process ID
+    /// and the process creation time. Appending samples does not allocate
+    /// any managed memory. This class does not depend on any native APIs
+    /// and can be used to read history files on any platform.
+    /// </remarks>
+    public unsafe sealed class HistoryFile : BaseObject
+    {
+        internal const int HistoryMagic = 0x00484850;
+        internal const int HistoryVersion = 1;
+
+        private const int SeriesInUse = 0x1;
+        private const int SampleSize = 8;
+
+        private struct SeriesKey : IEquatable<SeriesKey>
+        {
+            public int Id;
+            public long Key;
+
+            public SeriesKey(int id, long key)
+            {
+                this.Id = id;
+                this.Key = key;
+            }
+
+            public bool Equals(SeriesKey other)
+            {
+                return this.Id == other.Id && this.Key == other.Key;
+            }
+
+            public override bool Equals(object obj)
+            {
+                return obj is SeriesKey && this.Equals((SeriesKey)obj);
+            }
+
+            public override int GetHashCode()
+            {
+                return this.Id ^ this.Key.GetHashCode() * 31;
+            }
+        }
+
+        /// <summary>
+        /// Opens an existing history file for reading.
+        /// </summary>
+        /// <param name="fileName">The name of the history file.</param>
+        public static HistoryFile OpenRead(string fileName)
+        {
+            return new HistoryFile(fileName, 0, 0, 0, true);
+        }
+
+        private readonly bool _readOnly;
+        private readonly FileStream _fileStream;
+        private readonly MemoryMappedFile _mappedFile;
+        private readonly MemoryMappedViewAccessor _view;
+        private byte* _base;
+
+        private HistoryFileHeader* _header;
+        private HistorySeriesHeader* _series;
+        private byte* _data;
+        private int _capacity;
+        private int _capacityMask;
+        private int _metricCount;
+        private int _seriesCapacity;
+        private int _seriesSize;
+
+        // Maps series IDs and keys to series indices. The writer owns the 
+        // series table, so the index is always current for a writable file. 
+        // A read-only file rebuilds it when a lookup fails.
+        private readonly Dictionary<SeriesKey, int> _seriesIndex = new Dictionary<SeriesKey, int>();
+        private readonly Stack<int> _freeSeries = new Stack<int>();
+
+        /// <summary>
+        /// Opens or creates a history file for writing. If the existing file
+        /// was created with different parameters it is discarded.
+        /// </summary>
+        /// <param name="fileName">The name of the history file.</param>
+        /// <param name="capacity">
+        /// The number of samples kept for each metric. This value will be
+        /// rounded up to a power of two. One sample is always reserved for
+        /// the writer, so at most capacity - 1 samples can be read.
+        /// </param>
+        /// <param name="metricCount">The number of metrics in each series.</param>
+        /// <param name="seriesCapacity">The maximum number of series.</param>
+        public HistoryFile(string fileName, int capacity, int metricCount, int seriesCapacity)
+            : this(fileName, capacity.RoundUpTwo(), metricCount, seriesCapacity, false)
+        { }
+
+        private HistoryFile(string fileName, int capacity, int metricCount, int seriesCapacity, bool readOnly)
+        {
+            _readOnly = readOnly;
+
+            if (!readOnly)
+            {
+                if (capacity < 2)
+                    throw new ArgumentException("The capacity must be at least 2.");
+                if (metricCount <= 0)
+                    throw new ArgumentException("The metric count must be greater than zero.");
+                if (seriesCapacity <= 0)
+                    throw new ArgumentException("The series capacity must be greater than zero.");
+            }
+
+            _fileStream = new FileStream(
+                fileName,
+                readOnly ? FileMode.Open : FileMode.OpenOrCreate,
+                readOnly ? FileAccess.Read : FileAccess.ReadWrite,
+                readOnly ? FileShare.ReadWrite : FileShare.Read
+                );
+
+            try
+            {
+                bool valid = this.ValidateExisting(capacity, metricCount, seriesCapacity);
+
+                if (!valid)
+                {
+                    if (readOnly)
+                        throw new InvalidDataException("The file is not a valid history file.");
+
+                    // Discard the old contents and start again.
+                    _fileStream.SetLength(0);
+                    _fileStream.SetLength(GetFileSize(capacity, metricCount, seriesCapacity));
+                }
+
+                _mappedFile = MemoryMappedFile.CreateFromFile(
+                    _fileStream,
+                    null,
+                    0,
+                    readOnly ? MemoryMappedFileAccess.Read : MemoryMappedFileAccess.ReadWrite,
+                    null,
+                    HandleInheritability.None,
+                    true
+                    );
+                _view = _mappedFile.CreateViewAccessor(
+                    0,
+                    0,
+                    readOnly ? MemoryMappedFileAccess.Read : MemoryMappedFileAccess.ReadWrite
+                    );
+                _view.SafeMemoryMappedViewHandle.AcquirePointer(ref _base);
+                _header = (HistoryFileHeader*)_base;
+
+                if (!valid)
+                {
+                    _header->Version = HistoryVersion;
+                    _header->Capacity = capacity;
+                    _header->MetricCount = metricCount;
+                    _header->SeriesCapacity = seriesCapacity;
+                    _header->Sequence = 0;
+                    Thread.MemoryBarrier();
+                    // Write the magic last so a torn initialization is detected
+                    // the next time the file is opened.
+                    _header->Magic = HistoryMagic;
+                }
+
+                _capacity = _header->Capacity;
+                _capacityMask = _capacity - 1;
+                _metricCount = _header->MetricCount;
+                _seriesCapacity = _header->SeriesCapacity;
+                _seriesSize = _metricCount * _capacity * SampleSize;
+                _series = (HistorySeriesHeader*)(_base + HistoryFileHeader.SizeOf);
+                _data = (byte*)(_series + _seriesCapacity);
+                this.BuildSeriesIndex();
+            }
+            catch
+            {
+                this.CloseMapping();
+                _fileStream.Dispose();
+                throw;
+            }
+        }
+
+        protected override void DisposeObject(bool disposing)
+        {
+            this.CloseMapping();
+
+            if (_fileStream != null)
+                _fileStream.Dispose();
+        }
+
+        private void CloseMapping()
+        {
+            if (_base != null)
+            {
+                if (!_readOnly)
+                    _view.Flush();
+
+                _view.SafeMemoryMappedViewHandle.ReleasePointer();
+                _base = null;
+                _header = null;
+                _series = null;
+                _data = null;
+            }
+
+            if (_view != null)
+                _view.Dispose();
+            if (_mappedFile != null)
+                _mappedFile.Dispose();
+        }
+
+        /// <summary>
+        /// Gets the number of samples kept for each metric.
+        /// </summary>
+        public int Capacity
+        {
+            get { return _capacity; }
+        }
+
+        /// <summary>
+        /// Gets the number of metrics in each series.
+        /// </summary>
+        public int MetricCount
+        {
+            get { return _metricCount; }
+        }
+
+        public bool ReadOnly
+        {
+            get { return _readOnly; }
+        }
+
+        /// <summary>
+        /// Gets the maximum number of series.
+        /// </summary>
+        public int SeriesCapacity
+        {
+            get { return _seriesCapacity; }
+        }
+
+        /// <summary>
+        /// Gets the global sequence number, incremented by
+        /// <see cref="EndTick"/>.
+        /// </summary>
+        public long Sequence
+        {
+            get { return _header->Sequence; }
+        }
+
+        /// <summary>
+        /// Allocates a new series, reusing a free slot if possible.
+        /// </summary>
+        /// <param name="id">The ID of the series, e.g. a process ID.</param>
+        /// <param name="key">A key which distinguishes series with the same ID.</param>
+        /// <returns>The index of the new series, or -1 if the file is full.</returns>
+        public int AllocateSeries(int id, long key)
+        {
+            this.CheckWritable();
+
+            if (_freeSeries.Count == 0)
+                return -1;
+
+            int index = _freeSeries.Pop();
+            HistorySeriesHeader* series = &_series[index];
+
+            series->Id = id;
+            series->Key = key;
+            series->Count = 0;
+            series->LastSequence = _header->Sequence;
+            Thread.MemoryBarrier();
+            series->Flags = SeriesInUse;
+
+            _seriesIndex[new SeriesKey(id, key)] = index;
+
+            return index;
+        }
+
+        /// <summary>
+        /// Finds a series.
+        /// </summary>
+        /// <param name="id">The ID of the series.</param>
+        /// <param name="key">The key of the series.</param>
+        /// <returns>The index of the series, or -1 if it was not found.</returns>
+        public int FindSeries(int id, long key)
+        {
+            int index = this.LookupSeries(id, key);
+
+            // Another process may have changed the series table.
+            if (index == -1 && _readOnly)
+            {
+                this.BuildSeriesIndex();
+                index = this.LookupSeries(id, key);
+            }
+
+            return index;
+        }
+
+        private int LookupSeries(int id, long key)
+        {
+            int index;
+
+            if (!_seriesIndex.TryGetValue(new SeriesKey(id, key), out index))
+                return -1;
+
+            HistorySeriesHeader* series = &_series[index];
+
+            if ((series->Flags & SeriesInUse) == 0 || series->Id != id || series->Key != key)
+                return -1;
+
+            return index;
+        }
+
+        private void BuildSeriesIndex()
+        {
+            _seriesIndex.Clear();
+            _freeSeries.Clear();
+
+            // Push in reverse so that the lowest free slot is used first.
+            for (int i = _seriesCapacity - 1; i >= 0; i--)
+            {
+                HistorySeriesHeader* series = &_series[i];
+
+                if ((series->Flags & SeriesInUse) != 0)
+                    _seriesIndex[new SeriesKey(series->Id, series->Key)] = i;
+                else
+                    _freeSeries.Push(i);
+            }
+        }
+
+        private void ReleaseSeries(int index)
+        {
+            HistorySeriesHeader* series = &_series[index];
+            SeriesKey key = new SeriesKey(series->Id, series->Key);
+            int indexed;
+
+            series->Flags = 0;
+
+            if (_seriesIndex.TryGetValue(key, out indexed) && indexed == index)
+                _seriesIndex.Remove(key);
+
+            _freeSeries.Push(index);
+        }
+
+        /// <summary>
+        /// Finds a series and marks it as current so that it is not freed by
+        /// <see cref="FreeStaleSeries"/>.
+        /// </summary>
+        /// <param name="id">The ID of the series.</param>
+        /// <param name="key">The key of the series.</param>
+        /// <returns>The index of the series, or -1 if it was not found.</returns>
+        public int AttachSeries(int id, long key)
+        {
+            this.CheckWritable();
+
+            int index = this.FindSeries(id, key);
+
+            if (index != -1)
+                _series[index].LastSequence = _header->Sequence;
+
+            return index;
+        }
+
+        /// <summary>
+        /// Frees a series so its slot can be reused.
+        /// </summary>
+        /// <param name="index">The index of the series.</param>
+        public void FreeSeries(int index)
+        {
+            this.CheckWritable();
+            this.CheckSeries(index);
+
+            if ((_series[index].Flags & SeriesInUse) != 0)
+                this.ReleaseSeries(index);
+        }
+
+        /// <summary>
+        /// Frees every series which was not written to since the specified
+        /// sequence number. This is used to discard the history of processes
+        /// which exited while the file was closed.
+        /// </summary>
+        /// <param name="sequence">The minimum sequence number to keep.</param>
+        /// <param name="keepIndex">A series which must not be freed, or -1.</param>
+        /// <returns>The number of series freed.</returns>
+        public int FreeStaleSeries(long sequence, int keepIndex)
+        {
+            int freed = 0;
+
+            this.CheckWritable();
+
+            for (int i = 0; i < _seriesCapacity; i++)
+            {
+                HistorySeriesHeader* series = &_series[i];
+
+                if (i != keepIndex && (series->Flags & SeriesInUse) != 0 && series->LastSequence < sequence)
+                {
+                    this.ReleaseSeries(i);
+                    freed++;
+                }
+            }
+
+            return freed;
+        }
+
+        /// <summary>
+        /// Gets information about the series currently in use.
+        /// </summary>
+        public HistorySeriesInfo[] GetSeries()
+        {
+            List<HistorySeriesInfo> list = new List<HistorySeriesInfo>();
+
+            for (int i = 0; i < _seriesCapacity; i++)
+            {
+                HistorySeriesHeader* series = &_series[i];
+
+                if ((series->Flags & SeriesInUse) != 0)
+                {
+                    list.Add(new HistorySeriesInfo
+                    {
+                        Index = i,
+                        Id = series->Id,
+                        Key = series->Key,
+                        Count = series->Count
+                    });
+                }
+            }
+
+            return list.ToArray();
+        }
+
+        /// <summary>
+        /// Gets the number of samples which can be read from a series.
+        /// </summary>
+        /// <param name="index">The index of the series.</param>
+        public int GetSampleCount(int index)
+        {
+            this.CheckSeries(index);
+
+            long count = _series[index].Count;
+
+            return count > _capacity - 1 ? _capacity - 1 : (int)count;
+        }
+
+        /// <summary>
+        /// Stores a sample for the current tick. The sample will not be
+        /// visible until <see cref="Publish"/> is called.
+        /// </summary>
+        /// <param name="index">The index of the series.</param>
+        /// <param name="metric">The metric.</param>
+        /// <param name="value">The value of the sample.</param>
+        public void Write(int index, int metric, long value)
+        {
+            *(long*)this.GetNextSample(index, metric) = value;
+        }
+
+        /// <summary>
+        /// Stores a sample for the current tick. The sample will not be
+        /// visible until <see cref="Publish"/> is called.
+        /// </summary>
+        /// <param name="index">The index of the series.</param>
+        /// <param name="metric">The metric.</param>
+        /// <param name="value">The value of the sample.</param>
+        public void Write(int index, int metric, float value)
+        {
+            *(double*)this.GetNextSample(index, metric) = value;
+        }
+
+        /// <summary>
+        /// Makes the samples written for the current tick visible.
+        /// </summary>
+        /// <param name="index">The index of the series.</param>
+        public void Publish(int index)
+        {
+            this.CheckWritable();
+            this.CheckSeries(index);
+
+            HistorySeriesHeader* series = &_series[index];
+
+            series->LastSequence = _header->Sequence;
+            // Make sure the samples are written before we increment the count.
+            Thread.MemoryBarrier();
+            series->Count++;
+        }
+
+        /// <summary>
+        /// Increments the global sequence number. Call this after all series
+        /// have been published for a tick.
+        /// </summary>
+        public void EndTick()
+        {
+            this.CheckWritable();
+            _header->Sequence++;
+        }
+
+        /// <summary>
+        /// Reads samples from a series, most recent first.
+        /// </summary>
+        /// <param name="index">The index of the series.</param>
+        /// <param name="metric">The metric.</param>
+        /// <param name="buffer">The buffer to store the samples in.</param>
+        /// <returns>The number of samples read.</returns>
+        public int Read(int index, int metric, long[] buffer)
+        {
+            long count;
+            int length = this.GetReadLength(index, buffer.Length, out count);
+
+            for (int i = 0; i < length; i++)
+                buffer[i] = *(long*)this.GetSample(index, metric, count - 1 - i);
+
+            return length;
+        }
+
+        /// <summary>
+        /// Reads samples from a series, most recent first.
+        /// </summary>
+        /// <param name="index">The index of the series.</param>
+        /// <param name="metric">The metric.</param>
+        /// <param name="buffer">The buffer to store the samples in.</param>
+        /// <returns>The number of samples read.</returns>
+        public int Read(int index, int metric, float[] buffer)
+        {
+            long count;
+            int length = this.GetReadLength(index, buffer.Length, out count);
+
+            for (int i = 0; i < length; i++)
+                buffer[i] = (float)*(double*)this.GetSample(index, metric, count - 1 - i);
+
+            return length;
+        }
+
+        /// <summary>
+        /// Adds the samples of a series to a circular buffer, oldest first.
+        /// </summary>
+        /// <param name="index">The index of the series.</param>
+        /// <param name="metric">The metric.</param>
+        /// <param name="buffer">The buffer to fill.</param>
+        public void Load(int index, int metric, CircularBuffer<long> buffer)
+        {
+            long count;
+            int length = this.GetReadLength(index, buffer.Size, out count);
+
+            for (long i = count - length; i < count; i++)
+                buffer.Add(*(long*)this.GetSample(index, metric, i));
+        }
+
+        /// <summary>
+        /// Adds the samples of a series to a circular buffer, oldest first.
+        /// </summary>
+        /// <param name="index">The index of the series.</param>
+        /// <param name="metric">The metric.</param>
+        /// <param name="buffer">The buffer to fill.</param>
+        public void Load(int index, int metric, CircularBuffer<float> buffer)
+        {
+            long count;
+            int length = this.GetReadLength(index, buffer.Size, out count);
+
+            for (long i = count - length; i < count; i++)
+                buffer.Add((float)*(double*)this.GetSample(index, metric, i));
+        }
+
+        private void CheckSeries(int index)
+        {
+            if (_base == null)
+                throw new ObjectDisposedException("HistoryFile");
+            if (index < 0 || index >= _seriesCapacity)
+                throw new ArgumentOutOfRangeException("index");
+        }
+
+        private void CheckWritable()
+        {
+            if (_readOnly)
+                throw new InvalidOperationException("The history file is read-only.");
+        }
+
+        private int GetReadLength(int index, int maxLength, out long count)
+        {
+            this.CheckSeries(index);
+
+            count = _series[index].Count;
+            Thread.MemoryBarrier();
+
+            long length = count;
+
+            // The slot at the writer's position may be half-written. Once 
+            // the ring is full that slot holds the oldest sample, so it 
+            // must never be returned.
+            if (length > _capacity - 1)
+                length = _capacity - 1;
+            if (length > maxLength)
+                length = maxLength;
+
+            return (int)length;
+        }
+
+        private byte* GetNextSample(int index, int metric)
+        {
+            this.CheckWritable();
+            this.CheckSeries(index);
+
+            return this.GetSample(index, metric, _series[index].Count);
+        }
+
+        private byte* GetSample(int index, int metric, long sample)
+        {
+            if (metric < 0 || metric >= _metricCount)
+                throw new ArgumentOutOfRangeException("metric");
+
+            return _data +
+                (long)index * _seriesSize +
+                (long)metric * _capacity * SampleSize +
+                (sample & _capacityMask) * SampleSize;
+        }
+
+        private static long GetFileSize(int capacity, int metricCount, int seriesCapacity)
+        {
+            return HistoryFileHeader.SizeOf +
+                (long)HistorySeriesHeader.SizeOf * seriesCapacity +
+                (long)seriesCapacity * metricCount * capacity * SampleSize;
+        }
+
+        private bool ValidateExisting(int capacity, int metricCount, int seriesCapacity)
+        {
+            if (_fileStream.Length < HistoryFileHeader.SizeOf)
+                return false;
+
+            byte[] buffer = new byte[HistoryFileHeader.SizeOf];
+            HistoryFileHeader header;
+
+            _fileStream.Position = 0;
+
+            if (_fileStream.Read(buffer, 0, buffer.Length) != buffer.Length)
+                return false;
+
+            fixed (byte* bufferPtr = buffer)
+                header = *(HistoryFileHeader*)bufferPtr;
+
+            if (header.Magic != HistoryMagic || header.Version != HistoryVersion)
+                return false;
+            if (header.Capacity < 2 || header.Capacity.RoundUpTwo() != header.Capacity)
+                return false;
+            if (header.MetricCount <= 0 || header.SeriesCapacity <= 0)
+                return false;
+            if (_fileStream.Length < GetFileSize(header.Capacity, header.MetricCount, header.SeriesCapacity))
+                return false;
+
+            // When opening for writing, the layout must match exactly.
+            if (!_readOnly)
+            {
+                if (header.Capacity != capacity || header.MetricCount != metricCount ||
+                    header.SeriesCapacity != seriesCapacity)
+                    return false;
+            }
+
+            return true;
+        }
+    }
+}
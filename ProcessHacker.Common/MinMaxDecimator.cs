@@ -0,0 +1,362 @@
+﻿/*
+ * Process Hacker -
+ *   min/max decimator for plotting long series
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.Collections.Generic;
+
+namespace ProcessHacker.Common
+{
+    /// <summary>
+    /// Reduces a series to a fixed number of columns, each holding the
+    /// minimum and maximum of the samples it covers.
+    /// </summary>
+    /// <remarks>
+    /// <para>
+    /// Samples are first reduced to buckets of a whole number of samples,
+    /// at least one bucket per column. Buckets are aligned to the absolute
+    /// position of each sample in the series, so when the source is a
+    /// <see cref="CircularBuffer&lt;T&gt;"/> only the newly added samples
+    /// and the partially erased oldest bucket need to be processed on each
+    /// update. Other sources are decimated from scratch every time.
+    /// </para>
+    /// <para>
+    /// The buckets are then divided between the columns with fractional
+    /// boundaries, so that every column is used even when the number of
+    /// samples isn't a multiple of the number of columns.
+    /// </para>
+    /// <para>
+    /// The data is assumed to be ordered most recent first, and column 0
+    /// contains the most recent samples.
+    /// </para>
+    /// <para>
+    /// This class is not thread-safe.
+    /// </para>
+    /// </remarks>
+    public sealed class MinMaxDecimator
+    {
+        private IList<float> _floatData;
+        private IList<long> _longData;
+
+        private int _columns;
+        private int _samplesPerBucket;
+        private long _total;
+        private int _count;
+        private long _firstBucket;
+        private long _lastBucket;
+        private bool _valid;
+
+        private int _ringSize;
+        private double[] _minimums;
+        private double[] _maximums;
+
+        private int _columnCount;
+        private int[] _columnBuckets;
+        private double[] _columnMinimums;
+        private double[] _columnMaximums;
+
+        /// <summary>
+        /// Gets the number of columns which contain data.
+        /// </summary>
+        public int ColumnCount
+        {
+            get { return _valid ? _columnCount : 0; }
+        }
+
+        /// <summary>
+        /// Gets the number of samples in each bucket. A column covers one 
+        /// or more buckets.
+        /// </summary>
+        public int SamplesPerBucket
+        {
+            get { return _samplesPerBucket; }
+        }
+
+        /// <summary>
+        /// Gets the largest value in the decimated data.
+        /// </summary>
+        public double Maximum
+        {
+            get
+            {
+                int columnCount = this.ColumnCount;
+                double max = 0;
+
+                for (int i = 0; i < columnCount; i++)
+                {
+                    double value = this.GetMaximum(i);
+
+                    if (value > max)
+                        max = value;
+                }
+
+                return max;
+            }
+        }
+
+        /// <summary>
+        /// Gets the largest value covered by a column.
+        /// </summary>
+        /// <param name="column">The column. Column 0 is the most recent.</param>
+        public double GetMaximum(int column)
+        {
+            return _columnMaximums[column];
+        }
+
+        /// <summary>
+        /// Gets the smallest value covered by a column.
+        /// </summary>
+        /// <param name="column">The column. Column 0 is the most recent.</param>
+        public double GetMinimum(int column)
+        {
+            return _columnMinimums[column];
+        }
+
+        /// <summary>
+        /// Gets the index of the most recent sample covered by a column.
+        /// </summary>
+        /// <param name="column">The column. Column 0 is the most recent.</param>
+        public int GetSampleIndex(int column)
+        {
+            long bucket = _lastBucket - _columnBuckets[column];
+            long index = _total - 1 - Math.Min((bucket + 1) * _samplesPerBucket - 1, _total - 1);
+
+            return (int)Math.Max(0, index);
+        }
+
+        /// <summary>
+        /// Discards the cached columns. The next update will process the
+        /// entire series.
+        /// </summary>
+        public void Invalidate()
+        {
+            _valid = false;
+        }
+
+        /// <summary>
+        /// Updates the columns from a series.
+        /// </summary>
+        /// <param name="data">The series, most recent first.</param>
+        /// <param name="columns">The maximum number of columns.</param>
+        public void Update(IList<float> data, int columns)
+        {
+            CircularBuffer<float> buffer = data as CircularBuffer<float>;
+
+            if (data != _floatData)
+            {
+                _floatData = data;
+                _longData = null;
+                _valid = false;
+            }
+
+            this.Update(data.Count, buffer != null ? buffer.AddCount : data.Count, buffer != null, columns);
+        }
+
+        /// <summary>
+        /// Updates the columns from a series.
+        /// </summary>
+        /// <param name="data">The series, most recent first.</param>
+        /// <param name="columns">The maximum number of columns.</param>
+        public void Update(IList<long> data, int columns)
+        {
+            CircularBuffer<long> buffer = data as CircularBuffer<long>;
+
+            if (data != _longData)
+            {
+                _longData = data;
+                _floatData = null;
+                _valid = false;
+            }
+
+            this.Update(data.Count, buffer != null ? buffer.AddCount : data.Count, buffer != null, columns);
+        }
+
+        private void Update(int count, long total, bool incremental, int columns)
+        {
+            if (columns <= 0 || count <= 0)
+            {
+                _valid = false;
+                return;
+            }
+
+            // Round down so that there are at least as many buckets as 
+            // columns.
+            int samplesPerBucket = Math.Max(1, count / columns);
+
+            if (
+                !_valid || !incremental ||
+                columns != _columns ||
+                samplesPerBucket != _samplesPerBucket ||
+                total < _total ||
+                total - _total >= count
+                )
+            {
+                this.Rebuild(count, total, samplesPerBucket, columns);
+            }
+            else if (total != _total || count != _count)
+            {
+                this.Append(count, total);
+            }
+            else
+            {
+                return;
+            }
+
+            this.UpdateColumns();
+        }
+
+        private void UpdateColumns()
+        {
+            int buckets = (int)(_lastBucket - _firstBucket + 1);
+            int columnCount = Math.Min(_columns, buckets);
+
+            if (_columnBuckets == null || _columnBuckets.Length < columnCount)
+            {
+                _columnBuckets = new int[_columns];
+                _columnMinimums = new double[_columns];
+                _columnMaximums = new double[_columns];
+            }
+
+            // Each column covers the buckets from its own boundary to the 
+            // next column's, counting back from the most recent bucket.
+            for (int c = 0; c < columnCount; c++)
+            {
+                int start = (int)((long)c * buckets / columnCount);
+                int end = (int)((long)(c + 1) * buckets / columnCount);
+                double min = double.MaxValue;
+                double max = double.MinValue;
+
+                for (int b = start; b < end; b++)
+                {
+                    int slot = this.GetSlot(_lastBucket - b);
+
+                    if (_minimums[slot] < min)
+                        min = _minimums[slot];
+                    if (_maximums[slot] > max)
+                        max = _maximums[slot];
+                }
+
+                _columnBuckets[c] = start;
+                _columnMinimums[c] = min;
+                _columnMaximums[c] = max;
+            }
+
+            _columnCount = columnCount;
+        }
+
+        private void Append(int count, long total)
+        {
+            // Merge the new samples, oldest first.
+            for (long a = _total; a < total; a++)
+            {
+                long bucket = a / _samplesPerBucket;
+
+                if (bucket > _lastBucket)
+                {
+                    this.ResetSlot(this.GetSlot(bucket));
+                    _lastBucket = bucket;
+                }
+
+                this.Merge(this.GetSlot(bucket), this.GetValue((int)(total - 1 - a)));
+            }
+
+            long first = total - count;
+            long firstBucket = first / _samplesPerBucket;
+
+            // If samples were erased from the oldest bucket, the bucket must
+            // be recomputed from the samples which remain.
+            if (first > _total - _count && first % _samplesPerBucket != 0)
+                this.RebuildBucket(firstBucket, count, total);
+
+            _firstBucket = firstBucket;
+            _total = total;
+            _count = count;
+        }
+
+        private void Rebuild(int count, long total, int samplesPerBucket, int columns)
+        {
+            _columns = columns;
+            _samplesPerBucket = samplesPerBucket;
+            // Until the bucket size changes, the series can grow to almost 
+            // twice as many buckets as columns, plus a partial bucket at 
+            // each end.
+            _ringSize = columns * 2 + 2;
+
+            if (_minimums == null || _minimums.Length < _ringSize)
+            {
+                _minimums = new double[_ringSize];
+                _maximums = new double[_ringSize];
+            }
+
+            _firstBucket = (total - count) / samplesPerBucket;
+            _lastBucket = (total - 1) / samplesPerBucket;
+
+            for (long bucket = _firstBucket; bucket <= _lastBucket; bucket++)
+                this.ResetSlot(this.GetSlot(bucket));
+
+            for (int i = 0; i < count; i++)
+                this.Merge(this.GetSlot((total - 1 - i) / samplesPerBucket), this.GetValue(i));
+
+            _total = total;
+            _count = count;
+            _valid = true;
+        }
+
+        private void RebuildBucket(long bucket, int count, long total)
+        {
+            int slot = this.GetSlot(bucket);
+            long start = Math.Max(bucket * _samplesPerBucket, total - count);
+            long end = Math.Min((bucket + 1) * _samplesPerBucket, total);
+
+            this.ResetSlot(slot);
+
+            for (long a = start; a < end; a++)
+                this.Merge(slot, this.GetValue((int)(total - 1 - a)));
+        }
+
+        private int GetSlot(long bucket)
+        {
+            return (int)(bucket % _ringSize);
+        }
+
+        private double GetValue(int index)
+        {
+            if (_floatData != null)
+                return _floatData[index];
+            else
+                return _longData[index];
+        }
+
+        private void Merge(int slot, double value)
+        {
+            if (value < _minimums[slot])
+                _minimums[slot] = value;
+            if (value > _maximums[slot])
+                _maximums[slot] = value;
+        }
+
+        private void ResetSlot(int slot)
+        {
+            _minimums[slot] = double.MaxValue;
+            _maximums[slot] = double.MinValue;
+        }
+    }
+}
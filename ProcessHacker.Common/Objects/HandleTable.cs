@@ -20,8 +20,8 @@
  * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
  */
 
-using System.Collections.Generic;
-using ProcessHacker.Common.Threading;
+using System;
+using System.Threading;
 
 namespace ProcessHacker.Common.Objects
 {
@@ -29,6 +29,12 @@ namespace ProcessHacker.Common.Objects
     {
         public int Handle { get; internal set; }
         public IRefCounted Object { get; internal set; }
+
+        /// <summary>
+        /// The number of threads currently referencing the object
+        /// through this entry.
+        /// </summary>
+        internal int LookupCount;
     }
 
     /// <summary>
@@ -41,9 +47,49 @@ namespace ProcessHacker.Common.Objects
     /// Provides methods for managing handles to objects.
     /// </summary>         
     /// <typeparam name="TEntry">The type of each handle table entry.</typeparam>
+    /// <remarks>
+    /// <para>
+    /// Entries are stored in pages of a two-level table, indexed 
+    /// directly by the handle value. Lookups don't take any locks. 
+    /// Free entries are kept on a lock-free stack whose head 
+    /// includes a counter so that a stale head can't be swapped in 
+    /// (the ABA problem).
+    /// </para>
+    /// <para>
+    /// Each handle contains a reuse tag which is incremented every 
+    /// time its entry is freed, so a stale handle is not accepted 
+    /// once the entry has been reused.
+    /// </para>
+    /// </remarks>
     public class HandleTable<TEntry> : BaseObject
         where TEntry : HandleTableEntry, new()
     {
+        // Handle layout: 
+        // Reserved: 2 bits (handles are divisible by 4).
+        // Index: 20 bits.
+        // Tag: 9 bits.
+        private const int HandleIndexShift = 2;
+        private const int IndexBits = 20;
+        private const int IndexMask = (1 << IndexBits) - 1;
+        private const int HandleTagShift = HandleIndexShift + IndexBits;
+        private const int TagMask = 0x1ff;
+
+        // Each page contains 256 entries.
+        private const int PageShift = 8;
+        private const int PageSize = 1 << PageShift;
+        private const int PageMask = PageSize - 1;
+        private const int PageCount = (IndexMask + 1) >> PageShift;
+
+        // The free list is empty when the index in its head is 0.
+        private const int NoIndex = 0;
+
+        private class Page
+        {
+            public readonly TEntry[] Entries = new TEntry[PageSize];
+            public readonly int[] Tags = new int[PageSize];
+            public readonly int[] NextFree = new int[PageSize];
+        }
+
         /// <summary>
         /// Represents a callback function for handle table enumeration.
         /// </summary>
@@ -52,25 +98,111 @@ namespace ProcessHacker.Common.Objects
         /// <returns>Return true to stop enumerating; otherwise return false.</returns>
         public delegate bool EnumerateHandleTableDelegate(int handle, TEntry entry);
 
-        private readonly IdGenerator _handleGenerator = new IdGenerator(4, 4);
-        private readonly FastResourceLock _lock = new FastResourceLock();
-        private readonly Dictionary<int, TEntry> _handles = new Dictionary<int, TEntry>();
+        private readonly Page[] _pages = new Page[PageCount];
+        // The highest index which has been handed out. Index 0 is 
+        // never used so that no handle has the value 0.
+        private int _nextIndex;
+        // Free list head: index (low 32 bits), counter (high 32 bits).
+        private long _freeHead;
 
         protected override void DisposeObject(bool disposing)
         {
-            _lock.AcquireExclusive();
+            foreach (Page page in _pages)
+            {
+                if (page == null)
+                    continue;
 
-            try
+                for (int i = 0; i < PageSize; i++)
+                {
+                    TEntry entry = Interlocked.Exchange(ref page.Entries[i], null);
+
+                    if (entry != null)
+                        entry.Object.Dereference(disposing);
+                }
+            }
+        }
+
+        private static int GetHandleIndex(int handle)
+        {
+            return (handle >> HandleIndexShift) & IndexMask;
+        }
+
+        private static int MakeHandle(int index, int tag)
+        {
+            return (tag << HandleTagShift) | (index << HandleIndexShift);
+        }
+
+        private Page GetPage(int index)
+        {
+            return _pages[index >> PageShift];
+        }
+
+        private Page EnsurePage(int index)
+        {
+            Page page = _pages[index >> PageShift];
+
+            if (page != null)
+                return page;
+
+            Page newPage = new Page();
+
+            return Interlocked.CompareExchange(ref _pages[index >> PageShift], newPage, null) ?? newPage;
+        }
+
+        private int PopFreeIndex()
+        {
+            while (true)
             {
-                foreach (var entry in _handles.Values)
-                    entry.Object.Dereference(disposing);
+                long head = Interlocked.Read(ref _freeHead);
+                int index = (int)head;
+
+                if (index == NoIndex)
+                    return NoIndex;
+
+                // If the index is popped and pushed again by someone 
+                // else, the counter changes and the exchange fails.
+                int next = this.GetPage(index).NextFree[index & PageMask];
+                long newHead = ((head >> 32) + 1) << 32 | (uint)next;
+
+                if (Interlocked.CompareExchange(ref _freeHead, newHead, head) == head)
+                    return index;
             }
-            finally
+        }
+
+        private void PushFreeIndex(int index)
+        {
+            Page page = this.GetPage(index);
+
+            while (true)
+            {
+                long head = Interlocked.Read(ref _freeHead);
+                long newHead = ((head >> 32) + 1) << 32 | (uint)index;
+
+                page.NextFree[index & PageMask] = (int)head;
+
+                if (Interlocked.CompareExchange(ref _freeHead, newHead, head) == head)
+                    break;
+            }
+        }
+
+        private int AllocateIndex()
+        {
+            int index = this.PopFreeIndex();
+
+            if (index != NoIndex)
+                return index;
+
+            index = Interlocked.Increment(ref _nextIndex);
+
+            if (index > IndexMask)
             {
-                _lock.ReleaseExclusive();
+                Interlocked.Decrement(ref _nextIndex);
+                throw new InvalidOperationException("The handle table is full.");
             }
 
-            _lock.Dispose();
+            this.EnsurePage(index);
+
+            return index;
         }
 
         /// <summary>
@@ -93,7 +225,9 @@ namespace ProcessHacker.Common.Objects
         /// <returns>The new handle.</returns>
         public int Allocate(IRefCounted obj, TEntry entry)
         {
-            int handle = _handleGenerator.Pop();
+            int index = this.AllocateIndex();
+            Page page = this.GetPage(index);
+            int handle = MakeHandle(index, page.Tags[index & PageMask]);
 
             // Reference the object so it does not get freed while 
             // it is stored in the handle table.
@@ -104,17 +238,9 @@ namespace ProcessHacker.Common.Objects
             entry.Handle = handle;
             entry.Object = obj;
 
-            // Add the handle entry.
-            _lock.AcquireExclusive();
-
-            try
-            {
-                _handles.Add(handle, entry);
-            }
-            finally
-            {
-                _lock.ReleaseExclusive();
-            }
+            // Publish the entry. The exchange makes sure the entry is 
+            // initialized before other threads can see it.
+            Interlocked.Exchange(ref page.Entries[index & PageMask], entry);
 
             return handle;
         }
@@ -124,24 +250,31 @@ namespace ProcessHacker.Common.Objects
         /// </summary>
         /// <param name="callback">The callback for the enumeration.</param>
         /// <returns>Whether the enumeration was stopped by the callback.</returns>
+        /// <remarks>
+        /// Handles which are created or closed during the enumeration 
+        /// may or may not be included.
+        /// </remarks>
         public bool Enumerate(EnumerateHandleTableDelegate callback)
         {
-            _lock.AcquireShared();
+            int count = Thread.VolatileRead(ref _nextIndex);
 
-            try
+            for (int index = 1; index <= count; index++)
             {
-                foreach (var entry in _handles.Values)
+                Page page = this.GetPage(index);
+
+                if (page == null)
+                    continue;
+
+                TEntry entry = page.Entries[index & PageMask];
+
+                if (entry != null)
                 {
                     if (callback(entry.Handle, entry))
                         return true;
                 }
-
-                return false;
-            }
-            finally
-            {
-                _lock.ReleaseShared();
             }
+
+            return false;
         }
 
         /// <summary>
@@ -151,29 +284,32 @@ namespace ProcessHacker.Common.Objects
         /// <returns>Whether the handle was closed.</returns>
         public bool Free(int handle)
         {
-            IRefCounted obj;
+            int index = GetHandleIndex(handle);
+            Page page = this.GetPage(index);
 
-            _lock.AcquireExclusive();
+            if (page == null)
+                return false;
 
-            try
-            {
-                if (!_handles.ContainsKey(handle))
-                    return false;
+            TEntry entry = page.Entries[index & PageMask];
 
-                // Store the object reference for dereferencing later.
-                obj = _handles[handle].Object;
-                // Remove the handle so it can no longer be used.
-                _handles.Remove(handle);
-            }
-            finally
-            {
-                _lock.ReleaseExclusive();
-            }
+            if (entry == null || entry.Handle != handle)
+                return false;
 
-            // Make the handle value available.
-            _handleGenerator.Push(handle);
-            // Dereference the object (this doesn't need to be in the locking block).
-            obj.Dereference();
+            // Remove the handle so it can no longer be used. Only one 
+            // thread can succeed here.
+            if (Interlocked.CompareExchange(ref page.Entries[index & PageMask], null, entry) != entry)
+                return false;
+
+            // Wait for threads which found the entry before it was 
+            // removed to finish referencing the object.
+            while (Thread.VolatileRead(ref entry.LookupCount) != 0)
+                Thread.SpinWait(1);
+
+            // Make the index available with a new tag.
+            page.Tags[index & PageMask] = (page.Tags[index & PageMask] + 1) & TagMask;
+            this.PushFreeIndex(index);
+            // Dereference the object.
+            entry.Object.Dereference();
 
             return true;
         }
@@ -185,19 +321,19 @@ namespace ProcessHacker.Common.Objects
         /// <returns>A handle table entry.</returns>
         public TEntry LookupEntry(int handle)
         {
-            _lock.AcquireShared();
+            int index = GetHandleIndex(handle);
+            Page page = this.GetPage(index);
 
-            try
-            {
-                if (_handles.ContainsKey(handle))
-                    return _handles[handle];
-                else
-                    return null;
-            }
-            finally
-            {
-                _lock.ReleaseShared();
-            }
+            if (page == null)
+                return null;
+
+            TEntry entry = page.Entries[index & PageMask];
+
+            // A stale handle has a different tag from the entry.
+            if (entry != null && entry.Handle == handle)
+                return entry;
+            else
+                return null;
         }
 
         /// <summary>
@@ -210,7 +346,9 @@ namespace ProcessHacker.Common.Objects
         /// </returns>
         public IRefCounted LookupObject(int handle)
         {
-            return this.LookupEntry(handle).Object;
+            TEntry entry = this.LookupEntry(handle);
+
+            return entry != null ? entry.Object : null;
         }
 
         /// <summary>
@@ -254,28 +392,39 @@ namespace ProcessHacker.Common.Objects
         /// </returns>
         public IRefCounted ReferenceByHandle(int handle, out TEntry entry)
         {
-            _lock.AcquireShared();
+            int index = GetHandleIndex(handle);
+            Page page = this.GetPage(index);
+
+            entry = null;
+
+            if (page == null)
+                return null;
+
+            TEntry lookupEntry = page.Entries[index & PageMask];
+
+            if (lookupEntry == null || lookupEntry.Handle != handle)
+                return null;
+
+            Interlocked.Increment(ref lookupEntry.LookupCount);
 
             try
             {
-                if (_handles.ContainsKey(handle))
-                {
-                    IRefCounted obj = _handles[handle].Object;
+                // Free removes the entry before waiting for the lookup 
+                // count to reach zero, so if the entry is still present 
+                // the object can't be dereferenced until we are done.
+                if (page.Entries[index & PageMask] != lookupEntry)
+                    return null;
 
-                    obj.Reference();
-                    entry = _handles[handle];
+                IRefCounted obj = lookupEntry.Object;
 
-                    return obj;
-                }
-                else
-                {
-                    entry = null;
-                    return null;
-                }
+                obj.Reference();
+                entry = lookupEntry;
+
+                return obj;
             }
             finally
             {
-                _lock.ReleaseShared();
+                Interlocked.Decrement(ref lookupEntry.LookupCount);
             }
         }
 
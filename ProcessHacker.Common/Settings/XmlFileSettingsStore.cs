@@ -20,7 +20,11 @@
  * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+using System;
+using System.Collections.Generic;
 using System.IO;
+using System.Text;
+using System.Threading;
 using System.Xml;
 
 namespace ProcessHacker.Common.Settings
@@ -28,16 +32,101 @@ namespace ProcessHacker.Common.Settings
     /// <summary>
     /// Provides an XML-based settings store.
     /// </summary>
+    /// <remarks>
+    /// <para>
+    /// The file is read once into a dictionary. Reads use an immutable 
+    /// snapshot and don't take any locks. Each write publishes a new 
+    /// snapshot which shares the dictionary of saved values and only 
+    /// copies the small dictionary of changes made since the last 
+    /// flush. The changes are merged into the saved values when the 
+    /// file is written, or once there are too many of them.
+    /// </para>
+    /// <para>
+    /// Changes are written to the file by Flush, or by a background 
+    /// timer shortly after the last change. The file is only written 
+    /// if there are unsaved changes, and is replaced atomically by 
+    /// writing a temporary file first.
+    /// </para>
+    /// </remarks>
     public sealed class XmlFileSettingsStore : ISettingsStore
     {
         private const string _rootElementName = "settings";
         private const string _settingElementName = "setting";
         private const string _nameAttributeName = "name";
+        private const int _lazyFlushDelay = 2000;
+        private const int _maxChanges = 32;
+
+        private sealed class Snapshot
+        {
+            public static readonly Snapshot Empty = new Snapshot(new Dictionary<string, string>(), new List<string>(), 0);
+
+            public readonly Dictionary<string, string> Values;
+            // The names in file order, so that rewriting the file 
+            // doesn't reorder it.
+            public readonly List<string> Names;
+            // Values set since the changes were last merged, and the 
+            // names among them which aren't in Values.
+            public readonly Dictionary<string, string> Changes;
+            public readonly List<string> NewNames;
+            public readonly int Version;
+
+            public Snapshot(Dictionary<string, string> values, List<string> names, int version)
+                : this(values, names, new Dictionary<string, string>(), new List<string>(), version)
+            { }
+
+            public Snapshot(
+                Dictionary<string, string> values,
+                List<string> names,
+                Dictionary<string, string> changes,
+                List<string> newNames,
+                int version
+                )
+            {
+                this.Values = values;
+                this.Names = names;
+                this.Changes = changes;
+                this.NewNames = newNames;
+                this.Version = version;
+            }
+
+            public bool TryGetValue(string name, out string value)
+            {
+                return this.Changes.TryGetValue(name, out value) || this.Values.TryGetValue(name, out value);
+            }
+
+            /// <summary>
+            /// Creates a snapshot with the same values and no changes.
+            /// </summary>
+            public Snapshot Merge()
+            {
+                if (this.Changes.Count == 0)
+                    return this;
+
+                Dictionary<string, string> values = new Dictionary<string, string>(this.Values);
+                List<string> names = this.Names;
+
+                foreach (KeyValuePair<string, string> pair in this.Changes)
+                    values[pair.Key] = pair.Value;
+
+                if (this.NewNames.Count != 0)
+                {
+                    names = new List<string>(this.Names.Count + this.NewNames.Count);
+                    names.AddRange(this.Names);
+                    names.AddRange(this.NewNames);
+                }
+
+                return new Snapshot(values, names, this.Version);
+            }
+        }
 
         private readonly string _fileName;
-        private readonly object _docLock = new object();
-        private XmlDocument _doc;
-        private XmlNode _rootNode;
+        // Serializes writers. Readers never take this lock.
+        private readonly object _writeLock = new object();
+        // Serializes file writes.
+        private readonly object _flushLock = new object();
+        private volatile Snapshot _snapshot;
+        private int _savedVersion;
+        private Timer _flushTimer;
 
         /// <summary>
         /// Creates a new settings store from the specified file.
@@ -60,14 +149,40 @@ namespace ProcessHacker.Common.Settings
         /// <summary>
         /// Flushes persistent storage.
         /// </summary>
+        /// <remarks>
+        /// Nothing is written if there are no unsaved changes.
+        /// </remarks>
         public void Flush()
         {
-            if (!string.IsNullOrEmpty(_fileName))
+            if (string.IsNullOrEmpty(_fileName))
+                return;
+
+            lock (_flushLock)
             {
-                lock (_docLock)
-                {
-                    _doc.Save(_fileName);
-                }
+                Snapshot snapshot = _snapshot;
+
+                if (snapshot.Version == _savedVersion)
+                    return;
+
+                this.Save(snapshot);
+                _savedVersion = snapshot.Version;
+
+                // Merge the saved changes (and any made since) so the 
+                // next writes start with an empty set of changes.
+                lock (_writeLock)
+                    _snapshot = _snapshot.Merge();
+            }
+        }
+
+        private void FlushTimerCallback(object state)
+        {
+            try
+            {
+                this.Flush();
+            }
+            catch (Exception ex)
+            {
+                Logging.Log(ex);
             }
         }
 
@@ -78,41 +193,103 @@ namespace ProcessHacker.Common.Settings
         /// <returns>A string if a value was found for the setting, otherwise null.</returns>
         public string GetValue(string name)
         {
-            lock (_docLock)
-            {
-                XmlNodeList nodes = _rootNode.SelectNodes(_settingElementName + "[@" + _nameAttributeName + "='" + name + "']");
-
-                if (nodes == null)
-                    return null;
+            string value;
 
-                if (nodes.Count == 0)
-                    return null;
+            if (_snapshot.TryGetValue(name, out value))
+                return value;
 
-                return nodes[0].InnerText;
-            }
+            return null;
         }
 
         private void Initialize()
         {
-            _doc = new XmlDocument();
-
-            // Does the file exist? If not, initialize a new XML document.
+            // Does the file exist? If not, start with no settings.
             if (!string.IsNullOrEmpty(_fileName) && File.Exists(_fileName))
             {
-                _doc.Load(_fileName);
+                _snapshot = Load(_fileName);
             }
             else
             {
-                this.InitializeNew(_doc);
+                _snapshot = Snapshot.Empty;
             }
 
-            _rootNode = _doc.SelectSingleNode("/" + _rootElementName);
+            _savedVersion = _snapshot.Version;
         }
 
-        private void InitializeNew(XmlDocument doc)
+        private static Snapshot Load(string fileName)
         {
-            doc.RemoveAll();
-            doc.AppendChild(doc.CreateElement(_rootElementName));
+            XmlDocument doc = new XmlDocument();
+            Dictionary<string, string> values = new Dictionary<string, string>();
+            List<string> names = new List<string>();
+
+            doc.Load(fileName);
+
+            XmlNode rootNode = doc.SelectSingleNode("/" + _rootElementName);
+
+            if (rootNode != null)
+            {
+                foreach (XmlNode node in rootNode.ChildNodes)
+                {
+                    if (node.NodeType != XmlNodeType.Element || node.Name != _settingElementName)
+                        continue;
+
+                    XmlAttribute nameAttribute = node.Attributes[_nameAttributeName];
+
+                    if (nameAttribute == null)
+                        continue;
+
+                    // If a name appears more than once, the first value wins.
+                    if (!values.ContainsKey(nameAttribute.Value))
+                    {
+                        values.Add(nameAttribute.Value, node.InnerText);
+                        names.Add(nameAttribute.Value);
+                    }
+                }
+            }
+
+            return new Snapshot(values, names, 0);
+        }
+
+        private void Save(Snapshot snapshot)
+        {
+            string tempFileName = _fileName + ".tmp";
+            XmlWriterSettings settings = new XmlWriterSettings();
+
+            settings.Encoding = new UTF8Encoding(false);
+            settings.Indent = true;
+
+            using (XmlWriter writer = XmlWriter.Create(tempFileName, settings))
+            {
+                writer.WriteStartDocument();
+                writer.WriteStartElement(_rootElementName);
+
+                foreach (string name in snapshot.Names)
+                    WriteSetting(writer, snapshot, name);
+                foreach (string name in snapshot.NewNames)
+                    WriteSetting(writer, snapshot, name);
+
+                writer.WriteEndElement();
+                writer.WriteEndDocument();
+            }
+
+            // Replace the settings file in one step so that a crash 
+            // can't leave it half-written.
+            if (File.Exists(_fileName))
+                File.Replace(tempFileName, _fileName, null);
+            else
+                File.Move(tempFileName, _fileName);
+        }
+
+        private static void WriteSetting(XmlWriter writer, Snapshot snapshot, string name)
+        {
+            string value;
+
+            snapshot.TryGetValue(name, out value);
+
+            writer.WriteStartElement(_settingElementName);
+            writer.WriteAttributeString(_nameAttributeName, name);
+            writer.WriteString(value);
+            writer.WriteEndElement();
         }
 
         /// <summary>
@@ -124,13 +301,16 @@ namespace ProcessHacker.Common.Settings
         /// </remarks>
         public void Reset()
         {
-            lock (_docLock)
+            lock (_writeLock)
             {
-                this.InitializeNew(_doc);
-
-                if (!string.IsNullOrEmpty(_fileName))
-                    _doc.Save(_fileName);
+                _snapshot = new Snapshot(
+                    new Dictionary<string, string>(),
+                    new List<string>(),
+                    _snapshot.Version + 1
+                    );
             }
+
+            this.Flush();
         }
 
         /// <summary>
@@ -144,24 +324,43 @@ namespace ProcessHacker.Common.Settings
         /// </remarks>
         public void SetValue(string name, string value)
         {
-            lock (_docLock)
+            lock (_writeLock)
             {
-                XmlNodeList nodes = _rootNode.SelectNodes(_settingElementName + "[@" + _nameAttributeName + "='" + name + "']");
+                Snapshot snapshot = _snapshot;
+                string oldValue;
+                bool exists = snapshot.TryGetValue(name, out oldValue);
+
+                if (exists && oldValue == value)
+                    return;
+
+                // Copy the changes, since readers may be using them. The 
+                // saved values are shared with the previous snapshot.
+                Dictionary<string, string> changes = new Dictionary<string, string>(snapshot.Changes);
+                List<string> newNames = snapshot.NewNames;
 
-                if (nodes != null && nodes.Count != 0)
+                changes[name] = value;
+
+                if (!exists)
                 {
-                    nodes[0].InnerText = value;
+                    newNames = new List<string>(snapshot.NewNames);
+                    newNames.Add(name);
                 }
-                else
-                {
-                    XmlElement settingElement = _doc.CreateElement(_settingElementName);
-                    XmlAttribute nameAttribute = _doc.CreateAttribute(_nameAttributeName);
 
-                    nameAttribute.Value = name;
-                    settingElement.Attributes.Append(nameAttribute);
-                    settingElement.InnerText = value;
+                snapshot = new Snapshot(snapshot.Values, snapshot.Names, changes, newNames, snapshot.Version + 1);
 
-                    _rootNode.AppendChild(settingElement);
+                // Don't let the changes grow without bound if the file 
+                // isn't being flushed.
+                if (changes.Count > _maxChanges)
+                    snapshot = snapshot.Merge();
+
+                _snapshot = snapshot;
+
+                if (!string.IsNullOrEmpty(_fileName))
+                {
+                    if (_flushTimer == null)
+                        _flushTimer = new Timer(this.FlushTimerCallback, null, _lazyFlushDelay, Timeout.Infinite);
+                    else
+                        _flushTimer.Change(_lazyFlushDelay, Timeout.Infinite);
                 }
             }
         }
@@ -0,0 +1,901 @@
+﻿/*
+ * Process Hacker -
+ *   scalable resource lock
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#if DEBUG
+#define RIGOROUS_CHECKS
+#endif
+
+using System;
+using System.Diagnostics;
+using System.Threading;
+
+namespace ProcessHacker.Common.Threading
+{
+    /// <summary>
+    /// Provides a resource (reader-writer) lock for heavily shared
+    /// data.
+    /// </summary>
+    /// <remarks>
+    /// <para>
+    /// This lock works like <see cref="FastResourceLock"/>, but the
+    /// owner and waiter counts are 20 bits wide instead of 10, so
+    /// the lock can be used by more than 1023 threads at once.
+    /// </para>
+    /// <para>
+    /// If reader striping is enabled, shared acquires increment a
+    /// counter chosen by the current thread ID instead of the lock
+    /// value, so readers on different threads usually don't write
+    /// to the same cache line. Exclusive acquires become more
+    /// expensive because they have to wait for all striped readers
+    /// to leave.
+    /// </para>
+    /// <para>
+    /// Contention statistics can be enabled for each instance. They
+    /// are off by default because they add interlocked operations
+    /// to every acquire.
+    /// </para>
+    /// </remarks>
+    public sealed class ScalableResourceLock : IDisposable, IResourceLock
+    {
+        // Details
+        //
+        // Resource lock value width: 64 bits.
+        // Lock owned (either exclusive or shared): L (1 bit).
+        // Exclusive waking: W (1 bit).
+        // Shared owners count: SC (20 bits).
+        // Shared waiters count: SW (20 bits).
+        // Exclusive waiters count: EW (20 bits).
+        //
+        // The state transitions are the same as FastResourceLock.
+        //
+        // On 32-bit systems a plain read of the lock value can be torn.
+        // This is harmless because every decision based on a read is
+        // validated by a compare-exchange on the whole value.
+        //
+        // Striped readers
+        //
+        // A striped shared acquire increments _slots[k], where k is
+        // derived from the thread ID, and then checks _slotsBlocked. If
+        // it is non-zero, a writer is active or waiting, and the reader
+        // backs out and uses the lock value instead. A writer increments
+        // _slotsBlocked, acquires the lock value in exclusive mode and
+        // then waits for all slots to become zero. Both sides use
+        // interlocked operations, so either the reader sees the writer
+        // or the writer sees the reader.
+        //
+        // A shared release decrements _slots[k] if it is non-zero and
+        // releases the lock value otherwise. For each k, the slot count
+        // never exceeds the number of owners with that k, so an owner
+        // is always counted in either its slot or SC. An owner whose
+        // count was taken from its slot by another thread with the same
+        // k is simply counted in SC instead.
+
+        #region Constants
+
+        // Lock owned: 1 bit.
+        private const long LockOwned = 0x1;
+
+        // Exclusive waking: 1 bit.
+        private const long LockExclusiveWaking = 0x2;
+
+        // Shared owners count: 20 bits.
+        private const int LockSharedOwnersShift = 2;
+        private const long LockSharedOwnersMask = 0xfffff;
+        private const long LockSharedOwnersIncrement = 0x4;
+
+        // Shared waiters count: 20 bits.
+        private const int LockSharedWaitersShift = 22;
+        private const long LockSharedWaitersMask = 0xfffff;
+        private const long LockSharedWaitersIncrement = 0x400000;
+
+        // Exclusive waiters count: 20 bits.
+        private const int LockExclusiveWaitersShift = 42;
+        private const long LockExclusiveWaitersMask = 0xfffff;
+        private const long LockExclusiveWaitersIncrement = 0x40000000000;
+
+        private const long ExclusiveMask = LockExclusiveWaking | (LockExclusiveWaitersMask << LockExclusiveWaitersShift);
+
+        // Each slot is padded to its own 64-byte cache line.
+        private const int SlotStride = 16;
+
+        #endregion
+
+        public struct Statistics
+        {
+            /// <summary>
+            /// The number of times the lock has been acquired in exclusive mode.
+            /// </summary>
+            public long AcqExcl;
+            /// <summary>
+            /// The number of times the lock has been acquired in shared mode.
+            /// </summary>
+            public long AcqShrd;
+            /// <summary>
+            /// The number of times the lock has been acquired in shared mode
+            /// using a reader slot.
+            /// </summary>
+            public long AcqShrdStriped;
+            /// <summary>
+            /// The number of times an acquire had to retry or spin.
+            /// </summary>
+            public long Spins;
+            /// <summary>
+            /// The number of times exclusive waiters have gone to sleep.
+            /// </summary>
+            public long AcqExclSlp;
+            /// <summary>
+            /// The number of times shared waiters have gone to sleep.
+            /// </summary>
+            public long AcqShrdSlp;
+            /// <summary>
+            /// The total time spent asleep or waiting for striped readers,
+            /// in Stopwatch ticks.
+            /// </summary>
+            public long WaitTicks;
+            /// <summary>
+            /// The highest number of exclusive waiters at any one time.
+            /// </summary>
+            public int PeakExclWtrsCount;
+            /// <summary>
+            /// The highest number of shared waiters at any one time.
+            /// </summary>
+            public int PeakShrdWtrsCount;
+
+            /// <summary>
+            /// Gets the total wait time.
+            /// </summary>
+            public TimeSpan WaitTime
+            {
+                get { return TimeSpan.FromSeconds((double)this.WaitTicks / Stopwatch.Frequency); }
+            }
+        }
+
+        private class Counters
+        {
+            public long AcqExcl;
+            public long AcqShrd;
+            public long AcqShrdStriped;
+            public long Spins;
+            public long AcqExclSlp;
+            public long AcqShrdSlp;
+            public long WaitTicks;
+            public int PeakExclWtrsCount;
+            public int PeakShrdWtrsCount;
+        }
+
+        // The number of times to spin before going to sleep.
+        private static readonly int SpinCount = NativeMethods.SpinCount;
+
+        private long _value;
+        private IntPtr _sharedWakeEvent;
+        private IntPtr _exclusiveWakeEvent;
+
+        private readonly int[] _slots;
+        private readonly int _slotMask;
+        private int _slotsBlocked;
+
+        private readonly Counters _counters;
+
+        /// <summary>
+        /// Creates a ScalableResourceLock without reader striping.
+        /// </summary>
+        public ScalableResourceLock()
+            : this(false, false)
+        { }
+
+        /// <summary>
+        /// Creates a ScalableResourceLock.
+        /// </summary>
+        /// <param name="striped">
+        /// Whether shared acquires should use per-thread reader slots.
+        /// This is useful for locks which are almost always acquired
+        /// in shared mode by many threads.
+        /// </param>
+        /// <param name="enableStatistics">Whether to collect contention statistics.</param>
+        public ScalableResourceLock(bool striped, bool enableStatistics)
+        {
+            if (striped)
+            {
+                int slotCount = 1;
+
+                while (slotCount < Environment.ProcessorCount * 2)
+                    slotCount *= 2;
+
+                _slots = new int[slotCount * SlotStride];
+                _slotMask = slotCount - 1;
+            }
+
+            if (enableStatistics)
+                _counters = new Counters();
+        }
+
+        ~ScalableResourceLock()
+        {
+            this.Dispose(false);
+        }
+
+        private void Dispose(bool disposing)
+        {
+            if (_sharedWakeEvent != IntPtr.Zero)
+            {
+                NativeMethods.CloseHandle(_sharedWakeEvent);
+                _sharedWakeEvent = IntPtr.Zero;
+            }
+
+            if (_exclusiveWakeEvent != IntPtr.Zero)
+            {
+                NativeMethods.CloseHandle(_exclusiveWakeEvent);
+                _exclusiveWakeEvent = IntPtr.Zero;
+            }
+        }
+
+        /// <summary>
+        /// Disposes resources associated with the ScalableResourceLock.
+        /// </summary>
+        public void Dispose()
+        {
+            this.Dispose(true);
+            GC.SuppressFinalize(this);
+        }
+
+        /// <summary>
+        /// Gets the number of exclusive waiters.
+        /// </summary>
+        public int ExclusiveWaiters
+        {
+            get { return (int)((Interlocked.Read(ref _value) >> LockExclusiveWaitersShift) & LockExclusiveWaitersMask); }
+        }
+
+        /// <summary>
+        /// Gets whether the lock is owned in either
+        /// exclusive or shared mode.
+        /// </summary>
+        public bool Owned
+        {
+            get { return (Interlocked.Read(ref _value) & LockOwned) != 0 || this.StripedOwners != 0; }
+        }
+
+        /// <summary>
+        /// Gets the number of shared owners.
+        /// </summary>
+        public int SharedOwners
+        {
+            get { return (int)((Interlocked.Read(ref _value) >> LockSharedOwnersShift) & LockSharedOwnersMask) + this.StripedOwners; }
+        }
+
+        /// <summary>
+        /// Gets the number of shared waiters.
+        /// </summary>
+        public int SharedWaiters
+        {
+            get { return (int)((Interlocked.Read(ref _value) >> LockSharedWaitersShift) & LockSharedWaitersMask); }
+        }
+
+        /// <summary>
+        /// Gets whether shared acquires use per-thread reader slots.
+        /// </summary>
+        public bool Striped
+        {
+            get { return _slots != null; }
+        }
+
+        private int StripedOwners
+        {
+            get
+            {
+                if (_slots == null)
+                    return 0;
+
+                int count = 0;
+
+                for (int i = 0; i < _slots.Length; i += SlotStride)
+                    count += Thread.VolatileRead(ref _slots[i]);
+
+                return count;
+            }
+        }
+
+        private int GetSlotIndex()
+        {
+            return (Thread.CurrentThread.ManagedThreadId & _slotMask) * SlotStride;
+        }
+
+        /// <summary>
+        /// Acquires the lock in exclusive mode, blocking
+        /// if necessary.
+        /// </summary>
+        /// <remarks>
+        /// Exclusive acquires are given precedence over shared
+        /// acquires.
+        /// </remarks>
+        public void AcquireExclusive()
+        {
+            if (_counters != null)
+                Interlocked.Increment(ref _counters.AcqExcl);
+
+            if (_slots != null)
+            {
+                // Send new readers to the lock value.
+                Interlocked.Increment(ref _slotsBlocked);
+                this.AcquireExclusiveValue();
+                this.WaitForStripedReaders();
+            }
+            else
+            {
+                this.AcquireExclusiveValue();
+            }
+        }
+
+        private void AcquireExclusiveValue()
+        {
+            long value;
+            int i = 0;
+
+            while (true)
+            {
+                value = _value;
+
+                // Case 1: lock not owned AND an exclusive waiter is not waking up.
+                if ((value & (LockOwned | LockExclusiveWaking)) == 0)
+                {
+#if RIGOROUS_CHECKS
+                    System.Diagnostics.Trace.Assert(((value >> LockSharedOwnersShift) & LockSharedOwnersMask) == 0);
+
+#endif
+                    if (Interlocked.CompareExchange(
+                        ref _value,
+                        value + LockOwned,
+                        value
+                        ) == value)
+                        break;
+                }
+                // Case 2: lock owned OR lock not owned and an exclusive waiter is waking up.
+                else if (i >= SpinCount)
+                {
+                    // This call must go *before* the next operation. Otherwise,
+                    // we will have a race condition between potential releasers
+                    // and us.
+                    this.EnsureEventCreated(ref _exclusiveWakeEvent);
+
+                    if (Interlocked.CompareExchange(
+                        ref _value,
+                        value + LockExclusiveWaitersIncrement,
+                        value
+                        ) == value)
+                    {
+                        long startTime = 0;
+
+                        if (_counters != null)
+                        {
+                            Interlocked.Increment(ref _counters.AcqExclSlp);
+                            UpdatePeak(ref _counters.PeakExclWtrsCount,
+                                (int)((value >> LockExclusiveWaitersShift) & LockExclusiveWaitersMask) + 1);
+                            startTime = Stopwatch.GetTimestamp();
+                        }
+
+                        // Go to sleep.
+                        if (NativeMethods.WaitForSingleObject(
+                            _exclusiveWakeEvent,
+                            Timeout.Infinite
+                            ) != NativeMethods.WaitObject0)
+                            Utils.Break(Utils.MsgFailedToWaitIndefinitely);
+
+                        if (_counters != null)
+                            Interlocked.Add(ref _counters.WaitTicks, Stopwatch.GetTimestamp() - startTime);
+
+                        // Acquire the lock.
+                        // At this point *no one* should be able to steal the lock from us.
+                        do
+                        {
+                            value = _value;
+#if RIGOROUS_CHECKS
+
+                            System.Diagnostics.Trace.Assert((value & LockOwned) == 0);
+                            System.Diagnostics.Trace.Assert((value & LockExclusiveWaking) != 0);
+#endif
+                        } while (Interlocked.CompareExchange(
+                            ref _value,
+                            value + LockOwned - LockExclusiveWaking,
+                            value
+                            ) != value);
+
+                        break;
+                    }
+                }
+
+                if (_counters != null)
+                    Interlocked.Increment(ref _counters.Spins);
+
+                i++;
+            }
+        }
+
+        private void WaitForStripedReaders()
+        {
+            int i = 0;
+            long startTime = 0;
+
+            for (int slot = 0; slot < _slots.Length; slot += SlotStride)
+            {
+                while (Thread.VolatileRead(ref _slots[slot]) != 0)
+                {
+                    if (_counters != null)
+                    {
+                        if (i == 0)
+                            startTime = Stopwatch.GetTimestamp();
+
+                        Interlocked.Increment(ref _counters.Spins);
+                    }
+
+                    // Readers hold the lock for a short time, so spin and
+                    // then yield instead of waiting on an event.
+                    if (i < SpinCount)
+                        Thread.SpinWait(8);
+                    else if (i < SpinCount + 10)
+                        Thread.Sleep(0);
+                    else
+                        Thread.Sleep(1);
+
+                    i++;
+                }
+            }
+
+            if (_counters != null && i != 0)
+                Interlocked.Add(ref _counters.WaitTicks, Stopwatch.GetTimestamp() - startTime);
+        }
+
+        /// <summary>
+        /// Acquires the lock in shared mode, blocking
+        /// if necessary.
+        /// </summary>
+        /// <remarks>
+        /// Exclusive acquires are given precedence over shared
+        /// acquires.
+        /// </remarks>
+        public void AcquireShared()
+        {
+            if (_counters != null)
+                Interlocked.Increment(ref _counters.AcqShrd);
+
+            if (_slots != null && this.TryAcquireStriped())
+            {
+                if (_counters != null)
+                    Interlocked.Increment(ref _counters.AcqShrdStriped);
+
+                return;
+            }
+
+            this.AcquireSharedValue();
+        }
+
+        private bool TryAcquireStriped()
+        {
+            int slot;
+
+            if (Thread.VolatileRead(ref _slotsBlocked) != 0)
+                return false;
+
+            slot = this.GetSlotIndex();
+            Interlocked.Increment(ref _slots[slot]);
+
+            if (Thread.VolatileRead(ref _slotsBlocked) == 0)
+                return true;
+
+            // A writer has arrived. Back out, unless another owner
+            // with the same slot has already taken our count, in
+            // which case we are counted in the lock value.
+            return !this.TryReleaseStriped(slot);
+        }
+
+        private bool TryReleaseStriped(int slot)
+        {
+            int count;
+
+            while ((count = Thread.VolatileRead(ref _slots[slot])) != 0)
+            {
+                if (Interlocked.CompareExchange(ref _slots[slot], count - 1, count) == count)
+                    return true;
+            }
+
+            return false;
+        }
+
+        private void AcquireSharedValue()
+        {
+            long value;
+            int i = 0;
+
+            while (true)
+            {
+                value = _value;
+
+                // Case 1: lock not owned AND no exclusive waiter is waking up AND
+                // there are no shared owners AND there are no exclusive waiters
+                if ((value & (
+                    LockOwned |
+                    (LockSharedOwnersMask << LockSharedOwnersShift) |
+                    ExclusiveMask
+                    )) == 0)
+                {
+                    if (Interlocked.CompareExchange(
+                        ref _value,
+                        value + LockOwned + LockSharedOwnersIncrement,
+                        value
+                        ) == value)
+                        break;
+                }
+                // Case 2: lock is owned AND no exclusive waiter is waking up AND
+                // there are shared owners AND there are no exclusive waiters
+                else if (
+                    (value & LockOwned) != 0 &&
+                    ((value >> LockSharedOwnersShift) & LockSharedOwnersMask) != 0 &&
+                    (value & ExclusiveMask) == 0
+                    )
+                {
+                    if (Interlocked.CompareExchange(
+                        ref _value,
+                        value + LockSharedOwnersIncrement,
+                        value
+                        ) == value)
+                        break;
+                }
+                // Other cases.
+                else if (i >= SpinCount)
+                {
+                    this.EnsureEventCreated(ref _sharedWakeEvent);
+
+                    if (Interlocked.CompareExchange(
+                        ref _value,
+                        value + LockSharedWaitersIncrement,
+                        value
+                        ) == value)
+                    {
+                        long startTime = 0;
+
+                        if (_counters != null)
+                        {
+                            Interlocked.Increment(ref _counters.AcqShrdSlp);
+                            UpdatePeak(ref _counters.PeakShrdWtrsCount,
+                                (int)((value >> LockSharedWaitersShift) & LockSharedWaitersMask) + 1);
+                            startTime = Stopwatch.GetTimestamp();
+                        }
+
+                        // Go to sleep.
+                        if (NativeMethods.WaitForSingleObject(
+                            _sharedWakeEvent,
+                            Timeout.Infinite
+                            ) != NativeMethods.WaitObject0)
+                            Utils.Break(Utils.MsgFailedToWaitIndefinitely);
+
+                        if (_counters != null)
+                            Interlocked.Add(ref _counters.WaitTicks, Stopwatch.GetTimestamp() - startTime);
+
+                        // Go back and try again.
+                        continue;
+                    }
+                }
+
+                if (_counters != null)
+                    Interlocked.Increment(ref _counters.Spins);
+
+                i++;
+            }
+        }
+
+        /// <summary>
+        /// Converts the ownership mode from exclusive to shared.
+        /// </summary>
+        /// <remarks>
+        /// Exclusive acquires are not given a chance to acquire
+        /// the lock before this function does - as a result,
+        /// this function will never block.
+        /// </remarks>
+        public void ConvertExclusiveToShared()
+        {
+            long value;
+            long sharedWaiters;
+
+            while (true)
+            {
+                value = _value;
+#if RIGOROUS_CHECKS
+
+                System.Diagnostics.Trace.Assert((value & LockOwned) != 0);
+                System.Diagnostics.Trace.Assert((value & LockExclusiveWaking) == 0);
+                System.Diagnostics.Trace.Assert(((value >> LockSharedOwnersShift) & LockSharedOwnersMask) == 0);
+#endif
+
+                sharedWaiters = (value >> LockSharedWaitersShift) & LockSharedWaitersMask;
+
+                if (Interlocked.CompareExchange(
+                    ref _value,
+                    (value + LockSharedOwnersIncrement) & ~(LockSharedWaitersMask << LockSharedWaitersShift),
+                    value
+                    ) == value)
+                {
+                    if (sharedWaiters != 0)
+                        NativeMethods.ReleaseSemaphore(_sharedWakeEvent, (int)sharedWaiters, IntPtr.Zero);
+
+                    break;
+                }
+            }
+
+            // We are now counted in the lock value, so readers can
+            // use their slots again.
+            if (_slots != null)
+                Interlocked.Decrement(ref _slotsBlocked);
+        }
+
+        /// <summary>
+        /// Checks if the specified event has been created, and
+        /// if not, creates it.
+        /// </summary>
+        /// <param name="handle">A reference to the event handle.</param>
+        private void EnsureEventCreated(ref IntPtr handle)
+        {
+            if (Thread.VolatileRead(ref handle) != IntPtr.Zero)
+                return;
+
+            IntPtr eventHandle = NativeMethods.CreateSemaphore(IntPtr.Zero, 0, int.MaxValue, null);
+
+            if (Interlocked.CompareExchange(ref handle, eventHandle, IntPtr.Zero) != IntPtr.Zero)
+                NativeMethods.CloseHandle(eventHandle);
+        }
+
+        private static void UpdatePeak(ref int peak, int count)
+        {
+            Interlocked2.Set(
+                ref peak,
+                p => p < count,
+                p => count
+                );
+        }
+
+        /// <summary>
+        /// Gets statistics information for the lock.
+        /// </summary>
+        /// <returns>
+        /// A structure containing statistics. All fields are zero if
+        /// statistics were not enabled when the lock was created.
+        /// </returns>
+        public Statistics GetStatistics()
+        {
+            if (_counters == null)
+                return new Statistics();
+
+            return new Statistics
+            {
+                AcqExcl = Interlocked.Read(ref _counters.AcqExcl),
+                AcqShrd = Interlocked.Read(ref _counters.AcqShrd),
+                AcqShrdStriped = Interlocked.Read(ref _counters.AcqShrdStriped),
+                Spins = Interlocked.Read(ref _counters.Spins),
+                AcqExclSlp = Interlocked.Read(ref _counters.AcqExclSlp),
+                AcqShrdSlp = Interlocked.Read(ref _counters.AcqShrdSlp),
+                WaitTicks = Interlocked.Read(ref _counters.WaitTicks),
+                PeakExclWtrsCount = _counters.PeakExclWtrsCount,
+                PeakShrdWtrsCount = _counters.PeakShrdWtrsCount
+            };
+        }
+
+        /// <summary>
+        /// Releases the lock in exclusive mode.
+        /// </summary>
+        public void ReleaseExclusive()
+        {
+            this.ReleaseExclusiveValue();
+
+            if (_slots != null)
+                Interlocked.Decrement(ref _slotsBlocked);
+        }
+
+        private void ReleaseExclusiveValue()
+        {
+            long value;
+
+            while (true)
+            {
+                value = _value;
+#if RIGOROUS_CHECKS
+
+                System.Diagnostics.Trace.Assert((value & LockOwned) != 0);
+                System.Diagnostics.Trace.Assert((value & LockExclusiveWaking) == 0);
+                System.Diagnostics.Trace.Assert(((value >> LockSharedOwnersShift) & LockSharedOwnersMask) == 0);
+#endif
+
+                // Case 1: if we have exclusive waiters, release one.
+                if (((value >> LockExclusiveWaitersShift) & LockExclusiveWaitersMask) != 0)
+                {
+                    if (Interlocked.CompareExchange(
+                        ref _value,
+                        value - LockOwned + LockExclusiveWaking - LockExclusiveWaitersIncrement,
+                        value
+                        ) == value)
+                    {
+                        NativeMethods.ReleaseSemaphore(_exclusiveWakeEvent, 1, IntPtr.Zero);
+
+                        break;
+                    }
+                }
+                // Case 2: if we have shared waiters, release all of them.
+                else
+                {
+                    long sharedWaiters = (value >> LockSharedWaitersShift) & LockSharedWaitersMask;
+
+                    if (Interlocked.CompareExchange(
+                        ref _value,
+                        value & ~(LockOwned | (LockSharedWaitersMask << LockSharedWaitersShift)),
+                        value
+                        ) == value)
+                    {
+                        if (sharedWaiters != 0)
+                            NativeMethods.ReleaseSemaphore(_sharedWakeEvent, (int)sharedWaiters, IntPtr.Zero);
+
+                        break;
+                    }
+                }
+            }
+        }
+
+        /// <summary>
+        /// Releases the lock in shared mode.
+        /// </summary>
+        public void ReleaseShared()
+        {
+            if (_slots != null && this.TryReleaseStriped(this.GetSlotIndex()))
+                return;
+
+            this.ReleaseSharedValue();
+        }
+
+        private void ReleaseSharedValue()
+        {
+            long value;
+            long sharedOwners;
+
+            while (true)
+            {
+                value = _value;
+#if RIGOROUS_CHECKS
+
+                System.Diagnostics.Trace.Assert((value & LockOwned) != 0);
+                System.Diagnostics.Trace.Assert((value & LockExclusiveWaking) == 0);
+                System.Diagnostics.Trace.Assert(((value >> LockSharedOwnersShift) & LockSharedOwnersMask) != 0);
+#endif
+
+                sharedOwners = (value >> LockSharedOwnersShift) & LockSharedOwnersMask;
+
+                // Case 1: there are multiple shared owners.
+                if (sharedOwners > 1)
+                {
+                    if (Interlocked.CompareExchange(
+                        ref _value,
+                        value - LockSharedOwnersIncrement,
+                        value
+                        ) == value)
+                        break;
+                }
+                // Case 2: we are the last shared owner AND there are exclusive waiters.
+                else if (((value >> LockExclusiveWaitersShift) & LockExclusiveWaitersMask) != 0)
+                {
+                    if (Interlocked.CompareExchange(
+                        ref _value,
+                        value - LockOwned + LockExclusiveWaking - LockSharedOwnersIncrement - LockExclusiveWaitersIncrement,
+                        value
+                        ) == value)
+                    {
+                        NativeMethods.ReleaseSemaphore(_exclusiveWakeEvent, 1, IntPtr.Zero);
+
+                        break;
+                    }
+                }
+                // Case 3: we are the last shared owner AND there are no exclusive waiters.
+                else
+                {
+                    if (Interlocked.CompareExchange(
+                        ref _value,
+                        value - LockOwned - LockSharedOwnersIncrement,
+                        value
+                        ) == value)
+                        break;
+                }
+            }
+        }
+
+        /// <summary>
+        /// Attempts to acquire the lock in exclusive mode.
+        /// </summary>
+        /// <returns>Whether the lock was acquired.</returns>
+        public bool TryAcquireExclusive()
+        {
+            long value;
+
+            if (_slots != null)
+            {
+                if (this.StripedOwners != 0)
+                    return false;
+
+                Interlocked.Increment(ref _slotsBlocked);
+            }
+
+            value = _value;
+
+            if ((value & (LockOwned | LockExclusiveWaking)) == 0 &&
+                Interlocked.CompareExchange(
+                ref _value,
+                value + LockOwned,
+                value
+                ) == value)
+            {
+                if (_slots == null)
+                    return true;
+
+                // A reader may have taken a slot before it saw us.
+                if (this.StripedOwners == 0)
+                    return true;
+
+                this.ReleaseExclusiveValue();
+            }
+
+            if (_slots != null)
+                Interlocked.Decrement(ref _slotsBlocked);
+
+            return false;
+        }
+
+        /// <summary>
+        /// Attempts to acquire the lock in shared mode.
+        /// </summary>
+        /// <returns>Whether the lock was acquired.</returns>
+        public bool TryAcquireShared()
+        {
+            long value;
+
+            if (_slots != null && this.TryAcquireStriped())
+                return true;
+
+            value = _value;
+
+            if ((value & ExclusiveMask) != 0)
+                return false;
+
+            if ((value & LockOwned) == 0)
+            {
+                return Interlocked.CompareExchange(
+                    ref _value,
+                    value + LockOwned + LockSharedOwnersIncrement,
+                    value
+                    ) == value;
+            }
+
+            if (((value >> LockSharedOwnersShift) & LockSharedOwnersMask) != 0)
+            {
+                return Interlocked.CompareExchange(
+                    ref _value,
+                    value + LockSharedOwnersIncrement,
+                    value
+                    ) == value;
+            }
+
+            return false;
+        }
+    }
+}
@@ -287,8 +287,10 @@ namespace ProcessHacker.Native
                         try
                         {
                             // Use NProcessHacker.
-                            using (MemoryAlloc oniMem = new MemoryAlloc(0x4000))
+                            using (MemoryAllocScope scope = new MemoryAllocScope())
                             {
+                                MemoryRegion oniMem = scope.Allocate(0x4000);
+
                                 NProcessHacker.PhQueryNameFileObject(
                                     objectHandle, 
                                     oniMem, 
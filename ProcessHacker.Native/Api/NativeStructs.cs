@@ -661,6 +661,13 @@ namespace ProcessHacker.Native.Api
     [StructLayout(LayoutKind.Sequential)]
     public struct FileInternalInformation
     {
+        public static readonly int SizeOf;
+
+        static FileInternalInformation()
+        {
+            SizeOf = Marshal.SizeOf(typeof(FileInternalInformation));
+        }
+
         public long IndexNumber;
     }
 
@@ -916,6 +923,19 @@ namespace ProcessHacker.Native.Api
         public int Size;
     }
 
+    [StructLayout(LayoutKind.Sequential)]
+    public struct ImageDebugDirectory
+    {
+        public int Characteristics;
+        public int TimeDateStamp;
+        public short MajorVersion;
+        public short MinorVersion;
+        public int Type;
+        public int SizeOfData;
+        public int AddressOfRawData;
+        public int PointerToRawData;
+    }
+
     [StructLayout(LayoutKind.Sequential)]
     public struct ImageExportDirectory
     {
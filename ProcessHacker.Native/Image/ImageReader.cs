@@ -0,0 +1,767 @@
+﻿/*
+ * Process Hacker -
+ *   streaming image reader
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.IO;
+using System.Text;
+using ProcessHacker.Common.Objects;
+using ProcessHacker.Native.Api;
+
+namespace ProcessHacker.Native.Image
+{
+    /// <summary>
+    /// Reads information from an image file without mapping it.
+    /// </summary>
+    /// <remarks>
+    /// <para>
+    /// Only the headers and the directories which are requested are read,
+    /// so the size of the image does not matter. All reads are bounded by
+    /// the size of the file and by limits on the number of entries, so a
+    /// malformed image can never cause an access violation or make the
+    /// reader run for a long time.
+    /// </para>
+    /// <para>
+    /// Names are only decoded when they are requested. This class is not
+    /// thread-safe.
+    /// </para>
+    /// </remarks>
+    public unsafe sealed class ImageReader : BaseObject
+    {
+        /// <summary>
+        /// The maximum number of DLLs which will be read from the import directory.
+        /// </summary>
+        public const int MaxImportDlls = 4096;
+        /// <summary>
+        /// The maximum number of functions which will be read for each imported DLL.
+        /// </summary>
+        public const int MaxImportFunctions = 65536;
+        /// <summary>
+        /// The maximum number of functions which will be read from the import 
+        /// directory in total, across all imported DLLs.
+        /// </summary>
+        public const int MaxImportThunks = 262144;
+        /// <summary>
+        /// The maximum length of a name.
+        /// </summary>
+        public const int MaxNameLength = 1024;
+
+        private const int Pe32DataDirectoryOffset = 96;
+        private const int Pe32PlusDataDirectoryOffset = 112;
+        private const int MaxSections = 96;
+        private const int MaxDebugEntries = 64;
+        private const int PageSize = 0x1000;
+
+        private readonly Stream _stream;
+        private readonly bool _ownsStream;
+        private readonly long _length;
+
+        private readonly byte[] _page = new byte[PageSize];
+        private long _pageOffset = -1;
+        private int _pageLength;
+
+        private ImageFileHeader _fileHeader;
+        private short _magic;
+        private int _numberOfDataEntries;
+        private long _dataDirectoryOffset;
+        private ImageSectionHeader[] _sections;
+
+        private ImageReaderImports _imports;
+        private ImageReaderExports _exports;
+        private int _remainingImportThunks = MaxImportThunks;
+
+        /// <summary>
+        /// Opens an image file.
+        /// </summary>
+        /// <param name="fileName">The name of the image file.</param>
+        public ImageReader(string fileName)
+            : this(new FileStream(fileName, FileMode.Open, System.IO.FileAccess.Read, FileShare.ReadWrite | FileShare.Delete, 1), true)
+        { }
+
+        /// <summary>
+        /// Reads an image from a stream.
+        /// </summary>
+        /// <param name="stream">A seekable stream containing the image.</param>
+        /// <param name="ownsStream">Whether to close the stream when the reader is disposed.</param>
+        public ImageReader(Stream stream, bool ownsStream)
+        {
+            _stream = stream;
+            _ownsStream = ownsStream;
+
+            try
+            {
+                _length = stream.Length;
+                this.LoadHeaders();
+            }
+            catch
+            {
+                if (ownsStream)
+                    stream.Dispose();
+
+                throw;
+            }
+        }
+
+        protected override void DisposeObject(bool disposing)
+        {
+            if (_ownsStream)
+                _stream.Dispose();
+        }
+
+        public ImageReaderExports Exports
+        {
+            get
+            {
+                if (_exports == null)
+                    _exports = new ImageReaderExports(this);
+
+                return _exports;
+            }
+        }
+
+        public ImageFileHeader FileHeader
+        {
+            get { return _fileHeader; }
+        }
+
+        public ImageReaderImports Imports
+        {
+            get
+            {
+                if (_imports == null)
+                    _imports = new ImageReaderImports(this);
+
+                return _imports;
+            }
+        }
+
+        public long Length
+        {
+            get { return _length; }
+        }
+
+        /// <summary>
+        /// Gets or sets the number of import thunks which may still be read.
+        /// </summary>
+        internal int RemainingImportThunks
+        {
+            get { return _remainingImportThunks; }
+            set { _remainingImportThunks = value; }
+        }
+
+        public short Magic
+        {
+            get { return _magic; }
+        }
+
+        public int NumberOfDataEntries
+        {
+            get { return _numberOfDataEntries; }
+        }
+
+        public int NumberOfSections
+        {
+            get { return _sections.Length; }
+        }
+
+        public ImageDataDirectory GetDataEntry(ImageDataEntry entry)
+        {
+            ImageDataDirectory dataDirectory;
+
+            if ((int)entry < 0 || (int)entry >= _numberOfDataEntries)
+                return new ImageDataDirectory();
+
+            if (!this.TryRead(
+                _dataDirectoryOffset + (int)entry * sizeof(ImageDataDirectory),
+                &dataDirectory,
+                sizeof(ImageDataDirectory)
+                ))
+                return new ImageDataDirectory();
+
+            return dataDirectory;
+        }
+
+        /// <summary>
+        /// Reads the debug directory.
+        /// </summary>
+        /// <returns>The debug directory entries.</returns>
+        public ImageDebugDirectory[] GetDebugDirectory()
+        {
+            ImageDataDirectory dataEntry = this.GetDataEntry(ImageDataEntry.Debug);
+            long offset = this.RvaToOffset(dataEntry.VirtualAddress);
+
+            if (offset == -1)
+                return new ImageDebugDirectory[0];
+
+            int count = Math.Min(dataEntry.Size / sizeof(ImageDebugDirectory), MaxDebugEntries);
+            ImageDebugDirectory[] entries = new ImageDebugDirectory[Math.Max(count, 0)];
+
+            for (int i = 0; i < entries.Length; i++)
+            {
+                ImageDebugDirectory entry;
+
+                if (!this.TryRead(offset + i * sizeof(ImageDebugDirectory), &entry, sizeof(ImageDebugDirectory)))
+                {
+                    Array.Resize(ref entries, i);
+                    break;
+                }
+
+                entries[i] = entry;
+            }
+
+            return entries;
+        }
+
+        /// <summary>
+        /// Reads the load configuration directory of a PE32 image.
+        /// </summary>
+        /// <param name="loadConfig">The load configuration. Fields not present in the image are zero.</param>
+        /// <returns>Whether the image has a load configuration directory.</returns>
+        public bool GetLoadConfig(out ImageLoadConfigDirectory loadConfig)
+        {
+            loadConfig = new ImageLoadConfigDirectory();
+
+            if (_magic != Win32.Pe32Magic)
+                return false;
+
+            fixed (ImageLoadConfigDirectory* ptr = &loadConfig)
+                return this.ReadLoadConfig(ptr, sizeof(ImageLoadConfigDirectory));
+        }
+
+        /// <summary>
+        /// Reads the load configuration directory of a PE32+ image.
+        /// </summary>
+        /// <param name="loadConfig">The load configuration. Fields not present in the image are zero.</param>
+        /// <returns>Whether the image has a load configuration directory.</returns>
+        public bool GetLoadConfig64(out ImageLoadConfigDirectory64 loadConfig)
+        {
+            loadConfig = new ImageLoadConfigDirectory64();
+
+            if (_magic != Win32.Pe32PlusMagic)
+                return false;
+
+            fixed (ImageLoadConfigDirectory64* ptr = &loadConfig)
+                return this.ReadLoadConfig(ptr, sizeof(ImageLoadConfigDirectory64));
+        }
+
+        public ImageSectionHeader GetSection(int index)
+        {
+            return _sections[index];
+        }
+
+        public string GetSectionName(int index)
+        {
+            ImageSectionHeader section = _sections[index];
+
+            return new string((sbyte*)section.Name, 0, 8).TrimEnd('\0');
+        }
+
+        private void LoadHeaders()
+        {
+            short dosMagic;
+            int ntHeadersOffset;
+            int signature;
+
+            if (!this.TryRead(0, &dosMagic, 2) || dosMagic != 0x5a4d) // MZ
+                throw new Exception("The file is not a valid executable image.");
+            if (!this.TryRead(0x3c, &ntHeadersOffset, 4) || ntHeadersOffset <= 0 || ntHeadersOffset >= 0x10000000)
+                throw new Exception("Invalid NT headers offset.");
+            if (!this.TryRead(ntHeadersOffset, &signature, 4) || signature != 0x4550) // PE\0\0
+                throw new Exception("The file is not a valid executable image.");
+
+            long fileHeaderOffset = ntHeadersOffset + 4;
+            long optionalHeaderOffset = fileHeaderOffset + sizeof(ImageFileHeader);
+            ImageFileHeader fileHeader;
+            short magic;
+            int numberOfDataEntries;
+
+            if (!this.TryRead(fileHeaderOffset, &fileHeader, sizeof(ImageFileHeader)))
+                throw new Exception("The file is not a valid executable image.");
+            if (!this.TryRead(optionalHeaderOffset, &magic, 2))
+                throw new Exception("The file is not a valid executable image.");
+
+            if (magic == Win32.Pe32Magic)
+                _dataDirectoryOffset = optionalHeaderOffset + Pe32DataDirectoryOffset;
+            else if (magic == Win32.Pe32PlusMagic)
+                _dataDirectoryOffset = optionalHeaderOffset + Pe32PlusDataDirectoryOffset;
+            else
+                throw new Exception("The file is not a PE32 or PE32+ image.");
+
+            if (!this.TryRead(_dataDirectoryOffset - 4, &numberOfDataEntries, 4))
+                throw new Exception("The file is not a valid executable image.");
+
+            _fileHeader = fileHeader;
+            _magic = magic;
+            _numberOfDataEntries = Math.Max(0, Math.Min(numberOfDataEntries, 16));
+
+            int numberOfSections = Math.Max(0, Math.Min((int)fileHeader.NumberOfSections, MaxSections));
+            long sectionsOffset = optionalHeaderOffset + (ushort)fileHeader.SizeOfOptionalHeader;
+
+            _sections = new ImageSectionHeader[numberOfSections];
+
+            for (int i = 0; i < numberOfSections; i++)
+            {
+                ImageSectionHeader section;
+
+                if (!this.TryRead(sectionsOffset + i * sizeof(ImageSectionHeader), &section, sizeof(ImageSectionHeader)))
+                {
+                    Array.Resize(ref _sections, i);
+                    break;
+                }
+
+                _sections[i] = section;
+            }
+        }
+
+        private bool ReadLoadConfig(void* buffer, int size)
+        {
+            ImageDataDirectory dataEntry = this.GetDataEntry(ImageDataEntry.LoadConfig);
+            long offset = this.RvaToOffset(dataEntry.VirtualAddress);
+            int directorySize;
+
+            if (offset == -1 || !this.TryRead(offset, &directorySize, 4))
+                return false;
+
+            // Older images have smaller load configuration directories.
+            size = Math.Min(size, directorySize);
+
+            if (size < 4)
+                return false;
+
+            return this.TryRead(offset, buffer, size);
+        }
+
+        /// <summary>
+        /// Reads a null-terminated ANSI string.
+        /// </summary>
+        /// <param name="offset">The file offset of the string.</param>
+        /// <returns>The string, or null if the offset is invalid.</returns>
+        internal string ReadAnsiString(long offset)
+        {
+            if (offset < 0 || offset >= _length)
+                return null;
+
+            StringBuilder sb = new StringBuilder();
+
+            for (int i = 0; i < MaxNameLength; i++)
+            {
+                byte b;
+
+                if (!this.TryRead(offset + i, &b, 1) || b == 0)
+                    break;
+
+                sb.Append((char)b);
+            }
+
+            return sb.ToString();
+        }
+
+        internal bool TryReadInt16(long offset, out short value)
+        {
+            short v;
+            bool result = this.TryRead(offset, &v, 2);
+
+            value = v;
+
+            return result;
+        }
+
+        internal bool TryReadInt32(long offset, out int value)
+        {
+            int v;
+            bool result = this.TryRead(offset, &v, 4);
+
+            value = v;
+
+            return result;
+        }
+
+        internal bool TryReadInt64(long offset, out long value)
+        {
+            long v;
+            bool result = this.TryRead(offset, &v, 8);
+
+            value = v;
+
+            return result;
+        }
+
+        /// <summary>
+        /// Reads data from the image.
+        /// </summary>
+        /// <param name="offset">The file offset of the data.</param>
+        /// <param name="buffer">The buffer which will receive the data.</param>
+        /// <param name="length">The number of bytes to read.</param>
+        /// <returns>False if the data lies outside the file, otherwise true.</returns>
+        internal bool TryRead(long offset, void* buffer, int length)
+        {
+            byte* dest = (byte*)buffer;
+
+            if (offset < 0 || length < 0 || offset + length > _length)
+                return false;
+
+            while (length > 0)
+            {
+                long pageOffset = offset & ~((long)PageSize - 1);
+
+                if (pageOffset != _pageOffset)
+                {
+                    int read = 0;
+                    int toRead = (int)Math.Min(PageSize, _length - pageOffset);
+
+                    _pageOffset = -1;
+                    _stream.Position = pageOffset;
+
+                    while (read < toRead)
+                    {
+                        int r = _stream.Read(_page, read, toRead - read);
+
+                        if (r == 0)
+                            break;
+
+                        read += r;
+                    }
+
+                    _pageOffset = pageOffset;
+                    _pageLength = read;
+                }
+
+                int pageIndex = (int)(offset - pageOffset);
+                int available = Math.Min(_pageLength - pageIndex, length);
+
+                if (available <= 0)
+                    return false;
+
+                System.Runtime.InteropServices.Marshal.Copy(_page, pageIndex, (IntPtr)dest, available);
+
+                dest += available;
+                offset += available;
+                length -= available;
+            }
+
+            return true;
+        }
+
+        /// <summary>
+        /// Converts a relative virtual address to a file offset.
+        /// </summary>
+        /// <param name="rva">The relative virtual address.</param>
+        /// <returns>The file offset, or -1 if the address is not backed by the file.</returns>
+        public long RvaToOffset(int rva)
+        {
+            if (rva == 0)
+                return -1;
+
+            for (int i = 0; i < _sections.Length; i++)
+            {
+                uint virtualAddress = (uint)_sections[i].VirtualAddress;
+                uint sizeOfRawData = (uint)_sections[i].SizeOfRawData;
+
+                if ((uint)rva >= virtualAddress && (uint)rva < (ulong)virtualAddress + sizeOfRawData)
+                {
+                    long offset = (long)(uint)_sections[i].PointerToRawData + ((uint)rva - virtualAddress);
+
+                    return offset < _length ? offset : -1;
+                }
+            }
+
+            return -1;
+        }
+    }
+
+    /// <summary>
+    /// The import directory of an image read by an <see cref="ImageReader"/>.
+    /// </summary>
+    public sealed class ImageReaderImports
+    {
+        private readonly ImageReader _reader;
+        private readonly ImageImportDescriptor[] _descriptors;
+        private readonly ImageReaderImportDll[] _dlls;
+
+        internal unsafe ImageReaderImports(ImageReader reader)
+        {
+            ImageDataDirectory dataEntry = reader.GetDataEntry(ImageDataEntry.Import);
+            long offset = reader.RvaToOffset(dataEntry.VirtualAddress);
+            int count = 0;
+
+            _reader = reader;
+            _descriptors = new ImageImportDescriptor[0];
+
+            if (offset != -1)
+            {
+                ImageImportDescriptor descriptor;
+
+                // Do a quick scan.
+                while (
+                    count < ImageReader.MaxImportDlls &&
+                    reader.TryRead(offset + count * sizeof(ImageImportDescriptor), &descriptor, sizeof(ImageImportDescriptor)) &&
+                    (descriptor.OriginalFirstThunk != 0 || descriptor.FirstThunk != 0)
+                    )
+                {
+                    if (count == _descriptors.Length)
+                        Array.Resize(ref _descriptors, Math.Max(16, count * 2));
+
+                    _descriptors[count++] = descriptor;
+                }
+            }
+
+            Array.Resize(ref _descriptors, count);
+            _dlls = new ImageReaderImportDll[count];
+        }
+
+        public ImageReaderImportDll this[int index]
+        {
+            get { return this.GetDll(index); }
+        }
+
+        public int Count
+        {
+            get { return _dlls.Length; }
+        }
+
+        public ImageReaderImportDll GetDll(int index)
+        {
+            if (index < 0 || index >= _dlls.Length)
+                return null;
+
+            if (_dlls[index] == null)
+                _dlls[index] = new ImageReaderImportDll(_reader, _descriptors[index]);
+
+            return _dlls[index];
+        }
+    }
+
+    /// <summary>
+    /// A DLL imported by an image read by an <see cref="ImageReader"/>.
+    /// </summary>
+    public sealed class ImageReaderImportDll
+    {
+        private readonly ImageReader _reader;
+        private readonly ImageImportDescriptor _descriptor;
+        private readonly long _lookupTable;
+        private readonly int _entrySize;
+        private readonly int _count;
+        private string _name;
+
+        internal ImageReaderImportDll(ImageReader reader, ImageImportDescriptor descriptor)
+        {
+            _reader = reader;
+            _descriptor = descriptor;
+            _entrySize = reader.Magic == Win32.Pe32PlusMagic ? 8 : 4;
+
+            if (_descriptor.OriginalFirstThunk != 0)
+                _lookupTable = reader.RvaToOffset(_descriptor.OriginalFirstThunk);
+            else
+                _lookupTable = reader.RvaToOffset(_descriptor.FirstThunk);
+
+            // Do a quick scan. The number of thunks is limited across all 
+            // DLLs as well, since many descriptors can share a lookup table.
+            if (_lookupTable != -1)
+            {
+                int limit = Math.Min(ImageReader.MaxImportFunctions, reader.RemainingImportThunks);
+                int i = 0;
+
+                while (i < limit && this.ReadThunk(i) != 0)
+                    i++;
+
+                _count = i;
+                reader.RemainingImportThunks -= i;
+            }
+        }
+
+        public ImageImportEntry this[int index]
+        {
+            get { return this.GetEntry(index); }
+        }
+
+        public int Count
+        {
+            get { return _count; }
+        }
+
+        public string Name
+        {
+            get
+            {
+                if (_name == null)
+                    _name = _reader.ReadAnsiString(_reader.RvaToOffset(_descriptor.Name)) ?? string.Empty;
+
+                return _name;
+            }
+        }
+
+        public ImageImportEntry GetEntry(int index)
+        {
+            if (index < 0 || index >= _count)
+                return ImageImportEntry.Empty;
+
+            long entry = this.ReadThunk(index);
+
+            // Is this entry using an ordinal?
+            if (
+                (_entrySize == 4 && (entry & 0x80000000) != 0) ||
+                (_entrySize == 8 && ((ulong)entry & 0x8000000000000000) != 0)
+                )
+            {
+                return new ImageImportEntry
+                {
+                    Ordinal = (short)(entry & 0xffff)
+                };
+            }
+
+            long nameOffset = _reader.RvaToOffset((int)(entry & 0x7fffffff));
+            short hint;
+
+            if (nameOffset == -1 || !_reader.TryReadInt16(nameOffset, out hint))
+                return ImageImportEntry.Empty;
+
+            return new ImageImportEntry
+            {
+                NameHint = hint,
+                Name = _reader.ReadAnsiString(nameOffset + 2)
+            };
+        }
+
+        private long ReadThunk(int index)
+        {
+            long offset = _lookupTable + (long)index * _entrySize;
+
+            if (_entrySize == 8)
+            {
+                long value;
+
+                return _reader.TryReadInt64(offset, out value) ? value : 0;
+            }
+            else
+            {
+                int value;
+
+                return _reader.TryReadInt32(offset, out value) ? (uint)value : 0;
+            }
+        }
+    }
+
+    /// <summary>
+    /// The export directory of an image read by an <see cref="ImageReader"/>.
+    /// </summary>
+    public sealed class ImageReaderExports
+    {
+        private readonly ImageReader _reader;
+        private readonly ImageDataDirectory _dataDirectory;
+        private readonly ImageExportDirectory _exportDirectory;
+        private readonly bool _present;
+        private readonly long _addressTable;
+        private readonly long _namePointerTable;
+        private readonly long _ordinalTable;
+
+        internal unsafe ImageReaderExports(ImageReader reader)
+        {
+            ImageExportDirectory exportDirectory;
+
+            _reader = reader;
+            _dataDirectory = reader.GetDataEntry(ImageDataEntry.Export);
+
+            long offset = reader.RvaToOffset(_dataDirectory.VirtualAddress);
+
+            if (offset != -1 && reader.TryRead(offset, &exportDirectory, sizeof(ImageExportDirectory)))
+            {
+                _exportDirectory = exportDirectory;
+                _present = true;
+                _addressTable = reader.RvaToOffset(exportDirectory.AddressOfFunctions);
+                _namePointerTable = reader.RvaToOffset(exportDirectory.AddressOfNames);
+                _ordinalTable = reader.RvaToOffset(exportDirectory.AddressOfNameOrdinals);
+            }
+        }
+
+        public int Count
+        {
+            get { return _present ? Math.Max(0, _exportDirectory.NumberOfFunctions) : 0; }
+        }
+
+        public int NumberOfNames
+        {
+            get { return _present ? Math.Max(0, _exportDirectory.NumberOfNames) : 0; }
+        }
+
+        public ImageExportEntry GetEntry(int index)
+        {
+            if (!_present || _namePointerTable == -1 || _ordinalTable == -1)
+                return ImageExportEntry.Empty;
+            if (index < 0 || index >= this.NumberOfNames)
+                return ImageExportEntry.Empty;
+
+            short ordinal;
+
+            if (!_reader.TryReadInt16(_ordinalTable + (long)index * 2, out ordinal))
+                return ImageExportEntry.Empty;
+
+            return new ImageExportEntry
+            {
+                Ordinal = (short)(ordinal + _exportDirectory.Base),
+                Name = this.GetName(index)
+            };
+        }
+
+        /// <summary>
+        /// Gets the name of an exported function.
+        /// </summary>
+        /// <param name="index">The index into the name pointer table.</param>
+        public string GetName(int index)
+        {
+            int rva;
+
+            if (!_present || _namePointerTable == -1 || index < 0 || index >= this.NumberOfNames)
+                return null;
+            if (!_reader.TryReadInt32(_namePointerTable + (long)index * 4, out rva))
+                return null;
+
+            return _reader.ReadAnsiString(_reader.RvaToOffset(rva));
+        }
+
+        /// <summary>
+        /// Gets the forwarder string for an exported function.
+        /// </summary>
+        /// <param name="ordinal">The ordinal of the function.</param>
+        /// <returns>The forwarded name, or null if the function is not forwarded.</returns>
+        public string GetForwardedName(short ordinal)
+        {
+            int rva;
+
+            if (!_present || _addressTable == -1)
+                return null;
+            if (ordinal - _exportDirectory.Base < 0 || ordinal - _exportDirectory.Base >= this.Count)
+                return null;
+            if (!_reader.TryReadInt32(_addressTable + (long)(ordinal - _exportDirectory.Base) * 4, out rva))
+                return null;
+
+            if (
+                rva >= _dataDirectory.VirtualAddress &&
+                rva < _dataDirectory.VirtualAddress + _dataDirectory.Size
+                )
+            {
+                // This is a forwarder RVA.
+                return _reader.ReadAnsiString(_reader.RvaToOffset(rva));
+            }
+
+            return null;
+        }
+    }
+}
@@ -123,8 +123,12 @@ namespace ProcessHacker.Native.Ipc
 
         public T Read<T>() where T : struct
         {
-            using (MemoryAlloc data = this.Read())
+            using (MemoryAllocScope scope = new MemoryAllocScope())
             {
+                MemoryRegion data = scope.Allocate(_header->BlockSize);
+
+                this.Read(data);
+
                 return data.ReadStruct<T>();
             }
         }
@@ -177,8 +181,10 @@ namespace ProcessHacker.Native.Ipc
 
         public void Write<T>(int size, T s) where T : struct
         {
-            using (MemoryAlloc data = new MemoryAlloc(size))
+            using (MemoryAllocScope scope = new MemoryAllocScope())
             {
+                MemoryRegion data = scope.Allocate(size);
+
                 data.WriteStruct(s);
                 this.Write(data);
             }
@@ -38,7 +38,8 @@ namespace ProcessHacker.Native
         private static int _freedCount;
         private static int _reallocatedCount;
 
-        // A private heap just for the client.
+        // A private heap just for the client. Small blocks are cached 
+        // by MemoryPool.
         private static Heap _privateHeap = new Heap(HeapFlags.Class1 | HeapFlags.Growable);
         //private static Heap _processHeap = Heap.GetDefault();
 
@@ -62,6 +63,10 @@ namespace ProcessHacker.Native
             get { return _reallocatedCount; }
         }
 
+        // The size class of the block in MemoryPool, or -1 if the block 
+        // was allocated directly from the heap.
+        private int _sizeClass = -1;
+
         /// <summary>
         /// Creates a new, invalid memory allocation. 
         /// You must set the pointer using the Memory property.
@@ -96,7 +101,7 @@ namespace ProcessHacker.Native
         /// <param name="flags">Any flags to use.</param>
         public MemoryAlloc(int size, HeapFlags flags)
         {
-            this.Memory = _privateHeap.Allocate(size);
+            this.Memory = MemoryPool.Allocate(size, out _sizeClass);
             this.Size = size;
 
 #if ENABLE_STATISTICS
@@ -108,7 +113,7 @@ namespace ProcessHacker.Native
 
         protected override void Free()
         {
-            _privateHeap.Free(this);
+            MemoryPool.Free(this, _sizeClass);
 
 #if ENABLE_STATISTICS
             System.Threading.Interlocked.Increment(ref _freedCount);
@@ -126,7 +131,22 @@ namespace ProcessHacker.Native
             if (newSize > 0)
                 GC.RemoveMemoryPressure(this.Size);
 
-            this.Memory = _privateHeap.Reallocate(this.Memory, newSize);
+            if (_sizeClass == -1)
+            {
+                this.Memory = _privateHeap.Reallocate(this.Memory, newSize);
+            }
+            else if (newSize > MemoryPool.GetSizeClassSize(_sizeClass))
+            {
+                int newSizeClass;
+                IntPtr newMemory = MemoryPool.Allocate(newSize, out newSizeClass);
+
+                Win32.RtlMoveMemory(newMemory, this.Memory, this.Size.ToIntPtr());
+                MemoryPool.Free(this.Memory, _sizeClass);
+
+                this.Memory = newMemory;
+                _sizeClass = newSizeClass;
+            }
+
             this.Size = newSize;
 
 #if ENABLE_STATISTICS
@@ -146,9 +166,9 @@ namespace ProcessHacker.Native
             if (newSize > 0)
                 GC.RemoveMemoryPressure(this.Size);
 
-            _privateHeap.Free(this.Memory);
+            MemoryPool.Free(this.Memory, _sizeClass);
 
-            this.Memory = _privateHeap.Allocate(newSize);
+            this.Memory = MemoryPool.Allocate(newSize, out _sizeClass);
             this.Size = newSize;
 
             if (this.Size > 0)
@@ -0,0 +1,105 @@
+﻿/*
+ * Process Hacker -
+ *   scoped pooled memory allocations
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.Collections.Generic;
+
+namespace ProcessHacker.Native
+{
+    /// <summary>
+    /// Allocates temporary buffers from the memory pool and frees them
+    /// all when the scope is disposed.
+    /// </summary>
+    /// <remarks>
+    /// The buffers returned by a scope are not finalizable and must not
+    /// be used after the scope is disposed. This class is not thread-safe.
+    /// </remarks>
+    /// <example>
+    /// using (MemoryAllocScope scope = new MemoryAllocScope())
+    /// {
+    ///     MemoryRegion data = scope.Allocate(0x100);
+    ///     ...
+    /// }
+    /// </example>
+    public sealed class MemoryAllocScope : IDisposable
+    {
+        private struct ScopeBlock
+        {
+            public IntPtr Memory;
+            public int SizeClass;
+        }
+
+        private List<ScopeBlock> _blocks;
+        private ScopeBlock _firstBlock;
+        private bool _haveFirstBlock;
+        private bool _disposed;
+
+        public void Dispose()
+        {
+            if (_disposed)
+                return;
+
+            _disposed = true;
+
+            if (_haveFirstBlock)
+                MemoryPool.Free(_firstBlock.Memory, _firstBlock.SizeClass);
+
+            if (_blocks != null)
+            {
+                for (int i = 0; i < _blocks.Count; i++)
+                    MemoryPool.Free(_blocks[i].Memory, _blocks[i].SizeClass);
+
+                _blocks = null;
+            }
+        }
+
+        /// <summary>
+        /// Allocates a buffer which is freed when the scope is disposed.
+        /// </summary>
+        /// <param name="size">The size of the buffer, in bytes.</param>
+        public MemoryRegion Allocate(int size)
+        {
+            if (_disposed)
+                throw new ObjectDisposedException("MemoryAllocScope");
+
+            ScopeBlock block;
+
+            block.Memory = MemoryPool.Allocate(size, out block.SizeClass);
+
+            // Most scopes only allocate one buffer.
+            if (!_haveFirstBlock)
+            {
+                _firstBlock = block;
+                _haveFirstBlock = true;
+            }
+            else
+            {
+                if (_blocks == null)
+                    _blocks = new List<ScopeBlock>();
+
+                _blocks.Add(block);
+            }
+
+            return new MemoryRegion(block.Memory, 0, size);
+        }
+    }
+}
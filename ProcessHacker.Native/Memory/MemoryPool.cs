@@ -0,0 +1,377 @@
+﻿/*
+ * Process Hacker -
+ *   size-class pooled native memory allocator
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.Threading;
+
+namespace ProcessHacker.Native
+{
+    /// <summary>
+    /// Contains counters describing the state of the memory pool.
+    /// </summary>
+    public struct MemoryPoolStatistics
+    {
+        /// <summary>
+        /// The number of blocks allocated from the pool.
+        /// </summary>
+        public long Allocations;
+        /// <summary>
+        /// The number of allocations satisfied by a thread cache.
+        /// </summary>
+        public long ThreadCacheHits;
+        /// <summary>
+        /// The number of allocations satisfied by the shared depot.
+        /// </summary>
+        public long DepotHits;
+        /// <summary>
+        /// The number of allocations which had to go to the heap,
+        /// including allocations which were too large to be pooled.
+        /// </summary>
+        public long HeapAllocations;
+        /// <summary>
+        /// The number of blocks returned to the heap.
+        /// </summary>
+        public long HeapFrees;
+        /// <summary>
+        /// The number of bytes held in the shared depot.
+        /// </summary>
+        public long DepotBytes;
+    }
+
+    /// <summary>
+    /// Allocates native memory from the private heap, caching freed
+    /// blocks by size class so that they can be reused without taking
+    /// the heap lock.
+    /// </summary>
+    /// <remarks>
+    /// <para>
+    /// Requests are rounded up to a power of two between 32 bytes and
+    /// 64 kB. Each thread keeps a small cache of blocks for each size
+    /// class. When a thread cache is full, half of it is moved to a
+    /// shared depot, and an empty thread cache is refilled from the
+    /// depot before going to the heap. Larger requests are always
+    /// allocated from the heap.
+    /// </para>
+    /// <para>
+    /// The amount of memory cached is bounded per thread and in the
+    /// depot. When a thread exits, its cache is finalized and the blocks
+    /// in it are moved to the depot or returned to the heap.
+    /// </para>
+    /// </remarks>
+    public static class MemoryPool
+    {
+        private const int MinimumShift = 5;
+        private const int MaximumShift = 16;
+        private const int SizeClassCount = MaximumShift - MinimumShift + 1;
+        private const int ThreadCacheBytes = 0x20000;
+        private const int DepotBytesPerClass = 0x80000;
+
+        /// <summary>
+        /// The largest request which is pooled.
+        /// </summary>
+        public const int MaximumPooledSize = 1 << MaximumShift;
+
+        private class ThreadCache
+        {
+            public IntPtr[][] Blocks = new IntPtr[SizeClassCount][];
+            public int[] Counts = new int[SizeClassCount];
+
+            public ThreadCache()
+            {
+                for (int i = 0; i < SizeClassCount; i++)
+                    this.Blocks[i] = new IntPtr[GetThreadCacheCapacity(i)];
+            }
+
+            ~ThreadCache()
+            {
+                // The thread which owned the cache has exited. There is 
+                // nothing to reclaim if the process is exiting as well.
+                if (Environment.HasShutdownStarted)
+                    return;
+
+                for (int i = 0; i < SizeClassCount; i++)
+                {
+                    if (this.Counts[i] != 0)
+                        FlushThreadCache(this, i, this.Counts[i]);
+                }
+            }
+        }
+
+        private class Depot
+        {
+            public IntPtr[] Blocks;
+            public int Count;
+        }
+
+        [ThreadStatic]
+        private static ThreadCache _threadCache;
+        private static readonly Depot[] _depots;
+
+        private static long _allocations;
+        private static long _threadCacheHits;
+        private static long _depotHits;
+        private static long _heapAllocations;
+        private static long _heapFrees;
+        private static long _depotBytes;
+
+        static MemoryPool()
+        {
+            _depots = new Depot[SizeClassCount];
+
+            for (int i = 0; i < SizeClassCount; i++)
+                _depots[i] = new Depot { Blocks = new IntPtr[Math.Min(1024, DepotBytesPerClass >> (MinimumShift + i))] };
+        }
+
+        private static Heap Heap
+        {
+            get { return MemoryAlloc.PrivateHeap; }
+        }
+
+        private static int GetThreadCacheCapacity(int sizeClass)
+        {
+            return Math.Max(2, Math.Min(32, ThreadCacheBytes >> (MinimumShift + sizeClass)));
+        }
+
+        /// <summary>
+        /// Gets the size class for a request.
+        /// </summary>
+        /// <param name="size">The size of the request, in bytes.</param>
+        /// <returns>The size class, or -1 if the request is too large to be pooled.</returns>
+        public static int GetSizeClass(int size)
+        {
+            if (size > MaximumPooledSize)
+                return -1;
+
+            int sizeClass = 0;
+
+            size = (size - 1) >> MinimumShift;
+
+            while (size > 0)
+            {
+                sizeClass++;
+                size >>= 1;
+            }
+
+            return sizeClass;
+        }
+
+        /// <summary>
+        /// Gets the number of bytes available in blocks of a size class.
+        /// </summary>
+        public static int GetSizeClassSize(int sizeClass)
+        {
+            return 1 << (MinimumShift + sizeClass);
+        }
+
+        /// <summary>
+        /// Allocates a block.
+        /// </summary>
+        /// <param name="size">The number of bytes to allocate.</param>
+        /// <param name="sizeClass">
+        /// Receives the size class of the block, which must be passed to
+        /// <see cref="Free"/>. This is -1 if the block was allocated
+        /// directly from the heap.
+        /// </param>
+        public static IntPtr Allocate(int size, out int sizeClass)
+        {
+            Interlocked.Increment(ref _allocations);
+
+            sizeClass = GetSizeClass(size);
+
+            if (sizeClass == -1)
+            {
+                Interlocked.Increment(ref _heapAllocations);
+                return Heap.Allocate(size);
+            }
+
+            ThreadCache cache = _threadCache ?? (_threadCache = new ThreadCache());
+            int count = cache.Counts[sizeClass];
+
+            if (count == 0)
+            {
+                count = RefillThreadCache(cache, sizeClass);
+
+                if (count == 0)
+                {
+                    Interlocked.Increment(ref _heapAllocations);
+                    return Heap.Allocate(GetSizeClassSize(sizeClass));
+                }
+
+                Interlocked.Increment(ref _depotHits);
+            }
+            else
+            {
+                Interlocked.Increment(ref _threadCacheHits);
+            }
+
+            count--;
+            cache.Counts[sizeClass] = count;
+
+            IntPtr block = cache.Blocks[sizeClass][count];
+
+            cache.Blocks[sizeClass][count] = IntPtr.Zero;
+
+            return block;
+        }
+
+        /// <summary>
+        /// Frees a block.
+        /// </summary>
+        /// <param name="block">The block to free.</param>
+        /// <param name="sizeClass">The size class returned when the block was allocated.</param>
+        public static void Free(IntPtr block, int sizeClass)
+        {
+            if (sizeClass == -1)
+            {
+                Interlocked.Increment(ref _heapFrees);
+                Heap.Free(block);
+                return;
+            }
+
+            ThreadCache cache = _threadCache ?? (_threadCache = new ThreadCache());
+            IntPtr[] blocks = cache.Blocks[sizeClass];
+
+            if (cache.Counts[sizeClass] == blocks.Length)
+                FlushThreadCache(cache, sizeClass, blocks.Length / 2);
+
+            blocks[cache.Counts[sizeClass]++] = block;
+        }
+
+        private static int RefillThreadCache(ThreadCache cache, int sizeClass)
+        {
+            Depot depot = _depots[sizeClass];
+            IntPtr[] blocks = cache.Blocks[sizeClass];
+            int count = 0;
+
+            lock (depot)
+            {
+                // Only take half so that blocks keep moving between threads.
+                int take = Math.Min(depot.Count, Math.Max(1, blocks.Length / 2));
+
+                for (int i = 0; i < take; i++)
+                {
+                    depot.Count--;
+                    blocks[count++] = depot.Blocks[depot.Count];
+                    depot.Blocks[depot.Count] = IntPtr.Zero;
+                }
+            }
+
+            Interlocked.Add(ref _depotBytes, -(long)count * GetSizeClassSize(sizeClass));
+            cache.Counts[sizeClass] = count;
+
+            return count;
+        }
+
+        private static void FlushThreadCache(ThreadCache cache, int sizeClass, int flushCount)
+        {
+            Depot depot = _depots[sizeClass];
+            IntPtr[] blocks = cache.Blocks[sizeClass];
+            int count = cache.Counts[sizeClass];
+            int moved = 0;
+
+            lock (depot)
+            {
+                while (moved < flushCount && depot.Count < depot.Blocks.Length)
+                {
+                    count--;
+                    depot.Blocks[depot.Count++] = blocks[count];
+                    blocks[count] = IntPtr.Zero;
+                    moved++;
+                }
+            }
+
+            Interlocked.Add(ref _depotBytes, (long)moved * GetSizeClassSize(sizeClass));
+
+            // The depot is full. Give the rest back to the heap.
+            while (moved < flushCount)
+            {
+                count--;
+                Interlocked.Increment(ref _heapFrees);
+                Heap.Free(blocks[count]);
+                blocks[count] = IntPtr.Zero;
+                moved++;
+            }
+
+            cache.Counts[sizeClass] = count;
+        }
+
+        /// <summary>
+        /// Returns all blocks cached by the current thread and the depot
+        /// to the heap.
+        /// </summary>
+        public static void Trim()
+        {
+            ThreadCache cache = _threadCache;
+
+            if (cache != null)
+            {
+                for (int i = 0; i < SizeClassCount; i++)
+                {
+                    IntPtr[] blocks = cache.Blocks[i];
+
+                    while (cache.Counts[i] > 0)
+                    {
+                        int count = --cache.Counts[i];
+
+                        Interlocked.Increment(ref _heapFrees);
+                        Heap.Free(blocks[count]);
+                        blocks[count] = IntPtr.Zero;
+                    }
+                }
+            }
+
+            for (int i = 0; i < SizeClassCount; i++)
+            {
+                Depot depot = _depots[i];
+                int freed = 0;
+
+                lock (depot)
+                {
+                    while (depot.Count > 0)
+                    {
+                        depot.Count--;
+                        Heap.Free(depot.Blocks[depot.Count]);
+                        depot.Blocks[depot.Count] = IntPtr.Zero;
+                        freed++;
+                    }
+                }
+
+                Interlocked.Add(ref _heapFrees, freed);
+                Interlocked.Add(ref _depotBytes, -(long)freed * GetSizeClassSize(i));
+            }
+        }
+
+        public static MemoryPoolStatistics GetStatistics()
+        {
+            MemoryPoolStatistics statistics = new MemoryPoolStatistics();
+
+            statistics.Allocations = Interlocked.Read(ref _allocations);
+            statistics.ThreadCacheHits = Interlocked.Read(ref _threadCacheHits);
+            statistics.DepotHits = Interlocked.Read(ref _depotHits);
+            statistics.HeapAllocations = Interlocked.Read(ref _heapAllocations);
+            statistics.HeapFrees = Interlocked.Read(ref _heapFrees);
+            statistics.DepotBytes = Interlocked.Read(ref _depotBytes);
+
+            return statistics;
+        }
+    }
+}
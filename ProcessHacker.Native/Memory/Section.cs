@@ -1,4 +1,5 @@
-﻿using ProcessHacker.Native.Api;
+﻿using System;
+using ProcessHacker.Native.Api;
 using ProcessHacker.Native.Objects;
 using ProcessHacker.Native.Security;
 
@@ -163,5 +164,23 @@ namespace ProcessHacker.Native
         {
             return this.Handle.MapView(offset, size, protection);
         }
+
+        /// <summary>
+        /// Creates a view of the section.
+        /// </summary>
+        /// <param name="offset">
+        /// The offset from the beginning of the section to map. This value 
+        /// must be a multiple of 0x10000 (65536).
+        /// </param>
+        /// <param name="size">
+        /// The number of bytes to map. This value will be rounded up to the 
+        /// page size.
+        /// </param>
+        /// <param name="protection">The page protection to apply to the mapping.</param>
+        /// <returns>A view of the section.</returns>
+        public SectionView MapView(long offset, int size, MemoryProtection protection)
+        {
+            return this.Handle.MapView(IntPtr.Zero, offset, new IntPtr(size), protection);
+        }
     }
 }
@@ -0,0 +1,105 @@
+﻿/*
+ * Process Hacker - 
+ *   CRC32 for MFS blocks
+ * 
+ * Copyright (C) 2011 wj32
+ * 
+ * This file is part of Process Hacker.
+ * 
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+namespace ProcessHacker.Native.Mfs
+{
+    /// <summary>
+    /// Computes the standard (IEEE 802.3) CRC32.
+    /// </summary>
+    /// <remarks>
+    /// This uses the slicing-by-8 method: eight 256-entry tables let 
+    /// each step process 8 bytes with independent lookups. Table k 
+    /// gives the CRC of a byte followed by k zero bytes. The data is 
+    /// read in little-endian order.
+    /// </remarks>
+    internal unsafe static class Crc32
+    {
+        private const uint Polynomial = 0xedb88320;
+
+        // Eight tables of 256 entries, one after another.
+        private static readonly uint[] _table;
+
+        static Crc32()
+        {
+            _table = new uint[8 * 256];
+
+            for (uint i = 0; i < 256; i++)
+            {
+                uint crc = i;
+
+                for (int j = 0; j < 8; j++)
+                    crc = (crc & 1) != 0 ? (crc >> 1) ^ Polynomial : crc >> 1;
+
+                _table[i] = crc;
+            }
+
+            for (int k = 1; k < 8; k++)
+            {
+                for (int i = 0; i < 256; i++)
+                {
+                    uint previous = _table[(k - 1) * 256 + i];
+
+                    _table[k * 256 + i] = (previous >> 8) ^ _table[previous & 0xff];
+                }
+            }
+        }
+
+        public static int Compute(byte* data, int length)
+        {
+            return (int)~Update(0xffffffff, data, length);
+        }
+
+        /// <summary>
+        /// Continues a CRC computation. Start with 0xffffffff and invert 
+        /// the final value.
+        /// </summary>
+        public static uint Update(uint crc, byte* data, int length)
+        {
+            fixed (uint* table = _table)
+            {
+                while (length >= 8)
+                {
+                    uint one = *(uint*)data ^ crc;
+                    uint two = *(uint*)(data + 4);
+
+                    crc =
+                        table[7 * 256 + (one & 0xff)] ^
+                        table[6 * 256 + ((one >> 8) & 0xff)] ^
+                        table[5 * 256 + ((one >> 16) & 0xff)] ^
+                        table[4 * 256 + (one >> 24)] ^
+                        table[3 * 256 + (two & 0xff)] ^
+                        table[2 * 256 + ((two >> 8) & 0xff)] ^
+                        table[1 * 256 + ((two >> 16) & 0xff)] ^
+                        table[two >> 24];
+
+                    data += 8;
+                    length -= 8;
+                }
+
+                for (int i = 0; i < length; i++)
+                    crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+            }
+
+            return crc;
+        }
+    }
+}
@@ -0,0 +1,68 @@
+﻿/*
+ * Process Hacker -
+ *   MFS storage interface
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+
+namespace ProcessHacker.Native.Mfs
+{
+    /// <summary>
+    /// Provides the mapped file which backs a memory file system.
+    /// </summary>
+    /// <remarks>
+    /// Views are always requested at offsets which are multiples of the
+    /// file system block size (at least 64 kB), so implementations do not
+    /// need to deal with allocation granularity.
+    /// </remarks>
+    public interface IMfsStorage : IDisposable
+    {
+        /// <summary>
+        /// Gets whether the storage was opened for read only access.
+        /// </summary>
+        bool ReadOnly { get; }
+
+        /// <summary>
+        /// Gets the current size of the storage, in bytes.
+        /// </summary>
+        long Size { get; }
+
+        /// <summary>
+        /// Makes the storage at least the specified size. Views which have
+        /// already been mapped remain valid.
+        /// </summary>
+        /// <param name="newSize">The new size, in bytes.</param>
+        void Extend(long newSize);
+
+        /// <summary>
+        /// Maps a part of the storage into memory.
+        /// </summary>
+        /// <param name="offset">The offset of the view.</param>
+        /// <param name="size">The size of the view.</param>
+        /// <returns>The base address of the view.</returns>
+        IntPtr MapView(long offset, int size);
+
+        /// <summary>
+        /// Unmaps a view created by <see cref="MapView"/>.
+        /// </summary>
+        /// <param name="view">The base address of the view.</param>
+        void UnmapView(IntPtr view);
+    }
+}
@@ -32,6 +32,21 @@ namespace ProcessHacker.Native.Mfs
     // The first cell of each block is the block header.
     //
     // Data can only be added to MFS, not removed.
+    //
+    // Version 1 ("MFS\0") cell IDs store a 16-bit block ID and a 16-bit 
+    // cell index. Version 2 ("MFS2") cell IDs store the global cell 
+    // number (block ID * cells per block + cell index), so block IDs 
+    // are only limited by the number of cells per block. Version 2 also 
+    // adds:
+    //
+    // * Extents: data which covers whole blocks is stored in a run of 
+    //   contiguous blocks without block headers, described by an extent 
+    //   cell in the object's data chain.
+    // * Child indexes: objects with many children have a hash table of 
+    //   children, chained through each child's HashLink.
+    // * Block hashes: the Hash field of each block header contains the 
+    //   CRC32 of the rest of the block. The hashes are only valid when 
+    //   MfsFsFlags.BlockHashesValid is set.
 
     [StructLayout(LayoutKind.Sequential, Pack = 4)]
     internal struct MfsCellId : IEquatable<MfsCellId>
@@ -50,16 +65,21 @@ namespace ProcessHacker.Native.Mfs
 
         public MfsCellId(ushort block, ushort cell)
         {
-            this.Block = block;
-            this.Cell = cell;
+            this.Value = (uint)block | ((uint)cell << 16);
+        }
+
+        public MfsCellId(uint value)
+        {
+            this.Value = value;
         }
 
-        public ushort Block;
-        public ushort Cell;
+        // The meaning of the value depends on the file system version. 
+        // Use MemoryFileSystem to get the block ID and cell index.
+        public uint Value;
 
         public bool Equals(MfsCellId other)
         {
-            return this.Block == other.Block && this.Cell == other.Cell;
+            return this.Value == other.Value;
         }
 
         public override bool Equals(object obj)
@@ -72,7 +92,7 @@ namespace ProcessHacker.Native.Mfs
 
         public override int GetHashCode()
         {
-            return ((Block << 16) | Cell).GetHashCode();
+            return this.Value.GetHashCode();
         }
     }
 
@@ -85,6 +105,17 @@ namespace ProcessHacker.Native.Mfs
         public MfsCellId RootObject;
         public int BlockSize;
         public int CellSize;
+
+        // Version 2 and above.
+        public MfsFsFlags Flags;
+        public int NextFreeBlock32;
+        public int CellBlock; // the block which cells are allocated from
+    }
+
+    [Flags]
+    internal enum MfsFsFlags : int
+    {
+        BlockHashesValid = 0x1
     }
 
     [StructLayout(LayoutKind.Sequential, Pack = 4)]
@@ -119,6 +150,12 @@ namespace ProcessHacker.Native.Mfs
 
         public int NameLength;
         public fixed char Name [32];
+
+        // Version 2 and above.
+        public int NameHash;
+        public MfsCellId HashLink;
+        public MfsCellId ChildIndex; // cell containing the bucket array
+        public int ChildIndexSize;
     }
 
     [StructLayout(LayoutKind.Sequential, Pack = 4)]
@@ -126,8 +163,21 @@ namespace ProcessHacker.Native.Mfs
     {
         public static readonly int DataOffset = Marshal.OffsetOf(typeof(MfsDataCell), "Data").ToInt32();
 
+        // Set in DataLength if the cell is an MfsExtentCell.
+        public const int ExtentFlag = unchecked((int)0x80000000);
+
         public MfsCellId NextCell;
         public int DataLength;
         public byte Data;
     }
+
+    [StructLayout(LayoutKind.Sequential, Pack = 4)]
+    internal struct MfsExtentCell
+    {
+        public MfsCellId NextCell;
+        public int DataLength; // includes MfsDataCell.ExtentFlag
+        public int StartBlock;
+        public int BlockCount;
+        public int Hash; // CRC32 of the data
+    }
 }
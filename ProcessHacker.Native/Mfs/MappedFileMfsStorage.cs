@@ -0,0 +1,164 @@
+﻿/*
+ * Process Hacker -
+ *   portable MFS storage
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.Collections.Generic;
+using System.IO;
+using System.IO.MemoryMappedFiles;
+
+namespace ProcessHacker.Native.Mfs
+{
+    /// <summary>
+    /// Stores a memory file system in a file using the framework's 
+    /// memory-mapped file support. This does not depend on any native 
+    /// Windows APIs and can be used on other platforms.
+    /// </summary>
+    public unsafe sealed class MappedFileMfsStorage : IMfsStorage
+    {
+        private readonly bool _readOnly;
+        private readonly MemoryMappedFileAccess _access;
+        private readonly FileStream _stream;
+        private MemoryMappedFile _file;
+        private long _size;
+        private readonly Dictionary<IntPtr, MemoryMappedViewAccessor> _views = new Dictionary<IntPtr, MemoryMappedViewAccessor>();
+
+        public MappedFileMfsStorage(string fileName, MfsOpenMode mode, bool readOnly)
+        {
+            FileMode fileMode;
+
+            switch (mode)
+            {
+                case MfsOpenMode.Open:
+                    fileMode = FileMode.Open;
+                    break;
+                default:
+                case MfsOpenMode.OpenIf:
+                    fileMode = FileMode.OpenOrCreate;
+                    break;
+                case MfsOpenMode.OverwriteIf:
+                    fileMode = FileMode.Create;
+                    break;
+            }
+
+            _readOnly = readOnly;
+            _access = !readOnly ? MemoryMappedFileAccess.ReadWrite : MemoryMappedFileAccess.Read;
+            _stream = new FileStream(
+                fileName,
+                fileMode,
+                !readOnly ? System.IO.FileAccess.ReadWrite : System.IO.FileAccess.Read,
+                FileShare.Read
+                );
+
+            try
+            {
+                if (_stream.Length == 0)
+                {
+                    if (readOnly)
+                        throw new MfsInvalidFileSystemException();
+
+                    // Empty files can't be mapped.
+                    _stream.SetLength(1);
+                }
+
+                _size = _stream.Length;
+                _file = this.CreateMapping();
+            }
+            catch
+            {
+                _stream.Dispose();
+                throw;
+            }
+        }
+
+        public void Dispose()
+        {
+            foreach (MemoryMappedViewAccessor view in _views.Values)
+            {
+                view.SafeMemoryMappedViewHandle.ReleasePointer();
+                view.Dispose();
+            }
+
+            _views.Clear();
+            _file.Dispose();
+            _stream.Dispose();
+        }
+
+        public bool ReadOnly
+        {
+            get { return _readOnly; }
+        }
+
+        public long Size
+        {
+            get { return _size; }
+        }
+
+        private MemoryMappedFile CreateMapping()
+        {
+            return MemoryMappedFile.CreateFromFile(
+                _stream,
+                null,
+                _size,
+                _access,
+                null,
+                HandleInheritability.None,
+                true
+                );
+        }
+
+        public void Extend(long newSize)
+        {
+            if (newSize <= _size)
+                return;
+
+            // A mapping can't be resized, so grow the file and create a new 
+            // mapping. Existing views keep the old mapping alive.
+            _stream.SetLength(newSize);
+            _size = newSize;
+            _file.Dispose();
+            _file = this.CreateMapping();
+        }
+
+        public IntPtr MapView(long offset, int size)
+        {
+            MemoryMappedViewAccessor view = _file.CreateViewAccessor(offset, size, _access);
+            byte* pointer = null;
+
+            view.SafeMemoryMappedViewHandle.AcquirePointer(ref pointer);
+
+            // Offsets are multiples of the block size, so the view begins 
+            // exactly at the pointer we got.
+            _views.Add(new IntPtr(pointer), view);
+
+            return new IntPtr(pointer);
+        }
+
+        public void UnmapView(IntPtr view)
+        {
+            MemoryMappedViewAccessor accessor = _views[view];
+
+            accessor.SafeMemoryMappedViewHandle.ReleasePointer();
+            accessor.Dispose();
+            _views.Remove(view);
+        }
+    }
+}
@@ -29,13 +29,30 @@ namespace ProcessHacker.Native.Mfs
     public class MemoryDataWriteStream : Stream
     {
         private readonly MemoryObject _obj;
-        private readonly byte[] _buffer;
+        private readonly int _maxBufferSize;
+        private byte[] _buffer;
         private int _bufferLength;
 
         internal MemoryDataWriteStream(MemoryObject obj, int bufferSize)
+            : this(obj, bufferSize, bufferSize)
+        { }
+
+        /// <summary>
+        /// Creates a write stream whose buffer starts small and grows 
+        /// as data is written.
+        /// </summary>
+        /// <param name="obj">The object to append data to.</param>
+        /// <param name="bufferSize">The initial size of the buffer.</param>
+        /// <param name="maxBufferSize">
+        /// The maximum size of the buffer. This should be the block size 
+        /// if the file system supports extents, so that full buffers are 
+        /// stored as extents instead of many small data cells.
+        /// </param>
+        internal MemoryDataWriteStream(MemoryObject obj, int bufferSize, int maxBufferSize)
         {
             _obj = obj;
-            _buffer = new byte[bufferSize];
+            _maxBufferSize = maxBufferSize;
+            _buffer = new byte[Math.Min(bufferSize, maxBufferSize)];
         }
 
         public override bool CanRead
@@ -99,40 +116,52 @@ namespace ProcessHacker.Native.Mfs
             throw new NotSupportedException();
         }
 
-        public override void Write(byte[] buffer, int offset, int count)
+        /// <summary>
+        /// Makes room in the buffer, either by growing it or by appending 
+        /// its contents to the object.
+        /// </summary>
+        private void MakeRoom()
         {
-            int availableBufferLength = _buffer.Length - _bufferLength;
+            if (_buffer.Length < _maxBufferSize)
+                Array.Resize(ref _buffer, Math.Min(_buffer.Length * 2, _maxBufferSize));
+            else
+                this.Flush();
+        }
 
+        public override void Write(byte[] buffer, int offset, int count)
+        {
             Utils.ValidateBuffer(buffer, offset, count);
 
-            if (availableBufferLength == 0)
+            while (count > 0)
             {
-                this.Flush();
-            }
-            else
-            {
-                if (count < availableBufferLength)
-                    availableBufferLength = count;
+                // Large writes don't need to be copied into the buffer.
+                if (_bufferLength == 0 && count >= _maxBufferSize)
+                {
+                    int directLength = count - count % _maxBufferSize;
 
-                Array.Copy(buffer, offset, _buffer, _bufferLength, availableBufferLength);
-                _bufferLength += availableBufferLength;
-                offset += availableBufferLength;
-                count -= availableBufferLength;
+                    _obj.AppendData(buffer, offset, directLength);
+                    offset += directLength;
+                    count -= directLength;
 
-                if (count > 0)
-                    this.Flush();
-            }
+                    continue;
+                }
 
-            if (count > 0)
-            {
-                _obj.AppendData(buffer, offset, count);
+                if (_bufferLength == _buffer.Length)
+                    this.MakeRoom();
+
+                int copyLength = Math.Min(count, _buffer.Length - _bufferLength);
+
+                Array.Copy(buffer, offset, _buffer, _bufferLength, copyLength);
+                _bufferLength += copyLength;
+                offset += copyLength;
+                count -= copyLength;
             }
         }
 
         public override void WriteByte(byte value)
         {
-            if (_bufferLength >= _buffer.Length)
-                this.Flush();
+            if (_bufferLength == _buffer.Length)
+                this.MakeRoom();
 
             _buffer[_bufferLength++] = value;
         }
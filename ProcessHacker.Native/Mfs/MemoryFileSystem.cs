@@ -21,6 +21,7 @@
  */
 
 using System;
+using System.Collections;
 using System.Collections.Generic;
 using System.Runtime.InteropServices;
 using ProcessHacker.Common;
@@ -35,17 +36,24 @@ namespace ProcessHacker.Native.Mfs
     {
         internal const int MfsMagic = 0x0053464d;
         internal const string MfsMagicString = "MFS\0";
+        internal const int MfsMagic2 = 0x3253464d;
+        internal const string MfsMagic2String = "MFS2";
 
         internal const int MfsBlockSizeBase = 0x10000;
 
         internal const int MfsDefaultBlockSize = 0x10000;
         internal const int MfsDefaultCellSize = 0x80;
 
+        // Objects get a child index once they have this many children.
+        internal const int MfsChildIndexThreshold = 16;
+        // The number of extent blocks mapped at a time.
+        internal const int MfsExtentWindowBlocks = 16;
+
         private class ViewDescriptor : IResettable
         {
             public ushort RefCount;
-            public ushort BlockId;
-            public SectionView View;
+            public int BlockId;
+            public IntPtr View;
 
             public void ResetObject()
             {
@@ -54,21 +62,30 @@ namespace ProcessHacker.Native.Mfs
         }
 
         private readonly bool _readOnly;
-        private readonly MemoryProtection _protection;
-        private readonly Section _section;
+        private readonly IMfsStorage _storage;
 
         private MfsFsHeader* _header;
+        private readonly int _version;
         private readonly int _blockSize;
         private readonly int _blockMask;
         private readonly int _cellSize;
         private readonly int _cellCount;
+        private readonly int _cellShift;
         private readonly int _dataCellDataMaxLength;
+        private readonly int _maxChildIndexSize;
 
-        private readonly MfsCellId _rootObjectCellId = new MfsCellId(0, 1);
+        private readonly MfsCellId _rootObjectCellId;
         private readonly MemoryObject _rootObjectMo;
 
+        // Blocks whose hashes have been checked (read only access).
+        private readonly bool _verifyHashes;
+        private BitArray _verifiedBlocks;
+        // Blocks whose hashes need to be updated when we close (write access).
+        private bool _maintainHashes;
+        private BitArray _dirtyBlocks;
+
         private readonly FreeList<ViewDescriptor> _vdFreeList = new FreeList<ViewDescriptor>(16);
-        private readonly Dictionary<ushort, ViewDescriptor> _views = new Dictionary<ushort, ViewDescriptor>();
+        private readonly Dictionary<int, ViewDescriptor> _views = new Dictionary<int, ViewDescriptor>();
         private readonly Dictionary<IntPtr, ViewDescriptor> _views2 = new Dictionary<IntPtr, ViewDescriptor>();
 
         private ViewDescriptor _cachedLastBlockView;
@@ -86,131 +103,167 @@ namespace ProcessHacker.Native.Mfs
         { }
 
         public MemoryFileSystem(string fileName, MfsOpenMode mode, bool readOnly, MfsParameters createParams)
-        {
-            FileCreationDispositionWin32 cdWin32;
+            : this(OpenStorage(fileName, mode, readOnly), createParams)
+        { }
 
-            if (readOnly && mode != MfsOpenMode.Open)
-                throw new ArgumentException("Invalid mode for read only access.");
+        /// <summary>
+        /// Opens or creates a memory file system in the specified storage. 
+        /// The file system takes ownership of the storage.
+        /// </summary>
+        /// <param name="storage">The storage to use.</param>
+        /// <param name="createParams">Parameters to use if a new file system is created.</param>
+        public MemoryFileSystem(IMfsStorage storage, MfsParameters createParams)
+        {
+            if (storage == null)
+                throw new ArgumentNullException("storage");
 
-            switch (mode)
-            {
-                case MfsOpenMode.Open:
-                    cdWin32 = FileCreationDispositionWin32.OpenExisting;
-                    break;
-                default:
-                case MfsOpenMode.OpenIf:
-                    cdWin32 = FileCreationDispositionWin32.OpenAlways;
-                    break;
-                case MfsOpenMode.OverwriteIf:
-                    cdWin32 = FileCreationDispositionWin32.CreateAlways;
-                    break;
-            }
+            bool justCreated = false;
 
-            using (FileHandle fhandle = FileHandle.CreateWin32(
-                fileName,
-                FileAccess.GenericRead | (!readOnly ? FileAccess.GenericWrite : 0),
-                FileShareMode.Read,
-                cdWin32
-                ))
-            {
-                bool justCreated = false;
+            _readOnly = storage.ReadOnly;
+            _storage = storage;
 
-                _readOnly = readOnly;
-                _protection = !readOnly ? MemoryProtection.ReadWrite : MemoryProtection.ReadOnly;
+            _blockSize = MfsBlockSizeBase; // fake block size to begin with; we'll fix it up later.
 
-                if (fhandle.FileSize == 0)
+            if (_storage.Size < _blockSize)
+            {
+                if (_readOnly)
                 {
-                    if (readOnly)
-                    {
-                        throw new MfsInvalidFileSystemException();
-                    }
-                    
-                    // File is too small. Make it 1 byte large and we'll deal with it soon.
-                    fhandle.SetEnd(1);
+                    throw new MfsInvalidFileSystemException();
                 }
+                
+                // We're creating a new file system. We need the correct block size now.
+                if (createParams != null)
+                    this._blockSize = createParams.BlockSize;
+                else
+                    this._blockSize = MfsDefaultBlockSize;
 
-                _section = new Section(fhandle, _protection);
+                this._storage.Extend(this._blockSize);
 
-                _blockSize = MfsBlockSizeBase; // fake block size to begin with; we'll fix it up later.
+                IntPtr view = this._storage.MapView(0, this._blockSize);
 
-                if (fhandle.FileSize < _blockSize)
+                try
                 {
-                    if (readOnly)
-                    {
-                        throw new MfsInvalidFileSystemException();
-                    }
-                    
-                    // We're creating a new file system. We need the correct block size now.
-                    if (createParams != null)
-                        this._blockSize = createParams.BlockSize;
-                    else
-                        this._blockSize = MfsDefaultBlockSize;
+                    this.InitializeFs((MfsFsHeader*)view, createParams);
+                }
+                finally
+                {
+                    this._storage.UnmapView(view);
+                }
 
-                    this._section.Extend(this._blockSize);
+                justCreated = true;
+            }
 
-                    using (SectionView view = this._section.MapView(0, this._blockSize, this._protection))
-                    {
-                        this.InitializeFs((MfsFsHeader*)view.Memory, createParams);
-                    }
+            _header = (MfsFsHeader*)this.ReferenceBlock(0);
 
-                    justCreated = true;
-                }
+            // Check the magic.
+            if (_header->Magic == MfsMagic)
+                _version = 1;
+            else if (_header->Magic == MfsMagic2)
+                _version = 2;
+            else
+                throw new MfsInvalidFileSystemException();
 
-                _header = (MfsFsHeader*)this.ReferenceBlock(0);
+            // Set up the local constants.
+            _blockSize = _header->BlockSize;
+            _cellSize = _header->CellSize;
 
-                // Check the magic.
-                if (_header->Magic != MfsMagic)
-                    throw new MfsInvalidFileSystemException();
+            // Backwards compatibility.
+            if (_blockSize == 0)
+                _blockSize = MfsDefaultBlockSize;
+            if (_cellSize == 0)
+                _cellSize = MfsDefaultCellSize;
 
-                // Set up the local constants.
-                _blockSize = _header->BlockSize;
-                _cellSize = _header->CellSize;
+            // Validate the parameters.
+            this.ValidateFsParameters(_blockSize, _cellSize);
 
-                // Backwards compatibility.
-                if (_blockSize == 0)
-                    _blockSize = MfsDefaultBlockSize;
-                if (_cellSize == 0)
-                    _cellSize = MfsDefaultCellSize;
+            _blockMask = _blockSize - 1;
+            _cellCount = _blockSize / _cellSize;
+            _dataCellDataMaxLength = _cellSize - MfsDataCell.DataOffset;
 
-                // Validate the parameters.
-                this.ValidateFsParameters(_blockSize, _cellSize);
+            while ((1 << _cellShift) < _cellCount)
+                _cellShift++;
+
+            // A child index must fit in the cells of a single block.
+            _maxChildIndexSize = 1;
 
-                _blockMask = _blockSize - 1;
-                _cellCount = _blockSize / _cellSize;
-                _dataCellDataMaxLength = _cellSize - MfsDataCell.DataOffset;
+            while (_maxChildIndexSize * 2 * sizeof(MfsCellId) <= (_cellCount - 1) * _cellSize)
+                _maxChildIndexSize *= 2;
 
-                // Remap block 0 with the correct block size.
-                this.DereferenceBlock(0);
+            _rootObjectCellId = this.MakeCellId(0, 1);
 
-                // If we just created a new file system, fix the section size.
-                if (justCreated)
-                    _section.Extend(_blockSize);
+            // Remap block 0 with the correct block size.
+            this.DereferenceBlock(0);
 
-                _header = (MfsFsHeader*)this.ReferenceBlock(0);
+            // If we just created a new file system, fix the storage size.
+            if (justCreated)
+                _storage.Extend(_blockSize);
 
-                // Set up the root object.
-                _rootObjectMo = new MemoryObject(this, _rootObjectCellId, true);
+            _header = (MfsFsHeader*)this.ReferenceBlock(0);
 
-                if (_header->NextFreeBlock != 1 && !readOnly)
+            if (_version >= 2)
+            {
+                bool hashesValid = (_header->Flags & MfsFsFlags.BlockHashesValid) != 0;
+
+                if (_readOnly)
                 {
-                    ushort lastBlockId = (ushort)(_header->NextFreeBlock - 1);
+                    _verifyHashes = hashesValid;
 
-                    this.ReferenceBlock(lastBlockId);
-                    _cachedLastBlockView = _views[lastBlockId];
+                    if (_verifyHashes)
+                        _verifiedBlocks = new BitArray(64);
+                }
+                else
+                {
+                    // If the file system wasn't closed properly some of the hashes 
+                    // may be stale, and we can't fix them because we don't know 
+                    // which blocks belong to extents. Stop maintaining hashes 
+                    // in that case.
+                    _maintainHashes = justCreated || hashesValid;
+                    _header->Flags &= ~MfsFsFlags.BlockHashesValid;
+
+                    if (_maintainHashes)
+                        _dirtyBlocks = new BitArray(64);
                 }
             }
+
+            // Set up the root object.
+            _rootObjectMo = new MemoryObject(this, _rootObjectCellId, true);
+
+            if (this.CellBlock != 0 && !_readOnly)
+            {
+                int lastBlockId = this.CellBlock;
+
+                this.ReferenceBlock(lastBlockId);
+                _cachedLastBlockView = _views[lastBlockId];
+            }
+        }
+
+        private static IMfsStorage OpenStorage(string fileName, MfsOpenMode mode, bool readOnly)
+        {
+            if (readOnly && mode != MfsOpenMode.Open)
+                throw new ArgumentException("Invalid mode for read only access.");
+
+            // Sections are faster and let other processes see our changes 
+            // immediately, but they aren't available outside Windows.
+            if (Environment.OSVersion.Platform == PlatformID.Win32NT)
+                return new SectionMfsStorage(fileName, mode, readOnly);
+            else
+                return new MappedFileMfsStorage(fileName, mode, readOnly);
         }
 
         protected override void DisposeObject(bool disposing)
         {
-            foreach (ViewDescriptor vd in _views.Values)
-                vd.View.Dispose(disposing);
+            if (disposing && _maintainHashes && _header != null)
+                this.UpdateBlockHashes();
 
             if (_rootObjectMo != null)
                 _rootObjectMo.Dispose();
 
-            if (_section != null)
-                _section.Dispose();
+            // The storage unmaps any views which are still referenced.
+            if (disposing && _storage != null)
+                _storage.Dispose();
+
+            _views.Clear();
+            _views2.Clear();
 
             _header = null;
         }
@@ -245,20 +298,79 @@ namespace ProcessHacker.Native.Mfs
             get { return _rootObjectMo; }
         }
 
+        /// <summary>
+        /// Gets the format version of the file system. Version 1 file 
+        /// systems do not support extents, child indexes or block hashes.
+        /// </summary>
+        public int Version
+        {
+            get { return _version; }
+        }
+
+        internal bool ExtentsSupported
+        {
+            get { return _version >= 2; }
+        }
+
+        private int CellBlock
+        {
+            get
+            {
+                if (_version >= 2)
+                    return _header->CellBlock;
+                else
+                    return _header->NextFreeBlock - 1;
+            }
+        }
+
+        private int NextFreeBlock
+        {
+            get
+            {
+                if (_version >= 2)
+                    return _header->NextFreeBlock32;
+                else
+                    return _header->NextFreeBlock;
+            }
+            set
+            {
+                if (_version >= 2)
+                {
+                    // The global cell number must fit in a cell ID.
+                    if (value > (1L << (32 - _cellShift)))
+                        throw new MfsException("The file system is full.");
+
+                    _header->NextFreeBlock32 = value;
+                }
+                else
+                {
+                    if (value > ushort.MaxValue)
+                        throw new MfsException("The file system is full.");
+
+                    _header->NextFreeBlock = (ushort)value;
+                }
+            }
+        }
+
         private IntPtr AllocateBlock()
         {
-            ushort blockId;
+            int blockId;
 
             return this.AllocateBlock(out blockId);
         }
 
-        private IntPtr AllocateBlock(out ushort blockId)
+        private IntPtr AllocateBlock(out int blockId)
         {
-            blockId = _header->NextFreeBlock++;
-            _section.Extend(_header->NextFreeBlock * _blockSize);
+            blockId = this.NextFreeBlock;
+            this.NextFreeBlock = blockId + 1;
+
+            if (_version >= 2)
+                _header->CellBlock = blockId;
+
+            _storage.Extend((long)this.NextFreeBlock * _blockSize);
 
-            SectionView view = _section.MapView(blockId * _blockSize, _blockSize, _protection);
-            MfsBlockHeader* header = (MfsBlockHeader*)view.Memory;
+            IntPtr view = _storage.MapView((long)blockId * _blockSize, _blockSize);
+            MfsBlockHeader* header = (MfsBlockHeader*)view;
 
             header->Hash = 0;
             header->NextFreeCell = 1;
@@ -270,7 +382,10 @@ namespace ProcessHacker.Native.Mfs
             vd.View = view;
 
             _views.Add(blockId, vd);
-            _views2.Add(view.Memory, vd);
+            _views2.Add(view, vd);
+
+            if (_maintainHashes)
+                SetBlockBit(ref _dirtyBlocks, blockId);
 
             return view;
         }
@@ -283,26 +398,37 @@ namespace ProcessHacker.Native.Mfs
         }
 
         private IntPtr AllocateCell(out MfsCellId cellIdOut)
+        {
+            return this.AllocateCells(1, out cellIdOut);
+        }
+
+        /// <summary>
+        /// Allocates a run of contiguous cells in the same block.
+        /// </summary>
+        private IntPtr AllocateCells(int count, out MfsCellId cellIdOut)
         {  
-            ushort blockId;
-            ushort cellId;
+            int blockId;
+            int cellId;
             IntPtr lastBlock;
             MfsBlockHeader* header;
 
-            if (_header->NextFreeBlock == 1)
+            if (count >= _cellCount)
+                throw new ArgumentException("count");
+
+            if (this.CellBlock == 0)
             {
                 // No blocks except for the FS header. Allocate one.
                 lastBlock = this.AllocateBlock(out blockId);
             }
             else
             {
-                blockId = (ushort)(_header->NextFreeBlock - 1);
+                blockId = this.CellBlock;
                 lastBlock = this.ReferenceBlock(blockId);
             }
 
             header = (MfsBlockHeader*)lastBlock;
 
-            if (header->NextFreeCell == _cellCount)
+            if (header->NextFreeCell + count > _cellCount)
             {
                 // Block full. Allocate a new one.
                 this.DereferenceBlock(lastBlock);
@@ -322,17 +448,80 @@ namespace ProcessHacker.Native.Mfs
                 _cachedLastBlockView = _views[blockId];
             }
 
-            cellId = header->NextFreeCell++;
-            cellIdOut = new MfsCellId(blockId, cellId);
+            cellId = header->NextFreeCell;
+            header->NextFreeCell += (ushort)count;
+            cellIdOut = this.MakeCellId(blockId, cellId);
 
             return lastBlock.Increment(cellId * _cellSize);
         }
 
+        /// <summary>
+        /// Creates an extent cell and copies data into a new run of blocks.
+        /// </summary>
+        /// <param name="prev">The previous data cell.</param>
+        /// <param name="buffer">The data to write.</param>
+        /// <param name="offset">The offset in the buffer.</param>
+        /// <param name="length">
+        /// The number of bytes to write. This must be a non-zero multiple of 
+        /// the block size.
+        /// </param>
+        internal MfsCellId CreateExtentCell(MfsCellId prev, byte[] buffer, int offset, int length)
+        {
+            MfsCellId cellId;
+            MfsExtentCell* ec;
+            int startBlock;
+            int blockCount;
+            uint crc = 0xffffffff;
+
+            if (_readOnly || _version < 2)
+                throw new MfsInvalidOperationException();
+
+            Utils.ValidateBuffer(buffer, offset, length);
+
+            if (length == 0 || (length & _blockMask) != 0)
+                throw new ArgumentException("length");
+
+            blockCount = length / _blockSize;
+            startBlock = this.NextFreeBlock;
+            this.NextFreeBlock = startBlock + blockCount;
+            _storage.Extend((long)this.NextFreeBlock * _blockSize);
+
+            // Copy the data a few blocks at a time so we don't need a huge view.
+            for (int i = 0; i < blockCount; i += MfsExtentWindowBlocks)
+            {
+                int windowLength = Math.Min(blockCount - i, MfsExtentWindowBlocks) * _blockSize;
+                IntPtr view = _storage.MapView((long)(startBlock + i) * _blockSize, windowLength);
+
+                try
+                {
+                    Marshal.Copy(buffer, offset, view, windowLength);
+                    crc = Crc32.Update(crc, (byte*)view, windowLength);
+                }
+                finally
+                {
+                    _storage.UnmapView(view);
+                }
+
+                offset += windowLength;
+            }
+
+            ec = (MfsExtentCell*)this.AllocateCell(out cellId);
+            ec->NextCell = MfsCellId.Empty;
+            ec->DataLength = length | MfsDataCell.ExtentFlag;
+            ec->StartBlock = startBlock;
+            ec->BlockCount = blockCount;
+            ec->Hash = (int)~crc;
+
+            this.LinkDataCell(prev, cellId);
+            this.DereferenceCell(cellId);
+
+            return cellId;
+        }
+
         internal MfsCellId CreateDataCell(MfsCellId prev, byte[] buffer, int offset, int length)
         {
             MfsCellId cellId;
             MfsDataCell* dc;
-            MfsDataCell* prevDc;
 
             if (_readOnly)
                 throw new MfsInvalidOperationException();
@@ -346,12 +535,7 @@ namespace ProcessHacker.Native.Mfs
             dc->NextCell = MfsCellId.Empty;
             dc->DataLength = length;
 
-            if (prev != MfsCellId.Empty)
-            {
-                prevDc = (MfsDataCell*)this.ReferenceCell(prev);
-                prevDc->NextCell = cellId;
-                this.DereferenceCell(prev);
-            }
+            this.LinkDataCell(prev, cellId);
 
             Marshal.Copy(buffer, offset, new IntPtr(&dc->Data), length);
 
@@ -395,6 +579,12 @@ namespace ProcessHacker.Native.Mfs
             else
                 blinkObj->Flink = cellId;
 
+            if (_version >= 2)
+            {
+                obj->NameHash = HashName(name);
+                this.AddToChildIndex(parent, parentObj, cellId, obj);
+            }
+
             this.DereferenceObject(blink);
             this.DereferenceObject(parent);
             this.DereferenceObject(cellId);
@@ -407,7 +597,82 @@ namespace ProcessHacker.Native.Mfs
             this.DereferenceBlock(_views2[view].BlockId);
         }
 
-        private void DereferenceBlock(ushort blockId)
+        private void AddToChildIndex(MfsCellId parent, MfsObjectHeader* parentObj, MfsCellId cellId, MfsObjectHeader* obj)
+        {
+            int indexSize = parentObj->ChildIndexSize;
+
+            if (parentObj->ChildIndex == MfsCellId.Empty)
+            {
+                if (parentObj->ChildCount >= MfsChildIndexThreshold)
+                    this.BuildChildIndex(parent, parentObj, Math.Min(MfsChildIndexThreshold, _maxChildIndexSize));
+            }
+            else if (parentObj->ChildCount > indexSize * 2 && indexSize < _maxChildIndexSize)
+            {
+                // Keep the chains short. The new child is already in the list.
+                this.BuildChildIndex(parent, parentObj, indexSize * 2);
+            }
+            else
+            {
+                MfsCellId* buckets = (MfsCellId*)this.ReferenceCell(parentObj->ChildIndex);
+                int bucket = obj->NameHash & (indexSize - 1);
+
+                obj->HashLink = buckets[bucket];
+                buckets[bucket] = cellId;
+
+                this.DereferenceCell(parentObj->ChildIndex);
+            }
+        }
+
+        /// <summary>
+        /// Creates a new child index for an object and adds all of its 
+        /// children to it.
+        /// </summary>
+        /// <remarks>
+        /// The old index (if any) is simply abandoned, since MFS doesn't 
+        /// support freeing cells. Because the index doubles in size each 
+        /// time, the wasted space is never more than the size of the 
+        /// current index.
+        /// </remarks>
+        private void BuildChildIndex(MfsCellId parent, MfsObjectHeader* parentObj, int indexSize)
+        {
+            MfsCellId indexCellId;
+            MfsCellId* buckets;
+            MfsCellId cellId;
+            int cellCount = (indexSize * sizeof(MfsCellId) + _cellSize - 1) / _cellSize;
+
+            buckets = (MfsCellId*)this.AllocateCells(cellCount, out indexCellId);
+
+            for (int i = 0; i < indexSize; i++)
+                buckets[i] = MfsCellId.Empty;
+
+            cellId = parentObj->ChildFlink;
+
+            while (cellId != parent)
+            {
+                MfsObjectHeader* obj = this.ReferenceObject(cellId);
+                MfsCellId newCellId = obj->Flink;
+                int bucket = obj->NameHash & (indexSize - 1);
+
+                obj->HashLink = buckets[bucket];
+                buckets[bucket] = cellId;
+
+                this.DereferenceObject(cellId);
+                cellId = newCellId;
+            }
+
+            parentObj->ChildIndex = indexCellId;
+            parentObj->ChildIndexSize = indexSize;
+
+            this.DereferenceCell(indexCellId);
+        }
+
+        private int ComputeBlockHash(IntPtr block)
+        {
+            // The hash covers everything except the hash field itself.
+            return Crc32.Compute((byte*)block + sizeof(int), _blockSize - sizeof(int));
+        }
+
+        private void DereferenceBlock(int blockId)
         {
             ViewDescriptor vd;
 
@@ -417,8 +682,8 @@ namespace ProcessHacker.Native.Mfs
             if (vd.RefCount == 0)
             {
                 _views.Remove(vd.BlockId);
-                _views2.Remove(vd.View.Memory);
-                vd.View.Dispose();
+                _views2.Remove(vd.View);
+                _storage.UnmapView(vd.View);
 
                 _vdFreeList.Free(vd);
             }
@@ -426,7 +691,7 @@ namespace ProcessHacker.Native.Mfs
 
         private void DereferenceCell(MfsCellId cellId)
         {
-            this.DereferenceBlock(cellId.Block);
+            this.DereferenceBlock(this.GetBlockId(cellId));
         }
 
         private void DereferenceCell(IntPtr cellView)
@@ -439,32 +704,112 @@ namespace ProcessHacker.Native.Mfs
             this.DereferenceCell(cellId);
         }
 
+        /// <summary>
+        /// Finds a child using the object's child index.
+        /// </summary>
+        /// <param name="obj">The parent object.</param>
+        /// <param name="name">The name of the child.</param>
+        /// <param name="cellId">
+        /// Receives the cell ID of the child, or MfsCellId.Empty if there 
+        /// is no such child.
+        /// </param>
+        /// <returns>False if the object does not have a child index.</returns>
+        internal bool FindChild(MfsObjectHeader* obj, string name, out MfsCellId cellId)
+        {
+            MfsCellId* buckets;
+            int hash;
+
+            cellId = MfsCellId.Empty;
+
+            if (_version < 2 || obj->ChildIndex == MfsCellId.Empty)
+                return false;
+
+            hash = HashName(name);
+            buckets = (MfsCellId*)this.ReferenceCell(obj->ChildIndex);
+            cellId = buckets[hash & (obj->ChildIndexSize - 1)];
+            this.DereferenceCell(obj->ChildIndex);
+
+            while (cellId != MfsCellId.Empty)
+            {
+                MfsObjectHeader* child = this.ReferenceObject(cellId);
+                MfsCellId newCellId = child->HashLink;
+                bool found = child->NameHash == hash && this.GetObjectName(child) == name;
+
+                this.DereferenceObject(cellId);
+
+                if (found)
+                    break;
+
+                cellId = newCellId;
+            }
+
+            return true;
+        }
+
         private IntPtr GetBlock(IntPtr cellView)
         {
             return cellView.And(_blockMask.ToIntPtr().Not());
         }
 
+        private int GetBlockId(MfsCellId cellId)
+        {
+            if (_version >= 2)
+                return (int)(cellId.Value >> _cellShift);
+            else
+                return (int)(cellId.Value & 0xffff);
+        }
+
         private MfsCellId GetCellId(IntPtr cellView)
         {
             IntPtr view;
 
             view = this.GetBlock(cellView);
 
-            return new MfsCellId(
+            return this.MakeCellId(
                 _views2[view].BlockId,
-                (ushort)(cellView.Decrement(view).ToInt32() / _cellSize)
+                cellView.Decrement(view).ToInt32() / _cellSize
                 );
         }
 
+        private int GetCellIndex(MfsCellId cellId)
+        {
+            if (_version >= 2)
+                return (int)(cellId.Value & (_cellCount - 1));
+            else
+                return (int)(cellId.Value >> 16);
+        }
+
         internal string GetObjectName(MfsObjectHeader* obj)
         {
             return new string(obj->Name, 0, obj->NameLength);
         }
 
+        private static int HashName(string name)
+        {
+            // FNV-1a. The hash is stored in the file system, so we can't 
+            // use String.GetHashCode.
+            uint hash = 2166136261;
+
+            unchecked
+            {
+                for (int i = 0; i < name.Length; i++)
+                {
+                    hash ^= name[i];
+                    hash *= 16777619;
+                }
+            }
+
+            return (int)hash;
+        }
+
         private void InitializeFs(MfsFsHeader* header, MfsParameters createParams)
         {
-            header->Magic = MfsMagic;
+            // New file systems always use the latest version.
+            header->Magic = MfsMagic2;
             header->NextFreeBlock = 1;
+            header->Flags = 0;
+            header->NextFreeBlock32 = 1;
+            header->CellBlock = 0;
 
             if (createParams != null)
             {
@@ -480,10 +825,10 @@ namespace ProcessHacker.Native.Mfs
                 header->CellSize = MfsDefaultCellSize;
             }
 
-            // Store root object in the next cell.
+            // Store root object in the next cell. This is global cell 1.
             MfsObjectHeader* obj = (MfsObjectHeader*)((byte*)header + header->CellSize);
 
-            this.InitializeObject(obj, _rootObjectCellId);
+            this.InitializeObject(obj, new MfsCellId(1));
             this.SetObjectName(obj, "root");
         }
 
@@ -497,6 +842,31 @@ namespace ProcessHacker.Native.Mfs
             obj->DataLength = 0;
             obj->Data = MfsCellId.Empty;
             obj->LastData = MfsCellId.Empty;
+            obj->NameHash = 0;
+            obj->HashLink = MfsCellId.Empty;
+            obj->ChildIndex = MfsCellId.Empty;
+            obj->ChildIndexSize = 0;
+        }
+
+        private void LinkDataCell(MfsCellId prev, MfsCellId cellId)
+        {
+            MfsDataCell* prevDc;
+
+            // Extent cells start with the same fields as data cells.
+            if (prev != MfsCellId.Empty)
+            {
+                prevDc = (MfsDataCell*)this.ReferenceCell(prev);
+                prevDc->NextCell = cellId;
+                this.DereferenceCell(prev);
+            }
+        }
+
+        private MfsCellId MakeCellId(int blockId, int cell)
+        {
+            if (_version >= 2)
+                return new MfsCellId(((uint)blockId << _cellShift) | (uint)cell);
+            else
+                return new MfsCellId((ushort)blockId, (ushort)cell);
         }
 
         internal int ReadDataCell(MfsCellId cellId, byte[] buffer, int offset, int length)
@@ -513,8 +883,16 @@ namespace ProcessHacker.Native.Mfs
 
                 dc = (MfsDataCell*)this.ReferenceCell(cellId);
 
-                readLength = length > dc->DataLength ? dc->DataLength : length;
-                Marshal.Copy(new IntPtr(&dc->Data), buffer, offset, readLength);
+                if ((dc->DataLength & MfsDataCell.ExtentFlag) != 0)
+                {
+                    readLength = this.ReadExtent((MfsExtentCell*)dc, buffer, offset, null, length);
+                }
+                else
+                {
+                    readLength = length > dc->DataLength ? dc->DataLength : length;
+                    Marshal.Copy(new IntPtr(&dc->Data), buffer, offset, readLength);
+                }
+
                 offset += readLength;
                 bytesRead += readLength;
                 length -= readLength;
@@ -543,9 +921,16 @@ namespace ProcessHacker.Native.Mfs
 
                 dc = (MfsDataCell*)this.ReferenceCell(cellId);
 
-                readLength = length > dc->DataLength ? dc->DataLength : length;
-                Marshal.Copy(new IntPtr(&dc->Data), buf, 0, readLength);
-                stream.Write(buf, 0, readLength);
+                if ((dc->DataLength & MfsDataCell.ExtentFlag) != 0)
+                {
+                    readLength = this.ReadExtent((MfsExtentCell*)dc, null, 0, stream, length);
+                }
+                else
+                {
+                    readLength = length > dc->DataLength ? dc->DataLength : length;
+                    Marshal.Copy(new IntPtr(&dc->Data), buf, 0, readLength);
+                    stream.Write(buf, 0, readLength);
+                }
 
                 bytesRead += readLength;
                 length -= readLength;
@@ -561,10 +946,61 @@ namespace ProcessHacker.Native.Mfs
             return bytesRead;
         }
 
-        private IntPtr ReferenceBlock(ushort blockId)
+        /// <summary>
+        /// Reads data from an extent into a buffer or a stream.
+        /// </summary>
+        private int ReadExtent(MfsExtentCell* ec, byte[] buffer, int offset, System.IO.Stream stream, int length)
+        {
+            int extentLength = ec->DataLength & ~MfsDataCell.ExtentFlag;
+            int readLength = length > extentLength ? extentLength : length;
+            // We can only check the hash if we're reading the whole extent.
+            bool verify = readLength == extentLength;
+            uint crc = 0xffffffff;
+            byte[] streamBuffer = null;
+            int bytesRead = 0;
+
+            for (int i = 0; bytesRead < readLength; i += MfsExtentWindowBlocks)
+            {
+                int copyLength = Math.Min(readLength - bytesRead, MfsExtentWindowBlocks * _blockSize);
+
+                IntPtr view = _storage.MapView((long)(ec->StartBlock + i) * _blockSize, copyLength);
+
+                try
+                {
+                    if (verify)
+                        crc = Crc32.Update(crc, (byte*)view, copyLength);
+
+                    if (stream != null)
+                    {
+                        if (streamBuffer == null)
+                            streamBuffer = new byte[copyLength];
+
+                        Marshal.Copy(view, streamBuffer, 0, copyLength);
+                        stream.Write(streamBuffer, 0, copyLength);
+                    }
+                    else
+                    {
+                        Marshal.Copy(view, buffer, offset + bytesRead, copyLength);
+                    }
+                }
+                finally
+                {
+                    _storage.UnmapView(view);
+                }
+
+                bytesRead += copyLength;
+            }
+
+            if (verify && (int)~crc != ec->Hash)
+                throw new MfsInvalidFileSystemException("The extent at block " + ec->StartBlock.ToString() + " is corrupt.");
+
+            return bytesRead;
+        }
+
+        private IntPtr ReferenceBlock(int blockId)
         {
             ViewDescriptor vd;
-            SectionView view;
+            IntPtr view;
 
             if (_views.ContainsKey(blockId))
             {
@@ -573,16 +1009,32 @@ namespace ProcessHacker.Native.Mfs
             }
             else
             {
-                view = _section.MapView(blockId * _blockSize, _blockSize, _protection);
+                view = _storage.MapView((long)blockId * _blockSize, _blockSize);
+
+                // Block 0 contains the file system header, not a block header.
+                if (_verifyHashes && blockId != 0 && !(blockId < _verifiedBlocks.Length && _verifiedBlocks[blockId]))
+                {
+                    if (((MfsBlockHeader*)view)->Hash != this.ComputeBlockHash(view))
+                    {
+                        _storage.UnmapView(view);
+                        throw new MfsInvalidFileSystemException("Block " + blockId.ToString() + " is corrupt.");
+                    }
+
+                    SetBlockBit(ref _verifiedBlocks, blockId);
+                }
+
                 vd = _vdFreeList.Allocate();
                 vd.RefCount = 1;
                 vd.BlockId = blockId;
                 vd.View = view;
 
                 _views.Add(blockId, vd);
-                _views2.Add(vd.View.Memory, vd);
+                _views2.Add(vd.View, vd);
             }
 
+            if (_maintainHashes)
+                SetBlockBit(ref _dirtyBlocks, blockId);
+
             return vd.View;
         }
 
@@ -590,9 +1042,9 @@ namespace ProcessHacker.Native.Mfs
         {
             IntPtr block;
 
-            block = this.ReferenceBlock(cellId.Block);
+            block = this.ReferenceBlock(this.GetBlockId(cellId));
 
-            return block.Increment(cellId.Cell * _cellSize);
+            return block.Increment(this.GetCellIndex(cellId) * _cellSize);
         }
 
         internal MfsObjectHeader* ReferenceObject(MfsCellId cellId)
@@ -600,6 +1052,14 @@ namespace ProcessHacker.Native.Mfs
             return (MfsObjectHeader*)this.ReferenceCell(cellId);
         }
 
+        private static void SetBlockBit(ref BitArray bits, int blockId)
+        {
+            if (blockId >= bits.Length)
+                bits.Length = Math.Max(blockId + 1, bits.Length * 2);
+
+            bits[blockId] = true;
+        }
+
         internal void SetObjectName(MfsObjectHeader* obj, string name)
         {
             if (_readOnly)
@@ -609,6 +1069,28 @@ namespace ProcessHacker.Native.Mfs
             Utils.StrCpy(obj->Name, name, 32);
         }
 
+        private void UpdateBlockHashes()
+        {
+            BitArray dirtyBlocks = _dirtyBlocks;
+
+            // Stop tracking blocks since we're about to reference them ourselves.
+            _maintainHashes = false;
+            _dirtyBlocks = null;
+
+            for (int i = 1; i < dirtyBlocks.Length; i++)
+            {
+                if (!dirtyBlocks[i])
+                    continue;
+
+                IntPtr block = this.ReferenceBlock(i);
+
+                ((MfsBlockHeader*)block)->Hash = this.ComputeBlockHash(block);
+                this.DereferenceBlock(i);
+            }
+
+            _header->Flags |= MfsFsFlags.BlockHashesValid;
+        }
+
         private void ValidateFsParameters(int blockSize, int cellSize)
         {
             if (blockSize <= 0)
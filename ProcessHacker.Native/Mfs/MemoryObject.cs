@@ -102,8 +102,18 @@ namespace ProcessHacker.Native.Mfs
             {
                 int writeLength;
 
-                writeLength = length > _fs.DataCellDataMaxLength ? _fs.DataCellDataMaxLength : length;
-                cellId = _fs.CreateDataCell(_obj->LastData, buffer, offset, writeLength);
+                if (length >= _fs.BlockSize && _fs.ExtentsSupported)
+                {
+                    // Store whole blocks in an extent. The rest goes into data cells.
+                    writeLength = length & ~(_fs.BlockSize - 1);
+                    cellId = _fs.CreateExtentCell(_obj->LastData, buffer, offset, writeLength);
+                }
+                else
+                {
+                    writeLength = length > _fs.DataCellDataMaxLength ? _fs.DataCellDataMaxLength : length;
+                    cellId = _fs.CreateDataCell(_obj->LastData, buffer, offset, writeLength);
+                }
+
                 offset += writeLength;
                 length -= writeLength;
                 _obj->DataLength += writeLength;
@@ -154,6 +164,15 @@ namespace ProcessHacker.Native.Mfs
             MfsCellId cellId;
             MfsObjectHeader* obj;
 
+            // Use the child index if the object has one.
+            if (_fs.FindChild(_obj, name, out cellId))
+            {
+                if (cellId == MfsCellId.Empty)
+                    return null;
+
+                return new MemoryObject(_fs, cellId);
+            }
+
             cellId = _obj->ChildFlink;
 
             // Traverse the linked list and find the child with the specified name.
@@ -208,7 +227,12 @@ namespace ProcessHacker.Native.Mfs
 
         public MemoryDataWriteStream GetWriteStream()
         {
-            return new MemoryDataWriteStream(this, _fs.DataCellDataMaxLength);
+            // Buffer whole blocks if they can be stored as extents.
+            return new MemoryDataWriteStream(
+                this,
+                _fs.DataCellDataMaxLength,
+                _fs.ExtentsSupported ? _fs.BlockSize : _fs.DataCellDataMaxLength
+                );
         }
 
         public byte[] ReadData()
@@ -0,0 +1,128 @@
+﻿/*
+ * Process Hacker -
+ *   section-based MFS storage
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.Collections.Generic;
+using ProcessHacker.Native.Api;
+using ProcessHacker.Native.Objects;
+using ProcessHacker.Native.Security;
+
+namespace ProcessHacker.Native.Mfs
+{
+    /// <summary>
+    /// Stores a memory file system in a file using a native section object.
+    /// </summary>
+    public sealed class SectionMfsStorage : IMfsStorage
+    {
+        private readonly bool _readOnly;
+        private readonly MemoryProtection _protection;
+        private readonly Section _section;
+        private long _size;
+        private readonly Dictionary<IntPtr, SectionView> _views = new Dictionary<IntPtr, SectionView>();
+
+        public SectionMfsStorage(string fileName, MfsOpenMode mode, bool readOnly)
+        {
+            FileCreationDispositionWin32 cdWin32;
+
+            switch (mode)
+            {
+                case MfsOpenMode.Open:
+                    cdWin32 = FileCreationDispositionWin32.OpenExisting;
+                    break;
+                default:
+                case MfsOpenMode.OpenIf:
+                    cdWin32 = FileCreationDispositionWin32.OpenAlways;
+                    break;
+                case MfsOpenMode.OverwriteIf:
+                    cdWin32 = FileCreationDispositionWin32.CreateAlways;
+                    break;
+            }
+
+            using (FileHandle fhandle = FileHandle.CreateWin32(
+                fileName,
+                FileAccess.GenericRead | (!readOnly ? FileAccess.GenericWrite : 0),
+                FileShareMode.Read,
+                cdWin32
+                ))
+            {
+                _readOnly = readOnly;
+                _protection = !readOnly ? MemoryProtection.ReadWrite : MemoryProtection.ReadOnly;
+
+                if (fhandle.FileSize == 0)
+                {
+                    if (readOnly)
+                        throw new MfsInvalidFileSystemException();
+
+                    // We can't create a section for an empty file. Make it 1 byte 
+                    // large; the file system will extend it soon.
+                    fhandle.SetEnd(1);
+                }
+
+                _size = fhandle.FileSize;
+                _section = new Section(fhandle, _protection);
+            }
+        }
+
+        public void Dispose()
+        {
+            foreach (SectionView view in _views.Values)
+                view.Dispose();
+
+            _views.Clear();
+            _section.Dispose();
+        }
+
+        public bool ReadOnly
+        {
+            get { return _readOnly; }
+        }
+
+        public long Size
+        {
+            get { return _size; }
+        }
+
+        public void Extend(long newSize)
+        {
+            if (newSize <= _size)
+                return;
+
+            _section.Extend(newSize);
+            _size = newSize;
+        }
+
+        public IntPtr MapView(long offset, int size)
+        {
+            SectionView view = _section.MapView(offset, size, _protection);
+
+            _views.Add(view.Memory, view);
+
+            return view.Memory;
+        }
+
+        public void UnmapView(IntPtr view)
+        {
+            _views[view].Dispose();
+            _views.Remove(view);
+        }
+    }
+}
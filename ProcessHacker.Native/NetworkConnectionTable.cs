@@ -0,0 +1,455 @@
+﻿/*
+ * Process Hacker -
+ *   network connection table
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.Net;
+using ProcessHacker.Common;
+using ProcessHacker.Native.Api;
+
+namespace ProcessHacker.Native
+{
+    /// <summary>
+    /// Identifies a network connection without allocating any objects.
+    /// </summary>
+    /// <remarks>
+    /// IPv4 addresses are stored in the low 32 bits of the first address 
+    /// field and IPv6 addresses use both fields. Addresses are kept in 
+    /// network byte order and ports in host byte order.
+    /// </remarks>
+    public struct NetworkConnectionKey : IEquatable<NetworkConnectionKey>
+    {
+        public long LocalAddress0;
+        public long LocalAddress1;
+        public long RemoteAddress0;
+        public long RemoteAddress1;
+        public int LocalScopeId;
+        public int RemoteScopeId;
+        public ushort LocalPort;
+        public ushort RemotePort;
+        public int Pid;
+        public NetworkProtocol Protocol;
+
+        public bool HasRemote
+        {
+            get { return this.Protocol == NetworkProtocol.Tcp || this.Protocol == NetworkProtocol.Tcp6; }
+        }
+
+        public bool IsIPv6
+        {
+            get { return this.Protocol == NetworkProtocol.Tcp6 || this.Protocol == NetworkProtocol.Udp6; }
+        }
+
+        public bool IsLocalAddressEmpty
+        {
+            get { return this.LocalAddress0 == 0 && this.LocalAddress1 == 0; }
+        }
+
+        public bool IsRemoteAddressEmpty
+        {
+            get { return this.RemoteAddress0 == 0 && this.RemoteAddress1 == 0; }
+        }
+
+        public bool Equals(NetworkConnectionKey other)
+        {
+            return
+                this.LocalAddress0 == other.LocalAddress0 &&
+                this.RemoteAddress0 == other.RemoteAddress0 &&
+                this.LocalPort == other.LocalPort &&
+                this.RemotePort == other.RemotePort &&
+                this.Pid == other.Pid &&
+                this.Protocol == other.Protocol &&
+                this.LocalAddress1 == other.LocalAddress1 &&
+                this.RemoteAddress1 == other.RemoteAddress1 &&
+                this.LocalScopeId == other.LocalScopeId &&
+                this.RemoteScopeId == other.RemoteScopeId;
+        }
+
+        public override bool Equals(object obj)
+        {
+            return obj is NetworkConnectionKey && this.Equals((NetworkConnectionKey)obj);
+        }
+
+        public override int GetHashCode()
+        {
+            // Many connections share addresses and differ only in their 
+            // ports, so the ports need to reach all bits of the hash.
+            ulong hash = (ulong)this.LocalAddress0;
+
+            hash = hash * 0x9e3779b97f4a7c15 + (ulong)this.LocalAddress1;
+            hash = hash * 0x9e3779b97f4a7c15 + (ulong)this.RemoteAddress0;
+            hash = hash * 0x9e3779b97f4a7c15 + (ulong)this.RemoteAddress1;
+            hash = hash * 0x9e3779b97f4a7c15 + (((ulong)this.LocalPort << 48) | ((ulong)this.RemotePort << 32) | (uint)this.Pid);
+            hash = hash * 0x9e3779b97f4a7c15 + (((ulong)(uint)this.LocalScopeId << 32) | (uint)this.RemoteScopeId);
+            hash = hash * 0x9e3779b97f4a7c15 + (ulong)this.Protocol;
+            hash ^= hash >> 29;
+
+            return (int)hash ^ (int)(hash >> 32);
+        }
+
+        public IPEndPoint GetLocalEndPoint()
+        {
+            return new IPEndPoint(
+                GetAddress(this.LocalAddress0, this.LocalAddress1, this.LocalScopeId, this.IsIPv6),
+                this.LocalPort
+                );
+        }
+
+        public IPEndPoint GetRemoteEndPoint()
+        {
+            if (!this.HasRemote)
+                return null;
+
+            return new IPEndPoint(
+                GetAddress(this.RemoteAddress0, this.RemoteAddress1, this.RemoteScopeId, this.IsIPv6),
+                this.RemotePort
+                );
+        }
+
+        private unsafe static IPAddress GetAddress(long address0, long address1, int scopeId, bool ipv6)
+        {
+            if (!ipv6)
+                return new IPAddress((long)(uint)address0);
+
+            byte[] bytes = new byte[16];
+
+            fixed (byte* bytesPtr = bytes)
+            {
+                ((long*)bytesPtr)[0] = address0;
+                ((long*)bytesPtr)[1] = address1;
+            }
+
+            return new IPAddress(bytes, (uint)scopeId);
+        }
+    }
+
+    public struct NetworkConnectionRow
+    {
+        public NetworkConnectionKey Key;
+        public MibTcpState State;
+        /// <summary>
+        /// The number of identical rows which were merged into this one.
+        /// </summary>
+        public int Count;
+
+        public NetworkConnection ToNetworkConnection()
+        {
+            return new NetworkConnection
+            {
+                Pid = this.Key.Pid,
+                Protocol = this.Key.Protocol,
+                Local = this.Key.GetLocalEndPoint(),
+                Remote = this.Key.GetRemoteEndPoint(),
+                State = this.State
+            };
+        }
+    }
+
+    /// <summary>
+    /// Decodes the connection tables returned by GetExtendedTcpTable and 
+    /// GetExtendedUdpTable into a flat, hashed array of rows.
+    /// </summary>
+    /// <remarks>
+    /// <para>
+    /// The table is meant to be reused: the row array, the hash index 
+    /// and the query buffer are only reallocated when they need to grow. 
+    /// Identical rows are merged and counted.
+    /// </para>
+    /// <para>
+    /// <see cref="Decode(NetworkProtocol, byte[])"/> does not call any 
+    /// native functions, so captured tables can be decoded anywhere.
+    /// This class is not thread-safe.
+    /// </para>
+    /// </remarks>
+    public unsafe sealed class NetworkConnectionTable : IDisposable
+    {
+        // Row layouts (MIB_TCPROW_OWNER_PID, etc.).
+        private const int TcpRowSize = 24;
+        private const int UdpRowSize = 12;
+        private const int Tcp6RowSize = 56;
+        private const int Udp6RowSize = 28;
+
+        private const int ErrorInsufficientBuffer = 122;
+
+        private NetworkConnectionRow[] _rows = new NetworkConnectionRow[64];
+        private int _count;
+        // Open addressing index into _rows. A bucket is only in use if its 
+        // stamp matches the current stamp, so clearing the table is O(1).
+        private int[] _buckets = new int[128];
+        private int[] _bucketStamps = new int[128];
+        private int _stamp = 1;
+        private MemoryAlloc _buffer;
+
+        public void Dispose()
+        {
+            if (_buffer != null)
+            {
+                _buffer.Dispose();
+                _buffer = null;
+            }
+        }
+
+        public int Count
+        {
+            get { return _count; }
+        }
+
+        /// <summary>
+        /// Gets the row array. Only the first <see cref="Count"/> rows are valid.
+        /// </summary>
+        public NetworkConnectionRow[] Rows
+        {
+            get { return _rows; }
+        }
+
+        public void Clear()
+        {
+            _count = 0;
+
+            if (++_stamp == int.MaxValue)
+            {
+                Array.Clear(_bucketStamps, 0, _bucketStamps.Length);
+                _stamp = 1;
+            }
+        }
+
+        /// <summary>
+        /// Finds a connection.
+        /// </summary>
+        /// <returns>The index of the row, or -1 if the connection is not in the table.</returns>
+        public int Find(ref NetworkConnectionKey key)
+        {
+            int mask = _buckets.Length - 1;
+            int bucket = key.GetHashCode() & mask;
+
+            while (_bucketStamps[bucket] == _stamp)
+            {
+                int index = _buckets[bucket];
+
+                if (_rows[index].Key.Equals(key))
+                    return index;
+
+                bucket = (bucket + 1) & mask;
+            }
+
+            return -1;
+        }
+
+        private void Add(ref NetworkConnectionKey key, MibTcpState state)
+        {
+            int mask = _buckets.Length - 1;
+            int bucket = key.GetHashCode() & mask;
+
+            while (_bucketStamps[bucket] == _stamp)
+            {
+                int index = _buckets[bucket];
+
+                if (_rows[index].Key.Equals(key))
+                {
+                    _rows[index].Count++;
+                    return;
+                }
+
+                bucket = (bucket + 1) & mask;
+            }
+
+            if (_count == _rows.Length)
+                Array.Resize(ref _rows, _rows.Length * 2);
+
+            _rows[_count].Key = key;
+            _rows[_count].State = state;
+            _rows[_count].Count = 1;
+            _buckets[bucket] = _count;
+            _bucketStamps[bucket] = _stamp;
+            _count++;
+
+            // Keep the load factor at 1/2 or less.
+            if (_count * 2 > _buckets.Length)
+                this.Rehash(_buckets.Length * 2);
+        }
+
+        private void Rehash(int size)
+        {
+            int mask = size - 1;
+
+            _buckets = new int[size];
+            _bucketStamps = new int[size];
+            _stamp = 1;
+
+            for (int i = 0; i < _count; i++)
+            {
+                int bucket = _rows[i].Key.GetHashCode() & mask;
+
+                while (_bucketStamps[bucket] == _stamp)
+                    bucket = (bucket + 1) & mask;
+
+                _buckets[bucket] = i;
+                _bucketStamps[bucket] = _stamp;
+            }
+        }
+
+        /// <summary>
+        /// Adds the rows from a connection table.
+        /// </summary>
+        /// <param name="protocol">The type of table.</param>
+        /// <param name="table">The table, as returned by GetExtendedTcpTable or GetExtendedUdpTable.</param>
+        public void Decode(NetworkProtocol protocol, byte[] table)
+        {
+            fixed (byte* tablePtr = table)
+                this.Decode(protocol, tablePtr, table.Length);
+        }
+
+        /// <summary>
+        /// Adds the rows from a connection table.
+        /// </summary>
+        /// <param name="protocol">The type of table.</param>
+        /// <param name="table">A pointer to the table.</param>
+        /// <param name="length">The length of the table, in bytes.</param>
+        public void Decode(NetworkProtocol protocol, byte* table, int length)
+        {
+            NetworkConnectionKey key = new NetworkConnectionKey();
+            int rowSize;
+            int count;
+
+            switch (protocol)
+            {
+                case NetworkProtocol.Tcp:
+                    rowSize = TcpRowSize;
+                    break;
+                case NetworkProtocol.Udp:
+                    rowSize = UdpRowSize;
+                    break;
+                case NetworkProtocol.Tcp6:
+                    rowSize = Tcp6RowSize;
+                    break;
+                case NetworkProtocol.Udp6:
+                    rowSize = Udp6RowSize;
+                    break;
+                default:
+                    throw new ArgumentException("protocol");
+            }
+
+            if (length < sizeof(int))
+                return;
+
+            count = *(int*)table;
+
+            // Don't trust the count.
+            if (count < 0 || count > (length - sizeof(int)) / rowSize)
+                count = (length - sizeof(int)) / rowSize;
+
+            key.Protocol = protocol;
+
+            for (int i = 0; i < count; i++)
+            {
+                int* row = (int*)(table + sizeof(int) + i * rowSize);
+                MibTcpState state = 0;
+
+                switch (protocol)
+                {
+                    case NetworkProtocol.Tcp:
+                        state = (MibTcpState)row[0];
+                        key.LocalAddress0 = (uint)row[1];
+                        key.LocalPort = ((ushort)row[2]).Reverse();
+                        key.RemoteAddress0 = (uint)row[3];
+                        key.RemotePort = ((ushort)row[4]).Reverse();
+                        key.Pid = row[5];
+                        break;
+                    case NetworkProtocol.Udp:
+                        key.LocalAddress0 = (uint)row[0];
+                        key.LocalPort = ((ushort)row[1]).Reverse();
+                        key.Pid = row[2];
+                        break;
+                    case NetworkProtocol.Tcp6:
+                        key.LocalAddress0 = *(long*)&row[0];
+                        key.LocalAddress1 = *(long*)&row[2];
+                        key.LocalScopeId = row[4];
+                        key.LocalPort = ((ushort)row[5]).Reverse();
+                        key.RemoteAddress0 = *(long*)&row[6];
+                        key.RemoteAddress1 = *(long*)&row[8];
+                        key.RemoteScopeId = row[10];
+                        key.RemotePort = ((ushort)row[11]).Reverse();
+                        state = (MibTcpState)row[12];
+                        key.Pid = row[13];
+                        break;
+                    case NetworkProtocol.Udp6:
+                        key.LocalAddress0 = *(long*)&row[0];
+                        key.LocalAddress1 = *(long*)&row[2];
+                        key.LocalScopeId = row[4];
+                        key.LocalPort = ((ushort)row[5]).Reverse();
+                        key.Pid = row[6];
+                        break;
+                }
+
+                this.Add(ref key, state);
+            }
+        }
+
+        /// <summary>
+        /// Clears the table and adds the connections currently active.
+        /// </summary>
+        public void Update()
+        {
+            this.Clear();
+
+            if (_buffer == null)
+                _buffer = new MemoryAlloc(0x4000);
+
+            this.QueryAndDecode(NetworkProtocol.Tcp, true);
+            this.QueryAndDecode(NetworkProtocol.Udp, true);
+            this.QueryAndDecode(NetworkProtocol.Tcp6, false);
+            this.QueryAndDecode(NetworkProtocol.Udp6, false);
+        }
+
+        private void QueryAndDecode(NetworkProtocol protocol, bool throwOnError)
+        {
+            AiFamily family = protocol == NetworkProtocol.Tcp || protocol == NetworkProtocol.Udp ? AiFamily.INet : AiFamily.INet6;
+            int result;
+            int length;
+
+            while (true)
+            {
+                length = _buffer.Size;
+
+                if (protocol == NetworkProtocol.Tcp || protocol == NetworkProtocol.Tcp6)
+                    result = Win32.GetExtendedTcpTable(_buffer, ref length, false, family, TcpTableClass.OwnerPidAll, 0);
+                else
+                    result = Win32.GetExtendedUdpTable(_buffer, ref length, false, family, UdpTableClass.OwnerPid, 0);
+
+                // The table may grow between calls, so keep trying.
+                if (result == ErrorInsufficientBuffer && length > _buffer.Size)
+                    _buffer.ResizeNew(length);
+                else
+                    break;
+            }
+
+            if (result != 0)
+            {
+                if (throwOnError)
+                    Win32.Throw(result);
+
+                return;
+            }
+
+            this.Decode(protocol, (byte*)_buffer.Memory, length);
+        }
+    }
+}
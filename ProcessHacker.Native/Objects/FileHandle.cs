@@ -1026,6 +1026,21 @@ namespace ProcessHacker.Native.Objects
             }
         }
 
+        /// <summary>
+        /// Gets the file system's unique identifier for the file.
+        /// </summary>
+        /// <returns>The index number of the file.</returns>
+        public long FileIndex
+        {
+            get
+            {
+                return this.QueryStruct<FileInternalInformation>(
+                    FileInformationClass.FileInternalInformation,
+                    FileInternalInformation.SizeOf
+                    ).IndexNumber;
+            }
+        }
+
         /// <summary>
         /// Gets a list of the files contained in the directory.
         /// </summary>
@@ -34,3 +34,5 @@ using System.Runtime.InteropServices;
 // [assembly: AssemblyVersion("1.0.*")]
 [assembly: AssemblyVersion("1.12.0.0")]
 [assembly: AssemblyFileVersion("1.12.0.0")]
+
+[assembly: InternalsVisibleTo("ProcessHacker.Tests")]
@@ -0,0 +1,141 @@
+﻿using System;
+using ProcessHacker.Native.Api;
+
+namespace ProcessHacker.Native.SsLogging
+{
+    /// <summary>
+    /// A view of an argument block which reads fields directly from the 
+    /// logging buffer. The view is only valid while it is being delivered.
+    /// </summary>
+    public unsafe struct SsArgumentView
+    {
+        private readonly KphSsArgumentBlock* _block;
+
+        internal SsArgumentView(KphSsArgumentBlock* block)
+        {
+            _block = block;
+        }
+
+        public IntPtr Address
+        {
+            get { return (IntPtr)_block; }
+        }
+
+        public int Index
+        {
+            get { return _block->Index; }
+        }
+
+        public int Size
+        {
+            get { return _block->Header.Size; }
+        }
+
+        public KphSsArgumentType Type
+        {
+            get { return _block->Type; }
+        }
+
+        /// <summary>
+        /// Gets the value of an integer argument, sign-extended to 64 bits.
+        /// </summary>
+        public long Value
+        {
+            get
+            {
+                switch (_block->Type)
+                {
+                    case KphSsArgumentType.Int8:
+                        return _block->Data.Int8;
+                    case KphSsArgumentType.Int16:
+                        return _block->Data.Int16;
+                    case KphSsArgumentType.Int32:
+                        return _block->Data.Int32;
+                    case KphSsArgumentType.Int64:
+                        return _block->Data.Int64;
+                    default:
+                        return 0;
+                }
+            }
+        }
+
+        private byte* Data
+        {
+            get { return (byte*)_block + KphSsArgumentBlock.DataOffset; }
+        }
+
+        /// <summary>
+        /// Gets a pointer to the characters of the string argument, or the 
+        /// object name of an object attributes argument.
+        /// </summary>
+        /// <param name="length">The number of characters in the string.</param>
+        /// <returns>
+        /// A pointer to the characters, or null if there is no string or the 
+        /// string does not fit inside the block.
+        /// </returns>
+        public char* GetStringBuffer(out int length)
+        {
+            int offset;
+
+            length = 0;
+
+            switch (_block->Type)
+            {
+                case KphSsArgumentType.UnicodeString:
+                    offset = KphSsArgumentBlock.DataOffset;
+                    break;
+                case KphSsArgumentType.ObjectAttributes:
+                    {
+                        KphSsObjectAttributes* oa = (KphSsObjectAttributes*)this.Data;
+
+                        if (KphSsArgumentBlock.DataOffset + KphSsObjectAttributes.SizeOf > _block->Header.Size)
+                            return null;
+                        if (oa->ObjectNameOffset == 0)
+                            return null;
+
+                        offset = KphSsArgumentBlock.DataOffset + oa->ObjectNameOffset;
+                    }
+                    break;
+                default:
+                    return null;
+            }
+
+            // The lengths come from the buffer, so make sure that we don't 
+            // read past the end of the block.
+            if (offset + KphSsUnicodeString.BufferOffset > _block->Header.Size)
+                return null;
+
+            KphSsUnicodeString* str = (KphSsUnicodeString*)((byte*)_block + offset);
+
+            if (offset + KphSsUnicodeString.BufferOffset + str->Length > _block->Header.Size)
+                return null;
+
+            length = str->Length / 2;
+
+            return (char*)((byte*)str + KphSsUnicodeString.BufferOffset);
+        }
+
+        /// <summary>
+        /// Gets the string argument, or the object name of an object 
+        /// attributes argument.
+        /// </summary>
+        public string GetString()
+        {
+            int length;
+            char* buffer = this.GetStringBuffer(out length);
+
+            if (buffer == null)
+                return null;
+
+            return new string(buffer, 0, length);
+        }
+
+        /// <summary>
+        /// Copies the argument into a heap object.
+        /// </summary>
+        public SsData ToData()
+        {
+            return SsLogger.ReadArgumentBlock(new MemoryRegion((IntPtr)_block));
+        }
+    }
+}
@@ -0,0 +1,79 @@
+﻿using System;
+using ProcessHacker.Native.Api;
+
+namespace ProcessHacker.Native.SsLogging
+{
+    /// <summary>
+    /// Walks the blocks written to a system service logging buffer.
+    /// </summary>
+    /// <remarks>
+    /// The ring does not do any synchronization; the caller must make sure 
+    /// that a block has been completely written before calling 
+    /// <see cref="Next"/>. This class has no dependencies on the kernel 
+    /// and can be driven by any producer which writes blocks in the same 
+    /// layout.
+    /// </remarks>
+    public unsafe sealed class SsBlockRing
+    {
+        private readonly byte* _buffer;
+        private readonly int _size;
+        private int _cursor;
+
+        public SsBlockRing(IntPtr buffer, int size)
+        {
+            _buffer = (byte*)buffer;
+            _size = size;
+        }
+
+        public IntPtr Buffer
+        {
+            get { return (IntPtr)_buffer; }
+        }
+
+        public int Cursor
+        {
+            get { return _cursor; }
+        }
+
+        public int Size
+        {
+            get { return _size; }
+        }
+
+        /// <summary>
+        /// Gets the next block and advances the cursor past it.
+        /// </summary>
+        public SsBlockView Next()
+        {
+            KphSsBlockHeader* header;
+
+            // Check if we have an implicit cursor reset.
+            if (_size - _cursor < KphSsBlockHeader.SizeOf)
+                _cursor = 0;
+
+            header = (KphSsBlockHeader*)(_buffer + _cursor);
+
+            // Check if we have an explicit cursor reset.
+            if (header->Type == KphSsBlockType.Reset)
+            {
+                _cursor = 0;
+                header = (KphSsBlockHeader*)_buffer;
+            }
+
+            // A zero-sized block would make us spin forever.
+            if (header->Size < KphSsBlockHeader.SizeOf || header->Size > _size - _cursor)
+                throw new InvalidOperationException("The block at offset " + _cursor.ToString() + " is invalid.");
+
+            SsBlockView block = new SsBlockView(header);
+
+            _cursor += header->Size;
+
+            return block;
+        }
+
+        public void Reset()
+        {
+            _cursor = 0;
+        }
+    }
+}
@@ -0,0 +1,49 @@
+﻿using System;
+
+namespace ProcessHacker.Native.SsLogging
+{
+    /// <summary>
+    /// A view of a block in a system service logging buffer. The view is 
+    /// only valid until the block is released back to the producer.
+    /// </summary>
+    public unsafe struct SsBlockView
+    {
+        private readonly KphSsBlockHeader* _header;
+
+        internal SsBlockView(KphSsBlockHeader* header)
+        {
+            _header = header;
+        }
+
+        public IntPtr Address
+        {
+            get { return (IntPtr)_header; }
+        }
+
+        public int Size
+        {
+            get { return _header->Size; }
+        }
+
+        public KphSsBlockType Type
+        {
+            get { return _header->Type; }
+        }
+
+        public SsArgumentView AsArgument()
+        {
+            if (_header->Type != KphSsBlockType.Argument)
+                throw new InvalidOperationException("The block is not an argument block.");
+
+            return new SsArgumentView((KphSsArgumentBlock*)_header);
+        }
+
+        public SsEventView AsEvent()
+        {
+            if (_header->Type != KphSsBlockType.Event)
+                throw new InvalidOperationException("The block is not an event block.");
+
+            return new SsEventView((KphSsEventBlock*)_header);
+        }
+    }
+}
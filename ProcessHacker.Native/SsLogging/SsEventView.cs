@@ -0,0 +1,112 @@
+﻿using System;
+using ProcessHacker.Native.Api;
+
+namespace ProcessHacker.Native.SsLogging
+{
+    /// <summary>
+    /// A view of an event block which reads fields directly from the 
+    /// logging buffer. The view is only valid while it is being delivered.
+    /// </summary>
+    public unsafe struct SsEventView
+    {
+        private readonly KphSsEventBlock* _block;
+
+        internal SsEventView(KphSsEventBlock* block)
+        {
+            _block = block;
+        }
+
+        public IntPtr Address
+        {
+            get { return (IntPtr)_block; }
+        }
+
+        public bool ArgumentsCopyFailed
+        {
+            get { return (_block->Flags & KphSsEventFlags.CopyArgumentsFailed) != 0; }
+        }
+
+        public bool ArgumentsProbeFailed
+        {
+            get { return (_block->Flags & KphSsEventFlags.ProbeArgumentsFailed) != 0; }
+        }
+
+        public int CallNumber
+        {
+            get { return _block->Number; }
+        }
+
+        public KphSsEventFlags Flags
+        {
+            get { return _block->Flags; }
+        }
+
+        public KProcessorMode Mode
+        {
+            get
+            {
+                if ((_block->Flags & KphSsEventFlags.UserMode) == KphSsEventFlags.UserMode)
+                    return KProcessorMode.UserMode;
+                else
+                    return KProcessorMode.KernelMode;
+            }
+        }
+
+        public int NumberOfArguments
+        {
+            get { return _block->NumberOfArguments; }
+        }
+
+        public int ProcessId
+        {
+            get { return _block->ClientId.ProcessId; }
+        }
+
+        public int Size
+        {
+            get { return _block->Header.Size; }
+        }
+
+        public int ThreadId
+        {
+            get { return _block->ClientId.ThreadId; }
+        }
+
+        /// <summary>
+        /// Gets the time of the event, in FILETIME format.
+        /// </summary>
+        public long Time
+        {
+            get { return _block->Time; }
+        }
+
+        public int TraceCount
+        {
+            get { return _block->TraceCount; }
+        }
+
+        public int GetArgument(int index)
+        {
+            if (index < 0 || index >= _block->NumberOfArguments)
+                throw new ArgumentOutOfRangeException("index");
+
+            return ((int*)((byte*)_block + _block->ArgumentsOffset))[index];
+        }
+
+        public IntPtr GetStackFrame(int index)
+        {
+            if (index < 0 || index >= _block->TraceCount)
+                throw new ArgumentOutOfRangeException("index");
+
+            return ((IntPtr*)((byte*)_block + _block->TraceOffset))[index];
+        }
+
+        /// <summary>
+        /// Copies the event into a heap object.
+        /// </summary>
+        public SsEvent ToEvent()
+        {
+            return SsLogger.ReadEventBlock(new MemoryRegion((IntPtr)_block));
+        }
+    }
+}
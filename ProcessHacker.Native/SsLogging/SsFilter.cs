@@ -0,0 +1,273 @@
+﻿using System;
+using System.Collections.Generic;
+using ProcessHacker.Native.Api;
+
+namespace ProcessHacker.Native.SsLogging
+{
+    public enum SsFilterRuleType
+    {
+        Number,
+        ProcessId,
+        ThreadId,
+        PreviousMode,
+        Argument,
+        ObjectName
+    }
+
+    internal enum SsFilterResult
+    {
+        Exclude,
+        Include,
+        NeedArguments
+    }
+
+    internal sealed class SsFilterRule
+    {
+        public IntPtr Handle;
+        public FilterType FilterType;
+        public SsFilterRuleType Type;
+        public int ArgumentIndex;
+        public int Value;
+        public string Prefix;
+    }
+
+    /// <summary>
+    /// A set of filter rules compiled into lookup tables which can be
+    /// evaluated against views of the logging buffer without allocating.
+    /// </summary>
+    /// <remarks>
+    /// Exclude rules take precedence over include rules. Events which
+    /// don't match any rule are included only if the filter includes
+    /// everything by default. Object name rules can only be evaluated
+    /// once the argument blocks following an event have been seen.
+    /// </remarks>
+    internal sealed unsafe class SsFilter
+    {
+        private sealed class RuleTable
+        {
+            public uint[] Numbers;
+            public int[] ProcessIds;
+            public int[] ThreadIds;
+            public int ModeMask;
+            public int[] ArgumentIndices;
+            public int[] ArgumentValues;
+            public int[] NameArgumentIndices;
+            public string[] NamePrefixes;
+
+            public bool HasNameRules
+            {
+                get { return this.NamePrefixes != null; }
+            }
+
+            public bool MatchesEvent(SsEventView e)
+            {
+                if (this.Numbers != null)
+                {
+                    int number = e.CallNumber;
+
+                    if (
+                        (uint)number < (uint)this.Numbers.Length * 32 &&
+                        (this.Numbers[number >> 5] & (1u << (number & 31))) != 0
+                        )
+                        return true;
+                }
+
+                if (this.ProcessIds != null && Array.BinarySearch(this.ProcessIds, e.ProcessId) >= 0)
+                    return true;
+                if (this.ThreadIds != null && Array.BinarySearch(this.ThreadIds, e.ThreadId) >= 0)
+                    return true;
+                if ((this.ModeMask & (1 << (int)e.Mode)) != 0)
+                    return true;
+
+                if (this.ArgumentIndices != null)
+                {
+                    int numberOfArguments = e.NumberOfArguments;
+
+                    for (int i = 0; i < this.ArgumentIndices.Length; i++)
+                    {
+                        int index = this.ArgumentIndices[i];
+
+                        if (index < numberOfArguments && e.GetArgument(index) == this.ArgumentValues[i])
+                            return true;
+                    }
+                }
+
+                return false;
+            }
+
+            public bool MatchesArgument(SsArgumentView a)
+            {
+                if (this.NamePrefixes == null)
+                    return false;
+
+                int length;
+                char* buffer = a.GetStringBuffer(out length);
+
+                if (buffer == null)
+                    return false;
+
+                for (int i = 0; i < this.NamePrefixes.Length; i++)
+                {
+                    string prefix = this.NamePrefixes[i];
+
+                    if (this.NameArgumentIndices[i] != -1 && this.NameArgumentIndices[i] != a.Index)
+                        continue;
+                    if (prefix.Length > length)
+                        continue;
+
+                    int j;
+
+                    // The prefixes are stored in upper case.
+                    for (j = 0; j < prefix.Length; j++)
+                    {
+                        if (char.ToUpperInvariant(buffer[j]) != prefix[j])
+                            break;
+                    }
+
+                    if (j == prefix.Length)
+                        return true;
+                }
+
+                return false;
+            }
+        }
+
+        public static SsFilter Compile(bool includeAll, ICollection<SsFilterRule> rules)
+        {
+            return new SsFilter(includeAll, rules);
+        }
+
+        private static RuleTable CompileTable(ICollection<SsFilterRule> rules, FilterType filterType)
+        {
+            RuleTable table = new RuleTable();
+            List<int> numbers = new List<int>();
+            List<int> pids = new List<int>();
+            List<int> tids = new List<int>();
+            List<int> argumentIndices = new List<int>();
+            List<int> argumentValues = new List<int>();
+            List<int> nameArgumentIndices = new List<int>();
+            List<string> namePrefixes = new List<string>();
+            int maxNumber = -1;
+
+            foreach (SsFilterRule rule in rules)
+            {
+                if (rule.FilterType != filterType)
+                    continue;
+
+                switch (rule.Type)
+                {
+                    case SsFilterRuleType.Number:
+                        numbers.Add(rule.Value);
+                        maxNumber = Math.Max(maxNumber, rule.Value);
+                        break;
+                    case SsFilterRuleType.ProcessId:
+                        pids.Add(rule.Value);
+                        break;
+                    case SsFilterRuleType.ThreadId:
+                        tids.Add(rule.Value);
+                        break;
+                    case SsFilterRuleType.PreviousMode:
+                        table.ModeMask |= 1 << rule.Value;
+                        break;
+                    case SsFilterRuleType.Argument:
+                        argumentIndices.Add(rule.ArgumentIndex);
+                        argumentValues.Add(rule.Value);
+                        break;
+                    case SsFilterRuleType.ObjectName:
+                        nameArgumentIndices.Add(rule.ArgumentIndex);
+                        namePrefixes.Add(rule.Prefix.ToUpperInvariant());
+                        break;
+                }
+            }
+
+            if (numbers.Count != 0)
+            {
+                table.Numbers = new uint[maxNumber / 32 + 1];
+
+                foreach (int number in numbers)
+                    table.Numbers[number >> 5] |= 1u << (number & 31);
+            }
+
+            if (pids.Count != 0)
+            {
+                table.ProcessIds = pids.ToArray();
+                Array.Sort(table.ProcessIds);
+            }
+
+            if (tids.Count != 0)
+            {
+                table.ThreadIds = tids.ToArray();
+                Array.Sort(table.ThreadIds);
+            }
+
+            if (argumentIndices.Count != 0)
+            {
+                table.ArgumentIndices = argumentIndices.ToArray();
+                table.ArgumentValues = argumentValues.ToArray();
+            }
+
+            if (namePrefixes.Count != 0)
+            {
+                table.NameArgumentIndices = nameArgumentIndices.ToArray();
+                table.NamePrefixes = namePrefixes.ToArray();
+            }
+
+            return table;
+        }
+
+        private readonly bool _includeAll;
+        private readonly RuleTable _include;
+        private readonly RuleTable _exclude;
+
+        private SsFilter(bool includeAll, ICollection<SsFilterRule> rules)
+        {
+            _includeAll = includeAll;
+            _include = CompileTable(rules, FilterType.Include);
+            _exclude = CompileTable(rules, FilterType.Exclude);
+        }
+
+        public bool IncludeAll
+        {
+            get { return _includeAll; }
+        }
+
+        /// <summary>
+        /// Evaluates the rules which only depend on the event block.
+        /// </summary>
+        /// <param name="e">The event block.</param>
+        /// <param name="included">Whether an include rule matched the event.</param>
+        /// <returns>
+        /// The result, or NeedArguments if the result depends on the
+        /// argument blocks which follow the event.
+        /// </returns>
+        public SsFilterResult EvaluateEvent(SsEventView e, out bool included)
+        {
+            included = false;
+
+            if (_exclude.MatchesEvent(e))
+                return SsFilterResult.Exclude;
+
+            included = _includeAll || _include.MatchesEvent(e);
+
+            if (_exclude.HasNameRules)
+                return SsFilterResult.NeedArguments;
+            if (included)
+                return SsFilterResult.Include;
+            if (_include.HasNameRules)
+                return SsFilterResult.NeedArguments;
+
+            return SsFilterResult.Exclude;
+        }
+
+        /// <summary>
+        /// Evaluates the object name rules against an argument block.
+        /// </summary>
+        public void EvaluateArgument(SsArgumentView a, ref bool included, ref bool excluded)
+        {
+            if (_exclude.MatchesArgument(a))
+                excluded = true;
+            else if (!included && _include.MatchesArgument(a))
+                included = true;
+        }
+    }
+}
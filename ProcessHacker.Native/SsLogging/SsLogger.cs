@@ -1,4 +1,5 @@
 ﻿using System;
+using System.Collections.Generic;
 using System.Threading;
 using ProcessHacker.Common;
 using ProcessHacker.Native.Api;
@@ -12,10 +13,15 @@ namespace ProcessHacker.Native.SsLogging
     public delegate void EventBlockReceivedDelegate(SsEvent eventBlock);
     public delegate void RawArgumentBlockReceivedDelegate(MemoryRegion argBlock);
     public delegate void RawEventBlockReceivedDelegate(MemoryRegion eventBlock);
+    public delegate void ArgumentViewReceivedDelegate(SsArgumentView argBlock);
+    public delegate void EventViewReceivedDelegate(SsEventView eventBlock);
 
     public sealed class SsLogger
     {
         private const int _highBlockSize = 0x200;
+        // How long an event waiting for its argument blocks is held when no 
+        // more blocks arrive, in 100ns units.
+        private const long _pendingEventTimeout = 100 * 10000;
 
         public static SsData ReadArgumentBlock(MemoryRegion data)
         {
@@ -100,7 +106,8 @@ namespace ProcessHacker.Native.SsLogging
                     break;
             }
 
-            ssArg.Index = argBlock.Index;
+            if (ssArg != null)
+                ssArg.Index = argBlock.Index;
 
             return ssArg;
         }
@@ -153,6 +160,16 @@ namespace ProcessHacker.Native.SsLogging
         public event EventBlockReceivedDelegate EventBlockReceived;
         public event RawArgumentBlockReceivedDelegate RawArgumentBlockReceived;
         public event RawEventBlockReceivedDelegate RawEventBlockReceived;
+        /// <summary>
+        /// Raised for each argument block without copying it. The view 
+        /// must not be used after the handler returns.
+        /// </summary>
+        public event ArgumentViewReceivedDelegate ArgumentViewReceived;
+        /// <summary>
+        /// Raised for each event block without copying it. The view 
+        /// must not be used after the handler returns.
+        /// </summary>
+        public event EventViewReceivedDelegate EventViewReceived;
 
         private bool _started;
         private readonly object _startLock = new object();
@@ -165,12 +182,51 @@ namespace ProcessHacker.Native.SsLogging
         private readonly VirtualMemoryAlloc _buffer;
         private readonly SemaphoreHandle _readSemaphore;
         private readonly SemaphoreHandle _writeSemaphore;
-        private int _cursor;
+        private readonly SsBlockRing _ring;
+        private readonly int _maxBatchSize;
+        private long _batchCount;
+        private long _blockCount;
+        // Set when the buffer turns out to be corrupt. We can't tell where 
+        // the driver will write its next block, so every block after that 
+        // is discarded.
+        private volatile bool _outOfSync;
+        private long _blocksDiscarded;
+
+        private enum GroupState
+        {
+            None,
+            Deliver,
+            Drop,
+            Pending
+        }
+
+        private readonly bool _includeAll;
+        private readonly List<SsFilterRule> _rules = new List<SsFilterRule>();
+        private int _nextRuleHandle;
+        private volatile SsFilter _filter;
+
+        // The event currently being filtered and its argument blocks. 
+        // Blocks are held in the buffer while we wait for the argument 
+        // blocks needed to decide whether to keep the event.
+        private GroupState _groupState;
+        private SsBlockView[] _groupBlocks = new SsBlockView[16];
+        private int _groupCount;
+        private bool _groupIncluded;
+        private bool _groupExcluded;
+        private SsFilter _groupFilter;
+        private long _eventsAccepted;
+        private long _eventsRejected;
 
         public SsLogger(int bufferedBlockCount, bool includeAll)
         {
+            _includeAll = includeAll;
+            this.CompileRules();
             // Allocate a buffer.
             _buffer = new VirtualMemoryAlloc(_highBlockSize * bufferedBlockCount);
+            _ring = new SsBlockRing(_buffer, _buffer.Size);
+            // Don't hold on to more than a quarter of the buffer, otherwise 
+            // the driver will start dropping blocks while we process them.
+            _maxBatchSize = Math.Max(1, bufferedBlockCount / 4);
 
             // Create the read and write semaphores.
 
@@ -196,41 +252,102 @@ namespace ProcessHacker.Native.SsLogging
             //    );
         }
 
-        //public IntPtr AddNumberRule(FilterType filterType, int number)
-        //{
-        //    return KProcessHacker.Instance.SsAddNumberRule(
-        //        _ruleSetEntryHandle,
-        //        filterType.ToKphSs(),
-        //        number
-        //        );
-        //}
-
-        //public IntPtr AddPreviousModeRule(FilterType filterType, KProcessorMode previousMode)
-        //{
-        //    return KProcessHacker.Instance.SsAddPreviousModeRule(
-        //        _ruleSetEntryHandle,
-        //        filterType.ToKphSs(),
-        //        previousMode
-        //        );
-        //}
-
-        //public IntPtr AddProcessIdRule(FilterType filterType, int pid)
-        //{
-        //    return KProcessHacker.Instance.SsAddProcessIdRule(
-        //        _ruleSetEntryHandle,
-        //        filterType.ToKphSs(),
-        //        pid.ToIntPtr()
-        //        );
-        //}
-
-        //public IntPtr AddThreadIdRule(FilterType filterType, int tid)
-        //{
-        //    return KProcessHacker.Instance.SsAddProcessIdRule(
-        //        _ruleSetEntryHandle,
-        //        filterType.ToKphSs(),
-        //        tid.ToIntPtr()
-        //        );
-        //}
+        private IntPtr AddRule(SsFilterRule rule)
+        {
+            lock (_rules)
+            {
+                rule.Handle = new IntPtr(++_nextRuleHandle);
+                _rules.Add(rule);
+                this.CompileRules();
+            }
+
+            return rule.Handle;
+        }
+
+        public IntPtr AddArgumentRule(FilterType filterType, int index, int value)
+        {
+            return this.AddRule(new SsFilterRule
+            {
+                FilterType = filterType,
+                Type = SsFilterRuleType.Argument,
+                ArgumentIndex = index,
+                Value = value
+            });
+        }
+
+        public IntPtr AddNumberRule(FilterType filterType, int number)
+        {
+            if (number < 0)
+                throw new ArgumentOutOfRangeException("number");
+
+            return this.AddRule(new SsFilterRule
+            {
+                FilterType = filterType,
+                Type = SsFilterRuleType.Number,
+                Value = number
+            });
+        }
+
+        /// <summary>
+        /// Adds a rule which matches events with a string or object 
+        /// attributes argument whose name starts with the specified prefix. 
+        /// The comparison is case-insensitive.
+        /// </summary>
+        /// <param name="filterType">The action to take when the rule matches.</param>
+        /// <param name="index">The index of the argument, or -1 to match any argument.</param>
+        /// <param name="prefix">The name prefix.</param>
+        public IntPtr AddObjectNameRule(FilterType filterType, int index, string prefix)
+        {
+            if (prefix == null)
+                throw new ArgumentNullException("prefix");
+
+            return this.AddRule(new SsFilterRule
+            {
+                FilterType = filterType,
+                Type = SsFilterRuleType.ObjectName,
+                ArgumentIndex = index,
+                Prefix = prefix
+            });
+        }
+
+        public IntPtr AddPreviousModeRule(FilterType filterType, KProcessorMode previousMode)
+        {
+            return this.AddRule(new SsFilterRule
+            {
+                FilterType = filterType,
+                Type = SsFilterRuleType.PreviousMode,
+                Value = (int)previousMode
+            });
+        }
+
+        public IntPtr AddProcessIdRule(FilterType filterType, int pid)
+        {
+            return this.AddRule(new SsFilterRule
+            {
+                FilterType = filterType,
+                Type = SsFilterRuleType.ProcessId,
+                Value = pid
+            });
+        }
+
+        public IntPtr AddThreadIdRule(FilterType filterType, int tid)
+        {
+            return this.AddRule(new SsFilterRule
+            {
+                FilterType = filterType,
+                Type = SsFilterRuleType.ThreadId,
+                Value = tid
+            });
+        }
+
+        private void CompileRules()
+        {
+            // The worker thread picks up the new filter at the next event.
+            if (_includeAll && _rules.Count == 0)
+                _filter = null;
+            else
+                _filter = SsFilter.Compile(_includeAll, _rules);
+        }
 
         private void BufferWorkerThreadStart()
         {
@@ -244,52 +361,276 @@ namespace ProcessHacker.Native.SsLogging
             while (!_terminating)
             {
                 NtStatus status;
-                KphSsBlockHeader blockHeader;
+                int count;
 
                 // Wait for a block to read (enable alerting so we can 
-                // be interrupted if someone wants us to stop).
-                status = _readSemaphore.Wait(true);
+                // be interrupted if someone wants us to stop). If an event 
+                // is waiting for its argument blocks, don't wait forever; 
+                // the driver may not log anything else for a while.
+                if (_groupCount != 0)
+                    status = _readSemaphore.Wait(true, _pendingEventTimeout);
+                else
+                    status = _readSemaphore.Wait(true);
 
                 // Did we get alerted?
                 if (status == NtStatus.Alerted)
-                    return;
+                    break;
 
-                // Check if we have an implicit cursor reset.
-                if (_buffer.Size - _cursor < KphSsBlockHeader.SizeOf)
-                    _cursor = 0;
+                if (status == NtStatus.Timeout)
+                {
+                    int pending = _groupCount;
 
-                // Read the block header.
-                blockHeader = _buffer.ReadStruct<KphSsBlockHeader>(_cursor, KphSsBlockHeader.SizeOf, 0);
+                    this.FinishGroup();
+                    _writeSemaphore.Release(pending);
 
-                // Check if we have an explicit cursor reset.
-                if (blockHeader.Type == KphSsBlockType.Reset)
-                {
-                    _cursor = 0;
-                    blockHeader = _buffer.ReadStruct<KphSsBlockHeader>(_cursor, KphSsBlockHeader.SizeOf, 0);
+                    continue;
                 }
 
-                // Process the block.
-                switch (blockHeader.Type)
+                // Take any other blocks which are ready without blocking, 
+                // so a burst of events only wakes us up once.
+                count = 1;
+
+                while (count < _maxBatchSize && _readSemaphore.Wait(false, 0) == NtStatus.Success)
+                    count++;
+
+                int held = _groupCount;
+                int processed = 0;
+
+                if (!_outOfSync)
                 {
-                    case KphSsBlockType.Event:
-                        if (this.EventBlockReceived != null)
-                            this.EventBlockReceived(ReadEventBlock(new MemoryRegion(this._buffer, this._cursor)));
-                        if (this.RawEventBlockReceived != null)
-                            this.RawEventBlockReceived(new MemoryRegion(this._buffer, this._cursor));
-                        break;
-                    case KphSsBlockType.Argument:
-                        if (this.ArgumentBlockReceived != null)
-                            this.ArgumentBlockReceived(ReadArgumentBlock(new MemoryRegion(this._buffer, this._cursor)));
-                        if (this.RawArgumentBlockReceived != null)
-                            this.RawArgumentBlockReceived(new MemoryRegion(this._buffer, this._cursor));
-                        break;
+                    try
+                    {
+                        for (; processed < count; processed++)
+                            this.FilterBlock(_ring.Next());
+                    }
+                    catch (InvalidOperationException ex)
+                    {
+                        // The buffer is corrupt. The driver keeps writing 
+                        // from its own cursor, which we have no way of 
+                        // finding, so reading from anywhere else (such as 
+                        // the start of the buffer) would only misinterpret 
+                        // its blocks. Drop the event we were holding and 
+                        // everything after it.
+                        Logging.Log(ex);
+                        _outOfSync = true;
+                        Interlocked.Add(ref _blocksDiscarded, _groupCount);
+                        this.ResetGroup();
+                    }
                 }
 
-                // Advance the cursor.
-                _cursor += blockHeader.Size;
-                // Signal that a buffer block is available for writing.
-                _writeSemaphore.Release();
+                if (_outOfSync)
+                    Interlocked.Add(ref _blocksDiscarded, count - processed);
+
+                Interlocked.Increment(ref _batchCount);
+                Interlocked.Add(ref _blockCount, count);
+
+                // Signal that the buffer blocks are available for writing. 
+                // Blocks belonging to an event which hasn't been decided yet 
+                // are kept until the next batch, so this can be zero, which 
+                // the semaphore doesn't accept.
+                int released = count + held - _groupCount;
+
+                if (released != 0)
+                    _writeSemaphore.Release(released);
             }
+
+            // Deliver whatever we have for the last event.
+            int remaining = _groupCount;
+
+            this.FinishGroup();
+            this.ResetGroup();
+
+            if (remaining != 0)
+                _writeSemaphore.Release(remaining);
+        }
+
+        private void FilterBlock(SsBlockView block)
+        {
+            switch (block.Type)
+            {
+                case KphSsBlockType.Event:
+                    {
+                        this.FinishGroup();
+
+                        SsFilter filter = _filter;
+                        bool included;
+
+                        _groupFilter = filter;
+                        _groupIncluded = false;
+                        _groupExcluded = false;
+
+                        if (filter == null)
+                        {
+                            _groupState = GroupState.Deliver;
+                        }
+                        else
+                        {
+                            switch (filter.EvaluateEvent(block.AsEvent(), out included))
+                            {
+                                case SsFilterResult.Include:
+                                    _groupState = GroupState.Deliver;
+                                    break;
+                                case SsFilterResult.Exclude:
+                                    _groupState = GroupState.Drop;
+                                    break;
+                                default:
+                                    _groupState = GroupState.Pending;
+                                    _groupIncluded = included;
+                                    break;
+                            }
+                        }
+
+                        if (_groupState == GroupState.Deliver)
+                        {
+                            Interlocked.Increment(ref _eventsAccepted);
+                            this.ProcessBlock(block);
+                        }
+                        else if (_groupState == GroupState.Drop)
+                        {
+                            Interlocked.Increment(ref _eventsRejected);
+                        }
+                        else
+                        {
+                            this.HoldBlock(block);
+                        }
+                    }
+                    break;
+                case KphSsBlockType.Argument:
+                    if (_groupState == GroupState.Deliver)
+                    {
+                        this.ProcessBlock(block);
+                    }
+                    else if (_groupState == GroupState.Pending)
+                    {
+                        this.HoldBlock(block);
+                        _groupFilter.EvaluateArgument(block.AsArgument(), ref _groupIncluded, ref _groupExcluded);
+
+                        // Decide now if we can, and don't hold on to so 
+                        // many blocks that the driver can't give us the 
+                        // next event.
+                        if (_groupExcluded || _groupCount >= _maxBatchSize)
+                            this.FinishGroup();
+                    }
+                    break;
+            }
+        }
+
+        private void HoldBlock(SsBlockView block)
+        {
+            if (_groupCount == _groupBlocks.Length)
+                Array.Resize(ref _groupBlocks, _groupBlocks.Length * 2);
+
+            _groupBlocks[_groupCount++] = block;
+        }
+
+        private void FinishGroup()
+        {
+            if (_groupState != GroupState.Pending)
+                return;
+
+            if (!_groupExcluded && _groupIncluded)
+            {
+                _groupState = GroupState.Deliver;
+                Interlocked.Increment(ref _eventsAccepted);
+
+                for (int i = 0; i < _groupCount; i++)
+                    this.ProcessBlock(_groupBlocks[i]);
+            }
+            else
+            {
+                _groupState = GroupState.Drop;
+                Interlocked.Increment(ref _eventsRejected);
+            }
+
+            _groupCount = 0;
+        }
+
+        private void ResetGroup()
+        {
+            _groupState = GroupState.None;
+            _groupCount = 0;
+        }
+
+        private void ProcessBlock(SsBlockView block)
+        {
+            try
+            {
+                this.DeliverBlock(block);
+            }
+            catch (Exception ex)
+            {
+                // An exception thrown by a handler says nothing about the 
+                // state of the buffer, so keep going.
+                Logging.Log(ex);
+            }
+        }
+
+        private void DeliverBlock(SsBlockView block)
+        {
+            switch (block.Type)
+            {
+                case KphSsBlockType.Event:
+                    if (this.EventViewReceived != null)
+                        this.EventViewReceived(block.AsEvent());
+                    if (this.EventBlockReceived != null)
+                        this.EventBlockReceived(block.AsEvent().ToEvent());
+                    if (this.RawEventBlockReceived != null)
+                        this.RawEventBlockReceived(new MemoryRegion(block.Address));
+                    break;
+                case KphSsBlockType.Argument:
+                    if (this.ArgumentViewReceived != null)
+                        this.ArgumentViewReceived(block.AsArgument());
+                    if (this.ArgumentBlockReceived != null)
+                        this.ArgumentBlockReceived(block.AsArgument().ToData());
+                    if (this.RawArgumentBlockReceived != null)
+                        this.RawArgumentBlockReceived(new MemoryRegion(block.Address));
+                    break;
+            }
+        }
+
+        /// <summary>
+        /// Gets the number of blocks processed and the number of times the 
+        /// worker thread woke up to process them.
+        /// </summary>
+        public void GetConsumerStatistics(out long blocksRead, out long batches)
+        {
+            blocksRead = Interlocked.Read(ref _blockCount);
+            batches = Interlocked.Read(ref _batchCount);
+        }
+
+        // The driver writes blocks to the buffer and signals the read 
+        // semaphore. Tests use these to stand in for it.
+        internal SsBlockRing Ring
+        {
+            get { return _ring; }
+        }
+
+        internal SemaphoreHandle ReadSemaphore
+        {
+            get { return _readSemaphore; }
+        }
+
+        internal SemaphoreHandle WriteSemaphore
+        {
+            get { return _writeSemaphore; }
+        }
+
+        /// <summary>
+        /// Gets the number of blocks which were discarded because the 
+        /// buffer was corrupt.
+        /// </summary>
+        public long BlocksDiscarded
+        {
+            get { return Interlocked.Read(ref _blocksDiscarded); }
+        }
+
+        /// <summary>
+        /// Gets whether the buffer was found to be corrupt. No more events 
+        /// are delivered after this happens.
+        /// </summary>
+        public bool OutOfSync
+        {
+            get { return _outOfSync; }
         }
 
         public void GetStatistics(out int blocksWritten, out int blocksDropped)
@@ -311,9 +652,28 @@ namespace ProcessHacker.Native.SsLogging
             blocksDropped = 0;
         }
 
+        /// <summary>
+        /// Gets the number of events which were delivered and the number 
+        /// of events which were removed by the filter rules.
+        /// </summary>
+        public void GetFilterStatistics(out long eventsAccepted, out long eventsRejected)
+        {
+            eventsAccepted = Interlocked.Read(ref _eventsAccepted);
+            eventsRejected = Interlocked.Read(ref _eventsRejected);
+        }
+
         public void RemoveRule(IntPtr handle)
         {
-            //KProcessHacker.Instance.SsRemoveRule(_ruleSetEntryHandle, handle);
+            lock (_rules)
+            {
+                int index = _rules.FindIndex((rule) => rule.Handle == handle);
+
+                if (index != -1)
+                {
+                    _rules.RemoveAt(index);
+                    this.CompileRules();
+                }
+            }
         }
 
         public void Start()
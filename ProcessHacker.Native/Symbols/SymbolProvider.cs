@@ -334,8 +334,10 @@ namespace ProcessHacker.Native.Symbols
             }
 
             // Allocate some memory for the symbol information.
-            using (MemoryAlloc data = new MemoryAlloc(SymbolInfo.SizeOf + _maxNameLen))
+            using (MemoryAllocScope scope = new MemoryAllocScope())
             {
+                MemoryRegion data = scope.Allocate(SymbolInfo.SizeOf + _maxNameLen);
+
                 SymbolInfo info = new SymbolInfo
                 {
                     SizeOfStruct = SymbolInfo.SizeOf, 
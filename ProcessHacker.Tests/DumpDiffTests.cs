@@ -0,0 +1,286 @@
+﻿/*
+ * Process Hacker -
+ *   dump comparison tests
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Text;
+using DumpAnalyzer;
+using ProcessHacker.Native.Mfs;
+
+namespace ProcessHacker.Tests
+{
+    public static unsafe class DumpDiffTests
+    {
+        private sealed class TestProcess
+        {
+            public int ProcessId;
+            public long StartTime;
+            public string FileName;
+            // Handle values and object addresses.
+            public readonly List<KeyValuePair<int, long>> Handles = new List<KeyValuePair<int, long>>();
+            // Base addresses and file names.
+            public readonly List<KeyValuePair<long, string>> Modules = new List<KeyValuePair<long, string>>();
+
+            public TestProcess(int processId, long startTime, string fileName)
+            {
+                this.ProcessId = processId;
+                this.StartTime = startTime;
+                this.FileName = fileName;
+            }
+
+            public TestProcess Handle(int handle, long obj)
+            {
+                this.Handles.Add(new KeyValuePair<int, long>(handle, obj));
+                return this;
+            }
+
+            public TestProcess Module(long baseAddress, string fileName)
+            {
+                this.Modules.Add(new KeyValuePair<long, string>(baseAddress, fileName));
+                return this;
+            }
+        }
+
+        private static void WriteDictionary(MemoryObject mo, params string[] pairs)
+        {
+            StringBuilder sb = new StringBuilder();
+
+            for (int i = 0; i < pairs.Length; i += 2)
+                sb.Append(pairs[i] + "=" + pairs[i + 1] + "\0");
+
+            mo.AppendData(Encoding.Unicode.GetBytes(sb.ToString()));
+        }
+
+        private static void WriteProcess(MemoryObject processesMo, TestProcess process)
+        {
+            // Lay the process out like Dump does.
+            using (MemoryObject processMo = processesMo.CreateChild(process.ProcessId.ToString("x")))
+            {
+                using (MemoryObject generalMo = processMo.CreateChild("General"))
+                {
+                    WriteDictionary(
+                        generalMo,
+                        "ProcessId", process.ProcessId.ToString("x"),
+                        "Name", Path.GetFileName(process.FileName),
+                        "StartTime", process.StartTime.ToString("x"),
+                        "FileName", process.FileName
+                        );
+                }
+
+                DumpTableWriter handles = new DumpTableWriter(DumpHandleRecord.SizeOf);
+
+                foreach (KeyValuePair<int, long> pair in process.Handles)
+                {
+                    DumpHandleRecord record;
+
+                    record.Object = pair.Value;
+                    record.Handle = pair.Key;
+                    record.Flags = 0;
+                    record.GrantedAccess = 0;
+                    record.TypeName = handles.AddString("File");
+                    record.ObjectName = handles.AddString(@"\Device\Object" + pair.Value.ToString("x"));
+                    handles.AddRecord(&record);
+                }
+
+                using (MemoryObject handlesMo = processMo.CreateChild("HandleTable"))
+                    handlesMo.AppendData(handles.ToArray());
+
+                DumpTableWriter modules = new DumpTableWriter(DumpModuleRecord.SizeOf);
+
+                foreach (KeyValuePair<long, string> pair in process.Modules)
+                {
+                    DumpModuleRecord record;
+
+                    record.BaseAddress = pair.Key;
+                    record.Size = 0x1000;
+                    record.Flags = 0;
+                    record.Name = modules.AddString(Path.GetFileName(pair.Value));
+                    record.FileName = modules.AddString(pair.Value);
+                    record.FileDescription = -1;
+                    record.FileCompanyName = -1;
+                    record.FileVersion = -1;
+                    modules.AddRecord(&record);
+                }
+
+                using (MemoryObject modulesMo = processMo.CreateChild("ModuleTable"))
+                    modulesMo.AppendData(modules.ToArray());
+            }
+        }
+
+        private static MemoryFileSystemTests.MemoryStorage CreateDump(params TestProcess[] processes)
+        {
+            MemoryFileSystemTests.MemoryStorage storage = new MemoryFileSystemTests.MemoryStorage(16 * 0x10000);
+
+            using (MemoryFileSystem mfs = new MemoryFileSystem(storage, null))
+            using (MemoryObject processesMo = mfs.RootObject.CreateChild("Processes"))
+            {
+                foreach (TestProcess process in processes)
+                    WriteProcess(processesMo, process);
+            }
+
+            return storage;
+        }
+
+        /// <summary>
+        /// Compares two dumps and describes each difference as 
+        /// "kind category PID item".
+        /// </summary>
+        private static List<string> Compare(TestProcess[] oldProcesses, TestProcess[] newProcesses)
+        {
+            MemoryFileSystemTests.MemoryStorage oldStorage = CreateDump(oldProcesses);
+            MemoryFileSystemTests.MemoryStorage newStorage = CreateDump(newProcesses);
+            List<string> differences = new List<string>();
+
+            try
+            {
+                using (DumpFile oldDump = new DumpFile(new MemoryFileSystem(oldStorage.Reopen(true), null)))
+                using (DumpFile newDump = new DumpFile(new MemoryFileSystem(newStorage.Reopen(true), null)))
+                {
+                    new DumpDiff(oldDump, newDump).Compare(entry =>
+                        differences.Add(
+                            entry.Kind + " " + entry.Category + " " + entry.ProcessId.ToString() + " " +
+                            entry.Item.Replace('\t', ' ') +
+                            (entry.Kind == DumpDiffKind.Changed ? " " + entry.OldValue + " -> " + entry.NewValue : "")
+                            ));
+                }
+            }
+            finally
+            {
+                oldStorage.Free();
+                newStorage.Free();
+            }
+
+            return differences;
+        }
+
+        private static void AssertDifferences(List<string> actual, params string[] expected)
+        {
+            Assert.AreEqual(
+                string.Join("\n", expected),
+                string.Join("\n", actual.ToArray()),
+                "Differences"
+                );
+        }
+
+        [Test]
+        public static void ReportsAddedAndRemovedProcesses()
+        {
+            List<string> differences = Compare(
+                new TestProcess[]
+                {
+                    new TestProcess(8, 100, @"C:\a.exe"),
+                    new TestProcess(12, 100, @"C:\b.exe")
+                },
+                new TestProcess[]
+                {
+                    new TestProcess(8, 100, @"C:\a.exe"),
+                    new TestProcess(16, 200, @"C:\c.exe")
+                });
+
+            AssertDifferences(
+                differences,
+                @"Removed Process 12 C:\b.exe",
+                @"Added Process 16 C:\c.exe"
+                );
+        }
+
+        [Test]
+        public static void ReusedProcessIdsAreDifferentProcesses()
+        {
+            // The same PID with a different creation time or image is a 
+            // new process, so its handles and modules are not compared.
+            List<string> differences = Compare(
+                new TestProcess[]
+                {
+                    new TestProcess(20, 100, @"C:\a.exe").Handle(4, 0x1000),
+                    new TestProcess(24, 100, @"C:\b.exe")
+                },
+                new TestProcess[]
+                {
+                    new TestProcess(20, 300, @"C:\a.exe").Handle(4, 0x2000),
+                    new TestProcess(24, 100, @"C:\c.exe")
+                });
+
+            AssertDifferences(
+                differences,
+                @"Removed Process 20 C:\a.exe",
+                @"Added Process 20 C:\a.exe",
+                @"Removed Process 24 C:\b.exe",
+                @"Added Process 24 C:\c.exe"
+                );
+        }
+
+        [Test]
+        public static void MatchesHandlesByValueAndObject()
+        {
+            List<string> differences = Compare(
+                new TestProcess[]
+                {
+                    new TestProcess(8, 100, @"C:\a.exe").Handle(4, 0x1000).Handle(8, 0x2000).Handle(12, 0x3000)
+                },
+                new TestProcess[]
+                {
+                    // Unsorted, and handle 8 was closed and reused for 
+                    // another object.
+                    new TestProcess(8, 100, @"C:\a.exe").Handle(16, 0x4000).Handle(8, 0x2800).Handle(4, 0x1000)
+                });
+
+            AssertDifferences(
+                differences,
+                @"Removed Handle 8 0x8 File \Device\Object2000",
+                @"Added Handle 8 0x8 File \Device\Object2800",
+                @"Removed Handle 8 0xc File \Device\Object3000",
+                @"Added Handle 8 0x10 File \Device\Object4000"
+                );
+        }
+
+        [Test]
+        public static void MatchesModulesByBaseAddressAndFileName()
+        {
+            List<string> differences = Compare(
+                new TestProcess[]
+                {
+                    new TestProcess(8, 100, @"C:\a.exe")
+                        .Module(0x400000, @"C:\a.exe")
+                        .Module(0x10000000, @"C:\x.dll")
+                },
+                new TestProcess[]
+                {
+                    // File names are compared without regard to case, and 
+                    // another DLL was loaded at the address of x.dll.
+                    new TestProcess(8, 100, @"C:\a.exe")
+                        .Module(0x20000000, @"C:\z.dll")
+                        .Module(0x10000000, @"C:\y.dll")
+                        .Module(0x400000, @"C:\A.EXE")
+                });
+
+            AssertDifferences(
+                differences,
+                "Changed Counter 8 Modules 2 -> 3",
+                @"Removed Module 8 0x10000000 C:\x.dll",
+                @"Added Module 8 0x10000000 C:\y.dll",
+                @"Added Module 8 0x20000000 C:\z.dll"
+                );
+        }
+    }
+}
@@ -0,0 +1,162 @@
+﻿/*
+ * Process Hacker -
+ *   dump record table tests
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.Runtime.InteropServices;
+
+namespace ProcessHacker.Tests
+{
+    public static unsafe class DumpTableTests
+    {
+        private static byte[] CreateTable(int count)
+        {
+            DumpTableWriter writer = new DumpTableWriter(DumpHandleRecord.SizeOf, count);
+
+            for (int i = 0; i < count; i++)
+            {
+                DumpHandleRecord record;
+
+                record.Object = 0x7ff00000000 + i * 0x40L;
+                record.Handle = (i + 1) * 4;
+                record.Flags = i % 3;
+                record.GrantedAccess = 0x1fffff;
+                // Type names are shared between many handles.
+                record.TypeName = writer.AddString(i % 2 == 0 ? "File" : "Key");
+                record.ObjectName = i % 5 == 0 ? -1 : writer.AddString(@"\Device\Object" + i.ToString());
+
+                writer.AddRecord(&record);
+            }
+
+            return writer.ToArray();
+        }
+
+        private static void SetHeaderField(byte[] data, string field, int value)
+        {
+            fixed (byte* dataPtr = data)
+                *(int*)(dataPtr + Marshal.OffsetOf(typeof(DumpTableHeader), field).ToInt32()) = value;
+        }
+
+        [Test]
+        public static void RoundTripsRecordsAndStrings()
+        {
+            using (DumpTableReader reader = DumpTableReader.Open(CreateTable(100), DumpHandleRecord.SizeOf))
+            {
+                Assert.IsTrue(reader != null, "Table is valid");
+                Assert.AreEqual(100, reader.RecordCount, "Record count");
+
+                for (int i = 0; i < 100; i++)
+                {
+                    DumpHandleRecord* record = (DumpHandleRecord*)reader.GetRecord(i);
+
+                    Assert.AreEqual(0x7ff00000000 + i * 0x40L, record->Object, "Object");
+                    Assert.AreEqual((i + 1) * 4, record->Handle, "Handle");
+                    Assert.AreEqual(i % 3, record->Flags, "Flags");
+                    Assert.AreEqual(i % 2 == 0 ? "File" : "Key", reader.GetString(record->TypeName), "Type name");
+                    Assert.AreEqual(i % 5 == 0 ? null : @"\Device\Object" + i.ToString(), reader.GetString(record->ObjectName), "Object name");
+                }
+
+                Assert.Throws<ArgumentOutOfRangeException>(() => reader.GetRecord(100), "Record past the end");
+                Assert.AreEqual(null, reader.GetString(0x7fffffff), "String offset past the end");
+            }
+        }
+
+        [Test]
+        public static void RoundTripsEmptyTable()
+        {
+            byte[] data = new DumpTableWriter(DumpModuleRecord.SizeOf).ToArray();
+
+            using (DumpTableReader reader = DumpTableReader.Open(data, DumpModuleRecord.SizeOf))
+            {
+                Assert.IsTrue(reader != null, "Table is valid");
+                Assert.AreEqual(0, reader.RecordCount, "Record count");
+            }
+        }
+
+        [Test]
+        public static void RejectsMalformedHeaders()
+        {
+            byte[] valid = CreateTable(10);
+            int stringsOffset = DumpTableHeader.SizeOf + 10 * DumpHandleRecord.SizeOf;
+
+            Assert.IsTrue(DumpTableReader.Open(new byte[DumpTableHeader.SizeOf - 1], DumpHandleRecord.SizeOf) == null, "Truncated header");
+            Assert.IsTrue(DumpTableReader.Open(valid, DumpHandleRecord.SizeOf + 4) == null, "Records are too small");
+
+            object[][] cases = new object[][]
+            {
+                new object[] { "Magic", 0x12345678 },
+                new object[] { "RecordCount", -1 },
+                // The records would overlap the string table.
+                new object[] { "RecordCount", 11 },
+                new object[] { "RecordSize", DumpHandleRecord.SizeOf + 1 },
+                new object[] { "RecordCount", int.MaxValue },
+                // The string table would overlap the header.
+                new object[] { "StringsOffset", DumpTableHeader.SizeOf - 4 },
+                new object[] { "StringsOffset", -1 },
+                new object[] { "StringsOffset", valid.Length },
+                new object[] { "StringsLength", -1 },
+                new object[] { "StringsLength", valid.Length - stringsOffset + 1 }
+            };
+
+            foreach (object[] c in cases)
+            {
+                byte[] data = (byte[])valid.Clone();
+
+                SetHeaderField(data, (string)c[0], (int)c[1]);
+                Assert.IsTrue(DumpTableReader.Open(data, DumpHandleRecord.SizeOf) == null, c[0] + " = " + c[1]);
+            }
+
+            // The records must start after the header: a table whose
+            // records end exactly at the string table is valid, but not
+            // if the header is not taken into account.
+            {
+                byte[] data = (byte[])valid.Clone();
+
+                SetHeaderField(data, "StringsOffset", 10 * DumpHandleRecord.SizeOf);
+                Assert.IsTrue(DumpTableReader.Open(data, DumpHandleRecord.SizeOf) == null, "Records overlap the string table");
+            }
+
+            using (DumpTableReader reader = DumpTableReader.Open(valid, DumpHandleRecord.SizeOf))
+                Assert.IsTrue(reader != null, "Unmodified table is valid");
+        }
+
+        [Benchmark]
+        public static void WriteAndLoadBenchmark()
+        {
+            byte[] data = CreateTable(100000);
+
+            Benchmark.Run("Write 100k handles", 10, () => CreateTable(100000));
+            Benchmark.Run("Load 100k handles", 10, () =>
+            {
+                using (DumpTableReader reader = DumpTableReader.Open(data, DumpHandleRecord.SizeOf))
+                {
+                    for (int i = 0; i < reader.RecordCount; i++)
+                    {
+                        DumpHandleRecord* record = (DumpHandleRecord*)reader.GetRecord(i);
+
+                        reader.GetString(record->TypeName);
+                        reader.GetString(record->ObjectName);
+                    }
+                }
+            });
+        }
+    }
+}
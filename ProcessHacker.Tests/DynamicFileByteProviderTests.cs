@@ -0,0 +1,172 @@
+﻿/*
+ * Process Hacker -
+ *   dynamic file byte provider tests
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.Collections.Generic;
+using System.IO;
+using Be.Windows.Forms;
+
+namespace ProcessHacker.Tests
+{
+    public static class DynamicFileByteProviderTests
+    {
+        private static void WithFile(int length, Action<string, List<byte>> action)
+        {
+            string fileName = Path.GetTempFileName();
+            List<byte> expected = new List<byte>(length);
+
+            for (int i = 0; i < length; i++)
+                expected.Add((byte)(i % 251));
+
+            try
+            {
+                File.WriteAllBytes(fileName, expected.ToArray());
+                action(fileName, expected);
+            }
+            finally
+            {
+                File.Delete(fileName);
+            }
+        }
+
+        private static void AssertContents(DynamicFileByteProvider provider, List<byte> expected, string message)
+        {
+            byte[] buffer = new byte[expected.Count + 16];
+
+            Assert.AreEqual((long)expected.Count, provider.Length, message + ": length");
+            Assert.AreEqual(expected.Count, provider.ReadBytes(0, buffer, 0, buffer.Length), message + ": bytes read");
+
+            for (int i = 0; i < expected.Count; i++)
+            {
+                if (buffer[i] != expected[i])
+                    Assert.AreEqual(expected[i], buffer[i], message + ": byte " + i.ToString());
+            }
+        }
+
+        [Test]
+        public static void ReadsAcrossEditedBlocks()
+        {
+            WithFile(0x10000, (fileName, expected) =>
+                {
+                    Random random = new Random(1);
+
+                    using (DynamicFileByteProvider provider = new DynamicFileByteProvider(fileName))
+                    {
+                        for (int i = 0; i < 300; i++)
+                        {
+                            long index = random.Next(expected.Count);
+
+                            switch (random.Next(3))
+                            {
+                                case 0:
+                                    byte value = (byte)random.Next(256);
+
+                                    provider.WriteByte(index, value);
+                                    expected[(int)index] = value;
+                                    break;
+                                case 1:
+                                    byte[] bytes = new byte[random.Next(1, 64)];
+
+                                    random.NextBytes(bytes);
+                                    provider.InsertBytes(index, bytes);
+                                    expected.InsertRange((int)index, bytes);
+                                    break;
+                                case 2:
+                                    int length = (int)Math.Min(random.Next(1, 64), expected.Count - index);
+
+                                    provider.DeleteBytes(index, length);
+                                    expected.RemoveRange((int)index, length);
+                                    break;
+                            }
+
+                            // Reads which start in one block and end in another.
+                            for (int j = 0; j < 4; j++)
+                            {
+                                int start = random.Next(expected.Count);
+                                int count = random.Next(1, 200);
+                                byte[] buffer = new byte[count];
+                                int read = provider.ReadBytes(start, buffer, 0, count);
+
+                                Assert.AreEqual(Math.Min(count, expected.Count - start), read, "Bytes read");
+
+                                for (int k = 0; k < read; k++)
+                                {
+                                    if (buffer[k] != expected[start + k])
+                                        Assert.AreEqual(expected[start + k], buffer[k], "Byte " + (start + k).ToString() + " after edit " + i.ToString());
+                                }
+
+                                Assert.AreEqual(expected[start], provider.ReadByte(start), "ReadByte");
+                            }
+                        }
+
+                        AssertContents(provider, expected, "After editing");
+
+                        provider.ApplyChanges();
+                        AssertContents(provider, expected, "After saving");
+                    }
+
+                    byte[] saved = File.ReadAllBytes(fileName);
+
+                    Assert.AreEqual(expected.Count, saved.Length, "Saved length");
+
+                    for (int i = 0; i < saved.Length; i++)
+                    {
+                        if (saved[i] != expected[i])
+                            Assert.AreEqual(expected[i], saved[i], "Saved byte " + i.ToString());
+                    }
+                });
+        }
+
+        [Test]
+        public static void EditsInsideMemoryBlocksKeepLaterOffsets()
+        {
+            WithFile(1000, (fileName, expected) =>
+                {
+                    using (DynamicFileByteProvider provider = new DynamicFileByteProvider(fileName))
+                    {
+                        byte[] bytes = new byte[] { 1, 2, 3, 4, 5, 6, 7, 8 };
+
+                        // Create a memory block in the middle of the file, 
+                        // then grow and shrink it.
+                        provider.InsertBytes(500, bytes);
+                        expected.InsertRange(500, bytes);
+                        Assert.AreEqual(expected[900], provider.ReadByte(900), "Byte after the inserted block");
+
+                        provider.InsertBytes(504, bytes);
+                        expected.InsertRange(504, bytes);
+                        Assert.AreEqual(expected[900], provider.ReadByte(900), "Byte after inserting into the block");
+
+                        // Appends to the memory block before a file block.
+                        provider.InsertBytes(516, bytes);
+                        expected.InsertRange(516, bytes);
+                        Assert.AreEqual(expected[900], provider.ReadByte(900), "Byte after appending to the block");
+
+                        provider.DeleteBytes(502, 10);
+                        expected.RemoveRange(502, 10);
+                        Assert.AreEqual(expected[900], provider.ReadByte(900), "Byte after deleting from the block");
+
+                        AssertContents(provider, expected, "After editing");
+                    }
+                });
+        }
+    }
+}
@@ -0,0 +1,388 @@
+﻿/*
+ * Process Hacker -
+ *   free list tests
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.Collections.Generic;
+using System.Runtime.CompilerServices;
+using System.Threading;
+using ProcessHacker.Common;
+
+namespace ProcessHacker.Tests
+{
+    public static class FreeListTests
+    {
+        /// <summary>
+        /// The free list this implementation replaced, for comparison.
+        /// </summary>
+        private class BaselineFreeList<T> where T : IResettable, new()
+        {
+            private readonly T[] _list;
+            private int _freeIndex;
+
+            public BaselineFreeList(int maximumCount)
+            {
+                _list = new T[maximumCount];
+            }
+
+            public T Allocate()
+            {
+                int freeIndex;
+
+                while (true)
+                {
+                    freeIndex = _freeIndex;
+
+                    if (freeIndex == 0)
+                    {
+                        T obj = new T();
+                        obj.ResetObject();
+                        return obj;
+                    }
+
+                    if (Interlocked.CompareExchange(ref _freeIndex, freeIndex - 1, freeIndex) == freeIndex)
+                        return _list[freeIndex - 1];
+                }
+            }
+
+            public void Free(T obj)
+            {
+                int freeIndex;
+
+                while (true)
+                {
+                    freeIndex = _freeIndex;
+
+                    if (freeIndex == _list.Length)
+                        return;
+
+                    if (Interlocked.CompareExchange(ref _freeIndex, freeIndex + 1, freeIndex) == freeIndex)
+                    {
+                        _list[freeIndex] = obj;
+                        break;
+                    }
+                }
+            }
+        }
+
+        private sealed class Item : IResettable
+        {
+            public int Value;
+            public int Resets;
+            // Not reset, so that the stress test can track ownership.
+            public int InUse;
+
+            public void ResetObject()
+            {
+                this.Value = 0;
+                this.Resets++;
+            }
+        }
+
+        [Test]
+        public static void ReusesFreedObjects()
+        {
+            FreeList<Item> list = new FreeList<Item>(64, true);
+            Item item = list.Allocate();
+
+            item.Value = 5;
+            list.Free(item);
+
+            Item reused = list.Allocate();
+
+            Assert.IsTrue(reused == item, "Freed object is reused");
+            Assert.AreEqual(0, reused.Value, "Freed object is reset");
+
+            FreeListStatistics statistics = list.GetStatistics();
+
+            Assert.AreEqual(2L, statistics.Allocations, "Allocations");
+            Assert.AreEqual(1L, statistics.NewObjects, "New objects");
+            Assert.AreEqual(1L, statistics.MagazineHits, "Magazine hits");
+        }
+
+        [Test]
+        public static void ListsOfTheSameTypeKeepSeparateCaches()
+        {
+            FreeList<Item> first = new FreeList<Item>(16, true);
+            FreeList<Item> second = new FreeList<Item>(16, true);
+            HashSet<Item> firstItems = new HashSet<Item>();
+            HashSet<Item> secondItems = new HashSet<Item>();
+
+            // Alternating between the lists must not hand objects from 
+            // one list to the other or push them through the depot.
+            for (int i = 0; i < 1000; i++)
+            {
+                Item a = first.Allocate();
+                Item b = second.Allocate();
+
+                firstItems.Add(a);
+                secondItems.Add(b);
+                first.Free(a);
+                second.Free(b);
+            }
+
+            Assert.AreEqual(1, firstItems.Count, "Objects created by the first list");
+            Assert.AreEqual(1, secondItems.Count, "Objects created by the second list");
+            Assert.IsFalse(firstItems.Overlaps(secondItems), "Lists share objects");
+
+            foreach (FreeList<Item> list in new FreeList<Item>[] { first, second })
+            {
+                FreeListStatistics statistics = list.GetStatistics();
+
+                Assert.AreEqual(1L, statistics.NewObjects, "New objects");
+                Assert.AreEqual(999L, statistics.MagazineHits, "Magazine hits");
+                Assert.AreEqual(0L, statistics.DepotHits, "Depot hits");
+            }
+        }
+
+        [Test]
+        public static void FullMagazinesMoveBetweenThreads()
+        {
+            FreeList<Item> list = new FreeList<Item>(64, true);
+            List<Item> items = new List<Item>();
+
+            for (int i = 0; i < 64; i++)
+                items.Add(list.Allocate());
+
+            // Free everything on another thread. Its two magazines 
+            // hold 32 objects and the rest go to the depot.
+            Thread thread = new Thread(() =>
+                {
+                    foreach (Item item in items)
+                        list.Free(item);
+                });
+            thread.Start();
+            thread.Join();
+
+            Assert.AreEqual(32, list.Count, "Objects in the depot");
+
+            for (int i = 0; i < 32; i++)
+                Assert.IsTrue(items.Contains(list.Allocate()), "Object from the depot");
+
+            FreeListStatistics statistics = list.GetStatistics();
+
+            Assert.AreEqual(0, list.Count, "Objects left in the depot");
+            Assert.AreEqual(2L, statistics.DepotHits, "Depot hits");
+            Assert.AreEqual(64L, statistics.NewObjects, "New objects");
+        }
+
+        [Test]
+        public static void DiscardsWhenDepotIsFull()
+        {
+            FreeList<Item> list = new FreeList<Item>(16, true);
+            List<Item> items = new List<Item>();
+
+            for (int i = 0; i < 100; i++)
+                items.Add(list.Allocate());
+            foreach (Item item in items)
+                list.Free(item);
+
+            // Two magazines of 16 and a depot of one magazine.
+            Assert.AreEqual(16, list.Count, "Objects in the depot");
+            Assert.AreEqual(100L - 48, list.GetStatistics().Discarded, "Discarded objects");
+        }
+
+        [Test]
+        public static void ConcurrentAllocateAndFree()
+        {
+            const int Iterations = 20000;
+
+            FreeList<Item> list = new FreeList<Item>(256, true);
+            int threadCount = Math.Max(4, Environment.ProcessorCount);
+            // Objects allocated by one thread and freed by another.
+            Queue<Item> handedOff = new Queue<Item>();
+            long allocations = 0;
+            string error = null;
+            Thread[] threads = new Thread[threadCount];
+
+            for (int t = 0; t < threadCount; t++)
+            {
+                int seed = t;
+
+                threads[t] = new Thread(() =>
+                    {
+                        Random random = new Random(seed);
+                        List<Item> held = new List<Item>();
+
+                        for (int i = 0; i < Iterations && error == null; i++)
+                        {
+                            int count = random.Next(1, 40);
+
+                            for (int j = 0; j < count; j++)
+                            {
+                                Item item = list.Allocate();
+
+                                if (item == null)
+                                    error = "An object was allocated as null";
+                                else if (Interlocked.Exchange(ref item.InUse, 1) != 0)
+                                    error = "An object was allocated twice";
+                                else
+                                    held.Add(item);
+                            }
+
+                            Interlocked.Add(ref allocations, count);
+
+                            // Free half of the objects here and let other
+                            // threads free the rest.
+                            for (int j = 0; j < held.Count; j++)
+                            {
+                                if (j % 2 == 0)
+                                {
+                                    held[j].InUse = 0;
+                                    list.Free(held[j]);
+                                }
+                                else
+                                {
+                                    lock (handedOff)
+                                        handedOff.Enqueue(held[j]);
+                                }
+                            }
+
+                            held.Clear();
+
+                            lock (handedOff)
+                            {
+                                while (handedOff.Count > 0 && held.Count < count)
+                                    held.Add(handedOff.Dequeue());
+                            }
+
+                            foreach (Item item in held)
+                            {
+                                item.InUse = 0;
+                                list.Free(item);
+                            }
+
+                            held.Clear();
+                        }
+                    });
+                threads[t].Start();
+            }
+
+            foreach (Thread thread in threads)
+                thread.Join();
+
+            Assert.AreEqual(null, error, "Error");
+
+            FreeListStatistics statistics = list.GetStatistics();
+
+            Assert.AreEqual(allocations, statistics.Allocations, "Allocations");
+            Assert.AreEqual(
+                allocations,
+                statistics.MagazineHits + statistics.DepotHits + statistics.NewObjects,
+                "Allocations served");
+        }
+
+        [MethodImpl(MethodImplOptions.NoInlining)]
+        private static WeakReference[] UseTemporaryList()
+        {
+            FreeList<Item> list = new FreeList<Item>(16);
+            Item item = list.Allocate();
+
+            list.Free(item);
+
+            return new WeakReference[] { new WeakReference(list), new WeakReference(item) };
+        }
+
+        [MethodImpl(MethodImplOptions.NoInlining)]
+        private static void UseOtherList()
+        {
+            FreeList<Item> list = new FreeList<Item>(16);
+
+            list.Free(list.Allocate());
+        }
+
+        [Test]
+        public static void CachesDoNotKeepListsAlive()
+        {
+            WeakReference[] references = UseTemporaryList();
+
+            GC.Collect();
+            GC.WaitForPendingFinalizers();
+            GC.Collect();
+
+            Assert.IsFalse(references[0].IsAlive, "Free list is collected");
+
+            // The cached objects are dropped once the thread uses 
+            // another free list.
+            UseOtherList();
+            GC.Collect();
+
+            Assert.IsFalse(references[1].IsAlive, "Cached object is collected");
+        }
+
+        private static void RunOnThreads(int threadCount, ThreadStart start)
+        {
+            Thread[] threads = new Thread[threadCount];
+
+            for (int i = 0; i < threadCount; i++)
+            {
+                threads[i] = new Thread(start);
+                threads[i].Start();
+            }
+
+            foreach (Thread thread in threads)
+                thread.Join();
+        }
+
+        [Benchmark]
+        public static void AllocateFreeBenchmark()
+        {
+            FreeList<Item> first = new FreeList<Item>(16);
+            FreeList<Item> second = new FreeList<Item>(16);
+            BaselineFreeList<Item> baseline = new BaselineFreeList<Item>(16);
+            int threadCount = Environment.ProcessorCount;
+
+            Benchmark.Run("One list", 10, () =>
+                {
+                    for (int i = 0; i < 1000000; i++)
+                        first.Free(first.Allocate());
+                });
+            Benchmark.Run("One list, baseline", 10, () =>
+                {
+                    for (int i = 0; i < 1000000; i++)
+                        baseline.Free(baseline.Allocate());
+                });
+            Benchmark.Run("Two lists, alternating", 10, () =>
+                {
+                    for (int i = 0; i < 500000; i++)
+                    {
+                        first.Free(first.Allocate());
+                        second.Free(second.Allocate());
+                    }
+                });
+
+            // The baseline can hand out an object twice under contention,
+            // so only its speed is compared here.
+            Benchmark.Run("One list, " + threadCount + " threads", 10, () =>
+                RunOnThreads(threadCount, () =>
+                    {
+                        for (int i = 0; i < 1000000 / threadCount; i++)
+                            first.Free(first.Allocate());
+                    }));
+            Benchmark.Run("One list, " + threadCount + " threads, baseline", 10, () =>
+                RunOnThreads(threadCount, () =>
+                    {
+                        for (int i = 0; i < 1000000 / threadCount; i++)
+                            baseline.Free(baseline.Allocate());
+                    }));
+        }
+    }
+}
@@ -0,0 +1,351 @@
+﻿/*
+ * Process Hacker -
+ *   handle table tests
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.Collections.Generic;
+using System.Threading;
+using ProcessHacker.Common;
+using ProcessHacker.Common.Objects;
+using ProcessHacker.Common.Threading;
+
+namespace ProcessHacker.Tests
+{
+    public static class HandleTableTests
+    {
+        private sealed class TestObject : BaseObject
+        {
+            public int Frees;
+
+            protected override void DisposeObject(bool disposing)
+            {
+                Interlocked.Increment(ref this.Frees);
+            }
+        }
+
+        [Flags]
+        private enum TestAccess
+        {
+            Read = 0x1,
+            Write = 0x2
+        }
+
+        /// <summary>
+        /// The lookup path of the table this implementation replaced, for 
+        /// comparison.
+        /// </summary>
+        private sealed class BaselineHandleTable
+        {
+            private readonly IdGenerator _handleGenerator = new IdGenerator(4, 4);
+            private readonly FastResourceLock _lock = new FastResourceLock();
+            private readonly Dictionary<int, IRefCounted> _handles = new Dictionary<int, IRefCounted>();
+
+            public int Allocate(IRefCounted obj)
+            {
+                int handle = _handleGenerator.Pop();
+
+                obj.Reference();
+                obj.Dispose();
+
+                _lock.AcquireExclusive();
+
+                try
+                {
+                    _handles.Add(handle, obj);
+                }
+                finally
+                {
+                    _lock.ReleaseExclusive();
+                }
+
+                return handle;
+            }
+
+            public IRefCounted ReferenceByHandle(int handle)
+            {
+                _lock.AcquireShared();
+
+                try
+                {
+                    IRefCounted obj;
+
+                    if (!_handles.TryGetValue(handle, out obj))
+                        return null;
+
+                    obj.Reference();
+
+                    return obj;
+                }
+                finally
+                {
+                    _lock.ReleaseShared();
+                }
+            }
+        }
+
+        [Test]
+        public static void AllocatesAndLooksUpHandles()
+        {
+            HandleTable table = new HandleTable();
+            Dictionary<int, TestObject> objects = new Dictionary<int, TestObject>();
+
+            for (int i = 0; i < 1000; i++)
+            {
+                TestObject obj = new TestObject();
+                int handle = table.Allocate(obj);
+
+                Assert.IsTrue(handle != 0 && handle % 4 == 0, "Handle is a non-zero multiple of 4");
+                Assert.IsFalse(objects.ContainsKey(handle), "Handle is unique");
+                objects.Add(handle, obj);
+            }
+
+            foreach (KeyValuePair<int, TestObject> pair in objects)
+            {
+                Assert.IsTrue(table.LookupObject(pair.Key) == pair.Value, "Lookup by handle");
+                Assert.IsTrue(table.LookupObject<TestObject>(pair.Key) == pair.Value, "Typed lookup by handle");
+                Assert.AreEqual(pair.Key, table.LookupEntry(pair.Key).Handle, "Entry handle");
+            }
+
+            int enumerated = 0;
+
+            table.Enumerate((handle, entry) =>
+                {
+                    Assert.IsTrue(objects[handle] == entry.Object, "Enumerated entry");
+                    enumerated++;
+                    return false;
+                });
+            Assert.AreEqual(objects.Count, enumerated, "Enumerated handles");
+
+            Assert.IsTrue(table.LookupObject(0) == null, "Handle 0 is invalid");
+            Assert.IsTrue(table.LookupObject(0x7ffffffc) == null, "Handle on a missing page");
+
+            // Disposing the table releases every object it still holds.
+            table.Dispose();
+
+            foreach (TestObject obj in objects.Values)
+                Assert.AreEqual(1, obj.Frees, "Object freed with the table");
+        }
+
+        [Test]
+        public static void StaleHandlesAreRejected()
+        {
+            HandleTable table = new HandleTable();
+            TestObject first = new TestObject();
+            TestObject second = new TestObject();
+            int firstHandle = table.Allocate(first);
+
+            Assert.IsTrue(table.Free(firstHandle), "Free");
+            Assert.AreEqual(1, first.Frees, "Object freed with its handle");
+            Assert.IsFalse(table.Free(firstHandle), "Second free");
+
+            // The index is reused, but with a different tag.
+            int secondHandle = table.Allocate(second);
+
+            Assert.IsTrue(secondHandle != firstHandle, "Reused entry has a new handle");
+            Assert.IsTrue(table.LookupObject(firstHandle) == null, "Stale lookup");
+            Assert.IsTrue(table.ReferenceByHandle(firstHandle) == null, "Stale reference");
+            Assert.IsFalse(table.Free(firstHandle), "Stale free");
+            Assert.IsTrue(table.LookupObject(secondHandle) == second, "Lookup of the new handle");
+            Assert.AreEqual(0, second.Frees, "New object still alive");
+
+            table.Dispose();
+            Assert.AreEqual(1, first.Frees, "Freed object is not freed again");
+            Assert.AreEqual(1, second.Frees, "Object freed with the table");
+        }
+
+        [Test]
+        public static void ReferenceOutlivesHandle()
+        {
+            HandleTable table = new HandleTable();
+            TestObject obj = new TestObject();
+            int handle = table.Allocate(obj);
+            HandleTableEntry entry;
+
+            Assert.IsTrue(table.ReferenceByHandle<TestObject>(handle, out entry) == obj, "Reference by handle");
+            Assert.AreEqual(handle, entry.Handle, "Referenced entry");
+            Assert.IsTrue(table.Free(handle), "Free");
+            Assert.AreEqual(0, obj.Frees, "Referenced object is still alive");
+
+            obj.Dereference();
+            Assert.AreEqual(1, obj.Frees, "Object freed with its last reference");
+
+            table.Dispose();
+        }
+
+        [Test]
+        public static void ConcurrentAllocateReferenceFree()
+        {
+            const int slotCount = 64;
+            const int iterations = 50000;
+            HandleTable table = new HandleTable();
+            int[] slots = new int[slotCount];
+            List<TestObject> created = new List<TestObject>();
+            int violations = 0;
+            Thread[] threads = new Thread[Math.Max(4, Environment.ProcessorCount)];
+
+            for (int t = 0; t < threads.Length; t++)
+            {
+                int seed = t;
+
+                threads[t] = new Thread(() =>
+                    {
+                        Random random = new Random(seed * 7919 + 1);
+                        List<TestObject> mine = new List<TestObject>();
+
+                        for (int i = 0; i < iterations; i++)
+                        {
+                            int slot = random.Next(slotCount);
+                            int handle = Thread.VolatileRead(ref slots[slot]);
+
+                            if (handle == 0)
+                            {
+                                TestObject obj = new TestObject();
+
+                                mine.Add(obj);
+                                handle = table.Allocate(obj);
+
+                                if (Interlocked.CompareExchange(ref slots[slot], handle, 0) != 0)
+                                    table.Free(handle);
+                            }
+                            else if (random.Next(4) == 0)
+                            {
+                                // Whoever takes the handle out of the slot frees it.
+                                if (Interlocked.CompareExchange(ref slots[slot], 0, handle) == handle)
+                                {
+                                    if (!table.Free(handle))
+                                        Interlocked.Increment(ref violations);
+                                }
+                            }
+                            else
+                            {
+                                TestObject obj = table.ReferenceByHandle<TestObject>(handle);
+
+                                // The handle may have been freed, but an object we 
+                                // got must not be freed until we release it.
+                                if (obj != null)
+                                {
+                                    if (obj.Frees != 0)
+                                        Interlocked.Increment(ref violations);
+
+                                    obj.Dereference();
+                                }
+                            }
+                        }
+
+                        lock (created)
+                            created.AddRange(mine);
+                    });
+                threads[t].Start();
+            }
+
+            foreach (Thread thread in threads)
+                thread.Join();
+
+            for (int i = 0; i < slotCount; i++)
+            {
+                if (slots[i] != 0)
+                    Assert.IsTrue(table.Free(slots[i]), "Free remaining handle");
+            }
+
+            Assert.AreEqual(0, violations, "Violations");
+            Assert.IsFalse(table.Enumerate((handle, entry) => true), "Table is empty");
+
+            foreach (TestObject obj in created)
+                Assert.AreEqual(1, obj.Frees, "Every object freed exactly once");
+
+            table.Dispose();
+        }
+
+        [Test]
+        public static void SecuredHandlesCheckAccess()
+        {
+            SecuredHandleTable table = new SecuredHandleTable();
+            TestObject obj = new TestObject();
+            int handle = table.Allocate(obj, TestAccess.Read);
+
+            Assert.IsTrue(table.ReferenceByHandle(handle, TestAccess.Read) == obj, "Granted access");
+            obj.Dereference();
+            Assert.IsTrue(table.ReferenceByHandle(handle, TestAccess.Read | TestAccess.Write) == null, "Denied access");
+            Assert.Throws<UnauthorizedAccessException>(
+                () => table.ReferenceByHandle(handle, TestAccess.Write, true),
+                "Denied access throws"
+                );
+            Assert.IsTrue(table.LookupEntry(handle).AreAnyAccessesGranted(TestAccess.Read | TestAccess.Write), "Any access");
+            Assert.IsTrue(table.ReferenceByHandle<TestObject, TestAccess>(handle, TestAccess.Read) == obj, "Typed reference");
+
+            Assert.IsTrue(table.Free(handle), "Free handle");
+            Assert.AreEqual(0, obj.Frees, "Referenced object is still alive");
+            obj.Dereference();
+            Assert.AreEqual(1, obj.Frees, "Object freed with its last reference");
+
+            table.Dispose();
+        }
+
+        private static void RunReferenceBenchmark(string name, Func<int, IRefCounted> reference, int[] handles)
+        {
+            Benchmark.Run(name + ", 1 thread", 10, () =>
+                {
+                    for (int i = 0; i < 1000000; i++)
+                        reference(handles[i & 1023]).Dereference();
+                });
+
+            Benchmark.Run(name + ", " + Environment.ProcessorCount + " threads", 10, () =>
+                {
+                    Thread[] threads = new Thread[Environment.ProcessorCount];
+
+                    for (int t = 0; t < threads.Length; t++)
+                    {
+                        int offset = t * 131;
+
+                        threads[t] = new Thread(() =>
+                            {
+                                for (int i = 0; i < 1000000; i++)
+                                    reference(handles[(i + offset) & 1023]).Dereference();
+                            });
+                        threads[t].Start();
+                    }
+
+                    foreach (Thread thread in threads)
+                        thread.Join();
+                });
+        }
+
+        [Benchmark]
+        public static void ReferenceByHandleBenchmark()
+        {
+            HandleTable table = new HandleTable();
+            BaselineHandleTable baseline = new BaselineHandleTable();
+            int[] handles = new int[1024];
+            int[] baselineHandles = new int[1024];
+
+            for (int i = 0; i < handles.Length; i++)
+            {
+                handles[i] = table.Allocate(new TestObject());
+                baselineHandles[i] = baseline.Allocate(new TestObject());
+            }
+
+            RunReferenceBenchmark("ReferenceByHandle", table.ReferenceByHandle, handles);
+            RunReferenceBenchmark("ReferenceByHandle, Dictionary and FastResourceLock", baseline.ReferenceByHandle, baselineHandles);
+
+            table.Dispose();
+        }
+    }
+}
@@ -0,0 +1,227 @@
+﻿/*
+ * Process Hacker -
+ *   history file tests
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.IO;
+using ProcessHacker.Common;
+
+namespace ProcessHacker.Tests
+{
+    public static class HistoryFileTests
+    {
+        private static void WithFile(Action<string> action)
+        {
+            string fileName = Path.GetTempFileName();
+
+            try
+            {
+                action(fileName);
+            }
+            finally
+            {
+                File.Delete(fileName);
+            }
+        }
+
+        private static void Append(HistoryFile file, int series, long value)
+        {
+            file.Write(series, 0, value);
+            file.Write(series, 1, (float)value / 2);
+            file.Publish(series);
+            file.EndTick();
+        }
+
+        [Test]
+        public static void ReadsNewestFirst()
+        {
+            WithFile(fileName =>
+            {
+                using (HistoryFile file = new HistoryFile(fileName, 8, 2, 4))
+                {
+                    int series = file.AllocateSeries(100, 1);
+                    long[] values = new long[8];
+                    float[] floats = new float[8];
+
+                    for (int i = 1; i <= 3; i++)
+                        Append(file, series, i);
+
+                    Assert.AreEqual(3, file.Read(series, 0, values), "long count");
+                    Assert.AreEqual(3L, values[0], "newest");
+                    Assert.AreEqual(1L, values[2], "oldest");
+                    Assert.AreEqual(3, file.Read(series, 1, floats), "float count");
+                    Assert.AreEqual(1.5f, floats[0], "newest float");
+                }
+            });
+        }
+
+        [Test]
+        public static void NeverReturnsWriterSlot()
+        {
+            WithFile(fileName =>
+            {
+                using (HistoryFile file = new HistoryFile(fileName, 8, 2, 4))
+                {
+                    int series = file.AllocateSeries(100, 1);
+                    long[] values = new long[16];
+
+                    for (int i = 0; i < 20; i++)
+                        Append(file, series, i);
+
+                    // Start writing the next tick without publishing it. This 
+                    // overwrites the slot of the oldest sample in the ring.
+                    file.Write(series, 0, 999);
+
+                    Assert.AreEqual(7, file.GetSampleCount(series), "sample count");
+                    Assert.AreEqual(7, file.Read(series, 0, values), "read count");
+
+                    for (int i = 0; i < 7; i++)
+                        Assert.AreEqual((long)(19 - i), values[i], "sample " + i);
+
+                    CircularBuffer<long> buffer = new CircularBuffer<long>(16);
+
+                    file.Load(series, 0, buffer);
+                    Assert.AreEqual(7, buffer.Count, "loaded count");
+                    Assert.AreEqual(19L, buffer[0], "loaded newest");
+                    Assert.AreEqual(13L, buffer[6], "loaded oldest");
+                }
+            });
+        }
+
+        [Test]
+        public static void PersistsAcrossReopen()
+        {
+            WithFile(fileName =>
+            {
+                using (HistoryFile file = new HistoryFile(fileName, 8, 2, 4))
+                {
+                    int series = file.AllocateSeries(100, 1);
+
+                    Append(file, series, 42);
+                }
+
+                using (HistoryFile file = new HistoryFile(fileName, 8, 2, 4))
+                {
+                    int series = file.AttachSeries(100, 1);
+                    long[] values = new long[1];
+
+                    Assert.IsTrue(series != -1, "series was not found");
+                    Assert.AreEqual(1, file.Read(series, 0, values), "count");
+                    Assert.AreEqual(42L, values[0], "value");
+                    Assert.AreEqual(-1, file.FindSeries(100, 2), "wrong key");
+                }
+
+                // A different layout discards the old contents.
+                using (HistoryFile file = new HistoryFile(fileName, 16, 2, 4))
+                    Assert.AreEqual(-1, file.FindSeries(100, 1), "series after layout change");
+            });
+        }
+
+        [Test]
+        public static void ReaderSeesNewSeries()
+        {
+            WithFile(fileName =>
+            {
+                using (HistoryFile writer = new HistoryFile(fileName, 8, 2, 4))
+                using (HistoryFile reader = HistoryFile.OpenRead(fileName))
+                {
+                    Assert.AreEqual(-1, reader.FindSeries(7, 7), "before allocation");
+
+                    int series = writer.AllocateSeries(7, 7);
+
+                    Append(writer, series, 5);
+
+                    Assert.AreEqual(series, reader.FindSeries(7, 7), "after allocation");
+                    Assert.AreEqual(1, reader.GetSampleCount(series), "sample count");
+                    Assert.Throws<InvalidOperationException>(() => reader.AllocateSeries(8, 8), "allocate on reader");
+                }
+            });
+        }
+
+        [Test]
+        public static void ReusesFreedSeries()
+        {
+            WithFile(fileName =>
+            {
+                using (HistoryFile file = new HistoryFile(fileName, 8, 2, 2))
+                {
+                    int a = file.AllocateSeries(1, 0);
+                    int b = file.AllocateSeries(2, 0);
+
+                    Assert.AreEqual(-1, file.AllocateSeries(3, 0), "allocation when full");
+
+                    file.FreeSeries(a);
+
+                    Assert.AreEqual(-1, file.FindSeries(1, 0), "freed series");
+
+                    int c = file.AllocateSeries(3, 0);
+
+                    Assert.AreEqual(a, c, "reused slot");
+                    Assert.AreEqual(0, file.GetSampleCount(c), "reused slot count");
+                    Assert.AreEqual(b, file.FindSeries(2, 0), "other series");
+                    Assert.AreEqual(c, file.FindSeries(3, 0), "new series");
+                }
+            });
+        }
+
+        [Test]
+        public static void FreesStaleSeries()
+        {
+            WithFile(fileName =>
+            {
+                using (HistoryFile file = new HistoryFile(fileName, 8, 2, 4))
+                {
+                    int system = file.AllocateSeries(-100, 0);
+                    int live = file.AllocateSeries(1, 0);
+                    int stale = file.AllocateSeries(2, 0);
+
+                    file.EndTick();
+                    file.Publish(live);
+
+                    Assert.AreEqual(1, file.FreeStaleSeries(file.Sequence, system), "freed count");
+                    Assert.AreEqual(system, file.FindSeries(-100, 0), "kept series");
+                    Assert.AreEqual(live, file.FindSeries(1, 0), "live series");
+                    Assert.AreEqual(-1, file.FindSeries(2, 0), "stale series");
+                    Assert.AreEqual(stale, file.AllocateSeries(3, 0), "reused stale slot");
+                }
+            });
+        }
+
+        [Benchmark]
+        public static void FindSeries()
+        {
+            WithFile(fileName =>
+            {
+                using (HistoryFile file = new HistoryFile(fileName, 8, 2, 512))
+                {
+                    for (int i = 0; i < 512; i++)
+                        file.AllocateSeries(i, i);
+
+                    Benchmark.Run("FindSeries x 512", 1000, () =>
+                    {
+                        for (int i = 0; i < 512; i++)
+                            file.FindSeries(i, i);
+                    });
+                }
+            });
+        }
+    }
+}
@@ -0,0 +1,308 @@
+﻿/*
+ * Process Hacker -
+ *   host name resolver tests
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.Collections.Generic;
+using System.Net;
+using System.Threading;
+
+namespace ProcessHacker.Tests
+{
+    public static class HostNameResolverTests
+    {
+        /// <summary>
+        /// A lookup function which records its calls and blocks until 
+        /// it is released.
+        /// </summary>
+        private sealed class StubLookup
+        {
+            private readonly ManualResetEvent _release = new ManualResetEvent(true);
+            private readonly Dictionary<IPAddress, string> _names = new Dictionary<IPAddress, string>();
+            private readonly List<IPAddress> _calls = new List<IPAddress>();
+            private int _running;
+            private int _maxRunning;
+
+            public void Add(IPAddress address, string hostName)
+            {
+                _names.Add(address, hostName);
+            }
+
+            public void Block()
+            {
+                _release.Reset();
+            }
+
+            public void Release()
+            {
+                _release.Set();
+            }
+
+            public int MaxRunning
+            {
+                get { lock (_calls) return _maxRunning; }
+            }
+
+            public IPAddress[] GetCalls()
+            {
+                lock (_calls)
+                    return _calls.ToArray();
+            }
+
+            public string Lookup(IPAddress address)
+            {
+                string hostName;
+
+                lock (_calls)
+                {
+                    _calls.Add(address);
+                    _running++;
+                    _maxRunning = Math.Max(_maxRunning, _running);
+                }
+
+                _release.WaitOne();
+
+                lock (_calls)
+                    _running--;
+
+                if (address.Equals(IPAddress.Broadcast))
+                    throw new InvalidOperationException("Lookup failed");
+
+                _names.TryGetValue(address, out hostName);
+
+                return hostName;
+            }
+        }
+
+        /// <summary>
+        /// Counts callbacks and waits for an expected number of them.
+        /// </summary>
+        private sealed class Results
+        {
+            private readonly Dictionary<object, string> _names = new Dictionary<object, string>();
+
+            public void Callback(IPAddress address, string hostName, object context)
+            {
+                lock (_names)
+                {
+                    _names.Add(context, hostName);
+                    Monitor.PulseAll(_names);
+                }
+            }
+
+            public int Count
+            {
+                get { lock (_names) return _names.Count; }
+            }
+
+            public string this[object context]
+            {
+                get { lock (_names) return _names[context]; }
+            }
+
+            public void WaitFor(int count)
+            {
+                lock (_names)
+                {
+                    while (_names.Count < count)
+                    {
+                        if (!Monitor.Wait(_names, 5000))
+                            throw new Exception("Timed out waiting for " + count.ToString() + " results");
+                    }
+                }
+            }
+        }
+
+        private static IPAddress Address(int i)
+        {
+            return new IPAddress(new byte[] { 10, 0, (byte)(i >> 8), (byte)i });
+        }
+
+        private static void WaitForIdle(HostNameResolver resolver)
+        {
+            for (int i = 0; i < 500 && resolver.PendingCount != 0; i++)
+                Thread.Sleep(10);
+
+            Assert.AreEqual(0, resolver.PendingCount, "Pending requests");
+        }
+
+        [Test]
+        public static void CoalescesRequestsForTheSameAddress()
+        {
+            StubLookup stub = new StubLookup();
+            HostNameResolver resolver = new HostNameResolver(stub.Lookup);
+            Results results = new Results();
+
+            stub.Add(Address(1), "one.example");
+            stub.Block();
+
+            for (int i = 0; i < 3; i++)
+                resolver.Resolve(Address(1), i, results.Callback);
+
+            Assert.AreEqual(1, resolver.PendingCount, "Pending requests");
+            stub.Release();
+            results.WaitFor(3);
+            WaitForIdle(resolver);
+
+            Assert.AreEqual(1, stub.GetCalls().Length, "Lookups");
+
+            for (int i = 0; i < 3; i++)
+                Assert.AreEqual("one.example", results[i], "Host name");
+
+            // Cached results are returned on the calling thread.
+            resolver.Resolve(Address(1), 3, results.Callback);
+
+            Assert.AreEqual(4, results.Count, "Results");
+            Assert.AreEqual(1, stub.GetCalls().Length, "Lookups after cache hit");
+        }
+
+        [Test]
+        public static void CachesFailedLookups()
+        {
+            StubLookup stub = new StubLookup();
+            HostNameResolver resolver = new HostNameResolver(stub.Lookup);
+            Results results = new Results();
+            string hostName;
+
+            resolver.Resolve(Address(1), 0, results.Callback);
+            resolver.Resolve(IPAddress.Broadcast, 1, results.Callback);
+            results.WaitFor(2);
+            WaitForIdle(resolver);
+
+            Assert.AreEqual(null, results[0], "Unknown address");
+            Assert.AreEqual(null, results[1], "Lookup which threw");
+            Assert.IsTrue(resolver.TryGetCached(Address(1), out hostName), "Failure is cached");
+            Assert.AreEqual(null, hostName, "Cached failure");
+
+            resolver.Resolve(Address(1), 2, results.Callback);
+            Assert.AreEqual(3, results.Count, "Results");
+            Assert.AreEqual(2, stub.GetCalls().Length, "Lookups");
+
+            // Expired failures are looked up again.
+            resolver.NegativeTtl = TimeSpan.Zero;
+            resolver.Resolve(Address(2), 3, results.Callback);
+            results.WaitFor(4);
+            WaitForIdle(resolver);
+
+            Assert.IsFalse(resolver.TryGetCached(Address(2), out hostName), "Expired failure");
+        }
+
+        [Test]
+        public static void DropsCancelledRequests()
+        {
+            StubLookup stub = new StubLookup();
+            HostNameResolver resolver = new HostNameResolver(stub.Lookup);
+            Results results = new Results();
+
+            resolver.MaxConcurrency = 1;
+            stub.Block();
+
+            resolver.Resolve(Address(1), 0, results.Callback);
+            resolver.Resolve(Address(2), 1, results.Callback);
+            resolver.Resolve(Address(3), 2, results.Callback);
+            resolver.Resolve(Address(3), 3, results.Callback);
+            // Nobody else wants the second address, but the third 
+            // still has a subscriber.
+            resolver.Cancel(Address(2), 1);
+            resolver.Cancel(Address(3), 2);
+            stub.Release();
+            results.WaitFor(2);
+            WaitForIdle(resolver);
+
+            IPAddress[] calls = stub.GetCalls();
+
+            Assert.AreEqual(2, calls.Length, "Lookups");
+            Assert.IsTrue(calls[0].Equals(Address(1)) && calls[1].Equals(Address(3)), "Looked up addresses");
+            Assert.AreEqual(2, results.Count, "Results");
+        }
+
+        [Test]
+        public static void LimitsConcurrentLookups()
+        {
+            StubLookup stub = new StubLookup();
+            HostNameResolver resolver = new HostNameResolver(stub.Lookup);
+            Results results = new Results();
+
+            resolver.MaxConcurrency = 2;
+            stub.Block();
+
+            for (int i = 0; i < 8; i++)
+                resolver.Resolve(Address(i), i, results.Callback);
+
+            Thread.Sleep(50);
+            stub.Release();
+            results.WaitFor(8);
+            WaitForIdle(resolver);
+
+            Assert.AreEqual(8, stub.GetCalls().Length, "Lookups");
+            Assert.IsTrue(stub.MaxRunning <= 2, "Concurrent lookups");
+        }
+
+        [Test]
+        public static void EvictsLeastRecentlyUsed()
+        {
+            StubLookup stub = new StubLookup();
+            HostNameResolver resolver = new HostNameResolver(stub.Lookup);
+            Results results = new Results();
+            string hostName;
+
+            resolver.Capacity = 2;
+            resolver.MaxConcurrency = 1;
+
+            for (int i = 0; i < 3; i++)
+                stub.Add(Address(i), "host" + i.ToString());
+
+            resolver.Resolve(Address(0), 0, results.Callback);
+            resolver.Resolve(Address(1), 1, results.Callback);
+            results.WaitFor(2);
+            WaitForIdle(resolver);
+
+            // Touch the first address so that the second is evicted.
+            Assert.IsTrue(resolver.TryGetCached(Address(0), out hostName), "First address is cached");
+            resolver.Resolve(Address(2), 2, results.Callback);
+            results.WaitFor(3);
+            WaitForIdle(resolver);
+
+            Assert.IsTrue(resolver.TryGetCached(Address(0), out hostName), "Recently used address is kept");
+            Assert.AreEqual("host0", hostName, "Host name");
+            Assert.IsFalse(resolver.TryGetCached(Address(1), out hostName), "Least recently used address is evicted");
+            Assert.IsTrue(resolver.TryGetCached(Address(2), out hostName), "New address is cached");
+        }
+
+        [Test]
+        public static void DisposeStopsCallbacks()
+        {
+            StubLookup stub = new StubLookup();
+            HostNameResolver resolver = new HostNameResolver(stub.Lookup);
+            Results results = new Results();
+
+            stub.Block();
+            resolver.Resolve(Address(1), 0, results.Callback);
+            resolver.Dispose();
+            resolver.Resolve(Address(2), 1, results.Callback);
+            stub.Release();
+            Thread.Sleep(100);
+
+            Assert.AreEqual(0, results.Count, "Results after dispose");
+            Assert.IsTrue(stub.GetCalls().Length <= 1, "Lookups after dispose");
+        }
+    }
+}
@@ -0,0 +1,297 @@
+﻿/*
+ * Process Hacker -
+ *   image reader tests
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.IO;
+using System.Text;
+using ProcessHacker.Native.Api;
+using ProcessHacker.Native.Image;
+
+namespace ProcessHacker.Tests
+{
+    public static class ImageReaderTests
+    {
+        private const int NtHeadersOffset = 0x40;
+        private const int OptionalHeaderOffset = NtHeadersOffset + 4 + 20;
+        private const int SectionHeaderOffset = OptionalHeaderOffset + 224;
+        private const int SectionOffset = 0x200;
+        private const int SectionRva = 0x1000;
+
+        /// <summary>
+        /// Builds a PE32 image with a single section containing an import 
+        /// directory.
+        /// </summary>
+        /// <param name="dllCount">The number of imported DLLs.</param>
+        /// <param name="functionsPerDll">The number of functions imported from each DLL.</param>
+        /// <param name="shareThunks">Whether all DLLs use the same lookup table.</param>
+        /// <param name="useNames">Whether functions are imported by name instead of by ordinal.</param>
+        private static byte[] BuildImage(int dllCount, int functionsPerDll, bool shareThunks, bool useNames)
+        {
+            int tableCount = shareThunks ? 1 : dllCount;
+            int tableSize = (functionsPerDll + 1) * 4;
+            int thunksStart = (dllCount + 1) * 20;
+            int namesStart = thunksStart + tableCount * tableSize;
+            MemoryStream names = new MemoryStream();
+            int[] dllNames = new int[dllCount];
+            int[][] tables = new int[tableCount][];
+
+            for (int d = 0; d < dllCount; d++)
+            {
+                dllNames[d] = SectionRva + namesStart + (int)names.Position;
+                WriteAnsi(names, "dll" + d.ToString() + ".dll");
+            }
+
+            for (int t = 0; t < tableCount; t++)
+            {
+                tables[t] = new int[functionsPerDll];
+
+                for (int i = 0; i < functionsPerDll; i++)
+                {
+                    if (useNames)
+                    {
+                        tables[t][i] = SectionRva + namesStart + (int)names.Position;
+                        names.WriteByte((byte)i);
+                        names.WriteByte((byte)(i >> 8));
+                        WriteAnsi(names, "Function" + i.ToString());
+                    }
+                    else
+                    {
+                        tables[t][i] = unchecked((int)0x80000000) | (i + 1);
+                    }
+                }
+            }
+
+            MemoryStream section = new MemoryStream();
+            BinaryWriter sw = new BinaryWriter(section);
+
+            for (int d = 0; d < dllCount; d++)
+            {
+                int table = SectionRva + thunksStart + (shareThunks ? 0 : d) * tableSize;
+
+                sw.Write(table); // OriginalFirstThunk
+                sw.Write(0); // TimeDateStamp
+                sw.Write(0); // ForwarderChain
+                sw.Write(dllNames[d]);
+                sw.Write(table); // FirstThunk
+            }
+
+            sw.Write(new byte[20]);
+
+            foreach (int[] table in tables)
+            {
+                foreach (int thunk in table)
+                    sw.Write(thunk);
+
+                sw.Write(0);
+            }
+
+            sw.Write(names.ToArray());
+            sw.Flush();
+
+            byte[] image = new byte[SectionOffset + section.Length];
+            BinaryWriter w = new BinaryWriter(new MemoryStream(image));
+
+            w.Write((short)0x5a4d); // MZ
+            w.Seek(0x3c, SeekOrigin.Begin);
+            w.Write(NtHeadersOffset);
+
+            w.Seek(NtHeadersOffset, SeekOrigin.Begin);
+            w.Write(0x4550); // PE\0\0
+            w.Write((short)0x14c); // Machine
+            w.Write((short)1); // NumberOfSections
+            w.Seek(12, SeekOrigin.Current);
+            w.Write((short)224); // SizeOfOptionalHeader
+            w.Write((short)0x102); // Characteristics
+
+            w.Seek(OptionalHeaderOffset, SeekOrigin.Begin);
+            w.Write((short)0x10b); // Magic
+            w.Seek(OptionalHeaderOffset + 92, SeekOrigin.Begin);
+            w.Write(16); // NumberOfRvaAndSizes
+            w.Seek(OptionalHeaderOffset + 96 + 8, SeekOrigin.Begin);
+            w.Write(SectionRva); // Import directory
+            w.Write(thunksStart);
+
+            w.Seek(SectionHeaderOffset, SeekOrigin.Begin);
+            w.Write(Encoding.ASCII.GetBytes(".idata\0\0"));
+            w.Write((int)section.Length); // VirtualSize
+            w.Write(SectionRva);
+            w.Write((int)section.Length); // SizeOfRawData
+            w.Write(SectionOffset);
+            w.Flush();
+
+            section.ToArray().CopyTo(image, SectionOffset);
+
+            return image;
+        }
+
+        private static void WriteAnsi(Stream stream, string s)
+        {
+            byte[] bytes = Encoding.ASCII.GetBytes(s);
+
+            stream.Write(bytes, 0, bytes.Length);
+            stream.WriteByte(0);
+        }
+
+        private static int CountImports(ImageReader reader)
+        {
+            int total = 0;
+
+            for (int i = 0; i < reader.Imports.Count; i++)
+                total += reader.Imports[i].Count;
+
+            return total;
+        }
+
+        /// <summary>
+        /// Reads everything the reader exposes, as the image analysis and 
+        /// the properties window do.
+        /// </summary>
+        private static void ReadAll(ImageReader reader)
+        {
+            ImageLoadConfigDirectory loadConfig;
+
+            for (int i = 0; i < reader.Imports.Count; i++)
+            {
+                ImageReaderImportDll dll = reader.Imports[i];
+
+                Assert.IsTrue(dll.Name != null, "DLL name");
+
+                for (int j = 0; j < Math.Min(dll.Count, 256); j++)
+                    dll.GetEntry(j);
+            }
+
+            for (int i = 0; i < Math.Min(reader.Exports.NumberOfNames, 256); i++)
+                reader.Exports.GetEntry(i);
+
+            for (int i = 0; i < reader.NumberOfSections; i++)
+                reader.GetSectionName(i);
+
+            reader.GetDebugDirectory();
+            reader.GetLoadConfig(out loadConfig);
+        }
+
+        [Test]
+        public static void ReadsImports()
+        {
+            using (ImageReader reader = new ImageReader(new MemoryStream(BuildImage(3, 5, false, true)), true))
+            {
+                Assert.AreEqual(3, reader.Imports.Count, "DLL count");
+                Assert.AreEqual("dll2.dll", reader.Imports[2].Name, "DLL name");
+                Assert.AreEqual(5, reader.Imports[2].Count, "function count");
+                Assert.AreEqual("Function4", reader.Imports[2][4].Name, "function name");
+                Assert.AreEqual((short)4, reader.Imports[2][4].NameHint, "function hint");
+            }
+
+            using (ImageReader reader = new ImageReader(new MemoryStream(BuildImage(1, 3, false, false)), true))
+                Assert.AreEqual((short)3, reader.Imports[0][2].Ordinal, "ordinal");
+        }
+
+        [Test]
+        public static void LimitsTotalThunks()
+        {
+            // Every descriptor points to the same large lookup table.
+            byte[] image = BuildImage(64, ImageReader.MaxImportFunctions - 1, true, false);
+
+            using (ImageReader reader = new ImageReader(new MemoryStream(image), true))
+            {
+                Assert.AreEqual(64, reader.Imports.Count, "DLL count");
+                Assert.AreEqual(ImageReader.MaxImportThunks, CountImports(reader), "total function count");
+                Assert.AreEqual(0, reader.Imports[63].Count, "function count of the last DLL");
+            }
+        }
+
+        [Test]
+        public static void RejectsInvalidHeaders()
+        {
+            byte[] image = BuildImage(1, 1, false, true);
+
+            image[NtHeadersOffset] = 0;
+
+            Assert.Throws<Exception>(() => new ImageReader(new MemoryStream(image), true), "bad signature");
+            Assert.Throws<Exception>(() => new ImageReader(new MemoryStream(new byte[0]), true), "empty file");
+        }
+
+        [Test]
+        public static void Fuzz()
+        {
+            byte[] original = BuildImage(8, 16, false, true);
+            Random random = new Random(1);
+
+            for (int iteration = 0; iteration < 5000; iteration++)
+            {
+                byte[] image = (byte[])original.Clone();
+                int mutations = random.Next(1, 16);
+
+                for (int i = 0; i < mutations; i++)
+                {
+                    // Most mutations hit the headers and the import 
+                    // descriptors, where they are the most interesting.
+                    int offset = random.Next(4) == 0 ?
+                        random.Next(image.Length) :
+                        random.Next(2) == 0 ? random.Next(SectionHeaderOffset + 40) : SectionOffset + random.Next(9 * 20);
+
+                    image[offset] = (byte)random.Next(256);
+                }
+
+                if (random.Next(8) == 0)
+                    Array.Resize(ref image, random.Next(image.Length));
+
+                ImageReader reader;
+
+                try
+                {
+                    reader = new ImageReader(new MemoryStream(image), true);
+                }
+                catch (Exception)
+                {
+                    // Invalid headers are reported by the constructor.
+                    continue;
+                }
+
+                using (reader)
+                {
+                    ReadAll(reader);
+                    Assert.IsTrue(CountImports(reader) <= ImageReader.MaxImportThunks, "total function count");
+                }
+            }
+        }
+
+        [Benchmark]
+        public static void CountImportsBenchmark()
+        {
+            byte[] typical = BuildImage(20, 50, false, true);
+            byte[] hostile = BuildImage(ImageReader.MaxImportDlls, ImageReader.MaxImportFunctions - 1, true, false);
+
+            Benchmark.Run("count imports, 20 DLLs, 1000 functions", 1000, () =>
+            {
+                using (ImageReader reader = new ImageReader(new MemoryStream(typical), true))
+                    CountImports(reader);
+            });
+
+            Benchmark.Run("count imports, 4096 DLLs sharing 65535 functions", 10, () =>
+            {
+                using (ImageReader reader = new ImageReader(new MemoryStream(hostile), true))
+                    CountImports(reader);
+            });
+        }
+    }
+}
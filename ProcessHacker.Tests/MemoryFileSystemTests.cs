@@ -0,0 +1,409 @@
+﻿/*
+ * Process Hacker -
+ *   memory file system tests
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.IO;
+using System.Runtime.InteropServices;
+using System.Text;
+using ProcessHacker.Native.Mfs;
+
+namespace ProcessHacker.Tests
+{
+    public static unsafe class MemoryFileSystemTests
+    {
+        private const int BlockSize = 0x10000;
+        private const int CellSize = 0x80;
+        private const int ExtentFlag = unchecked((int)0x80000000);
+
+        /// <summary>
+        /// Storage in a pinned array. The contents outlive the file 
+        /// system, so a file system can be reopened from them.
+        /// </summary>
+        internal sealed class MemoryStorage : IMfsStorage
+        {
+            private readonly byte[] _data;
+            private readonly GCHandle _handle;
+            private readonly bool _readOnly;
+            // Shared with reopened instances.
+            private readonly long[] _size;
+
+            public MemoryStorage(int capacity)
+            {
+                _data = new byte[capacity];
+                _handle = GCHandle.Alloc(_data, GCHandleType.Pinned);
+                _size = new long[1];
+            }
+
+            public MemoryStorage(byte[] image, int capacity)
+                : this(capacity)
+            {
+                Buffer.BlockCopy(image, 0, _data, 0, image.Length);
+                _size[0] = image.Length;
+            }
+
+            private MemoryStorage(MemoryStorage storage, bool readOnly)
+            {
+                _data = storage._data;
+                _handle = storage._handle;
+                _size = storage._size;
+                _readOnly = readOnly;
+            }
+
+            public byte[] Data
+            {
+                get { return _data; }
+            }
+
+            public bool ReadOnly
+            {
+                get { return _readOnly; }
+            }
+
+            public long Size
+            {
+                get { return _size[0]; }
+            }
+
+            public MemoryStorage Reopen(bool readOnly)
+            {
+                return new MemoryStorage(this, readOnly);
+            }
+
+            public void Extend(long newSize)
+            {
+                if (newSize > _data.Length)
+                    throw new IOException("The test storage is full.");
+
+                if (newSize > _size[0])
+                    _size[0] = newSize;
+            }
+
+            public IntPtr MapView(long offset, int size)
+            {
+                if (offset + size > _size[0])
+                    throw new IOException("The view is outside the storage.");
+
+                return new IntPtr((byte*)_handle.AddrOfPinnedObject() + offset);
+            }
+
+            public void UnmapView(IntPtr view)
+            { }
+
+            public void Dispose()
+            {
+                // Keep the contents; Free releases them.
+            }
+
+            public void Free()
+            {
+                _handle.Free();
+            }
+        }
+
+        /// <summary>
+        /// Builds a version 1 ("MFS\0") file system by hand, with the 
+        /// layout used before extents and child indexes were added.
+        /// </summary>
+        private sealed class Version1Image
+        {
+            public const uint Root = 1 << 16; // block 0, cell 1
+
+            public readonly byte[] Data = new byte[2 * BlockSize];
+            private int _nextCell = 1;
+
+            public Version1Image()
+            {
+                this.WriteInt32(0, 0x0053464d); // MFS\0
+                this.WriteUInt16(4, 2); // next free block
+                this.WriteInt32(8, (int)Root);
+                this.WriteInt32(12, BlockSize);
+                this.WriteInt32(16, CellSize);
+                this.InitializeObject(Root, "root");
+            }
+
+            private static int Offset(uint cellId)
+            {
+                // Block ID in the low 16 bits, cell index in the high 16 bits.
+                return (int)(cellId & 0xffff) * BlockSize + (int)(cellId >> 16) * CellSize;
+            }
+
+            private void WriteInt32(int offset, int value)
+            {
+                Buffer.BlockCopy(BitConverter.GetBytes(value), 0, this.Data, offset, 4);
+            }
+
+            private void WriteUInt16(int offset, int value)
+            {
+                Buffer.BlockCopy(BitConverter.GetBytes((ushort)value), 0, this.Data, offset, 2);
+            }
+
+            private uint Read(uint cellId, int field)
+            {
+                return BitConverter.ToUInt32(this.Data, Offset(cellId) + field);
+            }
+
+            private void Write(uint cellId, int field, uint value)
+            {
+                this.WriteInt32(Offset(cellId) + field, (int)value);
+            }
+
+            private uint AllocateCell()
+            {
+                uint cellId = 1 | ((uint)_nextCell++ << 16);
+
+                // Block 1's header: the next free cell.
+                this.WriteUInt16(BlockSize + 4, _nextCell);
+
+                return cellId;
+            }
+
+            private void InitializeObject(uint cellId, string name)
+            {
+                // Flink, Blink, ChildFlink and ChildBlink point to the object itself.
+                this.Write(cellId, 0, cellId);
+                this.Write(cellId, 4, cellId);
+                this.Write(cellId, 16, cellId);
+                this.Write(cellId, 20, cellId);
+                this.Write(cellId, 36, (uint)name.Length);
+                Encoding.Unicode.GetBytes(name, 0, name.Length, this.Data, Offset(cellId) + 40);
+            }
+
+            public uint AddObject(uint parent, string name)
+            {
+                uint cellId = this.AllocateCell();
+                uint last = this.Read(parent, 20);
+
+                this.InitializeObject(cellId, name);
+                this.Write(cellId, 8, parent);
+                // Insert at the tail of the parent's child list.
+                this.Write(cellId, 0, parent);
+                this.Write(cellId, 4, last);
+
+                if (last == parent)
+                    this.Write(parent, 16, cellId);
+                else
+                    this.Write(last, 0, cellId);
+
+                this.Write(parent, 20, cellId);
+                this.Write(parent, 12, this.Read(parent, 12) + 1);
+
+                return cellId;
+            }
+
+            public void AppendData(uint obj, byte[] data)
+            {
+                for (int offset = 0; offset < data.Length; offset += CellSize - 8)
+                {
+                    int length = Math.Min(data.Length - offset, CellSize - 8);
+                    uint cellId = this.AllocateCell();
+                    uint last = this.Read(obj, 32);
+
+                    this.Write(cellId, 4, (uint)length);
+                    Buffer.BlockCopy(data, offset, this.Data, Offset(cellId) + 8, length);
+
+                    if (last == 0)
+                        this.Write(obj, 28, cellId);
+                    else
+                        this.Write(last, 0, cellId);
+
+                    this.Write(obj, 32, cellId);
+                    this.Write(obj, 24, this.Read(obj, 24) + (uint)length);
+                }
+            }
+        }
+
+        private static byte[] MakeData(int length, int seed)
+        {
+            byte[] data = new byte[length];
+
+            new Random(seed).NextBytes(data);
+
+            return data;
+        }
+
+        private static bool AreEqual(byte[] a, byte[] b)
+        {
+            if (a.Length != b.Length)
+                return false;
+
+            for (int i = 0; i < a.Length; i++)
+            {
+                if (a[i] != b[i])
+                    return false;
+            }
+
+            return true;
+        }
+
+        private static uint BitwiseCrc32(byte[] data, int offset, int length)
+        {
+            uint crc = 0xffffffff;
+
+            for (int i = offset; i < offset + length; i++)
+            {
+                crc ^= data[i];
+
+                for (int j = 0; j < 8; j++)
+                    crc = (crc & 1) != 0 ? (crc >> 1) ^ 0xedb88320 : crc >> 1;
+            }
+
+            return ~crc;
+        }
+
+        [Test]
+        public static void Crc32MatchesStandard()
+        {
+            byte[] check = Encoding.ASCII.GetBytes("123456789");
+            byte[] data = MakeData(300, 1);
+
+            fixed (byte* p = check)
+                Assert.AreEqual(unchecked((int)0xcbf43926), Crc32.Compute(p, check.Length), "Check value");
+
+            // Every length and alignment around the 8-byte steps.
+            fixed (byte* p = data)
+            {
+                for (int offset = 0; offset < 8; offset++)
+                {
+                    for (int length = 0; length < 40; length++)
+                        Assert.AreEqual((int)BitwiseCrc32(data, offset, length), Crc32.Compute(p + offset, length), "CRC of " + length + " bytes");
+                }
+
+                // Updating in pieces gives the same result.
+                uint crc = Crc32.Update(0xffffffff, p, 13);
+
+                crc = Crc32.Update(crc, p + 13, data.Length - 13);
+                Assert.AreEqual((int)BitwiseCrc32(data, 0, data.Length), (int)~crc, "CRC updated in pieces");
+            }
+        }
+
+        [Test]
+        public static void WriteStreamStoresWholeBlocksAsExtents()
+        {
+            MemoryStorage storage = new MemoryStorage(64 * BlockSize);
+            byte[] data = MakeData(BlockSize * 3 + 1000, 2);
+
+            using (MemoryFileSystem mfs = new MemoryFileSystem(storage, null))
+            using (MemoryObject mo = mfs.RootObject.CreateChild("data"))
+            {
+                Assert.AreEqual(2, mfs.Version, "Version");
+
+                // Small writes, as BinaryWriter does.
+                using (Stream stream = mo.GetWriteStream())
+                {
+                    for (int offset = 0; offset < data.Length; offset += 100)
+                        stream.Write(data, offset, Math.Min(100, data.Length - offset));
+                }
+
+                Assert.AreEqual(data.Length, mo.DataLength, "Data length");
+            }
+
+            // The root object is global cell 1 and its only child is the 
+            // first object created. Its data starts with an extent cell.
+            byte[] image = storage.Data;
+            int child = BitConverter.ToInt32(image, CellSize + 16);
+            int firstData = BitConverter.ToInt32(image, child * CellSize + 28);
+
+            Assert.IsTrue((BitConverter.ToInt32(image, firstData * CellSize + 4) & ExtentFlag) != 0, "Data is stored in an extent");
+
+            // Reopen read only, which also checks the block hashes.
+            using (MemoryFileSystem mfs = new MemoryFileSystem(storage.Reopen(true), null))
+            using (MemoryObject mo = mfs.RootObject.GetChild("data"))
+                Assert.IsTrue(AreEqual(data, mo.ReadData()), "Data read back");
+
+            storage.Free();
+        }
+
+        [Test]
+        public static void ReadsVersion1FileSystems()
+        {
+            Version1Image image = new Version1Image();
+            uint processes = image.AddObject(Version1Image.Root, "Processes");
+            byte[] general = MakeData(300, 3);
+
+            image.AddObject(processes, "4");
+            image.AppendData(image.AddObject(processes, "8"), general);
+            image.AddObject(Version1Image.Root, "Services");
+
+            MemoryStorage storage = new MemoryStorage(image.Data, 16 * BlockSize);
+            byte[] added = MakeData(BlockSize + 500, 4);
+
+            using (MemoryFileSystem mfs = new MemoryFileSystem(storage.Reopen(true), null))
+            {
+                Assert.AreEqual(1, mfs.Version, "Version");
+                Assert.AreEqual("Processes,Services", string.Join(",", mfs.RootObject.ChildNames), "Root children");
+
+                using (MemoryObject processesMo = mfs.RootObject.GetChild("Processes"))
+                using (MemoryObject processMo = processesMo.GetChild("8"))
+                {
+                    Assert.AreEqual("4,8", string.Join(",", processesMo.ChildNames), "Process children");
+                    Assert.IsTrue(processesMo.GetChild("missing") == null, "Missing child");
+                    Assert.IsTrue(AreEqual(general, processMo.ReadData()), "Version 1 data");
+                }
+            }
+
+            // Version 1 file systems can still be written to, without extents.
+            using (MemoryFileSystem mfs = new MemoryFileSystem(storage.Reopen(false), null))
+            using (MemoryObject mo = mfs.RootObject.CreateChild("Network"))
+            using (Stream stream = mo.GetWriteStream())
+                stream.Write(added, 0, added.Length);
+
+            using (MemoryFileSystem mfs = new MemoryFileSystem(storage.Reopen(true), null))
+            using (MemoryObject processesMo = mfs.RootObject.GetChild("Processes"))
+            using (MemoryObject processMo = processesMo.GetChild("8"))
+            using (MemoryObject networkMo = mfs.RootObject.GetChild("Network"))
+            {
+                Assert.AreEqual(1, mfs.Version, "Version after writing");
+                Assert.IsTrue(AreEqual(general, processMo.ReadData()), "Old data after writing");
+                Assert.IsTrue(AreEqual(added, networkMo.ReadData()), "New data");
+            }
+
+            storage.Free();
+        }
+
+        [Benchmark]
+        public static void WriteAndHashBenchmark()
+        {
+            byte[] data = MakeData(BlockSize * 16, 5);
+
+            Benchmark.Run("CRC32 of 1 MB", 20, () =>
+                {
+                    fixed (byte* p = data)
+                        Crc32.Compute(p, data.Length);
+                });
+
+            Benchmark.Run("Write 1 MB in 100 byte pieces", 20, () =>
+                {
+                    MemoryStorage storage = new MemoryStorage(64 * BlockSize);
+
+                    using (MemoryFileSystem mfs = new MemoryFileSystem(storage, null))
+                    using (MemoryObject mo = mfs.RootObject.CreateChild("data"))
+                    using (Stream stream = mo.GetWriteStream())
+                    {
+                        for (int offset = 0; offset < data.Length; offset += 100)
+                            stream.Write(data, offset, Math.Min(100, data.Length - offset));
+                    }
+
+                    storage.Free();
+                });
+        }
+    }
+}
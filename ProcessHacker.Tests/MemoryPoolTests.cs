@@ -0,0 +1,97 @@
+﻿/*
+ * Process Hacker -
+ *   memory pool tests
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.Threading;
+using ProcessHacker.Native;
+
+namespace ProcessHacker.Tests
+{
+    public static class MemoryPoolTests
+    {
+        private static void AllocateAndFree(int count, int size)
+        {
+            IntPtr[] blocks = new IntPtr[count];
+            int sizeClass = -1;
+
+            for (int i = 0; i < count; i++)
+                blocks[i] = MemoryPool.Allocate(size, out sizeClass);
+            for (int i = 0; i < count; i++)
+                MemoryPool.Free(blocks[i], sizeClass);
+        }
+
+        [Test]
+        public static void ReusesFreedBlocks()
+        {
+            MemoryPool.Trim();
+
+            MemoryPoolStatistics before = MemoryPool.GetStatistics();
+
+            AllocateAndFree(8, 1000);
+            AllocateAndFree(8, 1000);
+
+            MemoryPoolStatistics after = MemoryPool.GetStatistics();
+
+            Assert.AreEqual(8, after.HeapAllocations - before.HeapAllocations, "Heap allocations");
+            Assert.AreEqual(8, after.ThreadCacheHits - before.ThreadCacheHits, "Thread cache hits");
+
+            MemoryPool.Trim();
+            Assert.AreEqual(0, MemoryPool.GetStatistics().DepotBytes, "Depot bytes after trimming");
+        }
+
+        [Test]
+        public static void ReclaimsBlocksOfExitedThreads()
+        {
+            MemoryPool.Trim();
+
+            MemoryPoolStatistics before = MemoryPool.GetStatistics();
+            Thread thread = new Thread(() => AllocateAndFree(8, 1000));
+
+            thread.Start();
+            thread.Join();
+
+            // The blocks are still in the thread's cache until the cache 
+            // is finalized.
+            long reclaimed = 0;
+
+            for (int i = 0; i < 10 && reclaimed < 8; i++)
+            {
+                GC.Collect();
+                GC.WaitForPendingFinalizers();
+
+                MemoryPoolStatistics after = MemoryPool.GetStatistics();
+
+                reclaimed = (after.DepotBytes - before.DepotBytes) / MemoryPool.GetSizeClassSize(MemoryPool.GetSizeClass(1000)) +
+                    after.HeapFrees - before.HeapFrees;
+            }
+
+            Assert.AreEqual(8, reclaimed, "Blocks reclaimed");
+
+            // The blocks are reused by this thread.
+            before = MemoryPool.GetStatistics();
+            AllocateAndFree(8, 1000);
+            Assert.AreEqual(0, MemoryPool.GetStatistics().HeapAllocations - before.HeapAllocations, "Heap allocations");
+
+            MemoryPool.Trim();
+        }
+    }
+}
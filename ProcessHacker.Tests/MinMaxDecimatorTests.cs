@@ -0,0 +1,147 @@
+﻿/*
+ * Process Hacker -
+ *   min/max decimator tests
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.Collections.Generic;
+using ProcessHacker.Common;
+
+namespace ProcessHacker.Tests
+{
+    public static class MinMaxDecimatorTests
+    {
+        private static void AssertSameColumns(MinMaxDecimator expected, MinMaxDecimator actual, string message)
+        {
+            Assert.AreEqual(expected.ColumnCount, actual.ColumnCount, message + ": column count");
+
+            for (int c = 0; c < expected.ColumnCount; c++)
+            {
+                Assert.AreEqual(expected.GetMinimum(c), actual.GetMinimum(c), message + ": minimum of column " + c);
+                Assert.AreEqual(expected.GetMaximum(c), actual.GetMaximum(c), message + ": maximum of column " + c);
+            }
+        }
+
+        [Test]
+        public static void ColumnsCoverAllSamples()
+        {
+            List<float> data = new List<float>();
+            MinMaxDecimator decimator = new MinMaxDecimator();
+
+            for (int i = 0; i < 100; i++)
+                data.Add(i);
+
+            decimator.Update(data, 10);
+
+            Assert.AreEqual(10, decimator.SamplesPerBucket, "samples per bucket");
+            Assert.AreEqual(10, decimator.ColumnCount, "column count");
+            Assert.AreEqual(99.0, decimator.Maximum, "maximum");
+
+            double min = double.MaxValue;
+            double max = double.MinValue;
+
+            for (int c = 0; c < decimator.ColumnCount; c++)
+            {
+                min = Math.Min(min, decimator.GetMinimum(c));
+                max = Math.Max(max, decimator.GetMaximum(c));
+            }
+
+            Assert.AreEqual(0.0, min, "smallest minimum");
+            Assert.AreEqual(99.0, max, "largest maximum");
+        }
+
+        [Test]
+        public static void ColumnsFillTheWidth()
+        {
+            List<float> data = new List<float>();
+            MinMaxDecimator decimator = new MinMaxDecimator();
+
+            // Most recent first, so column 0 holds the largest values.
+            for (int i = 0; i < 512; i++)
+                data.Add(511 - i);
+
+            decimator.Update(data, 400);
+
+            Assert.AreEqual(1, decimator.SamplesPerBucket, "samples per bucket");
+            Assert.AreEqual(400, decimator.ColumnCount, "column count");
+            Assert.AreEqual(511.0, decimator.GetMaximum(0), "maximum of the first column");
+            Assert.AreEqual(0.0, decimator.GetMinimum(399), "minimum of the last column");
+
+            // Each column continues where the previous one ended and covers 
+            // one or two samples.
+            for (int c = 1; c < decimator.ColumnCount; c++)
+            {
+                Assert.AreEqual(decimator.GetMinimum(c - 1) - 1, decimator.GetMaximum(c), "column " + c + " is contiguous");
+
+                double width = decimator.GetMaximum(c) - decimator.GetMinimum(c) + 1;
+
+                Assert.IsTrue(width == 1 || width == 2, "column " + c + " covers one or two samples");
+                Assert.AreEqual(data[decimator.GetSampleIndex(c)], (float)decimator.GetMaximum(c), "sample index of column " + c);
+            }
+        }
+
+        [Test]
+        public static void IncrementalMatchesRebuild()
+        {
+            Random random = new Random(1);
+            CircularBuffer<long> buffer = new CircularBuffer<long>(1000);
+            MinMaxDecimator incremental = new MinMaxDecimator();
+            MinMaxDecimator rebuilt = new MinMaxDecimator();
+
+            // Fill past the buffer size so that the oldest column is 
+            // partially erased.
+            for (int i = 0; i < 3000; i++)
+            {
+                buffer.Add(random.Next(1000));
+
+                incremental.Update(buffer, 37);
+                rebuilt.Invalidate();
+                rebuilt.Update(buffer, 37);
+
+                AssertSameColumns(rebuilt, incremental, "after " + (i + 1) + " samples");
+            }
+        }
+
+        [Benchmark]
+        public static void UpdatePerTick()
+        {
+            CircularBuffer<float> buffer = new CircularBuffer<float>(100000);
+            MinMaxDecimator decimator = new MinMaxDecimator();
+            Random random = new Random(1);
+
+            for (int i = 0; i < buffer.Size; i++)
+                buffer.Add((float)random.NextDouble());
+
+            decimator.Update(buffer, 400);
+
+            Benchmark.Run("incremental update, 100000 samples, 400 columns", 10000, () =>
+            {
+                buffer.Add((float)random.NextDouble());
+                decimator.Update(buffer, 400);
+            });
+
+            Benchmark.Run("full rebuild, 100000 samples, 400 columns", 100, () =>
+            {
+                decimator.Invalidate();
+                decimator.Update(buffer, 400);
+            });
+        }
+    }
+}
@@ -0,0 +1,276 @@
+﻿/*
+ * Process Hacker -
+ *   network connection table tests
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.Collections.Generic;
+using System.IO;
+using System.Net;
+using ProcessHacker.Native;
+using ProcessHacker.Native.Api;
+
+namespace ProcessHacker.Tests
+{
+    public static class NetworkConnectionTableTests
+    {
+        private static int Port(int port)
+        {
+            // Ports are stored in network byte order.
+            return ((port & 0xff) << 8) | (port >> 8);
+        }
+
+        private static byte[] BuildTable(int count, int rows, Func<int, int[]> getRow)
+        {
+            MemoryStream stream = new MemoryStream();
+            BinaryWriter writer = new BinaryWriter(stream);
+
+            writer.Write(count);
+
+            for (int i = 0; i < rows; i++)
+            {
+                foreach (int value in getRow(i))
+                    writer.Write(value);
+            }
+
+            return stream.ToArray();
+        }
+
+        private static byte[] BuildTable(params int[][] rows)
+        {
+            return BuildTable(rows.Length, rows.Length, i => rows[i]);
+        }
+
+        private static int[] Address6(string address)
+        {
+            byte[] bytes = IPAddress.Parse(address).GetAddressBytes();
+            int[] values = new int[4];
+
+            for (int i = 0; i < 4; i++)
+                values[i] = BitConverter.ToInt32(bytes, i * 4);
+
+            return values;
+        }
+
+        private static int[] Concat(params int[][] parts)
+        {
+            List<int> values = new List<int>();
+
+            foreach (int[] part in parts)
+                values.AddRange(part);
+
+            return values.ToArray();
+        }
+
+        private static int[] TcpRow(MibTcpState state, string local, int localPort, string remote, int remotePort, int pid)
+        {
+            // MIB_TCPROW_OWNER_PID: state, local address, local port, 
+            // remote address, remote port, PID.
+            return new int[]
+            {
+                (int)state,
+                BitConverter.ToInt32(IPAddress.Parse(local).GetAddressBytes(), 0),
+                Port(localPort),
+                BitConverter.ToInt32(IPAddress.Parse(remote).GetAddressBytes(), 0),
+                Port(remotePort),
+                pid
+            };
+        }
+
+        private static int[] UdpRow(string local, int localPort, int pid)
+        {
+            // MIB_UDPROW_OWNER_PID: local address, local port, PID.
+            return new int[]
+            {
+                BitConverter.ToInt32(IPAddress.Parse(local).GetAddressBytes(), 0),
+                Port(localPort),
+                pid
+            };
+        }
+
+        private static int[] Tcp6Row(
+            MibTcpState state,
+            string local, int localScopeId, int localPort,
+            string remote, int remoteScopeId, int remotePort,
+            int pid
+            )
+        {
+            // MIB_TCP6ROW_OWNER_PID: local address, local scope ID, local 
+            // port, remote address, remote scope ID, remote port, state, 
+            // PID.
+            return Concat(
+                Address6(local),
+                new int[] { localScopeId, Port(localPort) },
+                Address6(remote),
+                new int[] { remoteScopeId, Port(remotePort), (int)state, pid }
+                );
+        }
+
+        private static int[] Udp6Row(string local, int localScopeId, int localPort, int pid)
+        {
+            // MIB_UDP6ROW_OWNER_PID: local address, local scope ID, local 
+            // port, PID.
+            return Concat(Address6(local), new int[] { localScopeId, Port(localPort), pid });
+        }
+
+        [Test]
+        public static void DecodesAndMergesTcpRows()
+        {
+            int[][] rows = new int[][]
+            {
+                TcpRow(MibTcpState.Listening, "0.0.0.0", 135, "0.0.0.0", 0, 4),
+                TcpRow(MibTcpState.Established, "10.0.0.2", 50000, "192.168.1.1", 443, 1234),
+                TcpRow(MibTcpState.Established, "10.0.0.2", 50000, "192.168.1.1", 443, 1234)
+            };
+            NetworkConnectionTable table = new NetworkConnectionTable();
+
+            table.Decode(NetworkProtocol.Tcp, BuildTable(rows));
+
+            Assert.AreEqual(2, table.Count, "Identical rows are merged");
+            Assert.AreEqual(2, table.Rows[1].Count, "Merged row count");
+
+            NetworkConnection connection = table.Rows[1].ToNetworkConnection();
+
+            Assert.AreEqual(1234, connection.Pid, "PID");
+            Assert.AreEqual(MibTcpState.Established, connection.State, "State");
+            Assert.AreEqual("10.0.0.2:50000", connection.Local.ToString(), "Local end point");
+            Assert.AreEqual("192.168.1.1:443", connection.Remote.ToString(), "Remote end point");
+
+            NetworkConnectionKey key = table.Rows[0].Key;
+
+            Assert.AreEqual(0, table.Find(ref key), "Find");
+            key.Pid = 5;
+            Assert.AreEqual(-1, table.Find(ref key), "Find a missing connection");
+
+            table.Clear();
+            Assert.AreEqual(0, table.Count, "Cleared");
+            key.Pid = 4;
+            Assert.AreEqual(-1, table.Find(ref key), "Find after clearing");
+        }
+
+        [Test]
+        public static void DecodesUdpRows()
+        {
+            NetworkConnectionTable table = new NetworkConnectionTable();
+
+            table.Decode(NetworkProtocol.Udp, BuildTable(
+                UdpRow("0.0.0.0", 123, 4),
+                UdpRow("127.0.0.1", 53, 900)
+                ));
+
+            Assert.AreEqual(2, table.Count, "Rows decoded");
+
+            NetworkConnection connection = table.Rows[1].ToNetworkConnection();
+
+            Assert.AreEqual(NetworkProtocol.Udp, connection.Protocol, "Protocol");
+            Assert.AreEqual(900, connection.Pid, "PID");
+            Assert.AreEqual("127.0.0.1:53", connection.Local.ToString(), "Local end point");
+            Assert.IsTrue(connection.Remote == null, "No remote end point");
+            Assert.AreEqual("0.0.0.0:123", table.Rows[0].Key.GetLocalEndPoint().ToString(), "First row");
+        }
+
+        [Test]
+        public static void DecodesTcp6Rows()
+        {
+            NetworkConnectionTable table = new NetworkConnectionTable();
+
+            table.Decode(NetworkProtocol.Tcp6, BuildTable(
+                Tcp6Row(MibTcpState.Listening, "::", 0, 135, "::", 0, 0, 4),
+                Tcp6Row(MibTcpState.Established, "fe80::1", 12, 50000, "2001:db8::2", 7, 443, 1234)
+                ));
+
+            Assert.AreEqual(2, table.Count, "Rows decoded");
+
+            NetworkConnection listening = table.Rows[0].ToNetworkConnection();
+
+            Assert.AreEqual(MibTcpState.Listening, listening.State, "State");
+            Assert.AreEqual(4, listening.Pid, "PID");
+            Assert.AreEqual("[::]:135", listening.Local.ToString(), "Local end point");
+            Assert.IsTrue(table.Rows[0].Key.IsRemoteAddressEmpty, "Empty remote address");
+
+            NetworkConnection connection = table.Rows[1].ToNetworkConnection();
+
+            Assert.AreEqual(NetworkProtocol.Tcp6, connection.Protocol, "Protocol");
+            Assert.AreEqual(MibTcpState.Established, connection.State, "State");
+            Assert.AreEqual(1234, connection.Pid, "PID");
+            Assert.AreEqual("[fe80::1%12]:50000", connection.Local.ToString(), "Local end point");
+            Assert.AreEqual("[2001:db8::2%7]:443", connection.Remote.ToString(), "Remote end point");
+        }
+
+        [Test]
+        public static void DecodesUdp6Rows()
+        {
+            NetworkConnectionTable table = new NetworkConnectionTable();
+
+            table.Decode(NetworkProtocol.Udp6, BuildTable(
+                Udp6Row("fe80::2", 3, 5353, 700),
+                Udp6Row("::1", 0, 123, 4)
+                ));
+
+            Assert.AreEqual(2, table.Count, "Rows decoded");
+
+            NetworkConnection connection = table.Rows[0].ToNetworkConnection();
+
+            Assert.AreEqual(NetworkProtocol.Udp6, connection.Protocol, "Protocol");
+            Assert.AreEqual(700, connection.Pid, "PID");
+            Assert.AreEqual("[fe80::2%3]:5353", connection.Local.ToString(), "Local end point");
+            Assert.IsTrue(connection.Remote == null, "No remote end point");
+
+            connection = table.Rows[1].ToNetworkConnection();
+
+            Assert.AreEqual(4, connection.Pid, "PID");
+            Assert.AreEqual("[::1]:123", connection.Local.ToString(), "Local end point");
+        }
+
+        [Test]
+        public static void IgnoresCountsLargerThanTheTable()
+        {
+            NetworkConnectionTable table = new NetworkConnectionTable();
+            byte[] data = BuildTable(1000, 3, i => TcpRow(MibTcpState.Established, "10.0.0.1", 1000 + i, "10.0.0.2", 80, 8));
+
+            table.Decode(NetworkProtocol.Tcp, data);
+            Assert.AreEqual(3, table.Count, "Rows decoded");
+
+            table.Decode(NetworkProtocol.Tcp, new byte[2]);
+            Assert.AreEqual(3, table.Count, "Truncated table");
+        }
+
+        [Benchmark]
+        public static void DecodeBenchmark()
+        {
+            // Many connections between the same two hosts, which only 
+            // differ in their ports.
+            byte[] data = BuildTable(
+                20000,
+                20000,
+                i => TcpRow(MibTcpState.Established, "10.0.0.2", 10000 + i, "192.168.1.1", 443 + i % 4, 1000 + i % 50)
+                );
+            NetworkConnectionTable table = new NetworkConnectionTable();
+
+            Benchmark.Run("Decode 20000 TCP rows", 50, () =>
+                {
+                    table.Clear();
+                    table.Decode(NetworkProtocol.Tcp, data);
+                });
+
+            Assert.AreEqual(20000, table.Count, "Rows decoded");
+        }
+    }
+}
@@ -0,0 +1,177 @@
+﻿/*
+ * Process Hacker -
+ *   hex editor page cache tests
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.Collections.Generic;
+using Be.Windows.Forms;
+
+namespace ProcessHacker.Tests
+{
+    public static class PageCacheTests
+    {
+        /// <summary>
+        /// A page source backed by an array, with a range which can't be read.
+        /// </summary>
+        private sealed class FakePageSource : IPageSource
+        {
+            public byte[] Data;
+            public long UnreadableStart = -1;
+            public long UnreadableEnd = -1;
+            public int Reads;
+            public List<KeyValuePair<long, int>> Writes = new List<KeyValuePair<long, int>>();
+
+            public FakePageSource(int length)
+            {
+                this.Data = new byte[length];
+
+                for (int i = 0; i < length; i++)
+                    this.Data[i] = (byte)(i * 7 + 1);
+            }
+
+            public long Length
+            {
+                get { return this.Data.Length; }
+            }
+
+            public int Read(long offset, byte[] buffer, int count)
+            {
+                this.Reads++;
+
+                // Like ReadProcessMemory, stop at the first unreadable byte.
+                if (this.UnreadableStart != -1 && offset + count > this.UnreadableStart && offset < this.UnreadableEnd)
+                    count = (int)Math.Max(0, this.UnreadableStart - offset);
+
+                Buffer.BlockCopy(this.Data, (int)offset, buffer, 0, count);
+
+                return count;
+            }
+
+            public void Write(long offset, byte[] buffer, int bufferOffset, int count)
+            {
+                this.Writes.Add(new KeyValuePair<long, int>(offset, count));
+                Buffer.BlockCopy(buffer, bufferOffset, this.Data, (int)offset, count);
+            }
+        }
+
+        [Test]
+        public static void ReadsThroughCache()
+        {
+            FakePageSource source = new FakePageSource(10000);
+            PageCache cache = new PageCache(source, 1000, 4);
+            byte[] buffer = new byte[2500];
+
+            Assert.AreEqual(2500, cache.ReadBytes(1500, buffer, 0, buffer.Length), "count");
+
+            for (int i = 0; i < buffer.Length; i++)
+                Assert.AreEqual(source.Data[1500 + i], buffer[i], "byte " + i);
+
+            Assert.AreEqual(3, source.Reads, "pages read");
+            Assert.AreEqual(source.Data[1999], cache.ReadByte(1999), "cached byte");
+            Assert.AreEqual(3, source.Reads, "pages read after a cached read");
+            Assert.AreEqual(500, cache.ReadBytes(9500, buffer, 0, buffer.Length), "count at the end");
+        }
+
+        [Test]
+        public static void EvictsLeastRecentlyUsed()
+        {
+            FakePageSource source = new FakePageSource(10000);
+            PageCache cache = new PageCache(source, 1000, 2);
+
+            cache.ReadByte(0);
+            cache.ReadByte(1000);
+            cache.ReadByte(0);
+            cache.ReadByte(2000);
+
+            Assert.AreEqual(2, cache.PageCount, "page count");
+
+            int reads = source.Reads;
+
+            cache.ReadByte(0);
+            Assert.AreEqual(reads, source.Reads, "recently used page was kept");
+            cache.ReadByte(1000);
+            Assert.AreEqual(reads + 1, source.Reads, "least recently used page was evicted");
+        }
+
+        [Test]
+        public static void FlushWritesModifiedRanges()
+        {
+            FakePageSource source = new FakePageSource(10000);
+            PageCache cache = new PageCache(source, 1000, 1);
+
+            cache.WriteByte(10, 0xaa);
+            cache.WriteByte(12, 0xbb);
+            // This run crosses three page boundaries.
+            for (int i = 2990; i < 5010; i++)
+                cache.WriteByte(i, 0xcc);
+
+            // Dirty pages are kept even though the capacity is one page.
+            Assert.AreEqual(5, cache.DirtyPageCount, "dirty pages");
+            Assert.AreEqual((byte)0xaa, cache.ReadByte(10), "modified byte");
+            Assert.AreEqual((byte)(10 * 7 + 1), source.Data[10], "source before flush");
+
+            cache.Flush();
+
+            Assert.AreEqual(2, source.Writes.Count, "write count");
+            Assert.AreEqual(new KeyValuePair<long, int>(10, 3), source.Writes[0], "first write");
+            Assert.AreEqual(new KeyValuePair<long, int>(2990, 2020), source.Writes[1], "merged write");
+            Assert.AreEqual((byte)0xaa, source.Data[10], "source after flush");
+            Assert.AreEqual((byte)(11 * 7 + 1), source.Data[11], "unmodified byte");
+            Assert.IsFalse(cache.HasChanges, "changes after flush");
+        }
+
+        [Test]
+        public static void ReportsUnreadableBytes()
+        {
+            FakePageSource source = new FakePageSource(10000);
+            PageCache cache = new PageCache(source, 1000, 4);
+
+            source.UnreadableStart = 4500;
+            source.UnreadableEnd = 6000;
+
+            Assert.AreEqual((byte)0, cache.ReadByte(4600), "unreadable byte");
+            Assert.AreEqual(-1L, cache.FindUnreadable(0, 4500), "readable range");
+            Assert.AreEqual(4500L, cache.FindUnreadable(0, 10000), "whole range");
+            Assert.AreEqual(4700L, cache.FindUnreadable(4700, 100), "range inside unreadable bytes");
+            Assert.AreEqual(-1L, cache.FindUnreadable(6000, 4000), "range after unreadable bytes");
+        }
+
+        [Benchmark]
+        public static void SequentialReads()
+        {
+            FakePageSource source = new FakePageSource(16 * 1024 * 1024);
+            PageCache cache = new PageCache(source);
+            byte[] buffer = new byte[0x10000];
+
+            Benchmark.Run("read 16 MB in 64 kB blocks", 20, () =>
+            {
+                for (long i = 0; i < source.Length; i += buffer.Length)
+                    cache.ReadBytes(i, buffer, 0, buffer.Length);
+            });
+
+            Benchmark.Run("read 1M bytes one at a time", 20, () =>
+            {
+                for (long i = 0; i < 1024 * 1024; i++)
+                    cache.ReadByte(i);
+            });
+        }
+    }
+}
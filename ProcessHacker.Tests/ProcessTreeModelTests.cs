@@ -0,0 +1,198 @@
+﻿/*
+ * Process Hacker -
+ *   process tree model tests
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.Collections.Generic;
+using System.Windows.Forms;
+using Aga.Controls.Tree;
+
+namespace ProcessHacker.Tests
+{
+    public static class ProcessTreeModelTests
+    {
+        internal static ProcessItem CreateItem(int i, Random random)
+        {
+            ProcessItem item = new ProcessItem();
+
+            item.Pid = (i + 1) * 4;
+            item.Name = "process" + i.ToString() + ".exe";
+            // Each process is started by one of the processes before it.
+            item.HasParent = i != 0;
+            item.ParentPid = i != 0 ? (random.Next(i) + 1) * 4 : 0;
+            item.CpuUsage = (float)random.NextDouble();
+            item.CreateTime = DateTime.Now;
+
+            return item;
+        }
+
+        internal static ProcessTreeModel CreateModel(ProcessTree tree, List<ProcessItem> items, int count, Random random)
+        {
+            ProcessTreeModel model = new ProcessTreeModel(tree);
+
+            tree.Tree.Model = model;
+
+            for (int i = 0; i < count; i++)
+            {
+                ProcessItem item = CreateItem(items.Count, random);
+
+                items.Add(item);
+                model.Add(item);
+            }
+
+            return model;
+        }
+
+        internal static TreeColumn FindColumn(ProcessTree tree, string header)
+        {
+            foreach (TreeColumn column in tree.Tree.Columns)
+            {
+                if (column.Header == header)
+                    return column;
+            }
+
+            throw new ArgumentException("No column named " + header);
+        }
+
+        private static List<ProcessNode> GetChildren(ProcessTreeModel model)
+        {
+            List<ProcessNode> nodes = new List<ProcessNode>();
+
+            foreach (ProcessNode node in model.GetChildren(TreePath.Empty))
+                nodes.Add(node);
+
+            return nodes;
+        }
+
+        private static void AssertSortedByCpu(List<ProcessNode> nodes, int count)
+        {
+            HashSet<int> pids = new HashSet<int>();
+
+            Assert.AreEqual(count, nodes.Count, "Sorted nodes");
+
+            for (int i = 0; i < nodes.Count; i++)
+            {
+                Assert.IsTrue(pids.Add(nodes[i].Pid), "Node appears once");
+
+                // Descending is shown as ascending in the column headers.
+                if (i != 0)
+                    Assert.IsTrue(nodes[i - 1].ProcessItem.CpuUsage <= nodes[i].ProcessItem.CpuUsage, "Nodes are in order");
+            }
+        }
+
+        [Test]
+        public static void SortsAfterKeysChange()
+        {
+            Random random = new Random(1);
+            List<ProcessItem> items = new List<ProcessItem>();
+
+            using (ProcessTree tree = new ProcessTree())
+            {
+                ProcessTreeModel model = CreateModel(tree, items, 200, random);
+
+                FindColumn(tree, "CPU").SortOrder = SortOrder.Descending;
+                AssertSortedByCpu(GetChildren(model), 200);
+
+                // A few keys change, which is sorted in place.
+                for (int i = 0; i < 3; i++)
+                    items[random.Next(items.Count)].CpuUsage = (float)random.NextDouble();
+
+                AssertSortedByCpu(GetChildren(model), 200);
+
+                // Every key changes, which needs a full sort.
+                foreach (ProcessItem item in items)
+                    item.CpuUsage = (float)random.NextDouble();
+
+                AssertSortedByCpu(GetChildren(model), 200);
+            }
+        }
+
+        [Test]
+        public static void SortingCanBeTurnedOffAndOn()
+        {
+            Random random = new Random(2);
+            List<ProcessItem> items = new List<ProcessItem>();
+
+            using (ProcessTree tree = new ProcessTree())
+            {
+                ProcessTreeModel model = CreateModel(tree, items, 100, random);
+                TreeColumn column = FindColumn(tree, "CPU");
+
+                column.SortOrder = SortOrder.Descending;
+                AssertSortedByCpu(GetChildren(model), 100);
+
+                // Processes added while the list isn't sorted must still 
+                // show up once sorting is turned back on.
+                column.SortOrder = SortOrder.None;
+                Assert.AreEqual(1, GetChildren(model).Count, "Root nodes");
+
+                for (int i = 0; i < 50; i++)
+                {
+                    ProcessItem item = CreateItem(items.Count, random);
+
+                    items.Add(item);
+                    model.Add(item);
+                }
+
+                model.Remove(items[10]);
+                column.SortOrder = SortOrder.Descending;
+                AssertSortedByCpu(GetChildren(model), 149);
+            }
+        }
+
+        [Benchmark]
+        public static void SortBenchmark()
+        {
+            Random random = new Random(3);
+            List<ProcessItem> items = new List<ProcessItem>();
+
+            using (ProcessTree tree = new ProcessTree())
+            {
+                ProcessTreeModel model = CreateModel(tree, items, 5000, random);
+
+                FindColumn(tree, "CPU").SortOrder = SortOrder.Descending;
+                GetChildren(model);
+
+                Benchmark.Run("5000 nodes, no changes", 100, () => GetChildren(model));
+                Benchmark.Run("5000 nodes, 5 changes", 100, () =>
+                    {
+                        for (int i = 0; i < 5; i++)
+                            items[random.Next(items.Count)].CpuUsage = (float)random.NextDouble();
+
+                        GetChildren(model);
+                    });
+                Benchmark.Run("5000 nodes, all changed", 100, () =>
+                    {
+                        foreach (ProcessItem item in items)
+                            item.CpuUsage = (float)random.NextDouble();
+
+                        GetChildren(model);
+                    });
+
+                FindColumn(tree, "CPU").SortOrder = SortOrder.None;
+                FindColumn(tree, "Name").SortOrder = SortOrder.Descending;
+                GetChildren(model);
+
+                Benchmark.Run("5000 nodes by name, no changes", 100, () => GetChildren(model));
+            }
+        }
+    }
+}
@@ -0,0 +1,89 @@
+﻿/*
+ * Process Hacker -
+ *   unit test and benchmark runner
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+using System.Reflection;
+
+namespace ProcessHacker.Tests
+{
+    // Runs every public static method marked with [Test] in this assembly. 
+    // Methods marked with [Benchmark] are only run when -bench is given.
+    //
+    //   ProcessHacker.Tests [-bench] [filter ...]
+    //
+    // A filter selects the tests whose full name contains it. The exit code 
+    // is the number of failed tests.
+    static class Program
+    {
+        static int Main(string[] args)
+        {
+            bool bench = false;
+            List<string> filters = new List<string>();
+            int passed = 0;
+            int failed = 0;
+
+            foreach (string arg in args)
+            {
+                if (arg.Equals("-bench", StringComparison.OrdinalIgnoreCase))
+                    bench = true;
+                else
+                    filters.Add(arg);
+            }
+
+            foreach (Type type in typeof(Program).Assembly.GetTypes())
+            {
+                foreach (MethodInfo method in type.GetMethods(BindingFlags.Public | BindingFlags.Static))
+                {
+                    bool isTest = method.IsDefined(typeof(TestAttribute), false);
+                    bool isBenchmark = method.IsDefined(typeof(BenchmarkAttribute), false);
+                    string name = type.Name + "." + method.Name;
+
+                    if (!(isTest || (bench && isBenchmark)))
+                        continue;
+                    if (filters.Count != 0 && !filters.Exists(filter => name.IndexOf(filter, StringComparison.OrdinalIgnoreCase) != -1))
+                        continue;
+
+                    Stopwatch sw = Stopwatch.StartNew();
+
+                    try
+                    {
+                        method.Invoke(null, null);
+                        Console.WriteLine("PASS {0} ({1} ms)", name, sw.ElapsedMilliseconds);
+                        passed++;
+                    }
+                    catch (TargetInvocationException ex)
+                    {
+                        Console.WriteLine("FAIL {0}: {1}", name, ex.InnerException);
+                        failed++;
+                    }
+                }
+            }
+
+            Console.WriteLine();
+            Console.WriteLine("{0} passed, {1} failed", passed, failed);
+
+            return failed;
+        }
+    }
+}
@@ -0,0 +1,362 @@
+﻿/*
+ * Process Hacker -
+ *   ScalableResourceLock stress tests
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.Threading;
+using ProcessHacker.Common.Threading;
+
+namespace ProcessHacker.Tests
+{
+    public static class ScalableResourceLockTests
+    {
+        private static readonly int ThreadCount = Math.Max(4, Environment.ProcessorCount * 2);
+
+        /// <summary>
+        /// Tracks how many threads are inside the lock in each mode and
+        /// fails if the lock ever lets a writer in with anyone else.
+        /// </summary>
+        private sealed class Witness
+        {
+            public int Readers;
+            public int Writers;
+            public long Counter;
+            public int Violations;
+
+            public void EnterShared()
+            {
+                Interlocked.Increment(ref this.Readers);
+
+                if (Thread.VolatileRead(ref this.Writers) != 0)
+                    Interlocked.Increment(ref this.Violations);
+            }
+
+            public void ExitShared()
+            {
+                Interlocked.Decrement(ref this.Readers);
+            }
+
+            public void EnterExclusive()
+            {
+                if (Interlocked.Increment(ref this.Writers) != 1 || Thread.VolatileRead(ref this.Readers) != 0)
+                    Interlocked.Increment(ref this.Violations);
+            }
+
+            public void ExitExclusive()
+            {
+                Interlocked.Decrement(ref this.Writers);
+            }
+        }
+
+        /// <summary>
+        /// Runs the same body on several threads, started together.
+        /// </summary>
+        private static void RunThreads(int count, Action<int> body)
+        {
+            Thread[] threads = new Thread[count];
+            Exception failure = null;
+            ManualResetEvent start = new ManualResetEvent(false);
+
+            for (int i = 0; i < count; i++)
+            {
+                int index = i;
+
+                threads[i] = new Thread(() =>
+                    {
+                        start.WaitOne();
+
+                        try
+                        {
+                            body(index);
+                        }
+                        catch (Exception ex)
+                        {
+                            failure = ex;
+                        }
+                    });
+                threads[i].IsBackground = true;
+                threads[i].Start();
+            }
+
+            start.Set();
+
+            foreach (Thread thread in threads)
+            {
+                if (!thread.Join(60000))
+                    throw new Exception("A thread did not finish; the lock may be deadlocked.");
+            }
+
+            start.Close();
+
+            if (failure != null)
+                throw new Exception("A thread failed: " + failure.Message, failure);
+        }
+
+        private static void Stress(bool striped, int iterations)
+        {
+            ScalableResourceLock rlock = new ScalableResourceLock(striped, true);
+            Witness witness = new Witness();
+            long expectedCounter = 0;
+            long exclusiveAcquires = 0;
+            long sharedAcquires = 0;
+
+            RunThreads(ThreadCount, index =>
+                {
+                    Random random = new Random(index * 7919 + 1);
+                    long counter = 0;
+                    long exclusive = 0;
+                    long shared = 0;
+
+                    for (int i = 0; i < iterations; i++)
+                    {
+                        int op = random.Next(100);
+
+                        if (op < 70)
+                        {
+                            // Mostly readers, which is what striping is for.
+                            rlock.AcquireShared();
+                            shared++;
+                            witness.EnterShared();
+                            Thread.SpinWait(random.Next(20));
+                            witness.ExitShared();
+                            rlock.ReleaseShared();
+                        }
+                        else if (op < 85)
+                        {
+                            rlock.AcquireExclusive();
+                            exclusive++;
+                            witness.EnterExclusive();
+                            witness.Counter++;
+                            counter++;
+                            Thread.SpinWait(random.Next(20));
+                            witness.ExitExclusive();
+                            rlock.ReleaseExclusive();
+                        }
+                        else if (op < 90)
+                        {
+                            // Write, then keep reading without letting another
+                            // writer in between.
+                            rlock.AcquireExclusive();
+                            exclusive++;
+                            witness.EnterExclusive();
+                            witness.Counter++;
+                            counter++;
+                            witness.ExitExclusive();
+                            rlock.ConvertExclusiveToShared();
+                            witness.EnterShared();
+                            Thread.SpinWait(random.Next(20));
+                            witness.ExitShared();
+                            rlock.ReleaseShared();
+                        }
+                        else if (op < 95)
+                        {
+                            if (rlock.TryAcquireShared())
+                            {
+                                witness.EnterShared();
+                                witness.ExitShared();
+                                rlock.ReleaseShared();
+                            }
+                        }
+                        else
+                        {
+                            if (rlock.TryAcquireExclusive())
+                            {
+                                witness.EnterExclusive();
+                                witness.Counter++;
+                                counter++;
+                                witness.ExitExclusive();
+                                rlock.ReleaseExclusive();
+                            }
+                        }
+                    }
+
+                    Interlocked.Add(ref expectedCounter, counter);
+                    Interlocked.Add(ref exclusiveAcquires, exclusive);
+                    Interlocked.Add(ref sharedAcquires, shared);
+                });
+
+            string mode = striped ? "striped" : "not striped";
+
+            Assert.AreEqual(0, witness.Violations, "Exclusive access violations (" + mode + ")");
+            Assert.AreEqual(expectedCounter, witness.Counter, "Counter protected by the lock (" + mode + ")");
+            Assert.IsFalse(rlock.Owned, "Lock is released (" + mode + ")");
+            Assert.AreEqual(0, rlock.SharedOwners, "Shared owners (" + mode + ")");
+            Assert.AreEqual(0, rlock.ExclusiveWaiters, "Exclusive waiters (" + mode + ")");
+            Assert.AreEqual(0, rlock.SharedWaiters, "Shared waiters (" + mode + ")");
+
+            // Only blocking acquires are counted, and striped acquires
+            // are a subset of the shared ones.
+            ScalableResourceLock.Statistics statistics = rlock.GetStatistics();
+
+            Assert.AreEqual(exclusiveAcquires, statistics.AcqExcl, "Exclusive acquire count (" + mode + ")");
+            Assert.AreEqual(sharedAcquires, statistics.AcqShrd, "Shared acquire count (" + mode + ")");
+
+            if (striped)
+                Assert.IsTrue(statistics.AcqShrdStriped > 0 && statistics.AcqShrdStriped <= statistics.AcqShrd, "Striped acquire count");
+            else
+                Assert.AreEqual(0L, statistics.AcqShrdStriped, "Striped acquires without striping");
+
+            rlock.Dispose();
+        }
+
+        [Test]
+        public static void StressNotStriped()
+        {
+            Stress(false, 20000);
+        }
+
+        [Test]
+        public static void StressStriped()
+        {
+            Stress(true, 20000);
+        }
+
+        [Test]
+        public static void TryAcquireFailsWhenOwned()
+        {
+            ScalableResourceLock rlock = new ScalableResourceLock(true, false);
+
+            rlock.AcquireShared();
+            Assert.IsFalse(rlock.TryAcquireExclusive(), "Exclusive acquire while shared");
+            Assert.IsTrue(rlock.TryAcquireShared(), "Second shared acquire");
+            Assert.AreEqual(2, rlock.SharedOwners, "Shared owners");
+            rlock.ReleaseShared();
+            rlock.ReleaseShared();
+
+            rlock.AcquireExclusive();
+            Assert.IsFalse(rlock.TryAcquireShared(), "Shared acquire while exclusive");
+            Assert.IsFalse(rlock.TryAcquireExclusive(), "Exclusive acquire while exclusive");
+            rlock.ReleaseExclusive();
+
+            Assert.IsFalse(rlock.Owned, "Lock is released");
+            rlock.Dispose();
+        }
+
+        [Test]
+        public static void StripedAcquiresAreCounted()
+        {
+            ScalableResourceLock rlock = new ScalableResourceLock(true, true);
+
+            // Without writers every blocking shared acquire uses a slot.
+            for (int i = 0; i < 10; i++)
+            {
+                rlock.AcquireShared();
+                rlock.ReleaseShared();
+            }
+
+            // Try-acquires are not counted, like the exclusive ones.
+            for (int i = 0; i < 5; i++)
+            {
+                Assert.IsTrue(rlock.TryAcquireShared(), "Shared try-acquire");
+                rlock.ReleaseShared();
+            }
+
+            ScalableResourceLock.Statistics statistics = rlock.GetStatistics();
+
+            Assert.AreEqual(10L, statistics.AcqShrd, "Shared acquire count");
+            Assert.AreEqual(10L, statistics.AcqShrdStriped, "Striped acquire count");
+
+            rlock.AcquireExclusive();
+            rlock.ReleaseExclusive();
+            Assert.IsTrue(rlock.TryAcquireExclusive(), "Exclusive try-acquire");
+            rlock.ReleaseExclusive();
+
+            statistics = rlock.GetStatistics();
+
+            Assert.AreEqual(1L, statistics.AcqExcl, "Exclusive acquire count");
+            Assert.AreEqual(10L, statistics.AcqShrdStriped, "Striped acquire count after exclusive acquires");
+
+            rlock.Dispose();
+        }
+
+        /// <summary>
+        /// A monitor behind the resource lock interface, for comparison.
+        /// Shared acquires are exclusive.
+        /// </summary>
+        private sealed class MonitorLock : IResourceLock
+        {
+            private readonly object _lock = new object();
+
+            public void AcquireExclusive()
+            {
+                Monitor.Enter(_lock);
+            }
+
+            public void AcquireShared()
+            {
+                Monitor.Enter(_lock);
+            }
+
+            public void ReleaseExclusive()
+            {
+                Monitor.Exit(_lock);
+            }
+
+            public void ReleaseShared()
+            {
+                Monitor.Exit(_lock);
+            }
+
+            public bool TryAcquireExclusive()
+            {
+                return Monitor.TryEnter(_lock);
+            }
+
+            public bool TryAcquireShared()
+            {
+                return Monitor.TryEnter(_lock);
+            }
+        }
+
+        private static void SharedThroughput(IResourceLock rlock, int iterations)
+        {
+            RunThreads(ThreadCount, index =>
+                {
+                    for (int i = 0; i < iterations; i++)
+                    {
+                        rlock.AcquireShared();
+                        rlock.ReleaseShared();
+                    }
+                });
+        }
+
+        [Benchmark]
+        public static void SharedAcquireBenchmark()
+        {
+            ScalableResourceLock notStriped = new ScalableResourceLock(false, false);
+            ScalableResourceLock striped = new ScalableResourceLock(true, false);
+            FastResourceLock fast = new FastResourceLock();
+            FairResourceLock fair = new FairResourceLock();
+            MonitorLock monitor = new MonitorLock();
+
+            Benchmark.Run("Monitor", 5, () => SharedThroughput(monitor, 100000));
+            Benchmark.Run("FairResourceLock", 5, () => SharedThroughput(fair, 100000));
+            Benchmark.Run("FastResourceLock", 5, () => SharedThroughput(fast, 100000));
+            Benchmark.Run("ScalableResourceLock, not striped", 5, () => SharedThroughput(notStriped, 100000));
+            Benchmark.Run("ScalableResourceLock, striped", 5, () => SharedThroughput(striped, 100000));
+
+            fast.Dispose();
+            fair.Dispose();
+            notStriped.Dispose();
+            striped.Dispose();
+        }
+    }
+}
@@ -0,0 +1,534 @@
+﻿/*
+ * Process Hacker -
+ *   system service logging tests
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.Collections.Generic;
+using System.Threading;
+using ProcessHacker.Native.Api;
+using ProcessHacker.Native.SsLogging;
+
+namespace ProcessHacker.Tests
+{
+    public static unsafe class SsLoggingTests
+    {
+        private static int StringBlockSize(int characters)
+        {
+            return KphSsArgumentBlock.DataOffset + KphSsUnicodeString.BufferOffset + characters * 2;
+        }
+
+        private static KphSsArgumentBlock* WriteArgumentHeader(byte* buffer, int offset, int size, KphSsArgumentType type)
+        {
+            KphSsArgumentBlock* block = (KphSsArgumentBlock*)(buffer + offset);
+
+            block->Header.Size = (ushort)size;
+            block->Header.Type = KphSsBlockType.Argument;
+            block->Index = 0;
+            block->Type = type;
+
+            return block;
+        }
+
+        private static void WriteString(byte* str, string value, int storedLength)
+        {
+            ((KphSsUnicodeString*)str)->Length = (ushort)storedLength;
+            ((KphSsUnicodeString*)str)->MaximumLength = (ushort)storedLength;
+
+            char* chars = (char*)(str + KphSsUnicodeString.BufferOffset);
+
+            for (int i = 0; i < value.Length; i++)
+                chars[i] = value[i];
+        }
+
+        /// <summary>
+        /// Writes a string argument block and returns the offset of the next block.
+        /// </summary>
+        private static int WriteStringArgument(byte* buffer, int offset, string value, int storedLength)
+        {
+            KphSsArgumentBlock* block = WriteArgumentHeader(
+                buffer, offset, StringBlockSize(value.Length), KphSsArgumentType.UnicodeString);
+
+            WriteString((byte*)block + KphSsArgumentBlock.DataOffset, value, storedLength);
+
+            return offset + block->Header.Size;
+        }
+
+        /// <summary>
+        /// Writes an event block with one argument and returns the offset of the next block.
+        /// </summary>
+        private static int WriteEvent(byte* buffer, int offset, int number, int pid, int argument)
+        {
+            KphSsEventBlock* block = (KphSsEventBlock*)(buffer + offset);
+
+            block->Header.Size = (ushort)(KphSsEventBlock.SizeOf + 4);
+            block->Header.Type = KphSsBlockType.Event;
+            block->Flags = KphSsEventFlags.UserMode;
+            block->ClientId.UniqueProcess = new IntPtr(pid);
+            block->ClientId.UniqueThread = new IntPtr(pid + 1);
+            block->Number = number;
+            block->NumberOfArguments = 1;
+            block->ArgumentsOffset = (ushort)KphSsEventBlock.SizeOf;
+            *(int*)((byte*)block + KphSsEventBlock.SizeOf) = argument;
+
+            return offset + block->Header.Size;
+        }
+
+        /// <summary>
+        /// Writes blocks to a logger's buffer and signals them the way the 
+        /// driver does.
+        /// </summary>
+        private sealed class FakeDriver
+        {
+            private readonly SsLogger _logger;
+            private readonly byte* _buffer;
+            private readonly int _size;
+            private int _cursor;
+            private int _unpublished;
+
+            public FakeDriver(SsLogger logger)
+            {
+                _logger = logger;
+                _buffer = (byte*)logger.Ring.Buffer;
+                _size = logger.Ring.Size;
+            }
+
+            private int Allocate(int size)
+            {
+                // Each block takes one count from the write semaphore.
+                Assert.AreEqual(NtStatus.Success, _logger.WriteSemaphore.Wait(false, 5000 * 10000), "Free block");
+
+                if (_size - _cursor < size)
+                {
+                    if (_size - _cursor >= KphSsBlockHeader.SizeOf)
+                        ((KphSsBlockHeader*)(_buffer + _cursor))->Type = KphSsBlockType.Reset;
+
+                    _cursor = 0;
+                }
+
+                int offset = _cursor;
+
+                _cursor += size;
+                _unpublished++;
+
+                return offset;
+            }
+
+            public void Event(int number, int argument)
+            {
+                WriteEvent(_buffer, this.Allocate(KphSsEventBlock.SizeOf + 4), number, 10, argument);
+            }
+
+            public void StringArgument(string value)
+            {
+                WriteStringArgument(_buffer, this.Allocate(StringBlockSize(value.Length)), value, value.Length * 2);
+            }
+
+            public void InvalidBlock()
+            {
+                KphSsBlockHeader* header = (KphSsBlockHeader*)(_buffer + this.Allocate(KphSsBlockHeader.SizeOf));
+
+                header->Size = 0;
+                header->Type = KphSsBlockType.Argument;
+            }
+
+            /// <summary>
+            /// Signals the blocks written since the last call.
+            /// </summary>
+            public void Publish()
+            {
+                if (_unpublished != 0)
+                    _logger.ReadSemaphore.Release(_unpublished);
+
+                _unpublished = 0;
+            }
+        }
+
+        private static List<string> Record(SsLogger logger)
+        {
+            List<string> received = new List<string>();
+
+            logger.EventViewReceived += e =>
+                {
+                    lock (received)
+                        received.Add("event " + e.CallNumber.ToString() + " " + e.GetArgument(0).ToString());
+                };
+            logger.ArgumentViewReceived += a =>
+                {
+                    lock (received)
+                        received.Add(a.GetString());
+                };
+
+            return received;
+        }
+
+        private static void WaitUntil(Func<bool> condition, string message)
+        {
+            for (int i = 0; i < 500 && !condition(); i++)
+                Thread.Sleep(10);
+
+            Assert.IsTrue(condition(), message);
+        }
+
+        private static long BlocksRead(SsLogger logger)
+        {
+            long blocksRead;
+            long batches;
+
+            logger.GetConsumerStatistics(out blocksRead, out batches);
+
+            return blocksRead;
+        }
+
+        private static int FreeBlocks(SsLogger logger)
+        {
+            return logger.WriteSemaphore.GetBasicInformation().CurrentCount;
+        }
+
+        [Test]
+        public static void HoldsEventsUntilTheirArgumentsArrive()
+        {
+            SsLogger logger = new SsLogger(64, false);
+            FakeDriver driver = new FakeDriver(logger);
+            List<string> received = Record(logger);
+
+            // Event 7 is always logged. Other events are logged if they 
+            // have an argument which names a device object.
+            logger.AddNumberRule(FilterType.Include, 7);
+            logger.AddObjectNameRule(FilterType.Include, -1, "\\Device\\");
+            logger.Start();
+
+            try
+            {
+                // The event needs its argument blocks, which haven't 
+                // arrived, so no blocks can be given back to the driver.
+                driver.Event(1, 100);
+                driver.Publish();
+                WaitUntil(() => BlocksRead(logger) == 1, "First batch");
+                Assert.AreEqual(63, FreeBlocks(logger), "Free blocks after the first batch");
+
+                driver.StringArgument("\\REGISTRY\\A");
+                driver.StringArgument("\\Device\\Afd");
+                driver.Publish();
+                WaitUntil(() => BlocksRead(logger) == 3, "Second batch");
+                Assert.AreEqual(61, FreeBlocks(logger), "Free blocks after the second batch");
+                Assert.AreEqual(0, received.Count, "Blocks delivered before the event was decided");
+
+                // The next event decides the first one. The last event is 
+                // decided when no more blocks arrive.
+                driver.Event(7, 200);
+                driver.StringArgument("\\REGISTRY\\B");
+                driver.Event(2, 300);
+                driver.StringArgument("\\REGISTRY\\C");
+                driver.Publish();
+                WaitUntil(() => FreeBlocks(logger) == 64, "All blocks given back");
+            }
+            finally
+            {
+                logger.Stop();
+            }
+
+            long accepted;
+            long rejected;
+
+            logger.GetFilterStatistics(out accepted, out rejected);
+
+            Assert.AreEqual(
+                "event 1 100|\\REGISTRY\\A|\\Device\\Afd|event 7 200|\\REGISTRY\\B",
+                string.Join("|", received.ToArray()),
+                "Delivered blocks"
+                );
+            Assert.AreEqual(2L, accepted, "Accepted events");
+            Assert.AreEqual(1L, rejected, "Rejected events");
+        }
+
+        [Test]
+        public static void DeliversBatchesInOrder()
+        {
+            SsLogger logger = new SsLogger(64, true);
+            FakeDriver driver = new FakeDriver(logger);
+            List<string> received = Record(logger);
+            Random random = new Random(1);
+            int events = 0;
+
+            logger.Start();
+
+            try
+            {
+                // Enough blocks to wrap around the buffer many times.
+                while (events < 3000)
+                {
+                    int batch = random.Next(1, 10);
+
+                    for (int i = 0; i < batch; i++, events++)
+                    {
+                        driver.Event(events % 400, events);
+                        driver.StringArgument("arg" + events.ToString());
+                    }
+
+                    driver.Publish();
+                }
+
+                WaitUntil(() => BlocksRead(logger) == events * 2 && FreeBlocks(logger) == 64, "All blocks read");
+            }
+            finally
+            {
+                logger.Stop();
+            }
+
+            Assert.AreEqual(events * 2, received.Count, "Delivered blocks");
+
+            for (int i = 0; i < events; i++)
+            {
+                if (received[i * 2] != "event " + (i % 400).ToString() + " " + i.ToString() ||
+                    received[i * 2 + 1] != "arg" + i.ToString())
+                    Assert.IsTrue(false, "Block " + (i * 2).ToString() + " is " + received[i * 2]);
+            }
+        }
+
+        [Test]
+        public static void DiscardsBlocksAfterCorruption()
+        {
+            SsLogger logger = new SsLogger(64, true);
+            FakeDriver driver = new FakeDriver(logger);
+            List<string> received = Record(logger);
+
+            logger.Start();
+
+            try
+            {
+                driver.Event(1, 100);
+                driver.Publish();
+                WaitUntil(() => received.Count == 1, "First event");
+
+                driver.InvalidBlock();
+                driver.Event(2, 200);
+                driver.Publish();
+                WaitUntil(() => logger.OutOfSync, "Corruption is noticed");
+
+                // Whatever the driver writes next can't be found, so it 
+                // is discarded, but its space is still given back.
+                for (int i = 0; i < 10; i++)
+                    driver.Event(3, 300);
+
+                driver.Publish();
+                WaitUntil(() => FreeBlocks(logger) == 64, "All blocks given back");
+            }
+            finally
+            {
+                logger.Stop();
+            }
+
+            Assert.AreEqual(1, received.Count, "Delivered blocks");
+            Assert.AreEqual(12L, logger.BlocksDiscarded, "Discarded blocks");
+        }
+
+        private static SsFilterRule Rule(FilterType filterType, SsFilterRuleType type, int value)
+        {
+            return new SsFilterRule { FilterType = filterType, Type = type, Value = value };
+        }
+
+        private static SsFilterResult Evaluate(SsFilter filter, int number, int pid, int argument)
+        {
+            byte[] buffer = new byte[256];
+
+            fixed (byte* ptr = buffer)
+            {
+                bool included;
+
+                WriteEvent(ptr, 0, number, pid, argument);
+
+                return filter.EvaluateEvent(new SsBlockRing((IntPtr)ptr, buffer.Length).Next().AsEvent(), out included);
+            }
+        }
+
+        [Test]
+        public static void FilterExcludesBeforeIncludes()
+        {
+            SsFilter filter = SsFilter.Compile(false, new SsFilterRule[]
+            {
+                Rule(FilterType.Include, SsFilterRuleType.ProcessId, 10),
+                Rule(FilterType.Exclude, SsFilterRuleType.Number, 5),
+                Rule(FilterType.Exclude, SsFilterRuleType.Argument, 1234)
+            });
+
+            Assert.AreEqual(SsFilterResult.Include, Evaluate(filter, 6, 10, 0), "included process");
+            Assert.AreEqual(SsFilterResult.Exclude, Evaluate(filter, 5, 10, 0), "excluded number");
+            Assert.AreEqual(SsFilterResult.Exclude, Evaluate(filter, 6, 10, 1234), "excluded argument");
+            Assert.AreEqual(SsFilterResult.Exclude, Evaluate(filter, 6, 11, 0), "other process");
+
+            filter = SsFilter.Compile(true, new SsFilterRule[] { Rule(FilterType.Exclude, SsFilterRuleType.ProcessId, 10) });
+
+            Assert.AreEqual(SsFilterResult.Include, Evaluate(filter, 6, 11, 0), "include all");
+            Assert.AreEqual(SsFilterResult.Exclude, Evaluate(filter, 6, 10, 0), "include all, excluded process");
+        }
+
+        [Test]
+        public static void FilterMatchesObjectNames()
+        {
+            byte[] buffer = new byte[256];
+            SsFilter filter = SsFilter.Compile(false, new SsFilterRule[]
+            {
+                new SsFilterRule
+                {
+                    FilterType = FilterType.Include,
+                    Type = SsFilterRuleType.ObjectName,
+                    ArgumentIndex = -1,
+                    Prefix = "\\device\\"
+                }
+            });
+
+            Assert.AreEqual(SsFilterResult.NeedArguments, Evaluate(filter, 1, 10, 0), "event");
+
+            fixed (byte* ptr = buffer)
+            {
+                SsBlockRing ring = new SsBlockRing((IntPtr)ptr, buffer.Length);
+                bool included = false;
+                bool excluded = false;
+
+                WriteStringArgument(ptr, WriteStringArgument(ptr, 0, "\\REGISTRY", 18), "\\Device\\Afd", 22);
+
+                filter.EvaluateArgument(ring.Next().AsArgument(), ref included, ref excluded);
+                Assert.IsFalse(included, "other name");
+                filter.EvaluateArgument(ring.Next().AsArgument(), ref included, ref excluded);
+                Assert.IsTrue(included && !excluded, "matching name");
+            }
+        }
+
+        [Benchmark]
+        public static void FilterEvents()
+        {
+            const int eventCount = 4096;
+            List<SsFilterRule> rules = new List<SsFilterRule>();
+            byte[] buffer = new byte[eventCount * (KphSsEventBlock.SizeOf + 4)];
+            Random random = new Random(1);
+
+            for (int i = 0; i < 64; i++)
+                rules.Add(Rule(FilterType.Include, SsFilterRuleType.Number, random.Next(400)));
+            for (int i = 0; i < 16; i++)
+                rules.Add(Rule(FilterType.Exclude, SsFilterRuleType.ProcessId, random.Next(2000) * 4));
+
+            SsFilter filter = SsFilter.Compile(false, rules);
+
+            fixed (byte* ptr = buffer)
+            {
+                int offset = 0;
+
+                for (int i = 0; i < eventCount; i++)
+                    offset = WriteEvent(ptr, offset, random.Next(400), random.Next(2000) * 4, random.Next());
+
+                SsBlockRing ring = new SsBlockRing((IntPtr)ptr, buffer.Length);
+
+                Benchmark.Run("evaluate 4096 events, 80 rules", 1000, () =>
+                {
+                    bool included;
+
+                    ring.Reset();
+
+                    for (int i = 0; i < eventCount; i++)
+                        filter.EvaluateEvent(ring.Next().AsEvent(), out included);
+                });
+            }
+        }
+
+        [Test]
+        public static void RingWalksBlocks()
+        {
+            byte[] buffer = new byte[256];
+
+            fixed (byte* ptr = buffer)
+            {
+                SsBlockRing ring = new SsBlockRing((IntPtr)ptr, buffer.Length);
+                int offset = 0;
+
+                offset = WriteStringArgument(ptr, offset, "first", 10);
+                offset = WriteStringArgument(ptr, offset, "second", 12);
+                ((KphSsBlockHeader*)(ptr + offset))->Type = KphSsBlockType.Reset;
+
+                Assert.AreEqual("first", ring.Next().AsArgument().GetString(), "first block");
+                Assert.AreEqual("second", ring.Next().AsArgument().GetString(), "second block");
+                // The reset block sends us back to the start.
+                Assert.AreEqual("first", ring.Next().AsArgument().GetString(), "block after reset");
+            }
+        }
+
+        [Test]
+        public static void RingRejectsInvalidBlocks()
+        {
+            byte[] buffer = new byte[256];
+
+            fixed (byte* ptr = buffer)
+            {
+                SsBlockRing ring = new SsBlockRing((IntPtr)ptr, buffer.Length);
+
+                ((KphSsBlockHeader*)ptr)->Type = KphSsBlockType.Argument;
+                Assert.Throws<InvalidOperationException>(() => ring.Next(), "zero-sized block");
+
+                ((KphSsBlockHeader*)ptr)->Size = 1000;
+                Assert.Throws<InvalidOperationException>(() => ring.Next(), "block larger than the buffer");
+            }
+        }
+
+        [Test]
+        public static void StringLengthIsCheckedAgainstBlock()
+        {
+            byte[] buffer = new byte[256];
+
+            fixed (byte* ptr = buffer)
+            {
+                SsBlockRing ring = new SsBlockRing((IntPtr)ptr, buffer.Length);
+                int length;
+
+                // The stored length claims many more characters than the 
+                // block holds.
+                WriteStringArgument(ptr, 0, "abc", 0xfffe);
+
+                SsArgumentView view = ring.Next().AsArgument();
+
+                Assert.IsTrue(view.GetStringBuffer(out length) == null, "buffer");
+                Assert.AreEqual(0, length, "length");
+                Assert.AreEqual<string>(null, view.GetString(), "string");
+            }
+        }
+
+        [Test]
+        public static void ObjectNameIsCheckedAgainstBlock()
+        {
+            byte[] buffer = new byte[512];
+
+            fixed (byte* ptr = buffer)
+            {
+                SsBlockRing ring = new SsBlockRing((IntPtr)ptr, buffer.Length);
+                int nameOffset = KphSsObjectAttributes.SizeOf;
+                int size = KphSsArgumentBlock.DataOffset + nameOffset + KphSsUnicodeString.BufferOffset + 8;
+                KphSsArgumentBlock* block = WriteArgumentHeader(ptr, 0, size, KphSsArgumentType.ObjectAttributes);
+                KphSsObjectAttributes* oa = (KphSsObjectAttributes*)((byte*)block + KphSsArgumentBlock.DataOffset);
+
+                oa->ObjectNameOffset = (ushort)nameOffset;
+                WriteString((byte*)oa + nameOffset, "\\Foo", 8);
+                Assert.AreEqual("\\Foo", ring.Next().AsArgument().GetString(), "object name");
+
+                ring.Reset();
+                oa->ObjectNameOffset = 0x1000;
+                Assert.AreEqual<string>(null, ring.Next().AsArgument().GetString(), "name offset outside the block");
+            }
+        }
+    }
+}
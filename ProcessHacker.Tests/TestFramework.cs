@@ -0,0 +1,109 @@
+﻿/*
+ * Process Hacker -
+ *   test framework
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.Collections.Generic;
+using System.Diagnostics;
+
+namespace ProcessHacker.Tests
+{
+    /// <summary>
+    /// Marks a unit test. The method must be public, static and parameterless.
+    /// </summary>
+    [AttributeUsage(AttributeTargets.Method)]
+    public sealed class TestAttribute : Attribute
+    { }
+
+    /// <summary>
+    /// Marks a benchmark. Benchmarks print their own timings and are only 
+    /// run when requested.
+    /// </summary>
+    [AttributeUsage(AttributeTargets.Method)]
+    public sealed class BenchmarkAttribute : Attribute
+    { }
+
+    public class AssertionException : Exception
+    {
+        public AssertionException(string message)
+            : base(message)
+        { }
+    }
+
+    public static class Assert
+    {
+        public static void IsTrue(bool condition, string message)
+        {
+            if (!condition)
+                throw new AssertionException(message);
+        }
+
+        public static void IsFalse(bool condition, string message)
+        {
+            IsTrue(!condition, message);
+        }
+
+        public static void AreEqual<T>(T expected, T actual, string message)
+        {
+            if (!EqualityComparer<T>.Default.Equals(expected, actual))
+                throw new AssertionException(string.Format("{0}: expected {1}, got {2}.", message, expected, actual));
+        }
+
+        public static void Throws<TException>(Action action, string message)
+            where TException : Exception
+        {
+            try
+            {
+                action();
+            }
+            catch (TException)
+            {
+                return;
+            }
+
+            throw new AssertionException(message + ": expected " + typeof(TException).Name + ".");
+        }
+    }
+
+    public static class Benchmark
+    {
+        /// <summary>
+        /// Runs an action repeatedly and prints the average time per iteration.
+        /// </summary>
+        /// <param name="name">The name of the benchmark.</param>
+        /// <param name="iterations">The number of timed iterations.</param>
+        /// <param name="action">The action to run.</param>
+        public static void Run(string name, int iterations, Action action)
+        {
+            // Warm up so that the JIT isn't timed.
+            action();
+
+            Stopwatch sw = Stopwatch.StartNew();
+
+            for (int i = 0; i < iterations; i++)
+                action();
+
+            sw.Stop();
+
+            Console.WriteLine("  {0}: {1:0.000} ms", name, sw.Elapsed.TotalMilliseconds / iterations);
+        }
+    }
+}
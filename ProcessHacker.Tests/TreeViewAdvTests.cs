@@ -0,0 +1,202 @@
+﻿/*
+ * Process Hacker -
+ *   tree view tests
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.Collections.Generic;
+using System.Windows.Forms;
+using Aga.Controls.Tree;
+
+namespace ProcessHacker.Tests
+{
+    public static class TreeViewAdvTests
+    {
+        private static void AddVisibleNodes(TreeNodeAdv node, List<TreeNodeAdv> nodes)
+        {
+            foreach (TreeNodeAdv child in node.Children)
+            {
+                nodes.Add(child);
+
+                if (child.IsExpanded)
+                    AddVisibleNodes(child, nodes);
+            }
+        }
+
+        private static void AssertRowMap(TreeViewAdv tree, string message)
+        {
+            List<TreeNodeAdv> nodes = new List<TreeNodeAdv>();
+
+            AddVisibleNodes(tree.Root, nodes);
+            Assert.AreEqual(nodes.Count, tree.RowCount, message + ": rows");
+
+            for (int i = 0; i < nodes.Count; i++)
+            {
+                Assert.IsTrue(tree.RowMap[i] == nodes[i], message + ": node in row " + i.ToString());
+                Assert.AreEqual(i, nodes[i].Row, message + ": row number");
+            }
+        }
+
+        [Test]
+        public static void RowMapFollowsTheNodes()
+        {
+            TreeModel model = new TreeModel();
+
+            using (TreeViewAdv tree = new TreeViewAdv())
+            {
+                tree.Model = model;
+
+                for (int i = 0; i < 20; i++)
+                {
+                    Node node = new Node("Node " + i.ToString());
+
+                    model.Nodes.Add(node);
+
+                    for (int j = 0; j < 5; j++)
+                        node.Nodes.Add(new Node("Child " + j.ToString()));
+                }
+
+                AssertRowMap(tree, "Collapsed");
+                Assert.AreEqual(20, tree.RowCount, "Collapsed rows");
+
+                tree.ExpandAll();
+                AssertRowMap(tree, "Expanded");
+                Assert.AreEqual(120, tree.RowCount, "Expanded rows");
+
+                tree.Root.Children[3].Collapse();
+                AssertRowMap(tree, "Collapse one node");
+
+                tree.Root.Children[3].Expand();
+                AssertRowMap(tree, "Expand one node");
+
+                model.Nodes.RemoveAt(5);
+                AssertRowMap(tree, "Remove a node with children");
+
+                model.Nodes[0].Nodes.Insert(2, new Node("Inserted"));
+                AssertRowMap(tree, "Insert a child");
+
+                model.Nodes[model.Nodes.Count - 1].Nodes.Clear();
+                AssertRowMap(tree, "Clear the last node");
+
+                // Every child is read again. None of them have changed, so 
+                // the row map is kept.
+                model.OnStructureChanged(new TreePathEventArgs(TreePath.Empty));
+                tree.ExpandAll();
+                AssertRowMap(tree, "Structure changed");
+            }
+        }
+
+        [Test]
+        public static void ProcessTreeRowsFollowAddAndRemove()
+        {
+            Random random = new Random(1);
+            List<ProcessItem> items = new List<ProcessItem>();
+
+            using (ProcessTree tree = new ProcessTree())
+            {
+                ProcessTreeModel model = ProcessTreeModelTests.CreateModel(tree, items, 200, random);
+
+                tree.Tree.EndUpdate();
+                tree.Tree.ExpandAll();
+                AssertRowMap(tree.Tree, "Added");
+                Assert.AreEqual(200, tree.Tree.RowCount, "Rows");
+
+                for (int i = 0; i < 20; i++)
+                {
+                    ProcessItem item = items[random.Next(items.Count)];
+
+                    model.Remove(item);
+                    AssertRowMap(tree.Tree, "Removed");
+                    model.Add(item);
+                    tree.Tree.ExpandAll();
+                    AssertRowMap(tree.Tree, "Added again");
+                }
+            }
+        }
+
+        [Test]
+        public static void ProcessTreeRowsFollowSorting()
+        {
+            Random random = new Random(3);
+            List<ProcessItem> items = new List<ProcessItem>();
+
+            using (ProcessTree tree = new ProcessTree())
+            {
+                ProcessTreeModel model = ProcessTreeModelTests.CreateModel(tree, items, 200, random);
+
+                tree.Tree.EndUpdate();
+                ProcessTreeModelTests.FindColumn(tree, "CPU").SortOrder = SortOrder.Descending;
+                model.CallStructureChanged(new TreePathEventArgs(TreePath.Empty));
+                AssertRowMap(tree.Tree, "Sorted");
+                Assert.AreEqual(200, tree.Tree.RowCount, "Rows");
+
+                // A few nodes move, which is spliced into the row map.
+                for (int i = 0; i < 20; i++)
+                {
+                    items[random.Next(items.Count)].CpuUsage = (float)random.NextDouble();
+                    model.CallStructureChanged(new TreePathEventArgs(TreePath.Empty));
+                    AssertRowMap(tree.Tree, "One node moved");
+                }
+
+                // Every node moves, which rebuilds the row map.
+                foreach (ProcessItem item in items)
+                    item.CpuUsage = (float)random.NextDouble();
+
+                model.CallStructureChanged(new TreePathEventArgs(TreePath.Empty));
+                AssertRowMap(tree.Tree, "Every node moved");
+            }
+        }
+
+        [Benchmark]
+        public static void ProcessTreeBenchmark()
+        {
+            Random random = new Random(2);
+
+            Benchmark.Run("Add 5000 processes", 3, () =>
+                {
+                    using (ProcessTree tree = new ProcessTree())
+                        ProcessTreeModelTests.CreateModel(tree, new List<ProcessItem>(), 5000, random);
+                });
+
+            List<ProcessItem> items = new List<ProcessItem>();
+
+            using (ProcessTree tree = new ProcessTree())
+            {
+                ProcessTreeModel model = ProcessTreeModelTests.CreateModel(tree, items, 5000, random);
+
+                tree.Tree.EndUpdate();
+                tree.Tree.ExpandAll();
+
+                Benchmark.Run("Remove and add a process, 5000 rows", 100, () =>
+                    {
+                        ProcessItem item = items[random.Next(items.Count)];
+
+                        model.Remove(item);
+                        model.Add(item);
+                    });
+                Benchmark.Run("Collapse and expand the tree, 5000 rows", 10, () =>
+                    {
+                        tree.Tree.Root.Children[0].Collapse();
+                        tree.Tree.Root.Children[0].Expand();
+                    });
+            }
+        }
+    }
+}
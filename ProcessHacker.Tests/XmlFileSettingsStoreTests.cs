@@ -0,0 +1,143 @@
+﻿/*
+ * Process Hacker -
+ *   XML settings store tests
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.IO;
+using ProcessHacker.Common.Settings;
+
+namespace ProcessHacker.Tests
+{
+    public static class XmlFileSettingsStoreTests
+    {
+        private static void WithFile(Action<string> action)
+        {
+            string fileName = Path.Combine(Path.GetTempPath(), Guid.NewGuid().ToString("N") + ".xml");
+
+            try
+            {
+                action(fileName);
+            }
+            finally
+            {
+                File.Delete(fileName);
+                File.Delete(fileName + ".tmp");
+            }
+        }
+
+        [Test]
+        public static void ChangesAreSavedInOrder()
+        {
+            WithFile(fileName =>
+            {
+                XmlFileSettingsStore store = new XmlFileSettingsStore(fileName);
+
+                store.SetValue("b", "1");
+                store.SetValue("a", "2");
+                store.Flush();
+
+                // Change an existing value and add a new one after the flush.
+                store.SetValue("b", "3");
+                store.SetValue("c", "4");
+                Assert.AreEqual("3", store.GetValue("b"), "Unsaved change");
+                Assert.AreEqual("2", store.GetValue("a"), "Saved value");
+                Assert.IsTrue(store.GetValue("d") == null, "Missing value");
+                store.Flush();
+
+                string text = File.ReadAllText(fileName);
+
+                Assert.IsTrue(
+                    text.IndexOf("\"b\"") < text.IndexOf("\"a\"") && text.IndexOf("\"a\"") < text.IndexOf("\"c\""),
+                    "Settings are written in the order they were added"
+                    );
+
+                XmlFileSettingsStore loaded = new XmlFileSettingsStore(fileName);
+
+                Assert.AreEqual("3", loaded.GetValue("b"), "Loaded b");
+                Assert.AreEqual("2", loaded.GetValue("a"), "Loaded a");
+                Assert.AreEqual("4", loaded.GetValue("c"), "Loaded c");
+            });
+        }
+
+        [Test]
+        public static void ManyChangesAreMerged()
+        {
+            WithFile(fileName =>
+            {
+                XmlFileSettingsStore store = new XmlFileSettingsStore(fileName);
+
+                for (int i = 0; i < 1000; i++)
+                    store.SetValue("setting" + (i % 300), i.ToString());
+
+                // The last value written to each setting.
+                for (int i = 0; i < 300; i++)
+                    Assert.AreEqual((i < 100 ? 900 + i : 600 + i).ToString(), store.GetValue("setting" + i), "Value before flush");
+
+                store.Flush();
+
+                XmlFileSettingsStore loaded = new XmlFileSettingsStore(fileName);
+
+                for (int i = 0; i < 300; i++)
+                    Assert.AreEqual((i < 100 ? 900 + i : 600 + i).ToString(), loaded.GetValue("setting" + i), "Loaded value");
+            });
+        }
+
+        [Test]
+        public static void FlushWritesOnlyWhenChanged()
+        {
+            WithFile(fileName =>
+            {
+                XmlFileSettingsStore store = new XmlFileSettingsStore(fileName);
+
+                store.Flush();
+                Assert.IsFalse(File.Exists(fileName), "Nothing to save");
+
+                store.SetValue("a", "1");
+                store.Flush();
+                Assert.IsTrue(File.Exists(fileName), "Change saved");
+
+                File.Delete(fileName);
+                store.SetValue("a", "1");
+                store.Flush();
+                Assert.IsFalse(File.Exists(fileName), "Setting the same value is not a change");
+
+                store.Reset();
+                Assert.IsTrue(store.GetValue("a") == null, "Reset removes values");
+                Assert.IsTrue(File.Exists(fileName), "Reset is saved");
+            });
+        }
+
+        [Benchmark]
+        public static void SetValueBenchmark()
+        {
+            XmlFileSettingsStore store = new XmlFileSettingsStore(null);
+
+            for (int i = 0; i < 500; i++)
+                store.SetValue("setting" + i, "0");
+
+            Benchmark.Run("SetValue with 500 settings", 10, () =>
+            {
+                for (int i = 0; i < 10000; i++)
+                    store.SetValue("setting" + (i % 50), i.ToString());
+            });
+        }
+    }
+}
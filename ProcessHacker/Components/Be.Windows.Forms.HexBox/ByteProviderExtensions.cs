@@ -0,0 +1,38 @@
+using System;
+
+namespace Be.Windows.Forms
+{
+	/// <summary>
+	/// Provides bulk operations for any byte provider.
+	/// </summary>
+	public static class ByteProviderExtensions
+	{
+		/// <summary>
+		/// Reads bytes from a provider, using <see cref="IBulkByteProvider"/>
+		/// if the provider supports it.
+		/// </summary>
+		/// <param name="provider">the byte provider</param>
+		/// <param name="index">the index of the first byte to read</param>
+		/// <param name="buffer">the buffer which receives the bytes</param>
+		/// <param name="offset">the offset in the buffer at which to start storing bytes</param>
+		/// <param name="count">the maximum number of bytes to read</param>
+		/// <returns>the number of bytes read</returns>
+		public static int ReadBytes(this IByteProvider provider, long index, byte[] buffer, int offset, int count)
+		{
+			IBulkByteProvider bulkProvider = provider as IBulkByteProvider;
+
+			if(index < 0 || offset < 0 || count < 0 || offset + count > buffer.Length)
+				throw new ArgumentOutOfRangeException("index");
+
+			count = (int)Math.Min(count, Math.Max(0, provider.Length - index));
+
+			if(bulkProvider != null)
+				return bulkProvider.ReadBytes(index, buffer, offset, count);
+
+			for(int i = 0; i < count; i++)
+				buffer[offset + i] = provider.ReadByte(index + i);
+
+			return count;
+		}
+	}
+}
@@ -5,7 +5,7 @@ namespace Be.Windows.Forms
 	/// <summary>
 	/// Byte provider for a small amount of data.
 	/// </summary>
-	public class DynamicByteProvider : IByteProvider
+	public class DynamicByteProvider : IBulkByteProvider
 	{
 		/// <summary>
 		/// Contains information about changes.
@@ -97,6 +97,24 @@ namespace Be.Windows.Forms
 		public byte ReadByte(long index)
 		{ return _bytes[(int)index]; }
 
+		/// <summary>
+		/// Reads bytes from the byte collection.
+		/// </summary>
+		/// <param name="index">the index of the first byte to read</param>
+		/// <param name="buffer">the buffer which receives the bytes</param>
+		/// <param name="offset">the offset in the buffer at which to start storing bytes</param>
+		/// <param name="count">the maximum number of bytes to read</param>
+		/// <returns>the number of bytes read</returns>
+		public int ReadBytes(long index, byte[] buffer, int offset, int count)
+		{
+			count = (int)Math.Min(count, Math.Max(0, _bytes.Count - index));
+
+			for(int i = 0; i < count; i++)
+				buffer[offset + i] = _bytes[(int)index + i];
+
+			return count;
+		}
+
 		/// <summary>
 		/// Write a byte into the byte collection.
 		/// </summary>
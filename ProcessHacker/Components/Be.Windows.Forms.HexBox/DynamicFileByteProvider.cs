@@ -9,9 +9,14 @@ namespace Be.Windows.Forms
     /// </summary>
     /// <remarks>
     /// Only changes to the file are stored in memory with reads from the
-    /// original data occurring as required.
+    /// original data occurring as required. An index of block offsets is
+    /// kept so that finding the block containing an offset takes O(log n)
+    /// time rather than walking the block list. Edits which only change
+    /// the length of a memory block shift the offsets which follow it in
+    /// place; edits which add or remove blocks rebuild the index on the
+    /// next lookup.
     /// </remarks>
-    public sealed class DynamicFileByteProvider : IByteProvider, IDisposable
+    public sealed class DynamicFileByteProvider : IBulkByteProvider, IDisposable
     {
         const int COPY_BLOCK_SIZE = 4096;
 
@@ -21,6 +26,11 @@ namespace Be.Windows.Forms
         long _totalLength;
         bool _readOnly;
 
+        DataBlock[] _blockIndex;
+        long[] _blockOffsets;
+        bool _blockIndexValid;
+        int _lastBlockIndex;
+
         /// <summary>
         /// Constructs a new <see cref="DynamicFileByteProvider" /> instance.
         /// </summary>
@@ -80,6 +90,52 @@ namespace Be.Windows.Forms
             }
         }
 
+        /// <summary>
+        /// See <see cref="IBulkByteProvider.ReadBytes" /> for more information.
+        /// </summary>
+        public int ReadBytes(long index, byte[] buffer, int offset, int count)
+        {
+            count = (int)Math.Min(count, Math.Max(0, _totalLength - index));
+
+            if (count == 0)
+                return 0;
+
+            long blockOffset;
+            DataBlock block = GetDataBlock(index, out blockOffset);
+            int total = 0;
+
+            while (total < count && block != null)
+            {
+                long blockStart = index + total - blockOffset;
+                int blockCount = (int)Math.Min(count - total, block.Length - blockStart);
+
+                if (blockCount > 0)
+                {
+                    FileDataBlock fileBlock = block as FileDataBlock;
+                    if (fileBlock != null)
+                    {
+                        int bytesRead = ReadBytesFromFile(fileBlock.FileOffset + blockStart, buffer, offset + total, blockCount);
+
+                        total += bytesRead;
+
+                        if (bytesRead < blockCount)
+                            break;
+                    }
+                    else
+                    {
+                        MemoryDataBlock memoryBlock = (MemoryDataBlock)block;
+                        Array.Copy(memoryBlock.Data, blockStart, buffer, offset + total, blockCount);
+                        total += blockCount;
+                    }
+                }
+
+                blockOffset += block.Length;
+                block = block.NextBlock;
+            }
+
+            return total;
+        }
+
         /// <summary>
         /// See <see cref="IByteProvider.WriteByte" /> for more information.
         /// </summary>
@@ -99,6 +155,9 @@ namespace Be.Windows.Forms
                     return;
                 }
 
+                // The blocks are about to change.
+                _blockIndexValid = false;
+
                 FileDataBlock fileBlock = (FileDataBlock)block;
 
                 // If the byte changing is the first byte in the block and the previous block is a memory block, extend that.
@@ -182,6 +241,7 @@ namespace Be.Windows.Forms
                 if (memoryBlock != null)
                 {
                     memoryBlock.InsertBytes(index - blockOffset, bs);
+                    UpdateBlockOffsets(_lastBlockIndex, bs.Length);
                     return;
                 }
 
@@ -194,10 +254,14 @@ namespace Be.Windows.Forms
                     if (previousMemoryBlock != null)
                     {
                         previousMemoryBlock.InsertBytes(previousMemoryBlock.Length, bs);
+                        UpdateBlockOffsets(_lastBlockIndex - 1, bs.Length);
                         return;
                     }
                 }
 
+                // The blocks are about to change.
+                _blockIndexValid = false;
+
                 // Split the block into a prefix and a suffix and place a memory block in-between.
                 FileDataBlock prefixBlock = null;
                 if (index > blockOffset)
@@ -246,6 +310,19 @@ namespace Be.Windows.Forms
                 long blockOffset;
                 DataBlock block = GetDataBlock(index, out blockOffset);
 
+                // If the bytes are inside a memory block which is not 
+                // removed, only that block's length changes.
+                MemoryDataBlock memoryBlock = block as MemoryDataBlock;
+                if (memoryBlock != null && length < memoryBlock.Length && index - blockOffset + length <= memoryBlock.Length)
+                {
+                    memoryBlock.RemoveBytes(index - blockOffset, length);
+                    UpdateBlockOffsets(_lastBlockIndex, -length);
+                    return;
+                }
+
+                // The blocks are about to change.
+                _blockIndexValid = false;
+
                 // Truncate or remove each block as necessary.
                 while (bytesToDelete > 0)
                 {
@@ -448,17 +525,67 @@ namespace Be.Windows.Forms
                 throw new ArgumentOutOfRangeException("index");
             }
 
-            // Iterate over the blocks until the block containing the required offset is encountered.
-            blockOffset = 0;
-            for (DataBlock block = _dataMap.FirstBlock; block != null; block = block.NextBlock)
+            if (!_blockIndexValid)
+            {
+                BuildBlockIndex();
+            }
+
+            // Reads are usually sequential, so try the last block first.
+            int i = _lastBlockIndex;
+            if (!(i < _blockIndex.Length &&
+                _blockOffsets[i] <= findOffset &&
+                (findOffset < _blockOffsets[i] + _blockIndex[i].Length || i == _blockIndex.Length - 1)))
             {
-                if ((blockOffset <= findOffset && blockOffset + block.Length > findOffset) || block.NextBlock == null)
+                // Find the last block which starts at or before the offset. 
+                // This skips any empty blocks, and returns the last block 
+                // for the offset just past the end of the data.
+                int low = 0;
+                int high = _blockIndex.Length - 1;
+                while (low < high)
                 {
-                    return block;
+                    int mid = (low + high + 1) / 2;
+                    if (_blockOffsets[mid] <= findOffset)
+                        low = mid;
+                    else
+                        high = mid - 1;
                 }
-                blockOffset += block.Length;
+                i = low;
+                _lastBlockIndex = i;
+            }
+
+            blockOffset = _blockOffsets[i];
+            return _blockIndex[i];
+        }
+
+        void BuildBlockIndex()
+        {
+            DataBlock[] blocks = new DataBlock[_dataMap.Count];
+            long[] offsets = new long[blocks.Length];
+            long offset = 0;
+            int i = 0;
+
+            for (DataBlock block = _dataMap.FirstBlock; block != null; block = block.NextBlock)
+            {
+                blocks[i] = block;
+                offsets[i] = offset;
+                offset += block.Length;
+                i++;
+            }
+
+            _blockIndex = blocks;
+            _blockOffsets = offsets;
+            _lastBlockIndex = 0;
+            _blockIndexValid = true;
+        }
+
+        void UpdateBlockOffsets(int blockIndex, long delta)
+        {
+            // The block at blockIndex changed length, so the blocks after 
+            // it have moved.
+            for (int i = blockIndex + 1; i < _blockOffsets.Length; i++)
+            {
+                _blockOffsets[i] += delta;
             }
-            return null;
         }
 
         FileDataBlock GetNextFileDataBlock(DataBlock block, long dataOffset, out long nextDataOffset)
@@ -489,6 +616,24 @@ namespace Be.Windows.Forms
             return (byte)_fileStream.ReadByte();
         }
 
+        int ReadBytesFromFile(long fileOffset, byte[] buffer, int offset, int count)
+        {
+            if (_fileStream.Position != fileOffset)
+            {
+                _fileStream.Position = fileOffset;
+            }
+
+            int total = 0;
+            while (total < count)
+            {
+                int bytesRead = _fileStream.Read(buffer, offset + total, count - total);
+                if (bytesRead == 0)
+                    break;
+                total += bytesRead;
+            }
+            return total;
+        }
+
         void MoveFileBlock(FileDataBlock fileBlock, long dataOffset)
         {
             // First, determine whether the next file block needs to move before this one.
@@ -543,6 +688,7 @@ namespace Be.Windows.Forms
             _dataMap = new DataMap();
             _dataMap.AddFirst(new FileDataBlock(0, _fileStream.Length));
             _totalLength = _fileStream.Length;
+            _blockIndexValid = false;
         }
     }
 }
@@ -9,7 +9,7 @@ namespace Be.Windows.Forms
 	/// <summary>
 	/// Byte provider for (big) files.
 	/// </summary>
-	public class FileByteProvider : IByteProvider, IDisposable
+	public class FileByteProvider : IBulkByteProvider, IDisposable
 	{
 		#region WriteCollection class
 		/// <summary>
@@ -188,6 +188,53 @@ namespace Be.Windows.Forms
 			return res;
 		}
 
+		/// <summary>
+		/// Reads bytes from the file.
+		/// </summary>
+		/// <param name="index">the index of the first byte to read</param>
+		/// <param name="buffer">the buffer which receives the bytes</param>
+		/// <param name="offset">the offset in the buffer at which to start storing bytes</param>
+		/// <param name="count">the maximum number of bytes to read</param>
+		/// <returns>the number of bytes read</returns>
+		public int ReadBytes(long index, byte[] buffer, int offset, int count)
+		{
+			if(_fileStream.Position != index)
+				_fileStream.Position = index;
+
+			int total = 0;
+			while(total < count)
+			{
+				int bytesRead = _fileStream.Read(buffer, offset + total, count - total);
+				if(bytesRead == 0)
+					break;
+				total += bytesRead;
+			}
+
+			// Apply the pending changes.
+			if(_writes.Count != 0)
+			{
+				if(_writes.Count < total)
+				{
+					foreach(DictionaryEntry entry in _writes)
+					{
+						long writeIndex = (long)entry.Key;
+						if(writeIndex >= index && writeIndex < index + total)
+							buffer[offset + (int)(writeIndex - index)] = (byte)entry.Value;
+					}
+				}
+				else
+				{
+					for(int i = 0; i < total; i++)
+					{
+						if(_writes.Contains(index + i))
+							buffer[offset + i] = _writes[index + i];
+					}
+				}
+			}
+
+			return total;
+		}
+
 		/// <summary>
 		/// Gets the length of the file.
 		/// </summary>
@@ -1206,6 +1206,10 @@ namespace Be.Windows.Forms
         /// Contains the thumptrack delay for scrolling in milliseconds.
         /// </summary>
         const int THUMPTRACKDELAY = 50;
+		/// <summary>
+		/// Contains the number of bytes read at a time by the Find method.
+		/// </summary>
+		const int FIND_CHUNK_SIZE = 0x10000;
         /// <summary>
         /// Contains the Enviroment.TickCount of the last refresh
         /// </summary>
@@ -1911,37 +1915,58 @@ namespace Be.Windows.Forms
 		/// -2 if Find was aborted.</returns>
 		public long Find(byte[] bytes, long startIndex)
 		{
-			int match = 0;
 			int bytesLength = bytes.Length;
+			long length = _byteProvider.Length;
 
 			_abortFind = false;
 
-			for(long pos = startIndex; pos < _byteProvider.Length; pos++)
+			if(bytesLength == 0)
+				return -1;
+
+			// Read the data in large chunks. Consecutive chunks overlap by one byte 
+			// less than the pattern so that matches across chunk boundaries are found.
+			int chunkSize = Math.Max(FIND_CHUNK_SIZE, bytesLength * 2);
+			int chunkStep = chunkSize - bytesLength + 1;
+			byte[] buffer = new byte[chunkSize];
+			byte firstByte = bytes[0];
+
+			for(long chunkStart = Math.Max(0, startIndex); chunkStart <= length - bytesLength; chunkStart += chunkStep)
 			{
 				if(_abortFind)
 					return -2;
 
-				if(pos % 1000 == 0) // for performance reasons: DoEvents only 1 times per 1000 loops
-					Application.DoEvents();
+				_findingPos = chunkStart;
+				Application.DoEvents();
+
+				int count = _byteProvider.ReadBytes(chunkStart, buffer, 0, chunkSize);
+				int last = count - bytesLength;
+				int i = 0;
 
-				if(_byteProvider.ReadByte(pos) != bytes[match])
+				while(i <= last)
 				{
-					pos -= match;
-					match = 0;
-					_findingPos = pos;
-					continue;
-				}
+					// Array.IndexOf scans for a byte several bytes at a time, 
+					// so only candidate positions are compared in full.
+					i = Array.IndexOf<byte>(buffer, firstByte, i, last - i + 1);
 
-				match++;
+					if(i < 0)
+						break;
 
-				if(match == bytesLength)
-				{
-					long bytePos = pos-bytesLength+1;
-					Select(bytePos, bytesLength);
-					ScrollByteIntoView(_bytePos+_selectionLength);
-					ScrollByteIntoView(_bytePos);
+					int match = 1;
+
+					while(match < bytesLength && buffer[i + match] == bytes[match])
+						match++;
 
-					return bytePos;
+					if(match == bytesLength)
+					{
+						long bytePos = chunkStart + i;
+						Select(bytePos, bytesLength);
+						ScrollByteIntoView(_bytePos+_selectionLength);
+						ScrollByteIntoView(_bytePos);
+
+						return bytePos;
+					}
+
+					i++;
 				}
 			}
 
@@ -1979,13 +2004,7 @@ namespace Be.Windows.Forms
 
 			// put bytes into buffer
 			byte[] buffer = new byte[_selectionLength];
-			int id = -1;
-			for(long i = _bytePos; i < _bytePos+_selectionLength; i++)
-			{
-				id++;
-
-				buffer[id] = _byteProvider.ReadByte(i);
-			}
+			_byteProvider.ReadBytes(_bytePos, buffer, 0, buffer.Length);
 
 			DataObject da = new DataObject();
 
@@ -2241,6 +2260,7 @@ namespace Be.Windows.Forms
 
 			int counter = -1;
 			long intern_endByte = Math.Min(_byteProvider.Length-1, endByte+_iHexMaxHBytes);
+			byte[] bytes = ReadVisibleBytes(startByte, intern_endByte);
 
 			bool isKeyInterpreterActive = _keyInterpreter == null || _keyInterpreter.GetType() == typeof(KeyInterpreter);
 
@@ -2248,7 +2268,7 @@ namespace Be.Windows.Forms
 			{
 				counter++;
 				Point gridPoint = GetGridBytePoint(counter);
-				byte b = _byteProvider.ReadByte(i);
+				byte b = bytes[counter];
 
 				bool isSelectedByte = i >= _bytePos && i <= (_bytePos + _selectionLength-1) && _selectionLength != 0;
 
@@ -2263,6 +2283,20 @@ namespace Be.Windows.Forms
 			}
 		}
 
+		/// <summary>
+		/// Reads the bytes between startByte and endByte (inclusive) with a single call to the byte provider.
+		/// </summary>
+		byte[] ReadVisibleBytes(long startByte, long endByte)
+		{
+			if(endByte < startByte)
+				return new byte[0];
+
+			byte[] bytes = new byte[endByte - startByte + 1];
+			_byteProvider.ReadBytes(startByte, bytes, 0, bytes.Length);
+
+			return bytes;
+		}
+
 		void PaintHexString(Graphics g, byte b, Brush brush, Point gridPoint)
 		{
 			PointF bytePointF = GetBytePointF(gridPoint);
@@ -2301,6 +2335,7 @@ namespace Be.Windows.Forms
 
 			int counter = -1;
 			long intern_endByte = Math.Min(_byteProvider.Length-1, endByte+_iHexMaxHBytes);
+			byte[] bytes = ReadVisibleBytes(startByte, intern_endByte);
 
 			bool isKeyInterpreterActive = _keyInterpreter == null || _keyInterpreter.GetType() == typeof(KeyInterpreter);
 			bool isStringKeyInterpreterActive = _keyInterpreter != null && _keyInterpreter.GetType() == typeof(StringKeyInterpreter);
@@ -2310,7 +2345,7 @@ namespace Be.Windows.Forms
 				counter++;
 				Point gridPoint = GetGridBytePoint(counter);
 				PointF byteStringPointF = GetByteStringPointF(gridPoint);
-				byte b = _byteProvider.ReadByte(i);
+				byte b = bytes[counter];
 
 				bool isSelectedByte = i >= _bytePos && i <= (_bytePos + _selectionLength-1) && _selectionLength != 0;
 
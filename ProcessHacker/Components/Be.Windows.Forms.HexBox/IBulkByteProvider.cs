@@ -0,0 +1,24 @@
+using System;
+
+namespace Be.Windows.Forms
+{
+	/// <summary>
+	/// Defines a byte provider which can read many bytes at once.
+	/// </summary>
+	/// <remarks>
+	/// HexBox uses this interface when painting, copying and searching
+	/// so that it doesn't need to call ReadByte once for every byte.
+	/// </remarks>
+	public interface IBulkByteProvider : IByteProvider
+	{
+		/// <summary>
+		/// Reads bytes from the provider
+		/// </summary>
+		/// <param name="index">the index of the first byte to read</param>
+		/// <param name="buffer">the buffer which receives the bytes</param>
+		/// <param name="offset">the offset in the buffer at which to start storing bytes</param>
+		/// <param name="count">the maximum number of bytes to read</param>
+		/// <returns>the number of bytes read, which is less than count only at the end of the data</returns>
+		int ReadBytes(long index, byte[] buffer, int offset, int count);
+	}
+}
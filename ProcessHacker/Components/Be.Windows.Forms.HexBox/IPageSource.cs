@@ -0,0 +1,33 @@
+using System;
+
+namespace Be.Windows.Forms
+{
+	/// <summary>
+	/// Defines a fixed-length source of data which is read and written in pages by a <see cref="PageCache"/>.
+	/// </summary>
+	public interface IPageSource
+	{
+		/// <summary>
+		/// Gets the length of the data.
+		/// </summary>
+		long Length { get; }
+
+		/// <summary>
+		/// Reads data from the source
+		/// </summary>
+		/// <param name="offset">the offset of the first byte to read</param>
+		/// <param name="buffer">the buffer which receives the data</param>
+		/// <param name="count">the number of bytes to read</param>
+		/// <returns>the number of bytes read, or 0 if the data could not be read</returns>
+		int Read(long offset, byte[] buffer, int count);
+
+		/// <summary>
+		/// Writes data to the source
+		/// </summary>
+		/// <param name="offset">the offset of the first byte to write</param>
+		/// <param name="buffer">the buffer which contains the data</param>
+		/// <param name="bufferOffset">the offset in the buffer of the first byte to write</param>
+		/// <param name="count">the number of bytes to write</param>
+		void Write(long offset, byte[] buffer, int bufferOffset, int count);
+	}
+}
@@ -0,0 +1,411 @@
+using System;
+using System.Collections.Generic;
+
+namespace Be.Windows.Forms
+{
+	/// <summary>
+	/// Caches pages of an <see cref="IPageSource"/> and keeps track of modified bytes.
+	/// </summary>
+	/// <remarks>
+	/// Pages are read on demand. Unmodified pages are discarded in least recently used 
+	/// order once the cache is full. Modified pages stay in memory until they are 
+	/// written back by Flush, which only writes the modified range of each page and 
+	/// merges ranges which continue across page boundaries.
+	/// </remarks>
+	public sealed class PageCache
+	{
+		/// <summary>
+		/// The default page size.
+		/// </summary>
+		public const int DefaultPageSize = 0x1000;
+		/// <summary>
+		/// The default number of unmodified pages to keep.
+		/// </summary>
+		public const int DefaultCapacity = 256;
+
+		sealed class Page
+		{
+			public long Index;
+			public byte[] Data;
+			public int Length;
+			/// <summary>
+			/// The number of bytes at the start of the page which were read from the source.
+			/// </summary>
+			public int ReadLength;
+			/// <summary>
+			/// The start of the modified range, or -1 if the page is unmodified.
+			/// </summary>
+			public int DirtyStart = -1;
+			/// <summary>
+			/// The end of the modified range (exclusive).
+			/// </summary>
+			public int DirtyEnd;
+		}
+
+		readonly IPageSource _source;
+		readonly int _pageSize;
+		readonly int _capacity;
+		readonly long _length;
+
+		/// <summary>
+		/// Contains the unmodified pages, most recently used first.
+		/// </summary>
+		readonly LinkedList<Page> _lruList = new LinkedList<Page>();
+		readonly Dictionary<long, LinkedListNode<Page>> _cleanPages = new Dictionary<long, LinkedListNode<Page>>();
+		readonly Dictionary<long, Page> _dirtyPages = new Dictionary<long, Page>();
+
+		/// <summary>
+		/// The most recently accessed page, which is checked before the dictionaries.
+		/// </summary>
+		Page _lastPage;
+
+		long _pageReads;
+		long _pageFaults;
+
+		/// <summary>
+		/// Initializes a new instance of the PageCache class with the default page size and capacity.
+		/// </summary>
+		/// <param name="source">the source of the data</param>
+		public PageCache(IPageSource source) : this(source, DefaultPageSize, DefaultCapacity)
+		{
+		}
+
+		/// <summary>
+		/// Initializes a new instance of the PageCache class.
+		/// </summary>
+		/// <param name="source">the source of the data</param>
+		/// <param name="pageSize">the size of each page, in bytes</param>
+		/// <param name="capacity">the number of unmodified pages to keep</param>
+		public PageCache(IPageSource source, int pageSize, int capacity)
+		{
+			if(source == null)
+				throw new ArgumentNullException("source");
+			if(pageSize <= 0)
+				throw new ArgumentOutOfRangeException("pageSize");
+			if(capacity <= 0)
+				throw new ArgumentOutOfRangeException("capacity");
+
+			_source = source;
+			_pageSize = pageSize;
+			_capacity = capacity;
+			_length = source.Length;
+		}
+
+		/// <summary>
+		/// Gets the length of the data.
+		/// </summary>
+		public long Length
+		{
+			get { return _length; }
+		}
+
+		/// <summary>
+		/// Gets the size of each page.
+		/// </summary>
+		public int PageSize
+		{
+			get { return _pageSize; }
+		}
+
+		/// <summary>
+		/// Gets the number of pages currently in memory.
+		/// </summary>
+		public int PageCount
+		{
+			get { return _cleanPages.Count + _dirtyPages.Count; }
+		}
+
+		/// <summary>
+		/// Gets the number of modified pages.
+		/// </summary>
+		public int DirtyPageCount
+		{
+			get { return _dirtyPages.Count; }
+		}
+
+		/// <summary>
+		/// Gets the number of page lookups.
+		/// </summary>
+		public long PageReads
+		{
+			get { return _pageReads; }
+		}
+
+		/// <summary>
+		/// Gets the number of pages which had to be read from the source.
+		/// </summary>
+		public long PageFaults
+		{
+			get { return _pageFaults; }
+		}
+
+		/// <summary>
+		/// Gets whether any bytes have been modified since the last flush.
+		/// </summary>
+		public bool HasChanges
+		{
+			get { return _dirtyPages.Count != 0; }
+		}
+
+		Page GetPage(long pageIndex)
+		{
+			_pageReads++;
+
+			if(_lastPage != null && _lastPage.Index == pageIndex)
+				return _lastPage;
+
+			Page page;
+			LinkedListNode<Page> node;
+
+			if(_dirtyPages.TryGetValue(pageIndex, out page))
+			{
+				_lastPage = page;
+				return page;
+			}
+
+			if(_cleanPages.TryGetValue(pageIndex, out node))
+			{
+				if(node != _lruList.First)
+				{
+					_lruList.Remove(node);
+					_lruList.AddFirst(node);
+				}
+
+				_lastPage = node.Value;
+				return node.Value;
+			}
+
+			_pageFaults++;
+
+			if(_cleanPages.Count >= _capacity)
+			{
+				LinkedListNode<Page> last = _lruList.Last;
+
+				_lruList.RemoveLast();
+				_cleanPages.Remove(last.Value.Index);
+
+				// Reuse the evicted page's buffer.
+				page = last.Value;
+				page.DirtyStart = -1;
+				page.DirtyEnd = 0;
+			}
+			else
+			{
+				page = new Page();
+				page.Data = new byte[_pageSize];
+			}
+
+			long offset = pageIndex * _pageSize;
+			int length = (int)Math.Min(_pageSize, _length - offset);
+			int read = _source.Read(offset, page.Data, length);
+
+			// Bytes which couldn't be read are shown as zeros.
+			if(read < 0)
+				read = 0;
+			if(read < length)
+				Array.Clear(page.Data, read, length - read);
+
+			page.Index = pageIndex;
+			page.Length = length;
+			page.ReadLength = read;
+			_cleanPages.Add(pageIndex, _lruList.AddFirst(page));
+			_lastPage = page;
+
+			return page;
+		}
+
+		/// <summary>
+		/// Reads a byte
+		/// </summary>
+		/// <param name="index">the index of the byte to read</param>
+		public byte ReadByte(long index)
+		{
+			if(index < 0 || index >= _length)
+				throw new ArgumentOutOfRangeException("index");
+
+			return GetPage(index / _pageSize).Data[index % _pageSize];
+		}
+
+		/// <summary>
+		/// Reads bytes
+		/// </summary>
+		/// <param name="index">the index of the first byte to read</param>
+		/// <param name="buffer">the buffer which receives the bytes</param>
+		/// <param name="offset">the offset in the buffer at which to start storing bytes</param>
+		/// <param name="count">the maximum number of bytes to read</param>
+		/// <returns>the number of bytes read</returns>
+		public int ReadBytes(long index, byte[] buffer, int offset, int count)
+		{
+			if(index < 0)
+				throw new ArgumentOutOfRangeException("index");
+
+			count = (int)Math.Min(count, Math.Max(0, _length - index));
+
+			int done = 0;
+
+			while(done < count)
+			{
+				Page page = GetPage(index / _pageSize);
+				int pageOffset = (int)(index % _pageSize);
+				int chunk = Math.Min(count - done, page.Length - pageOffset);
+
+				Buffer.BlockCopy(page.Data, pageOffset, buffer, offset + done, chunk);
+				index += chunk;
+				done += chunk;
+			}
+
+			return count;
+		}
+
+		/// <summary>
+		/// Finds the first byte in a range which could not be read from the source. 
+		/// These bytes are read as zeros.
+		/// </summary>
+		/// <param name="index">the index of the first byte in the range</param>
+		/// <param name="count">the number of bytes in the range</param>
+		/// <returns>the index of the byte, or -1 if the whole range could be read</returns>
+		public long FindUnreadable(long index, long count)
+		{
+			if(index < 0)
+				throw new ArgumentOutOfRangeException("index");
+
+			long end = Math.Min(_length, index + count);
+
+			while(index < end)
+			{
+				Page page = GetPage(index / _pageSize);
+				long pageStart = page.Index * _pageSize;
+
+				if(page.ReadLength < page.Length && pageStart + page.ReadLength < end)
+					return Math.Max(index, pageStart + page.ReadLength);
+
+				index = pageStart + page.Length;
+			}
+
+			return -1;
+		}
+
+		/// <summary>
+		/// Modifies a byte. The change is not written to the source until Flush is called.
+		/// </summary>
+		/// <param name="index">the index of the byte to write</param>
+		/// <param name="value">the byte</param>
+		public void WriteByte(long index, byte value)
+		{
+			if(index < 0 || index >= _length)
+				throw new ArgumentOutOfRangeException("index");
+
+			Page page = GetPage(index / _pageSize);
+			int pageOffset = (int)(index % _pageSize);
+
+			if(page.DirtyStart == -1)
+			{
+				// Dirty pages can't be evicted, so take the page off the LRU list.
+				_lruList.Remove(_cleanPages[page.Index]);
+				_cleanPages.Remove(page.Index);
+				_dirtyPages.Add(page.Index, page);
+
+				page.DirtyStart = pageOffset;
+				page.DirtyEnd = pageOffset + 1;
+			}
+			else
+			{
+				page.DirtyStart = Math.Min(page.DirtyStart, pageOffset);
+				page.DirtyEnd = Math.Max(page.DirtyEnd, pageOffset + 1);
+			}
+
+			page.Data[pageOffset] = value;
+		}
+
+		/// <summary>
+		/// Writes all modified ranges back to the source.
+		/// </summary>
+		public void Flush()
+		{
+			if(_dirtyPages.Count == 0)
+				return;
+
+			List<long> indices = new List<long>(_dirtyPages.Keys);
+
+			indices.Sort();
+
+			int i = 0;
+
+			while(i < indices.Count)
+			{
+				Page first = _dirtyPages[indices[i]];
+				int runEnd = i;
+
+				// Extend the run while the modified range reaches the end of a page 
+				// and the next page is modified from its start.
+				while(
+					runEnd + 1 < indices.Count &&
+					indices[runEnd + 1] == indices[runEnd] + 1 &&
+					_dirtyPages[indices[runEnd]].DirtyEnd == _dirtyPages[indices[runEnd]].Length &&
+					_dirtyPages[indices[runEnd + 1]].DirtyStart == 0
+					)
+					runEnd++;
+
+				if(runEnd == i)
+				{
+					_source.Write(first.Index * _pageSize + first.DirtyStart, first.Data, first.DirtyStart, first.DirtyEnd - first.DirtyStart);
+				}
+				else
+				{
+					Page last = _dirtyPages[indices[runEnd]];
+					int firstLength = first.Length - first.DirtyStart;
+					byte[] data = new byte[firstLength + (runEnd - i - 1) * _pageSize + last.DirtyEnd];
+					int dataOffset = 0;
+
+					Buffer.BlockCopy(first.Data, first.DirtyStart, data, 0, firstLength);
+					dataOffset += firstLength;
+
+					for(int j = i + 1; j < runEnd; j++)
+					{
+						Buffer.BlockCopy(_dirtyPages[indices[j]].Data, 0, data, dataOffset, _pageSize);
+						dataOffset += _pageSize;
+					}
+
+					Buffer.BlockCopy(last.Data, 0, data, dataOffset, last.DirtyEnd);
+					_source.Write(first.Index * _pageSize + first.DirtyStart, data, 0, data.Length);
+				}
+
+				i = runEnd + 1;
+			}
+
+			// The written pages are now unmodified copies of the source.
+			foreach(long index in indices)
+			{
+				Page page = _dirtyPages[index];
+
+				page.DirtyStart = -1;
+				page.DirtyEnd = 0;
+				_cleanPages.Add(index, _lruList.AddFirst(page));
+			}
+
+			_dirtyPages.Clear();
+
+			while(_cleanPages.Count > _capacity)
+			{
+				LinkedListNode<Page> last = _lruList.Last;
+
+				if(last.Value == _lastPage)
+					_lastPage = null;
+
+				_lruList.RemoveLast();
+				_cleanPages.Remove(last.Value.Index);
+			}
+		}
+
+		/// <summary>
+		/// Discards all pages, including modified pages, so that the data is read again from the source.
+		/// </summary>
+		public void Clear()
+		{
+			_lruList.Clear();
+			_cleanPages.Clear();
+			_dirtyPages.Clear();
+			_lastPage = null;
+		}
+	}
+}
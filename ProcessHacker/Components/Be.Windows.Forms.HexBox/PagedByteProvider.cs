@@ -0,0 +1,170 @@
+using System;
+
+namespace Be.Windows.Forms
+{
+	/// <summary>
+	/// Byte provider for a large, fixed-length data source which is read in pages when needed.
+	/// </summary>
+	/// <remarks>
+	/// Changes are kept in the page cache and are written back to the source by ApplyChanges. 
+	/// Bytes can't be inserted or deleted.
+	/// </remarks>
+	public class PagedByteProvider : IBulkByteProvider
+	{
+		/// <summary>
+		/// Contains the page cache.
+		/// </summary>
+		readonly PageCache _cache;
+
+		/// <summary>
+		/// Initializes a new instance of the PagedByteProvider class.
+		/// </summary>
+		/// <param name="source">the source of the data</param>
+		public PagedByteProvider(IPageSource source) : this(new PageCache(source))
+		{
+		}
+
+		/// <summary>
+		/// Initializes a new instance of the PagedByteProvider class.
+		/// </summary>
+		/// <param name="cache">the page cache</param>
+		public PagedByteProvider(PageCache cache)
+		{
+			if(cache == null)
+				throw new ArgumentNullException("cache");
+
+			_cache = cache;
+		}
+
+		/// <summary>
+		/// Raises the Changed event.
+		/// </summary>
+		void OnChanged(EventArgs e)
+		{
+			if(Changed != null)
+				Changed(this, e);
+		}
+
+		/// <summary>
+		/// Gets the page cache.
+		/// </summary>
+		public PageCache Cache
+		{
+			get { return _cache; }
+		}
+
+		#region IByteProvider Members
+		/// <summary>
+		/// True, when changes are done.
+		/// </summary>
+		public bool HasChanges()
+		{
+			return _cache.HasChanges;
+		}
+
+		/// <summary>
+		/// Writes the modified ranges back to the source.
+		/// </summary>
+		public void ApplyChanges()
+		{
+			_cache.Flush();
+		}
+
+		/// <summary>
+		/// Occurs, when a byte is changed.
+		/// </summary>
+		public event EventHandler Changed;
+
+		/// <summary>
+		/// Never occurs, since the length is fixed.
+		/// </summary>
+		public event EventHandler LengthChanged
+		{
+			add { }
+			remove { }
+		}
+
+		/// <summary>
+		/// Reads a byte from the page cache.
+		/// </summary>
+		/// <param name="index">the index of the byte to read</param>
+		/// <returns>the byte</returns>
+		public byte ReadByte(long index)
+		{
+			return _cache.ReadByte(index);
+		}
+
+		/// <summary>
+		/// Reads bytes from the page cache.
+		/// </summary>
+		/// <param name="index">the index of the first byte to read</param>
+		/// <param name="buffer">the buffer which receives the bytes</param>
+		/// <param name="offset">the offset in the buffer at which to start storing bytes</param>
+		/// <param name="count">the maximum number of bytes to read</param>
+		/// <returns>the number of bytes read</returns>
+		public int ReadBytes(long index, byte[] buffer, int offset, int count)
+		{
+			return _cache.ReadBytes(index, buffer, offset, count);
+		}
+
+		/// <summary>
+		/// Writes a byte into the page cache.
+		/// </summary>
+		/// <param name="index">the index of the byte to write</param>
+		/// <param name="value">the byte</param>
+		public void WriteByte(long index, byte value)
+		{
+			_cache.WriteByte(index, value);
+			OnChanged(EventArgs.Empty);
+		}
+
+		/// <summary>
+		/// Not supported
+		/// </summary>
+		public void InsertBytes(long index, byte[] bs)
+		{
+			throw new NotSupportedException("PagedByteProvider.InsertBytes");
+		}
+
+		/// <summary>
+		/// Not supported
+		/// </summary>
+		public void DeleteBytes(long index, long length)
+		{
+			throw new NotSupportedException("PagedByteProvider.DeleteBytes");
+		}
+
+		/// <summary>
+		/// Gets the length of the data.
+		/// </summary>
+		public long Length
+		{
+			get { return _cache.Length; }
+		}
+
+		/// <summary>
+		/// Returns true
+		/// </summary>
+		public bool SupportsWriteByte()
+		{
+			return true;
+		}
+
+		/// <summary>
+		/// Returns false
+		/// </summary>
+		public bool SupportsInsertBytes()
+		{
+			return false;
+		}
+
+		/// <summary>
+		/// Returns false
+		/// </summary>
+		public bool SupportsDeleteBytes()
+		{
+			return false;
+		}
+		#endregion
+	}
+}
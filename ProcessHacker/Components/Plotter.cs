@@ -33,6 +33,7 @@ namespace ProcessHacker.Components
     public partial class Plotter : UserControl
     {
         private static int _globalMoveStep = 3;
+        private static bool _globalFitData;
 
         public static int GlobalMoveStep
         {
@@ -40,6 +41,17 @@ namespace ProcessHacker.Components
             set { _globalMoveStep = value; }
         }
 
+        /// <summary>
+        /// Gets or sets whether plotters compress their entire history into 
+        /// the width of the control instead of showing only the most recent 
+        /// samples.
+        /// </summary>
+        public static bool GlobalFitData
+        {
+            get { return _globalFitData; }
+            set { _globalFitData = value; }
+        }
+
         public delegate string GetToolTipDelegate(int item);
 
         private const BufferedGraphics NO_MANAGED_BACK_BUFFER = null;
@@ -49,6 +61,16 @@ namespace ProcessHacker.Components
         private Point _mouseLocation;
         private string _lastToolTip;
 
+        private readonly MinMaxDecimator _decimator1 = new MinMaxDecimator();
+        private readonly MinMaxDecimator _decimator2 = new MinMaxDecimator();
+        private bool _decimated;
+        private List<float> _scaledData1;
+        private List<float> _scaledData2;
+        private Point[] _fillPoints1;
+        private Point[] _fillPoints2;
+        private Point[] _linePoints1;
+        private Point[] _linePoints2;
+
         public Plotter()
         {
             InitializeComponent();
@@ -126,6 +148,22 @@ namespace ProcessHacker.Components
             if (_useLongData && (_longData1 == null || (this.UseSecondLine && _longData2 == null)))
                 return;
 
+            // If the history should fit and doesn't at the normal step, 
+            // decimate the entire history into the width of the control 
+            // instead of drawing each sample. Otherwise the samples scroll 
+            // with the grid and the oldest ones are cut off.
+            int count = _useLongData ? _longData1.Count : (_data1 != null ? _data1.Count : 0);
+
+            _decimated = false;
+
+            if (_globalFitData && (long)count * moveStep > tWidth && (_useLongData || !this.UseSecondLine || _data2 != null))
+            {
+                this.DrawDecimated(g, tWidth, tHeight);
+                this.DrawText(g);
+                _decimated = true;
+                return;
+            }
+
             if (_useLongData)
                 this.FixLongData();
 
@@ -207,6 +245,151 @@ namespace ProcessHacker.Components
                 start++;
             }
 
+            this.DrawText(g);
+        }
+
+        private void DrawDecimated(Graphics g, int tWidth, int tHeight)
+        {
+            int columns = tWidth;
+            double scale = 1;
+
+            if (_useLongData)
+            {
+                _decimator1.Update(_longData1, columns);
+
+                if (this.UseSecondLine)
+                    _decimator2.Update(_longData2, columns);
+
+                // Scale the data to the largest value shown.
+                scale = _decimator1.Maximum;
+
+                if (this.UseSecondLine && _decimator2.Maximum > scale)
+                    scale = _decimator2.Maximum;
+                if (scale < _minMaxValue)
+                    scale = _minMaxValue;
+                if (scale == 0)
+                    scale = 1;
+            }
+            else
+            {
+                _decimator1.Update(_data1, columns);
+
+                if (this.UseSecondLine)
+                    _decimator2.Update(_data2, columns);
+            }
+
+            int n = _decimator1.ColumnCount;
+
+            if (this.UseSecondLine && _decimator2.ColumnCount < n)
+                n = _decimator2.ColumnCount;
+
+            if (n < 2)
+                return;
+
+            // The point arrays only need to be reallocated when the number of 
+            // columns changes, which is rare once the history is full.
+            EnsurePoints(ref _fillPoints1, n + 2);
+            EnsurePoints(ref _linePoints1, n * 2);
+
+            for (int c = 0; c < n; c++)
+            {
+                int x = GetColumnX(tWidth, c, n);
+                int hMax = GetHeight(tHeight, _decimator1.GetMaximum(c) / scale);
+                int hMin = GetHeight(tHeight, _decimator1.GetMinimum(c) / scale);
+
+                _fillPoints1[c] = new Point(x, hMax);
+                _linePoints1[c * 2] = new Point(x, hMax);
+                _linePoints1[c * 2 + 1] = new Point(x, hMin);
+            }
+
+            _fillPoints1[n] = new Point(GetColumnX(tWidth, n - 1, n), tHeight);
+            _fillPoints1[n + 1] = new Point(tWidth - 1, tHeight);
+
+            if (this.UseSecondLine)
+            {
+                EnsurePoints(ref _fillPoints2, n * 2);
+                EnsurePoints(ref _linePoints2, n * 2);
+
+                for (int c = 0; c < n; c++)
+                {
+                    int x = GetColumnX(tWidth, c, n);
+                    double max = _decimator2.GetMaximum(c) / scale;
+                    double min = _decimator2.GetMinimum(c) / scale;
+
+                    if (!this.OverlaySecondLine)
+                    {
+                        // Stack the second line on top of the first. This is 
+                        // an upper bound, since the extremes of the two lines 
+                        // in a column don't necessarily coincide.
+                        max = Math.Min(1.0, max + _decimator1.GetMaximum(c) / scale);
+                        min = Math.Min(1.0, min + _decimator1.GetMinimum(c) / scale);
+                    }
+
+                    int hMax = GetHeight(tHeight, max);
+                    int hMin = GetHeight(tHeight, min);
+
+                    _fillPoints2[c] = new Point(x, hMax);
+                    _fillPoints2[n * 2 - 1 - c] = this.OverlaySecondLine ? new Point(x, tHeight) : _fillPoints1[c];
+                    _linePoints2[c * 2] = new Point(x, hMax);
+                    _linePoints2[c * 2 + 1] = new Point(x, hMin);
+                }
+            }
+
+            using (SolidBrush fill1 = new SolidBrush(Color.FromArgb(100, _lineColor1)))
+            using (Pen line1 = new Pen(_lineColor1))
+            {
+                g.FillPolygon(fill1, _fillPoints1);
+                g.DrawLines(line1, _linePoints1);
+            }
+
+            if (this.UseSecondLine)
+            {
+                using (SolidBrush fill2 = new SolidBrush(Color.FromArgb(100, _lineColor2)))
+                using (Pen line2 = new Pen(_lineColor2))
+                {
+                    g.FillPolygon(fill2, _fillPoints2);
+                    g.DrawLines(line2, _linePoints2);
+                }
+            }
+        }
+
+        /// <summary>
+        /// Spreads the columns over the width of the control, with 
+        /// column 0 on the right.
+        /// </summary>
+        private static int GetColumnX(int tWidth, int column, int columnCount)
+        {
+            return tWidth - 1 - (int)((long)column * (tWidth - 1) / (columnCount - 1));
+        }
+
+        private static int GetColumnAt(int tWidth, int x, int columnCount)
+        {
+            if (columnCount < 2 || tWidth < 2)
+                return 0;
+
+            int offset = Math.Max(0, Math.Min(tWidth - 1, tWidth - 1 - x));
+
+            return (int)(((long)offset * (columnCount - 1) + (tWidth - 1) / 2) / (tWidth - 1));
+        }
+
+        private static void EnsurePoints(ref Point[] points, int length)
+        {
+            if (points == null || points.Length != length)
+                points = new Point[length];
+        }
+
+        private static int GetHeight(int tHeight, double value)
+        {
+            if (value > 1.0)
+                value = 1.0;
+            else if (value < 0.0)
+                value = 0.0;
+
+            return (int)(tHeight - (tHeight * value));
+        }
+
+        private void DrawText(Graphics g)
+        {
             // Draw the text, if any.
             if (!string.IsNullOrEmpty(_text))
             {
@@ -223,9 +406,14 @@ namespace ProcessHacker.Components
         {
             if (this.GetToolTip != null)
             {
-                int itemIndex = (this.Width - _mouseLocation.X) / this.EffectiveMoveStep;
+                int itemIndex;
 
-                if (itemIndex < this.Data1.Count)
+                if (_decimated)
+                    itemIndex = _decimator1.GetSampleIndex(GetColumnAt(this.Width, _mouseLocation.X, _decimator1.ColumnCount));
+                else
+                    itemIndex = (this.Width - _mouseLocation.X) / this.EffectiveMoveStep;
+
+                if (itemIndex < (_decimated && _useLongData ? _longData1.Count : this.Data1.Count))
                 {
                     try
                     {
@@ -277,9 +465,17 @@ namespace ProcessHacker.Components
             if (max < _minMaxValue)
                 max = _minMaxValue;
 
-            // redo the float list
-            _data1 = new List<float>();
-            _data2 = new List<float>();
+            // redo the float list, reusing the lists from the last paint
+            if (_scaledData1 == null)
+            {
+                _scaledData1 = new List<float>();
+                _scaledData2 = new List<float>();
+            }
+
+            _scaledData1.Clear();
+            _scaledData2.Clear();
+            _data1 = _scaledData1;
+            _data2 = _scaledData2;
 
             for (int i = 0; i < _longData1.Count && i <= maxIndex; i++)
             {
@@ -273,12 +273,37 @@ namespace ProcessHacker
 
                     //treeProcesses.InvalidateNodeControlCache();
                     this.treeProcesses.Invalidate();
+                    this.UpdateVisibleProcesses();
                 }));
             }
 
             _runCount++;
         }
 
+        /// <summary>
+        /// Tells the provider which processes are on screen so that their 
+        /// files are verified first.
+        /// </summary>
+        private void UpdateVisibleProcesses()
+        {
+            if (_provider == null)
+                return;
+
+            List<int> pids = new List<int>();
+            int firstRow = treeProcesses.FirstVisibleRow;
+            int lastRow = Math.Min(treeProcesses.RowCount, firstRow + treeProcesses.CurrentPageSize + 1);
+
+            for (int i = firstRow; i < lastRow; i++)
+            {
+                ProcessNode pNode = treeProcesses.RowMap[i].Tag as ProcessNode;
+
+                if (pNode != null)
+                    pids.Add(pNode.Pid);
+            }
+
+            _provider.SetVisibleProcesses(pids);
+        }
+
         private void PerformDelayed(int delay, MethodInvoker action)
         {
             Timer t = new Timer();
@@ -37,10 +37,169 @@ namespace ProcessHacker
     /// </summary>
     public class ProcessTreeModel : ITreeModel
     {
+        private struct SortKey
+        {
+            public ProcessNode Node;
+            public int Index;
+            public long Number;
+            public double Real;
+            public string Text;
+        }
+
+        private class SortColumn
+        {
+            public Func<ProcessNode, long> Number;
+            public Func<ProcessNode, double> Real;
+            public Func<ProcessNode, string> Text;
+            public bool Invert;
+        }
+
+        private class SortKeyComparer : IComparer<SortKey>
+        {
+            /// <summary>
+            /// Sorts keys which are almost in order.
+            /// </summary>
+            /// <param name="comparer">The comparer to use.</param>
+            /// <param name="keys">The keys.</param>
+            /// <param name="count">The number of keys to sort.</param>
+            /// <param name="maximumDisorder">
+            /// The maximum number of keys which may be out of order.
+            /// </param>
+            /// <returns>True if the keys were sorted, otherwise false.</returns>
+            public static bool InsertionSort(SortKeyComparer comparer, SortKey[] keys, int count, int maximumDisorder)
+            {
+                int disorder = 0;
+
+                for (int i = 1; i < count; i++)
+                {
+                    if (comparer.Compare(keys[i - 1], keys[i]) > 0)
+                    {
+                        if (++disorder > maximumDisorder)
+                            return false;
+                    }
+                }
+
+                if (disorder == 0)
+                    return true;
+
+                for (int i = 1; i < count; i++)
+                {
+                    SortKey key = keys[i];
+                    int j = i - 1;
+
+                    while (j >= 0 && comparer.Compare(keys[j], key) > 0)
+                    {
+                        keys[j + 1] = keys[j];
+                        j--;
+                    }
+
+                    keys[j + 1] = key;
+                }
+
+                return true;
+            }
+
+            private readonly SortColumn _column;
+            private readonly int _direction;
+
+            public SortKeyComparer(SortColumn column, SortOrder order)
+            {
+                _column = column;
+
+                // Ascending and descending are swapped in the tree's column headers.
+                _direction = order == SortOrder.Ascending ? -1 : 1;
+
+                if (column.Invert)
+                    _direction = -_direction;
+            }
+
+            public int Compare(SortKey x, SortKey y)
+            {
+                int result;
+
+                if (_column.Number != null)
+                    result = x.Number.CompareTo(y.Number);
+                else if (_column.Real != null)
+                    result = x.Real.CompareTo(y.Real);
+                else
+                    result = string.Compare(x.Text, y.Text);
+
+                if (result != 0)
+                    return result * _direction;
+
+                // Keep the previous order for equal keys.
+                return x.Index.CompareTo(y.Index);
+            }
+        }
+
+        private static readonly Dictionary<string, SortColumn> _sortColumns = new Dictionary<string, SortColumn>();
+
+        static ProcessTreeModel()
+        {
+            AddSortColumn("name", n => n.Name);
+            AddSortColumn("pid", n => (long)n.Pid);
+            AddSortColumn("pvt. memory", n => n.ProcessItem.Process.VirtualMemoryCounters.PrivatePageCount.ToInt64());
+            AddSortColumn("working set", n => n.ProcessItem.Process.VirtualMemoryCounters.WorkingSetSize.ToInt64());
+            AddSortColumn("peak working set", n => n.ProcessItem.Process.VirtualMemoryCounters.PeakWorkingSetSize.ToInt64());
+            AddSortColumn("private ws", n => (long)n.PrivateWorkingSetNumber);
+            AddSortColumn("shared ws", n => (long)n.SharedWorkingSetNumber);
+            AddSortColumn("shareable ws", n => (long)n.ShareableWorkingSetNumber);
+            AddSortColumn("virtual size", n => n.ProcessItem.Process.VirtualMemoryCounters.VirtualSize.ToInt64());
+            AddSortColumn("peak virtual size", n => n.ProcessItem.Process.VirtualMemoryCounters.PeakVirtualSize.ToInt64());
+            AddSortColumn("pagefile usage", n => n.ProcessItem.Process.VirtualMemoryCounters.PagefileUsage.ToInt64());
+            AddSortColumn("peak pagefile usage", n => n.ProcessItem.Process.VirtualMemoryCounters.PeakPagefileUsage.ToInt64());
+            AddSortColumn("page faults", n => (long)n.ProcessItem.Process.VirtualMemoryCounters.PageFaultCount);
+            _sortColumns.Add("cpu", new SortColumn { Real = n => n.ProcessItem.CpuUsage });
+            AddSortColumn("username", n => n.Username);
+            AddSortColumn("session id", n => (long)n.ProcessItem.SessionId);
+            AddSortColumn("priority class", n => (long)n.ProcessItem.Process.BasePriority);
+            AddSortColumn("base priority", n => (long)n.ProcessItem.Process.BasePriority);
+            AddSortColumn("description", n => n.Description);
+            AddSortColumn("company", n => n.Company);
+            AddSortColumn("file name", n => n.FileName);
+            AddSortColumn("command line", n => n.CommandLine);
+            AddSortColumn("threads", n => (long)n.ProcessItem.Process.NumberOfThreads);
+            AddSortColumn("handles", n => (long)n.ProcessItem.Process.HandleCount);
+            AddSortColumn("gdi handles", n => (long)n.GdiHandlesNumber);
+            AddSortColumn("user handles", n => (long)n.UserHandlesNumber);
+            AddSortColumn("i/o total", n => n.IoTotalNumber);
+            AddSortColumn("i/o ro", n => n.IoReadOtherNumber);
+            AddSortColumn("i/o w", n => n.IoWriteNumber);
+            AddSortColumn("integrity", n => (long)n.IntegrityLevel);
+            AddSortColumn("i/o priority", n => (long)n.IoPriority);
+            AddSortColumn("page priority", n => (long)n.PagePriority);
+            AddSortColumn("start time", n => n.ProcessItem.CreateTime.Ticks);
+            // Invert the order - bigger dates are actually smaller if we use the relative time span.
+            _sortColumns.Add("start time (relative)", new SortColumn { Number = n => n.ProcessItem.CreateTime.Ticks, Invert = true });
+            AddSortColumn("total cpu time", n => n.ProcessItem.Process.KernelTime + n.ProcessItem.Process.UserTime);
+            AddSortColumn("kernel cpu time", n => n.ProcessItem.Process.KernelTime);
+            AddSortColumn("user cpu time", n => n.ProcessItem.Process.UserTime);
+            AddSortColumn("verification status", n => n.VerificationStatus);
+            AddSortColumn("verified signer", n => n.VerifiedSigner);
+        }
+
+        private static void AddSortColumn(string name, Func<ProcessNode, long> number)
+        {
+            _sortColumns.Add(name, new SortColumn { Number = number });
+        }
+
+        private static void AddSortColumn(string name, Func<ProcessNode, string> text)
+        {
+            _sortColumns.Add(name, new SortColumn { Text = text });
+        }
+
         private readonly ProcessTree _tree;
         private readonly Dictionary<int, ProcessNode> _processes = new Dictionary<int, ProcessNode>();
         private readonly List<ProcessNode> _roots = new List<ProcessNode>();
 
+        // The result of the last sort, which is used as the starting point 
+        // for the next one.
+        private List<ProcessNode> _sortedNodes;
+        private string _sortedColumn;
+        private SortOrder _sortedOrder;
+        private readonly List<ProcessNode> _addedNodes = new List<ProcessNode>();
+        private SortKey[] _sortKeys = new SortKey[0];
+
         public ProcessTreeModel(ProcessTree tree)
         {
             _tree = tree;
@@ -53,6 +212,14 @@ namespace ProcessHacker
             // Add the process to the list of all processes.
             _processes.Add(item.Pid, itemNode);
 
+            if (_sortedNodes != null)
+            {
+                if (this.IsSorting())
+                    _addedNodes.Add(itemNode);
+                else
+                    this.ClearSortedNodes();
+            }
+
             // Find the process' parent and add the process to it if we found it.
             if (item.HasParent && _processes.ContainsKey(item.ParentPid))
             {
@@ -162,7 +329,7 @@ namespace ProcessHacker
             if (node == null)
                 return TreePath.Empty;
 
-            if (this.GetSortColumn() != string.Empty)
+            if (this.IsSorting())
             {
                 return new TreePath(node);
             }
@@ -193,6 +360,15 @@ namespace ProcessHacker
             get { return _roots.ToArray(); }
         }
 
+        private bool IsSorting()
+        {
+            foreach (TreeColumn column in _tree.Tree.Columns)
+                if (column.SortOrder != SortOrder.None)
+                    return true;
+
+            return false;
+        }
+
         public string GetSortColumn()
         {
             foreach (TreeColumn column in _tree.Tree.Columns)
@@ -226,137 +402,127 @@ namespace ProcessHacker
 
         public System.Collections.IEnumerable GetChildren(TreePath treePath)
         {
-            if (this.GetSortColumn() != string.Empty)
+            if (this.IsSorting())
+                return this.GetSortedNodes();
+
+            // Sorting has been turned off, so the previous order is no 
+            // longer useful.
+            this.ClearSortedNodes();
+
+            if (treePath.IsEmpty())
+                return _roots;
+            
+            return (treePath.LastNode as ProcessNode).Children;
+        }
+
+        private List<ProcessNode> GetSortedNodes()
+        {
+            string columnName = this.GetSortColumn();
+            SortOrder order = this.GetSortOrder();
+            SortColumn column;
+            int count = 0;
+
+            _sortColumns.TryGetValue(columnName, out column);
+
+            // Start from the previous order if the sort hasn't changed, so 
+            // that nodes whose keys haven't changed are already in place.
+            if (_sortedNodes == null || columnName != _sortedColumn || order != _sortedOrder)
+                this.ClearSortedNodes();
+
+            if (_sortKeys.Length < _processes.Count)
+                _sortKeys = new SortKey[_processes.Count];
+
+            if (_sortedNodes != null)
             {
-                List<ProcessNode> nodes = new List<ProcessNode>();
-                string sortC = this.GetSortColumn();
-                SortOrder sortO = this.GetSortOrder();
+                foreach (ProcessNode node in _sortedNodes)
+                {
+                    ProcessNode current;
 
-                nodes.AddRange(_processes.Values);
+                    // Skip nodes which have been removed.
+                    if (_processes.TryGetValue(node.Pid, out current) && current == node)
+                        count = this.AddSortKey(column, node, count);
+                }
 
-                nodes.Sort((n1, n2) =>
+                foreach (ProcessNode node in _addedNodes)
                 {
-                    // We have a problem here - the GdiHandlesNumber and UserHandlesNumber 
-                    // properties are dynamically retrieved, so if n1 == n2 we may end up 
-                    // getting different values for the same process due to the timing.
-                    // If we do, then Array.Sort will throw an exception.
-                    //
-                    // The temporary HACK used here is to return 0 whenever n1 == n2.
-                    if (n1 == n2)
-                        return 0;
-
-                    switch (sortC)
-                    {
-                        case "name":
-                            return this.ModifySort(string.Compare(n1.Name, n2.Name), sortO);
-                        case "pid":
-                            return this.ModifySort(n1.Pid.CompareTo(n2.Pid), sortO);
-                        case "pvt. memory":
-                            return this.ModifySort(n1.ProcessItem.Process.VirtualMemoryCounters.PrivatePageCount.CompareTo(
-                                n2.ProcessItem.Process.VirtualMemoryCounters.PrivatePageCount), sortO);
-                        case "working set":
-                            return this.ModifySort(n1.ProcessItem.Process.VirtualMemoryCounters.WorkingSetSize.CompareTo(
-                                n2.ProcessItem.Process.VirtualMemoryCounters.WorkingSetSize), sortO);
-                        case "peak working set":
-                            return this.ModifySort(n1.ProcessItem.Process.VirtualMemoryCounters.PeakWorkingSetSize.CompareTo(
-                                n2.ProcessItem.Process.VirtualMemoryCounters.PeakWorkingSetSize), sortO);
-                        case "private ws":
-                            return this.ModifySort(n1.PrivateWorkingSetNumber.CompareTo(n2.PrivateWorkingSetNumber), sortO);
-                        case "shared ws":
-                            return this.ModifySort(n1.SharedWorkingSetNumber.CompareTo(n2.SharedWorkingSetNumber), sortO);
-                        case "shareable ws":
-                            return this.ModifySort(n1.ShareableWorkingSetNumber.CompareTo(n2.ShareableWorkingSetNumber), sortO);
-                        case "virtual size":
-                            return this.ModifySort(n1.ProcessItem.Process.VirtualMemoryCounters.VirtualSize.CompareTo(
-                                n2.ProcessItem.Process.VirtualMemoryCounters.VirtualSize), sortO);
-                        case "peak virtual size":
-                            return this.ModifySort(n1.ProcessItem.Process.VirtualMemoryCounters.PeakVirtualSize.CompareTo(
-                                n2.ProcessItem.Process.VirtualMemoryCounters.PeakVirtualSize), sortO);
-                        case "pagefile usage":
-                            return this.ModifySort(n1.ProcessItem.Process.VirtualMemoryCounters.PagefileUsage.CompareTo(
-                                n2.ProcessItem.Process.VirtualMemoryCounters.PagefileUsage), sortO);
-                        case "peak pagefile usage":
-                            return this.ModifySort(n1.ProcessItem.Process.VirtualMemoryCounters.PeakPagefileUsage.CompareTo(
-                                n2.ProcessItem.Process.VirtualMemoryCounters.PeakPagefileUsage), sortO);
-                        case "page faults":
-                            return this.ModifySort(n1.ProcessItem.Process.VirtualMemoryCounters.PageFaultCount.CompareTo(
-                                n2.ProcessItem.Process.VirtualMemoryCounters.PageFaultCount), sortO);
-                        case "cpu":
-                            return this.ModifySort(n1.ProcessItem.CpuUsage.CompareTo(n2.ProcessItem.CpuUsage), sortO);
-                        case "username":
-                            return this.ModifySort(string.Compare(n1.Username, n2.Username), sortO);
-                        case "session id":
-                            return this.ModifySort(n1.ProcessItem.SessionId.CompareTo(n2.ProcessItem.SessionId), sortO);
-                        case "priority class":
-                        case "base priority":
-                            return this.ModifySort(n1.ProcessItem.Process.BasePriority.CompareTo(
-                                n2.ProcessItem.Process.BasePriority), sortO);
-                        case "description":
-                            return this.ModifySort(string.Compare(n1.Description, n2.Description), sortO);
-                        case "company":
-                            return this.ModifySort(string.Compare(n1.Company, n2.Company), sortO);
-                        case "file name":
-                            return this.ModifySort(string.Compare(n1.FileName, n2.FileName), sortO);
-                        case "command line":
-                            return this.ModifySort(string.Compare(n1.CommandLine, n2.CommandLine), sortO);
-                        case "threads":
-                            return this.ModifySort(n1.ProcessItem.Process.NumberOfThreads.CompareTo(
-                                n2.ProcessItem.Process.NumberOfThreads), sortO);
-                        case "handles":
-                            return this.ModifySort(n1.ProcessItem.Process.HandleCount.CompareTo(
-                                n2.ProcessItem.Process.HandleCount), sortO);
-                        case "gdi handles":
-                            return this.ModifySort(n1.GdiHandlesNumber.CompareTo(n2.GdiHandlesNumber), sortO);
-                        case "user handles":
-                            return this.ModifySort(n1.UserHandlesNumber.CompareTo(n2.UserHandlesNumber), sortO);
-                        case "i/o total":
-                            return this.ModifySort(n1.IoTotalNumber.CompareTo(n2.IoTotalNumber), sortO);
-                        case "i/o ro":
-                            return this.ModifySort(n1.IoReadOtherNumber.CompareTo(n2.IoReadOtherNumber), sortO);
-                        case "i/o w":
-                            return this.ModifySort(n1.IoWriteNumber.CompareTo(n2.IoWriteNumber), sortO);
-                        case "integrity":
-                            return this.ModifySort(n1.IntegrityLevel.CompareTo(n2.IntegrityLevel), sortO);
-                        case "i/o priority":
-                            return this.ModifySort(n1.IoPriority.CompareTo(n2.IoPriority), sortO);
-                        case "page priority":
-                            return this.ModifySort(n1.PagePriority.CompareTo(n2.PagePriority), sortO);
-                        case "start time":
-                            return this.ModifySort(n1.ProcessItem.CreateTime.CompareTo(n2.ProcessItem.CreateTime), sortO);
-                        case "start time (relative)":
-                            // Invert the order - bigger dates are actually smaller if we use the relative time span.
-                            return -this.ModifySort(n1.ProcessItem.CreateTime.CompareTo(n2.ProcessItem.CreateTime), sortO);
-                        case "total cpu time":
-                            return this.ModifySort((n1.ProcessItem.Process.KernelTime + n1.ProcessItem.Process.UserTime).
-                                                       CompareTo(n2.ProcessItem.Process.KernelTime + n2.ProcessItem.Process.UserTime), sortO);
-                        case "kernel cpu time":
-                            return this.ModifySort(n1.ProcessItem.Process.KernelTime.CompareTo(
-                                n2.ProcessItem.Process.KernelTime), sortO);
-                        case "user cpu time":
-                            return this.ModifySort(n1.ProcessItem.Process.UserTime.CompareTo(
-                                n2.ProcessItem.Process.UserTime), sortO);
-                        case "verification status":
-                            return this.ModifySort(string.Compare(n1.VerificationStatus, n2.VerificationStatus), sortO);
-                        case "verified signer":
-                            return this.ModifySort(string.Compare(n1.VerifiedSigner, n2.VerifiedSigner), sortO);
-                        default:
-                            return 0;
-                    }
-                });
+                    ProcessNode current;
+
+                    if (_processes.TryGetValue(node.Pid, out current) && current == node)
+                        count = this.AddSortKey(column, node, count);
+                }
+            }
+            else
+            {
+                foreach (ProcessNode node in _processes.Values)
+                    count = this.AddSortKey(column, node, count);
+            }
+
+            if (column != null)
+            {
+                SortKeyComparer comparer = new SortKeyComparer(column, order);
 
-                return nodes;
+                // Each misplaced key may have to move across the whole list, 
+                // so fall back to a full sort if more than a few are misplaced.
+                if (!SortKeyComparer.InsertionSort(comparer, _sortKeys, count, 8))
+                    Array.Sort(_sortKeys, 0, count, comparer);
             }
 
-            if (treePath.IsEmpty())
-                return _roots;
-            
-            return (treePath.LastNode as ProcessNode).Children;
+            List<ProcessNode> nodes = new List<ProcessNode>(count);
+
+            for (int i = 0; i < count; i++)
+            {
+                nodes.Add(_sortKeys[i].Node);
+                _sortKeys[i] = new SortKey();
+            }
+
+            _sortedNodes = nodes;
+            _sortedColumn = columnName;
+            _sortedOrder = order;
+            _addedNodes.Clear();
+
+            return nodes;
+        }
+
+        private void ClearSortedNodes()
+        {
+            _sortedNodes = null;
+            _addedNodes.Clear();
+        }
+
+        private int AddSortKey(SortColumn column, ProcessNode node, int count)
+        {
+            // Don't overrun the key array if the node lists are out of sync 
+            // with the process dictionary.
+            if (count == _sortKeys.Length)
+                return count;
+
+            SortKey key = new SortKey();
+
+            key.Node = node;
+            key.Index = count;
+
+            // Each key is read only once per sort. Some of them, like the 
+            // working set counts, are expensive to retrieve, and others, 
+            // like the GDI handle count, may change between two reads.
+            if (column != null)
+            {
+                if (column.Number != null)
+                    key.Number = column.Number(node);
+                else if (column.Real != null)
+                    key.Real = column.Real(node);
+                else
+                    key.Text = column.Text(node);
+            }
+
+            _sortKeys[count] = key;
+
+            return count + 1;
         }
 
         public bool IsLeaf(TreePath treePath)
         {
             // When we're sorting the whole tree is a flat list, so there are no children.
-            if (this.GetSortColumn() != string.Empty)
+            if (this.IsSorting())
                 return true;
 
             if (treePath.IsEmpty())
@@ -53,12 +53,19 @@ namespace Aga.Controls.Tree
 					for (int i = index; i < Count; i++)
 						this[i]._index++;
 					base.InsertItem(index, item);
+
+					if (_owner.Tree != null)
+						_owner.Tree.OnNodeInserted(item);
 				}
 			}
 
 			protected override void RemoveItem(int index)
 			{
 				TreeNodeAdv item = this[index];
+
+				if (_owner.Tree != null)
+					_owner.Tree.OnNodeRemoving(item);
+
 				item._parent = null;
 				item._index = -1;
 				for (int i = index + 1; i < Count; i++)
@@ -83,7 +90,14 @@ namespace Aga.Controls.Tree
 	    private int _row;
 		internal int Row
 		{
-			get { return _row; }
+			get
+			{
+				// Rows are renumbered lazily after nodes are inserted or removed.
+				if (this.Tree != null)
+					this.Tree.EnsureRowNumbers();
+
+				return _row;
+			}
 			set { _row = value; }
 		}
 
@@ -245,7 +259,23 @@ namespace Aga.Controls.Tree
 
 		internal void AssignIsExpanded(bool value)
 		{
-			_isExpanded = value;
+			if (_isExpanded == value)
+				return;
+
+			if (value)
+			{
+				_isExpanded = true;
+
+				if (this.Tree != null)
+					this.Tree.OnNodeExpanded(this);
+			}
+			else
+			{
+				if (this.Tree != null)
+					this.Tree.OnNodeCollapsing(this);
+
+				_isExpanded = false;
+			}
 		}
 
 		private TreeNodeAdv _parent;
@@ -23,11 +23,18 @@ namespace Aga.Controls.Tree
 		private const int LeftMargin = 7;
 		internal const int ItemDragSensivity = 4;
 	    private const int DividerWidth = 9;
+		// The number of children which may be added, removed or moved 
+		// before ReadChilds rebuilds the list instead of splicing it.
+		private const int MaxSplicedChilds = 16;
 
 	    private Pen _linePen;
 		private bool _suspendUpdate;
         private bool _completeSuspendUpdate; // Overrides my (wj32's) hacks
 		private bool _needFullUpdate;
+		// True if RowMap contains exactly the visible nodes. Row numbers 
+		// starting at _firstStaleRow may be out of date.
+		private bool _rowMapValid;
+		private int _firstStaleRow = int.MaxValue;
 		private bool _fireSelectionEvent;
 		private NodePlusMinus _plusMinus;
 		private Control _currentEditor;
@@ -659,6 +666,7 @@ namespace Aga.Controls.Tree
 
 		private void CreateNodes()
 		{
+			this.InvalidateRowMap();
 			this.Selection.Clear();
 			this.SelectionStart = null;
 			this.Root = new TreeNodeAdv(this, null);
@@ -676,40 +684,209 @@ namespace Aga.Controls.Tree
 		}
 
 		internal void ReadChilds(TreeNodeAdv parentNode, bool performFullUpdate)
+		{
+			this.ReadChilds(parentNode, GetPath(parentNode), performFullUpdate);
+		}
+
+		private void ReadChilds(TreeNodeAdv parentNode, TreePath path, bool performFullUpdate)
 		{
 			if (!parentNode.IsLeaf)
 			{
 				parentNode.IsExpandedOnce = true;
-				List<TreeNodeAdv> oldNodes = new List<TreeNodeAdv>(parentNode.Nodes);
-				parentNode.Nodes.Clear();
+
+				List<object> items = new List<object>();
 
 				if (Model != null)
 				{
-					IEnumerable items = Model.GetChildren(GetPath(parentNode));
-					if (items != null)
-						foreach (object obj in items)
+					IEnumerable children = Model.GetChildren(path);
+					if (children != null)
+						foreach (object obj in children)
+							items.Add(obj);
+				}
+
+				// Nodes taken out of the list by SpliceChilds which haven't 
+				// been put back yet.
+				Dictionary<object, TreeNodeAdv> detachedNodes = null;
+
+				if (performFullUpdate || !SpliceChilds(parentNode, items, ref detachedNodes))
+					RebuildChilds(parentNode, items, detachedNodes, performFullUpdate);
+			}
+		}
+
+		/// <summary>
+		/// Brings the children of a node in line with the model by adding, 
+		/// removing and moving only the nodes which have changed, so that 
+		/// the row map can be kept instead of being rebuilt.
+		/// </summary>
+		/// <returns>
+		/// False if too many children have changed. The remaining children 
+		/// must then be read again by RebuildChilds.
+		/// </returns>
+		private bool SpliceChilds(TreeNodeAdv parentNode, List<object> items, ref Dictionary<object, TreeNodeAdv> detachedNodes)
+		{
+			if (items.Count == parentNode.Nodes.Count)
+			{
+				int i = 0;
+
+				while (i < items.Count && items[i] != null && parentNode.Nodes[i].Tag == items[i])
+					i++;
+
+				// Nothing has changed, which is the most common case.
+				if (i == items.Count)
+				{
+					foreach (TreeNodeAdv node in parentNode.Nodes)
+					{
+						node.RightBounds = node.Height = null;
+						ReadNode(node);
+					}
+
+					return true;
+				}
+			}
+
+			Dictionary<object, int> positions = new Dictionary<object, int>(items.Count, ReferenceComparer.Instance);
+			int changes = 0;
+
+			foreach (object obj in items)
+			{
+				// Null and duplicate items can't be matched with their nodes.
+				if (obj == null || positions.ContainsKey(obj))
+					return false;
+
+				positions.Add(obj, positions.Count);
+			}
+
+			for (int i = parentNode.Nodes.Count - 1; i >= 0; i--)
+			{
+				object tag = parentNode.Nodes[i].Tag;
+
+				if (tag == null || !positions.ContainsKey(tag))
+				{
+					if (++changes > MaxSplicedChilds)
+						return false;
+
+					parentNode.Nodes.RemoveAt(i);
+				}
+			}
+
+			// The first i nodes match the first i items. Every other node 
+			// belongs to an item further down the list.
+			for (int i = 0; i < items.Count; i++)
+			{
+				object obj = items[i];
+				TreeNodeAdv node;
+
+				if (i < parentNode.Nodes.Count && parentNode.Nodes[i].Tag == obj)
+				{
+					node = parentNode.Nodes[i];
+					node.RightBounds = node.Height = null;
+				}
+				else
+				{
+					if (++changes > MaxSplicedChilds)
+						return false;
+
+					if (i + 1 < parentNode.Nodes.Count && parentNode.Nodes[i + 1].Tag == obj)
+					{
+						// The node in the way has moved down. Take it out until 
+						// its item is reached.
+						node = parentNode.Nodes[i];
+						parentNode.Nodes.RemoveAt(i);
+
+						if (detachedNodes == null)
+							detachedNodes = new Dictionary<object, TreeNodeAdv>(ReferenceComparer.Instance);
+						if (!detachedNodes.ContainsKey(node.Tag))
+							detachedNodes.Add(node.Tag, node);
+
+						node = parentNode.Nodes[i];
+						node.RightBounds = node.Height = null;
+					}
+					else if (detachedNodes != null && detachedNodes.TryGetValue(obj, out node))
+					{
+						detachedNodes.Remove(obj);
+						node.RightBounds = node.Height = null;
+						parentNode.Nodes.Insert(i, node);
+					}
+					else
+					{
+						node = null;
+
+						for (int j = i + 1; j < parentNode.Nodes.Count; j++)
 						{
-							bool found = false;
-							if (obj != null)
+							if (parentNode.Nodes[j].Tag == obj)
 							{
-								for (int i = 0; i < oldNodes.Count; i++)
-									if (obj == oldNodes[i].Tag)
-									{
-										oldNodes[i].RightBounds = oldNodes[i].Height = null;
-										AddNode(parentNode, -1, oldNodes[i]);
-										oldNodes.RemoveAt(i);
-										found = true;
-										break;
-									}
+								// The node has moved up.
+								node = parentNode.Nodes[j];
+								parentNode.Nodes.RemoveAt(j);
+								node.RightBounds = node.Height = null;
+								break;
 							}
-							if (!found)
-								AddNewNode(parentNode, obj, -1);
-
-							if (performFullUpdate)
-								FullUpdate();
 						}
+
+						if (node == null)
+							node = new TreeNodeAdv(this, obj);
+
+						parentNode.Nodes.Insert(i, node);
+					}
+				}
+
+				ReadNode(node);
+			}
+
+			// Only nodes with duplicate tags can be left over.
+			while (parentNode.Nodes.Count > items.Count)
+				parentNode.Nodes.RemoveAt(parentNode.Nodes.Count - 1);
+
+			return true;
+		}
+
+		private void RebuildChilds(TreeNodeAdv parentNode, List<object> items, Dictionary<object, TreeNodeAdv> detachedNodes, bool performFullUpdate)
+		{
+			// Splicing each child into the row map would renumber the 
+			// rows after it every time, so rebuild the map once on the 
+			// next full update instead.
+			if (AreChildrenInRowMap(parentNode))
+				InvalidateRowMap();
+
+			// Look up the existing nodes by tag. Searching a list for each 
+			// child is quadratic, which is slow for large flat lists.
+			Dictionary<object, TreeNodeAdv> oldNodes = new Dictionary<object, TreeNodeAdv>(
+				parentNode.Nodes.Count, ReferenceComparer.Instance);
+
+			foreach (TreeNodeAdv node in parentNode.Nodes)
+			{
+				if (node.Tag != null && !oldNodes.ContainsKey(node.Tag))
+					oldNodes.Add(node.Tag, node);
+			}
+
+			if (detachedNodes != null)
+			{
+				foreach (KeyValuePair<object, TreeNodeAdv> pair in detachedNodes)
+				{
+					if (!oldNodes.ContainsKey(pair.Key))
+						oldNodes.Add(pair.Key, pair.Value);
+				}
+			}
+
+			parentNode.Nodes.Clear();
+
+			foreach (object obj in items)
+			{
+				TreeNodeAdv oldNode;
+
+				if (obj != null && oldNodes.TryGetValue(obj, out oldNode))
+				{
+					oldNode.RightBounds = oldNode.Height = null;
+					AddNode(parentNode, -1, oldNode);
+					oldNodes.Remove(obj);
+				}
+				else
+				{
+					AddNewNode(parentNode, obj, -1);
 				}
 
+				if (performFullUpdate)
+					FullUpdate();
 			}
 		}
 
@@ -726,11 +903,18 @@ namespace Aga.Controls.Tree
 			else
 				parent.Nodes.Add(node);
 
-			node.IsLeaf = Model.IsLeaf(GetPath(node));
+			ReadNode(node);
+		}
+
+		private void ReadNode(TreeNodeAdv node)
+		{
+			TreePath path = GetPath(node);
+
+			node.IsLeaf = Model.IsLeaf(path);
 			if (node.IsLeaf)
 				node.Nodes.Clear();
 			if (!this.LoadOnDemand || node.IsExpandedOnce)
-				ReadChilds(node);
+				ReadChilds(node, path, false);
 
             this.InvalidateNodeControlCache();
 		}
@@ -806,18 +990,30 @@ namespace Aga.Controls.Tree
 
 	    private void CreateRowMap()
 	    {
-	        this.RowMap.Clear();
-	        int row = 0;
-	        this.ContentWidth = 0;
-	      
-            foreach (TreeNodeAdv node in VisibleNodes)
-	        {
-	            node.Row = row;
+			// The row map is kept up to date as nodes are added, removed, 
+			// expanded and collapsed, so it only needs to be rebuilt after 
+			// it has been invalidated.
+			if (_rowMapValid)
+			{
+				EnsureRowNumbers();
+			}
+			else
+			{
+				this.RowMap.Clear();
+				int row = 0;
+
+				foreach (TreeNodeAdv node in VisibleNodes)
+				{
+					node.Row = row;
+
+					this.RowMap.Add(node);
 
-	            this.RowMap.Add(node);
+					row++;
+				}
 
-	            row++;
-	        }
+				_rowMapValid = true;
+				_firstStaleRow = int.MaxValue;
+			}
 
 	        this.ContentWidth = 0;
          
@@ -828,6 +1024,195 @@ namespace Aga.Controls.Tree
             }
 	    }
 
+		private void InvalidateRowMap()
+		{
+			_rowMapValid = false;
+			_firstStaleRow = int.MaxValue;
+		}
+
+		/// <summary>
+		/// Renumbers the rows which have moved since the row map was last changed.
+		/// </summary>
+		internal void EnsureRowNumbers()
+		{
+			if (_firstStaleRow == int.MaxValue)
+				return;
+
+			int firstRow = _firstStaleRow;
+
+			_firstStaleRow = int.MaxValue;
+
+			for (int i = firstRow; i < this.RowMap.Count; i++)
+				this.RowMap[i].Row = i;
+		}
+
+		internal void OnNodeInserted(TreeNodeAdv node)
+		{
+			if (!AreChildrenInRowMap(node.Parent))
+				return;
+
+			int row;
+
+			if (node.Index == 0)
+			{
+				if (!TryGetRow(node.Parent, out row))
+					return;
+
+				row++;
+			}
+			else
+			{
+				TreeNodeAdv previous = node.Parent.Nodes[node.Index - 1];
+
+				if (!TryGetRow(previous, out row))
+					return;
+
+				row += 1 + CountVisibleDescendants(previous);
+			}
+
+			List<TreeNodeAdv> rows = new List<TreeNodeAdv>();
+
+			rows.Add(node);
+			AddVisibleDescendants(node, rows);
+			InsertRows(row, rows);
+		}
+
+		internal void OnNodeRemoving(TreeNodeAdv node)
+		{
+			int row;
+
+			if (!AreChildrenInRowMap(node.Parent))
+				return;
+			if (!TryGetRow(node, out row))
+				return;
+
+			RemoveRows(row, 1 + CountVisibleDescendants(node));
+		}
+
+		internal void OnNodeExpanded(TreeNodeAdv node)
+		{
+			int row;
+
+			if (!AreChildrenInRowMap(node))
+				return;
+			if (!TryGetRow(node, out row))
+				return;
+
+			List<TreeNodeAdv> rows = new List<TreeNodeAdv>();
+
+			AddVisibleDescendants(node, rows);
+			InsertRows(row + 1, rows);
+		}
+
+		internal void OnNodeCollapsing(TreeNodeAdv node)
+		{
+			int row;
+
+			if (!AreChildrenInRowMap(node))
+				return;
+			if (!TryGetRow(node, out row))
+				return;
+
+			RemoveRows(row + 1, CountVisibleDescendants(node));
+		}
+
+		private bool AreChildrenInRowMap(TreeNodeAdv parent)
+		{
+			if (!_rowMapValid)
+				return false;
+
+			for (TreeNodeAdv node = parent; node != this.Root; node = node.Parent)
+			{
+				if (node == null || !node.IsExpanded)
+					return false;
+			}
+
+			return true;
+		}
+
+		private bool TryGetRow(TreeNodeAdv node, out int row)
+		{
+			// The root node isn't displayed, so its children start at row 0.
+			if (node == this.Root)
+			{
+				row = -1;
+				return true;
+			}
+
+			EnsureRowNumbers();
+			row = node.Row;
+
+			if (row >= 0 && row < this.RowMap.Count && this.RowMap[row] == node)
+				return true;
+
+			// The row map is out of sync with the nodes. Rebuild it on the next update.
+			InvalidateRowMap();
+
+			return false;
+		}
+
+		private void InsertRows(int row, List<TreeNodeAdv> rows)
+		{
+			this.RowMap.InsertRange(row, rows);
+
+			if (row < _firstStaleRow)
+				_firstStaleRow = row;
+		}
+
+		private void RemoveRows(int row, int count)
+		{
+			if (count == 0)
+				return;
+
+			for (int i = row; i < row + count; i++)
+				this.RowMap[i].Row = -1;
+
+			this.RowMap.RemoveRange(row, count);
+
+			if (row < _firstStaleRow)
+				_firstStaleRow = row;
+		}
+
+		private static int CountVisibleDescendants(TreeNodeAdv node)
+		{
+			int count = 0;
+
+			if (node.IsExpanded)
+			{
+				foreach (TreeNodeAdv child in node.Nodes)
+					count += 1 + CountVisibleDescendants(child);
+			}
+
+			return count;
+		}
+
+		private static void AddVisibleDescendants(TreeNodeAdv node, List<TreeNodeAdv> rows)
+		{
+			if (node.IsExpanded)
+			{
+				foreach (TreeNodeAdv child in node.Nodes)
+				{
+					rows.Add(child);
+					AddVisibleDescendants(child, rows);
+				}
+			}
+		}
+
+		private sealed class ReferenceComparer : IEqualityComparer<object>
+		{
+			public static readonly ReferenceComparer Instance = new ReferenceComparer();
+
+			public new bool Equals(object x, object y)
+			{
+				return x == y;
+			}
+
+			public int GetHashCode(object obj)
+			{
+				return System.Runtime.CompilerServices.RuntimeHelpers.GetHashCode(obj);
+			}
+		}
+
 	    internal Rectangle GetNodeBounds(TreeNodeAdv node)
 		{
 			return GetNodeBounds(GetNodeControls(node));
@@ -1094,6 +1479,9 @@ namespace Aga.Controls.Tree
 			TreeNodeAdv parent = FindNode(e.Path);
 			if (parent != null)
 			{
+				if (ChangesManyRows(parent, e))
+					InvalidateRowMap();
+
 				if (e.Indices != null)
 				{
 					List<int> list = new List<int>(e.Indices);
@@ -1138,12 +1526,22 @@ namespace Aga.Controls.Tree
 			TreeNodeAdv parent = FindNode(e.Path);
 			if (parent != null)
 			{
+				if (ChangesManyRows(parent, e))
+					InvalidateRowMap();
+
 				for (int i = 0; i < e.Children.Length; i++)
 					AddNewNode(parent, e.Children[i], e.Indices[i]);
 			}
 			SmartFullUpdate();
 		}
 
+		private bool ChangesManyRows(TreeNodeAdv parent, TreeModelEventArgs e)
+		{
+			// Splice single nodes into the row map, but rebuild it once for 
+			// larger changes.
+			return e.Children.Length > 1 && AreChildrenInRowMap(parent);
+		}
+
 		private void _model_NodesChanged(object sender, TreeModelEventArgs e)
 		{
 			TreeNodeAdv parent = FindNode(e.Path);
@@ -33,7 +33,14 @@ namespace ProcessHacker
 {
     public partial class DumpHackerWindow : Form
     {
+        /// <summary>
+        /// The estimated number of bytes of decoded modules, handles and 
+        /// environment variables to keep for process windows.
+        /// </summary>
+        private const int MaximumCachedBytes = 64 * 1024 * 1024;
+
         private readonly MemoryFileSystem _mfs;
+        private readonly DumpCache _cache = new DumpCache(MaximumCachedBytes);
         private MemoryObject _processesMo;
         private MemoryObject _servicesMo;
         private string _phVersion;
@@ -84,6 +91,7 @@ namespace ProcessHacker
                 _processesMo.Dispose();
             if (_servicesMo != null)
                 _servicesMo.Dispose();
+            _cache.Clear();
             _mfs.Dispose();
 
             foreach (var item in _processes.Values)
@@ -98,6 +106,11 @@ namespace ProcessHacker
             get { return _architecture; }
         }
 
+        public DumpCache Cache
+        {
+            get { return _cache; }
+        }
+
         public Dictionary<int, ProcessItem> Processes
         {
             get { return _processes; }
@@ -153,16 +166,21 @@ namespace ProcessHacker
 
         private void LoadProcess(MemoryObject mo)
         {
-            var names = mo.ChildNames;
             ProcessItem pitem;
 
-            if (!names.Contains("General"))
-                return;
-
+            // Only read what the process tree needs. Everything else is 
+            // read when the process is viewed. Note that we look up 
+            // children by name instead of enumerating them, since older 
+            // dumps have one child object per handle.
             IDictionary<string, string> generalDict;
 
             using (MemoryObject general = mo.GetChild("General"))
+            {
+                if (general == null)
+                    return;
+
                 generalDict = Dump.GetDictionary(general);
+            }
 
             pitem = new ProcessItem
             {
@@ -230,21 +248,21 @@ namespace ProcessHacker
             if (generalDict.ContainsKey("ImportModules"))
                 pitem.ImportModules = Dump.ParseInt32(generalDict["ImportModules"]);
 
-            if (names.Contains("SmallIcon"))
+            using (var smallIcon = mo.GetChild("SmallIcon"))
             {
-                using (var smallIcon = mo.GetChild("SmallIcon"))
+                if (smallIcon != null)
                     pitem.Icon = Dump.GetIcon(smallIcon);
             }
 
-            if (names.Contains("VmCounters"))
+            using (var vmCounters = mo.GetChild("VmCounters"))
             {
-                using (var vmCounters = mo.GetChild("VmCounters"))
+                if (vmCounters != null)
                     pitem.Process.VirtualMemoryCounters = Dump.GetStruct<VmCountersEx64>(vmCounters).ToVmCountersEx();
             }
 
-            if (names.Contains("IoCounters"))
+            using (var ioCounters = mo.GetChild("IoCounters"))
             {
-                using (var ioCounters = mo.GetChild("IoCounters"))
+                if (ioCounters != null)
                     pitem.Process.IoCounters = Dump.GetStruct<IoCounters>(ioCounters);
             }
 
@@ -40,6 +40,10 @@ namespace ProcessHacker
         private readonly MemoryObject _processMo;
 
         private TokenProperties _tokenProps;
+        private bool _tokenLoaded;
+        private bool _modulesLoaded;
+        private bool _environmentLoaded;
+        private bool _handlesLoaded;
 
         public DumpProcessWindow(DumpHackerWindow hw, ProcessItem item, MemoryObject processMo)
         {
@@ -60,6 +64,8 @@ namespace ProcessHacker
             }
 
             this.Icon = _item.Icon;
+
+            tabControl.SelectedIndexChanged += this.tabControl_SelectedIndexChanged;
         }
 
         private void DumpProcessWindow_Load(object sender, EventArgs e)
@@ -72,7 +78,6 @@ namespace ProcessHacker
             };
             tabToken.Controls.Add(_tokenProps);
             _tokenProps.DumpInitialize();
-            this.LoadToken();
 
             // Modules
             if (_item.FileName != null)
@@ -80,22 +85,53 @@ namespace ProcessHacker
             listModules.List.AddShortcuts();
             listModules.List.ContextMenu = listModules.List.GetCopyMenu();
 
-            this.LoadModules();
-            listModules.UpdateItems();
-
             // Environment
             listEnvironment.AddShortcuts();
             listEnvironment.ContextMenu = listEnvironment.GetCopyMenu();
 
-            this.LoadEnvironment();
-
             // Handles
             listHandles.DumpDisableEvents();
             listHandles.List.AddShortcuts();
             listHandles.List.ContextMenu = listHandles.List.GetCopyMenu();
 
-            this.LoadHandles();
-            listHandles.UpdateItems();
+            // The other tabs are loaded when they are first shown.
+            this.LoadTab(tabControl.SelectedTab);
+        }
+
+        private void tabControl_SelectedIndexChanged(object sender, EventArgs e)
+        {
+            this.LoadTab(tabControl.SelectedTab);
+        }
+
+        private void LoadTab(TabPage tab)
+        {
+            if (tab == tabToken && !_tokenLoaded)
+            {
+                _tokenLoaded = true;
+                this.LoadToken();
+            }
+            else if (tab == tabModules && !_modulesLoaded)
+            {
+                _modulesLoaded = true;
+                this.LoadModules();
+                listModules.UpdateItems();
+            }
+            else if (tab == tabEnvironment && !_environmentLoaded)
+            {
+                _environmentLoaded = true;
+                this.LoadEnvironment();
+            }
+            else if (tab == tabHandles && !_handlesLoaded)
+            {
+                _handlesLoaded = true;
+                this.LoadHandles();
+                listHandles.UpdateItems();
+            }
+        }
+
+        private string GetCacheKey(string name)
+        {
+            return _item.Pid.ToString("x") + "\\" + name;
         }
 
         private void DumpProcessWindow_FormClosing(object sender, FormClosingEventArgs e)
@@ -110,16 +146,12 @@ namespace ProcessHacker
 
         private void LoadProperties()
         {
-            var names = _processMo.ChildNames;
-
-            if (names.Contains("LargeIcon"))
+            using (var largeIcon = _processMo.GetChild("LargeIcon"))
             {
-                using (var largeIcon = _processMo.GetChild("LargeIcon"))
+                if (largeIcon != null)
                     pictureIcon.Image = Dump.GetIcon(largeIcon).ToBitmap();
-            }
-            else
-            {
-                pictureIcon.Image = Properties.Resources.Process.ToBitmap();
+                else
+                    pictureIcon.Image = Properties.Resources.Process.ToBitmap();
             }
 
             if (_item.VersionInfo != null)
@@ -290,25 +322,94 @@ namespace ProcessHacker
 
         private void LoadModules()
         {
+            var modules = _hw.Cache.Get(this.GetCacheKey("Modules"), this.ReadModules, EstimateSize);
+
+            foreach (var item in modules)
+                listModules.AddItem(item);
+        }
+
+        private static int EstimateSize(List<ModuleItem> modules)
+        {
+            int size = 0;
+
+            foreach (var item in modules)
+            {
+                // The list slot, the object and its fields.
+                size += IntPtr.Size + DumpCache.ObjectOverhead + 64;
+                size += DumpCache.EstimateSize(item.Name);
+                size += DumpCache.EstimateSize(item.FileName);
+                size += DumpCache.EstimateSize(item.FileDescription);
+                size += DumpCache.EstimateSize(item.FileCompanyName);
+                size += DumpCache.EstimateSize(item.FileVersion);
+            }
+
+            return size;
+        }
+
+        private unsafe List<ModuleItem> ReadModules()
+        {
+            List<ModuleItem> modules = new List<ModuleItem>();
             MemoryObject modulesMo;
 
+            using (var tableMo = _processMo.GetChild("ModuleTable"))
+            {
+                if (tableMo != null)
+                {
+                    using (var table = DumpTableReader.Open(tableMo, DumpModuleRecord.SizeOf))
+                    {
+                        if (table != null)
+                        {
+                            modules.Capacity = table.RecordCount;
+
+                            for (int i = 0; i < table.RecordCount; i++)
+                                modules.Add(this.ReadModule(table, (DumpModuleRecord*)table.GetRecord(i)));
+                        }
+                    }
+
+                    return modules;
+                }
+            }
+
+            // Dumps created by older versions have one object per module.
             modulesMo = _processMo.GetChild("Modules");
 
             if (modulesMo == null)
-                return;
+                return modules;
 
             modulesMo.EnumChildren(childMo =>
             {
                 using (childMo)
-                    this.LoadModule(childMo);
+                    modules.Add(this.ReadModule(childMo));
 
                 return true;
             });
 
             modulesMo.Dispose();
+
+            return modules;
         }
 
-        private void LoadModule(MemoryObject mo)
+        private unsafe ModuleItem ReadModule(DumpTableReader table, DumpModuleRecord* record)
+        {
+            ModuleItem item = new ModuleItem();
+
+            item.BaseAddress = (ulong)record->BaseAddress;
+            item.Size = record->Size;
+            item.Flags = (LdrpDataTableEntryFlags)record->Flags;
+            item.Name = table.GetString(record->Name);
+            item.FileName = table.GetString(record->FileName);
+
+            if (record->FileDescription != -1)
+            {
+                item.FileDescription = table.GetString(record->FileDescription);
+                item.FileCompanyName = table.GetString(record->FileCompanyName);
+                item.FileVersion = table.GetString(record->FileVersion);
+            }
+
+            return item;
+        }
+
+        private ModuleItem ReadModule(MemoryObject mo)
         {
             var dict = Dump.GetDictionary(mo);
             ModuleItem item = new ModuleItem();
@@ -326,54 +427,153 @@ namespace ProcessHacker
                 item.FileVersion = dict["FileVersion"];
             }
 
-            listModules.AddItem(item);
+            return item;
         }
 
         private void LoadEnvironment()
         {
-            MemoryObject env = _processMo.GetChild("Environment");
-
-            if (env == null)
-                return;
-
-            IDictionary<string, string> dict = Dump.GetDictionary(env);
+            var dict = _hw.Cache.Get(this.GetCacheKey("Environment"), this.ReadEnvironment, EstimateSize);
 
             foreach (var kvp in dict)
             {
                 if (!string.IsNullOrEmpty(kvp.Key))
                     listEnvironment.Items.Add(new ListViewItem(new[] { kvp.Key, kvp.Value }));
             }
+        }
+
+        private static int EstimateSize(IDictionary<string, string> dict)
+        {
+            int size = 0;
+
+            foreach (var kvp in dict)
+            {
+                // The dictionary entry and bucket.
+                size += 28;
+                size += DumpCache.EstimateSize(kvp.Key);
+                size += DumpCache.EstimateSize(kvp.Value);
+            }
+
+            return size;
+        }
 
-            env.Dispose();
+        private IDictionary<string, string> ReadEnvironment()
+        {
+            using (MemoryObject env = _processMo.GetChild("Environment"))
+            {
+                if (env == null)
+                    return new Dictionary<string, string>();
+
+                return Dump.GetDictionary(env);
+            }
         }
 
         private void LoadHandles()
         {
+            var handles = _hw.Cache.Get(this.GetCacheKey("Handles"), this.ReadHandles, EstimateSize);
+            bool hideUnnamed = Settings.Instance.HideHandlesWithNoName;
+
+            foreach (var item in handles)
+            {
+                if (hideUnnamed && string.IsNullOrEmpty(item.ObjectInfo.BestName))
+                    continue;
+
+                listHandles.AddItem(item);
+            }
+        }
+
+        private static int EstimateSize(List<HandleItem> handles)
+        {
+            int size = 0;
+
+            foreach (var item in handles)
+            {
+                // The list slot, the object and its fields. Type names are 
+                // counted for every handle even if they are shared.
+                size += IntPtr.Size + DumpCache.ObjectOverhead + 64;
+                size += DumpCache.EstimateSize(item.ObjectInfo.OrigName);
+                size += DumpCache.EstimateSize(item.ObjectInfo.BestName);
+                size += DumpCache.EstimateSize(item.ObjectInfo.TypeName);
+            }
+
+            return size;
+        }
+
+        private unsafe List<HandleItem> ReadHandles()
+        {
+            List<HandleItem> handles = new List<HandleItem>();
             MemoryObject handlesMo;
 
+            using (var tableMo = _processMo.GetChild("HandleTable"))
+            {
+                if (tableMo != null)
+                {
+                    using (var table = DumpTableReader.Open(tableMo, DumpHandleRecord.SizeOf))
+                    {
+                        if (table != null)
+                        {
+                            handles.Capacity = table.RecordCount;
+
+                            for (int i = 0; i < table.RecordCount; i++)
+                                handles.Add(this.ReadHandle(table, (DumpHandleRecord*)table.GetRecord(i)));
+                        }
+                    }
+
+                    return handles;
+                }
+            }
+
+            // Dumps created by older versions have one object per handle.
             handlesMo = _processMo.GetChild("Handles");
 
             if (handlesMo == null)
-                return;
+                return handles;
 
             handlesMo.EnumChildren(childMo =>
             {
                 using (childMo)
-                    this.LoadHandles(childMo);
+                {
+                    HandleItem item = this.ReadHandle(childMo);
+
+                    if (item != null)
+                        handles.Add(item);
+                }
 
                 return true;
             });
 
             handlesMo.Dispose();
+
+            return handles;
         }
 
-        private void LoadHandles(MemoryObject mo)
+        private unsafe HandleItem ReadHandle(DumpTableReader table, DumpHandleRecord* record)
+        {
+            HandleItem item = new HandleItem();
+
+            item.Handle.ProcessId = _item.Pid;
+            item.Handle.Flags = (HandleFlags)record->Flags;
+            item.Handle.Handle = (short)record->Handle;
+            // Not really needed, just fill it in ignoring 32-bit vs 64-bit 
+            // differences.
+            item.Handle.Object = (record->Object & 0xffffffff).ToIntPtr();
+            item.Handle.GrantedAccess = record->GrantedAccess;
+
+            if (record->TypeName != -1)
+            {
+                item.ObjectInfo.TypeName = table.GetString(record->TypeName);
+                item.ObjectInfo.BestName = table.GetString(record->ObjectName);
+            }
+
+            return item;
+        }
+
+        private HandleItem ReadHandle(MemoryObject mo)
         {
             var dict = Dump.GetDictionary(mo);
             HandleItem item = new HandleItem();
 
             if (!dict.ContainsKey("Handle"))
-                return;
+                return null;
 
             item.Handle.ProcessId = _item.Pid;
             item.Handle.Flags = (HandleFlags)Dump.ParseInt32(dict["Flags"]);
@@ -389,13 +589,7 @@ namespace ProcessHacker
                 item.ObjectInfo.BestName = dict["ObjectName"];
             }
 
-            if (Settings.Instance.HideHandlesWithNoName)
-            {
-                if (string.IsNullOrEmpty(item.ObjectInfo.BestName))
-                    return;
-            }
-
-            listHandles.AddItem(item);
+            return item;
         }
 
         private void buttonInspectParent_Click(object sender, EventArgs e)
@@ -771,7 +771,7 @@ namespace ProcessHacker
 
                     try
                     {
-                        Program.NetworkProvider.Dictionary[item.Name].Connection.CloseTcpConnection();
+                        ((NetworkItem)item.Tag).Connection.CloseTcpConnection();
                     }
                     catch
                     {
@@ -2584,6 +2584,7 @@ namespace ProcessHacker
 
             Program.ProcessProvider.HistoryMaxSize = Settings.Instance.MaxSamples;
             ProcessHacker.Components.Plotter.GlobalMoveStep = Settings.Instance.PlotterStep;
+            ProcessHacker.Components.Plotter.GlobalFitData = Settings.Instance.PlotterFitHistory;
 
             // Set up symbols...
 
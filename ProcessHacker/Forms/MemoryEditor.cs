@@ -23,6 +23,7 @@
 using System;
 using System.Collections.Generic;
 using System.Windows.Forms;
+using Be.Windows.Forms;
 using ProcessHacker.Common;
 using ProcessHacker.Native;
 using ProcessHacker.Native.Api;
@@ -60,10 +61,86 @@ namespace ProcessHacker
             }
         }
 
+        /// <summary>
+        /// Reads and writes the memory region being edited.
+        /// </summary>
+        private sealed class ProcessMemorySource : IPageSource, IDisposable
+        {
+            private readonly int _pid;
+            private readonly IntPtr _address;
+            private readonly long _length;
+            private ProcessHandle _readHandle;
+            private ProcessHandle _writeHandle;
+
+            public ProcessMemorySource(int pid, IntPtr address, long length)
+            {
+                _pid = pid;
+                _address = address;
+                _length = length;
+                _readHandle = new ProcessHandle(pid, Program.MinProcessReadMemoryRights);
+            }
+
+            public void Dispose()
+            {
+                if (_readHandle != null)
+                {
+                    _readHandle.Dispose();
+                    _readHandle = null;
+                }
+
+                if (_writeHandle != null)
+                {
+                    _writeHandle.Dispose();
+                    _writeHandle = null;
+                }
+            }
+
+            public long Length
+            {
+                get { return _length; }
+            }
+
+            /// <summary>
+            /// Reads the start of the region, throwing an exception if it can't be read.
+            /// </summary>
+            public void Probe()
+            {
+                byte[] buffer = new byte[1];
+
+                if (_readHandle.ReadMemory(_address, buffer, 1) == 0)
+                    throw new Exception("Unknown error.");
+            }
+
+            public int Read(long offset, byte[] buffer, int count)
+            {
+                try
+                {
+                    return _readHandle.ReadMemory(_address.Increment(offset), buffer, count);
+                }
+                catch (WindowsException)
+                {
+                    // The page is not readable. It will be displayed as zeros.
+                    return 0;
+                }
+            }
+
+            public unsafe void Write(long offset, byte[] buffer, int bufferOffset, int count)
+            {
+                if (_writeHandle == null)
+                    _writeHandle = new ProcessHandle(_pid, Program.MinProcessWriteMemoryRights);
+
+                fixed (byte* bufferPtr = buffer)
+                {
+                    if (_writeHandle.WriteMemory(_address.Increment(offset), bufferPtr + bufferOffset, count) == 0)
+                        throw new Exception("Unknown error.");
+                }
+            }
+        }
+
         private readonly int _pid;
         private readonly long _length;
         private IntPtr _address;
-        private byte[] _data;
+        private ProcessMemorySource _source;
 
         public string Id
         {
@@ -121,6 +198,12 @@ namespace ProcessHacker
 
             if (this.WindowState == FormWindowState.Normal)
                 Settings.Instance.MemoryWindowSize = this.Size;
+
+            if (_source != null)
+            {
+                _source.Dispose();
+                _source = null;
+            }
         }
 
         public bool ReadOnly
@@ -155,29 +238,32 @@ namespace ProcessHacker
 
         private void ReadMemory()
         {
-            using (ProcessHandle phandle = new ProcessHandle(_pid, Program.MinProcessReadMemoryRights))
+            ProcessMemorySource source = new ProcessMemorySource(_pid, _address, _length);
+
+            try
             {
-                _data = new byte[_length];
+                source.Probe();
+            }
+            catch
+            {
+                source.Dispose();
+                throw;
+            }
 
-                if (phandle.ReadMemory(_address, _data, (int)_length) == 0)
-                    throw new Exception("Unknown error.");
+            // Pages are read from the process as they are displayed, so large 
+            // regions can be opened without reading them all up front.
+            hexBoxMemory.ByteProvider = new PagedByteProvider(source);
 
-                hexBoxMemory.ByteProvider = new Be.Windows.Forms.DynamicByteProvider(_data);
-            }
+            if (_source != null)
+                _source.Dispose();
+
+            _source = source;
         }
 
         private void WriteMemory()
         {
-            using (var phandle = new ProcessHandle(_pid, Program.MinProcessWriteMemoryRights))
-            {
-                for (long i = 0; i < hexBoxMemory.ByteProvider.Length; i++)
-                {
-                    _data[i] = hexBoxMemory.ByteProvider.ReadByte(i);
-                }
-
-                if (phandle.WriteMemory(_address, _data) == 0)
-                    throw new Exception("Unknown error.");
-            }
+            // Only the modified ranges are written back.
+            hexBoxMemory.ByteProvider.ApplyChanges();
         }
 
         private void buttonValues_Click(object sender, EventArgs e)
@@ -274,7 +360,6 @@ namespace ProcessHacker
         {
             try
             {
-                _data = null;
                 ReadMemory();
             }
             catch (Exception ex)
@@ -315,12 +400,46 @@ namespace ProcessHacker
 
             if (sfd.ShowDialog() == DialogResult.OK)
             {
-                for (long i = 0; i < hexBoxMemory.ByteProvider.Length; i++)
+                try
                 {
-                    _data[i] = hexBoxMemory.ByteProvider.ReadByte(i);
+                    this.SaveMemory(sfd.FileName);
                 }
+                catch (Exception ex)
+                {
+                    try
+                    {
+                        System.IO.File.Delete(sfd.FileName);
+                    }
+                    catch (Exception ex2)
+                    {
+                        Logging.Log(ex2);
+                    }
+
+                    PhUtils.ShowException("Unable to save the memory region", ex);
+                }
+            }
+        }
+
+        private void SaveMemory(string fileName)
+        {
+            PagedByteProvider provider = (PagedByteProvider)hexBoxMemory.ByteProvider;
+
+            using (var fs = new System.IO.FileStream(fileName, System.IO.FileMode.Create, System.IO.FileAccess.Write))
+            {
+                byte[] buffer = new byte[0x10000];
+                long length = provider.Length;
 
-                System.IO.File.WriteAllBytes(sfd.FileName, _data);
+                for (long i = 0; i < length; i += buffer.Length)
+                {
+                    int count = provider.ReadBytes(i, buffer, 0, buffer.Length);
+                    long unreadable = provider.Cache.FindUnreadable(i, count);
+
+                    // Don't save pages we couldn't read as zeros.
+                    if (unreadable != -1)
+                        throw new Exception("The memory at " + Utils.FormatAddress(_address.Increment(unreadable)) + " could not be read.");
+
+                    fs.Write(buffer, 0, count);
+                }
             }
         }
 
@@ -26,6 +26,7 @@ using System.Drawing;
 using System.IO;
 using System.Runtime.InteropServices;
 using System.Text;
+using System.Threading;
 using System.Windows.Forms;
 using ProcessHacker.Common;
 using ProcessHacker.Native;
@@ -38,6 +39,86 @@ namespace ProcessHacker
 {
     public static class Dump
     {
+        /// <summary>
+        /// The maximum number of threads used to collect process information.
+        /// </summary>
+        private const int MaxCollectorThreads = 8;
+
+        /// <summary>
+        /// Buffers a dump object and its children in memory so that it can 
+        /// be collected on any thread and written to the file system later.
+        /// </summary>
+        private sealed class DumpNode : IDisposable
+        {
+            private readonly string _name;
+            private List<MemoryStream> _data;
+            private List<DumpNode> _children;
+
+            public DumpNode(string name)
+            {
+                _name = name;
+            }
+
+            public void Dispose()
+            { }
+
+            public void AppendData(byte[] buffer)
+            {
+                this.GetWriteStream().Write(buffer, 0, buffer.Length);
+            }
+
+            public DumpNode CreateChild(string name)
+            {
+                DumpNode child = new DumpNode(name);
+
+                if (_children == null)
+                    _children = new List<DumpNode>();
+
+                _children.Add(child);
+
+                return child;
+            }
+
+            public Stream GetWriteStream()
+            {
+                MemoryStream stream = new MemoryStream();
+
+                if (_data == null)
+                    _data = new List<MemoryStream>();
+
+                _data.Add(stream);
+
+                return stream;
+            }
+
+            public void WriteTo(MemoryObject parent)
+            {
+                using (MemoryObject mo = parent.CreateChild(_name))
+                {
+                    if (_data != null)
+                    {
+                        // ToArray still works after the stream has been closed.
+                        foreach (MemoryStream stream in _data)
+                            mo.AppendData(stream.ToArray());
+                    }
+
+                    if (_children != null)
+                    {
+                        foreach (DumpNode child in _children)
+                            child.WriteTo(mo);
+                    }
+                }
+            }
+        }
+
+        private sealed class ProcessDumpJob
+        {
+            public SystemProcess Process;
+            public ProcessItem Item;
+            public Dictionary<int, SystemProcess> Processes;
+            public List<SystemHandleEntry> Handles;
+        }
+
         public static void Write(this BinaryWriter bw, string key, string value)
         {
             if (value == null)
@@ -88,6 +169,15 @@ namespace ProcessHacker
             }
         }
 
+        private static void AppendStruct<T>(DumpNode node, int size, T s) where T : struct
+        {
+            using (MemoryAlloc data = new MemoryAlloc(size))
+            {
+                data.WriteStruct(s);
+                node.AppendData(data.ReadBytes(data.Size));
+            }
+        }
+
         public static IDictionary<string, string> GetDictionary(MemoryObject mo)
         {
             Dictionary<string, string> dict = new Dictionary<string, string>();
@@ -208,50 +298,160 @@ namespace ProcessHacker
 
         public static void DumpProcesses(MemoryFileSystem mfs, ProcessSystemProvider provider)
         {
-            using (MemoryObject processes = mfs.RootObject.GetChild("Processes"))
+            // Take one snapshot of the system so that all processes are 
+            // dumped against the same process and handle lists.
+            var processes = Windows.GetProcesses();
+            var handles = GroupHandlesByProcess(Windows.GetHandles());
+            var jobs = new List<ProcessDumpJob>(processes.Count + 2);
+
+            foreach (var process in processes.Values)
+            {
+                ProcessItem item = null;
+                List<SystemHandleEntry> processHandles;
+
+                if (provider != null)
+                {
+                    if (provider.Dictionary.ContainsKey(process.Process.ProcessId))
+                        item = provider.Dictionary[process.Process.ProcessId];
+                }
+
+                if (!handles.TryGetValue(process.Process.ProcessId, out processHandles))
+                    processHandles = new List<SystemHandleEntry>();
+
+                jobs.Add(new ProcessDumpJob
+                {
+                    Process = process,
+                    Item = item,
+                    Processes = processes,
+                    Handles = processHandles
+                });
+            }
+
+            if (provider != null)
             {
-                var p = Windows.GetProcesses();
+                jobs.Add(new ProcessDumpJob
+                {
+                    Process = provider.DpcsProcess,
+                    Item = provider.Dictionary[provider.DpcsProcess.Process.ProcessId]
+                });
+                jobs.Add(new ProcessDumpJob
+                {
+                    Process = provider.InterruptsProcess,
+                    Item = provider.Dictionary[provider.InterruptsProcess.Process.ProcessId]
+                });
+            }
 
-                foreach (var process in p.Values)
+            // Collect the process information on a few threads. This thread 
+            // is the only one which writes to the file system, and it writes 
+            // the processes in order.
+            var results = new DumpNode[jobs.Count];
+            var completed = new bool[jobs.Count];
+            var resultsLock = new object();
+            int nextJob = -1;
+            int threadCount = Math.Min(jobs.Count, Math.Min(Environment.ProcessorCount, MaxCollectorThreads));
+
+            for (int i = 0; i < threadCount; i++)
+            {
+                Thread thread = new Thread(() =>
                 {
-                    using (var processChild = processes.CreateChild(process.Process.ProcessId.ToString("x")))
+                    int jobIndex;
+
+                    while ((jobIndex = Interlocked.Increment(ref nextJob)) < jobs.Count)
                     {
-                        ProcessItem item = null;
+                        DumpNode processNode = null;
 
-                        if (provider != null)
+                        try
                         {
-                            if (provider.Dictionary.ContainsKey(process.Process.ProcessId))
-                                item = provider.Dictionary[process.Process.ProcessId];
+                            processNode = CollectProcess(jobs[jobIndex]);
+                        }
+                        catch (Exception ex)
+                        {
+                            Logging.Log(ex);
+                        }
+                        finally
+                        {
+                            // Always complete the job, even if the thread is 
+                            // being aborted, so the writer never waits forever.
+                            lock (resultsLock)
+                            {
+                                results[jobIndex] = processNode;
+                                completed[jobIndex] = true;
+                                Monitor.PulseAll(resultsLock);
+                            }
                         }
-
-                        DumpProcess(processChild, process, item, p, Windows.GetHandles());
                     }
-                }
+                });
 
-                if (provider != null)
+                thread.IsBackground = true;
+                // Icons are extracted using the shell.
+                thread.SetApartmentState(ApartmentState.STA);
+                thread.Start();
+            }
+
+            using (MemoryObject processesMo = mfs.RootObject.GetChild("Processes"))
+            {
+                for (int i = 0; i < jobs.Count; i++)
                 {
-                    int dpcsPid = provider.DpcsProcess.Process.ProcessId;
-                    int interruptsPid = provider.InterruptsProcess.Process.ProcessId;
+                    DumpNode processNode;
 
-                    using (var dpcsChild = processes.CreateChild(dpcsPid.ToString("x")))
+                    lock (resultsLock)
                     {
-                        DumpProcess(dpcsChild, provider.DpcsProcess, provider.Dictionary[dpcsPid], null, null);
-                    }
+                        while (!completed[i])
+                            Monitor.Wait(resultsLock);
 
-                    using (var interruptsChild = processes.CreateChild(interruptsPid.ToString("x")))
-                    {
-                        DumpProcess(interruptsChild, provider.InterruptsProcess, provider.Dictionary[interruptsPid], null, null);
+                        processNode = results[i];
+                        results[i] = null;
                     }
+
+                    // A process which could not be collected at all is left out.
+                    if (processNode != null)
+                        processNode.WriteTo(processesMo);
                 }
             }
         }
 
-        public static void DumpProcess(
-            MemoryObject processMo,
+        private static Dictionary<int, List<SystemHandleEntry>> GroupHandlesByProcess(SystemHandleEntry[] handles)
+        {
+            var dict = new Dictionary<int, List<SystemHandleEntry>>();
+
+            foreach (var handle in handles)
+            {
+                List<SystemHandleEntry> list;
+
+                if (!dict.TryGetValue(handle.ProcessId, out list))
+                {
+                    list = new List<SystemHandleEntry>();
+                    dict.Add(handle.ProcessId, list);
+                }
+
+                list.Add(handle);
+            }
+
+            return dict;
+        }
+
+        private static DumpNode CollectProcess(ProcessDumpJob job)
+        {
+            DumpNode processNode = new DumpNode(job.Process.Process.ProcessId.ToString("x"));
+
+            try
+            {
+                DumpProcess(processNode, job.Process, job.Item, job.Processes, job.Handles);
+            }
+            catch (Exception ex)
+            {
+                Logging.Log(ex);
+            }
+
+            return processNode;
+        }
+
+        private static void DumpProcess(
+            DumpNode processMo,
             SystemProcess process,
             ProcessItem item,
             Dictionary<int, SystemProcess> processesDict,
-            object handles
+            List<SystemHandleEntry> handles
             )
         {
             int pid = process.Process.ProcessId;
@@ -465,7 +665,7 @@ namespace ProcessHacker
 
             try
             {
-                DumpProcessHandles(processMo, pid, handles);
+                DumpProcessHandles(processMo, handles);
             }
             catch
             { }
@@ -483,12 +683,14 @@ namespace ProcessHacker
             //}
         }
 
-        private static void DumpProcessModules(MemoryObject processMo, int pid)
+        private static void DumpProcessModules(DumpNode processMo, int pid)
         {
             if (pid <= 0)
                 return;
 
-            using (MemoryObject modules = processMo.CreateChild("Modules"))
+            DumpTableWriter modules = new DumpTableWriter(DumpModuleRecord.SizeOf);
+
+            try
             {
                 if (pid != 4)
                 {
@@ -583,36 +785,42 @@ namespace ProcessHacker
                         DumpProcessModule(modules, module);
                 }
             }
+            finally
+            {
+                // Keep whatever we managed to collect.
+                using (var modulesMo = processMo.CreateChild("ModuleTable"))
+                    modulesMo.AppendData(modules.ToArray());
+            }
         }
 
-        private static void DumpProcessModule(MemoryObject modulesMo, ILoadedModule module)
+        private unsafe static void DumpProcessModule(DumpTableWriter modules, ILoadedModule module)
         {
-            using (var child = modulesMo.CreateChild(module.BaseAddress.ToString("x")))
-            {
-                BinaryWriter bw = new BinaryWriter(child.GetWriteStream());
+            DumpModuleRecord record;
 
-                bw.Write("Name", module.BaseName);
-                bw.Write("FileName", module.FileName);
-                bw.Write("Size", module.Size);
-                bw.Write("BaseAddress", module.BaseAddress);
-                bw.Write("Flags", (int)module.Flags);
+            record.BaseAddress = (long)module.BaseAddress.ToUInt64();
+            record.Size = module.Size;
+            record.Flags = (int)module.Flags;
+            record.Name = modules.AddString(module.BaseName);
+            record.FileName = modules.AddString(module.FileName);
+            record.FileDescription = -1;
+            record.FileCompanyName = -1;
+            record.FileVersion = -1;
 
-                try
-                {
-                    var info = System.Diagnostics.FileVersionInfo.GetVersionInfo(module.FileName);
-
-                    bw.Write("FileDescription", info.FileDescription);
-                    bw.Write("FileCompanyName", info.CompanyName);
-                    bw.Write("FileVersion", info.FileVersion);
-                }
-                catch
-                { }
+            try
+            {
+                var info = System.Diagnostics.FileVersionInfo.GetVersionInfo(module.FileName);
 
-                bw.Close();
+                record.FileDescription = modules.AddString(info.FileDescription ?? "");
+                record.FileCompanyName = modules.AddString(info.CompanyName ?? "");
+                record.FileVersion = modules.AddString(info.FileVersion ?? "");
             }
+            catch
+            { }
+
+            modules.AddRecord(&record);
         }
 
-        private static void DumpProcessToken(MemoryObject processMo, int pid)
+        private static void DumpProcessToken(DumpNode processMo, int pid)
         {
             using (var tokenMo = processMo.CreateChild("Token"))
             {
@@ -699,7 +907,7 @@ namespace ProcessHacker
             }
         }
 
-        private static void DumpProcessEnvironment(MemoryObject processMo, int pid)
+        private static void DumpProcessEnvironment(DumpNode processMo, int pid)
         {
             using (var envMo = processMo.CreateChild("Environment"))
             {
@@ -717,43 +925,40 @@ namespace ProcessHacker
             }
         }
 
-        private static void DumpProcessHandles(MemoryObject processMo, int pid, object handlesIn)
+        private unsafe static void DumpProcessHandles(DumpNode processMo, List<SystemHandleEntry> handles)
         {
-            using (var handlesChild = processMo.CreateChild("Handles"))
-            {
-                SystemHandleEntry[] handles = (SystemHandleEntry[])handlesIn;
-
-                foreach (var handle in handles)
-                {
-                    if (handle.ProcessId != pid)
-                        continue;
+            DumpTableWriter table = new DumpTableWriter(DumpHandleRecord.SizeOf, handles.Count);
 
-                    using (var child = handlesChild.CreateChild(handle.Handle.ToString("x")))
-                    {
-                        BinaryWriter bw = new BinaryWriter(child.GetWriteStream());
+            // The handles have already been filtered by process.
+            foreach (var handle in handles)
+            {
+                DumpHandleRecord record;
 
-                        bw.Write("Handle", handle.Handle);
-                        bw.Write("Flags", (int)handle.Flags);
-                        bw.Write("Object", handle.Object);
-                        bw.Write("GrantedAccess", handle.GrantedAccess);
+                record.Handle = handle.Handle;
+                record.Flags = (int)handle.Flags;
+                record.Object = (long)handle.Object.ToUInt64();
+                record.GrantedAccess = handle.GrantedAccess;
+                record.TypeName = -1;
+                record.ObjectName = -1;
 
-                        try
-                        {
-                            var info = handle.GetHandleInfo();
-
-                            bw.Write("TypeName", info.TypeName);
-                            bw.Write("ObjectName", info.BestName);
-                        }
-                        catch
-                        { }
+                try
+                {
+                    var info = handle.GetHandleInfo();
 
-                        bw.Close();
-                    }
+                    record.TypeName = table.AddString(info.TypeName ?? "");
+                    record.ObjectName = table.AddString(info.BestName ?? "");
                 }
+                catch
+                { }
+
+                table.AddRecord(&record);
             }
+
+            using (var handlesMo = processMo.CreateChild("HandleTable"))
+                handlesMo.AppendData(table.ToArray());
         }
 
-        private static void DumpProcessHistory<T>(MemoryObject processMo, CircularBuffer<T> buffer, string name)
+        private static void DumpProcessHistory<T>(DumpNode processMo, CircularBuffer<T> buffer, string name)
         {
             using (var child = processMo.CreateChild(name + "History"))
             {
@@ -0,0 +1,139 @@
+﻿/*
+ * Process Hacker -
+ *   cache for decoded dump objects
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.Collections.Generic;
+
+namespace ProcessHacker
+{
+    /// <summary>
+    /// Keeps recently decoded dump objects so that they don't need to be
+    /// read from the file system again.
+    /// </summary>
+    /// <remarks>
+    /// Each entry has a cost, an estimate of the number of bytes it 
+    /// uses. When the total cost exceeds the maximum, the least recently 
+    /// used entries are discarded. This class is not thread-safe.
+    /// </remarks>
+    public sealed class DumpCache
+    {
+        /// <summary>
+        /// The estimated size of an object with no fields: the object 
+        /// header and method table pointer on 64-bit.
+        /// </summary>
+        public const int ObjectOverhead = 16;
+
+        private sealed class Entry
+        {
+            public string Key;
+            public object Value;
+            public int Cost;
+        }
+
+        private readonly int _maximumCost;
+        private int _cost;
+        // Most recently used first.
+        private readonly LinkedList<Entry> _lruList = new LinkedList<Entry>();
+        private readonly Dictionary<string, LinkedListNode<Entry>> _entries = new Dictionary<string, LinkedListNode<Entry>>();
+
+        public DumpCache(int maximumCost)
+        {
+            _maximumCost = maximumCost;
+        }
+
+        public int Cost
+        {
+            get { return _cost; }
+        }
+
+        public int Count
+        {
+            get { return _entries.Count; }
+        }
+
+        public int MaximumCost
+        {
+            get { return _maximumCost; }
+        }
+
+        public void Clear()
+        {
+            _lruList.Clear();
+            _entries.Clear();
+            _cost = 0;
+        }
+
+        /// <summary>
+        /// Gets a cached value, decoding it if necessary.
+        /// </summary>
+        /// <param name="key">A key which identifies the value.</param>
+        /// <param name="load">A function which decodes the value.</param>
+        /// <param name="getCost">A function which returns the cost of a value.</param>
+        public T Get<T>(string key, Func<T> load, Func<T, int> getCost)
+        {
+            LinkedListNode<Entry> node;
+
+            if (_entries.TryGetValue(key, out node))
+            {
+                _lruList.Remove(node);
+                _lruList.AddFirst(node);
+
+                return (T)node.Value.Value;
+            }
+
+            T value = load();
+            int cost = getCost(value);
+
+            // Don't bother caching values which would evict everything else.
+            if (cost > _maximumCost)
+                return value;
+
+            while (_cost + cost > _maximumCost && _lruList.Count != 0)
+                this.Remove(_lruList.Last);
+
+            node = _lruList.AddFirst(new Entry { Key = key, Value = value, Cost = cost });
+            _entries.Add(key, node);
+            _cost += cost;
+
+            return value;
+        }
+
+        /// <summary>
+        /// Estimates the number of bytes used by a string.
+        /// </summary>
+        public static int EstimateSize(string s)
+        {
+            if (s == null)
+                return 0;
+
+            // The object, the length, the characters and the terminator.
+            return ObjectOverhead + sizeof(int) + (s.Length + 1) * sizeof(char);
+        }
+
+        private void Remove(LinkedListNode<Entry> node)
+        {
+            _lruList.Remove(node);
+            _entries.Remove(node.Value.Key);
+            _cost -= node.Value.Cost;
+        }
+    }
+}
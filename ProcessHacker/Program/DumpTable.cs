@@ -0,0 +1,331 @@
+﻿/*
+ * Process Hacker -
+ *   fixed-layout dump record tables
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.Collections.Generic;
+using System.Runtime.InteropServices;
+using ProcessHacker.Native.Mfs;
+
+namespace ProcessHacker
+{
+    // A record table is stored as the data of a single dump object:
+    //
+    //   DumpTableHeader
+    //   RecordCount records of RecordSize bytes each
+    //   string table
+    //
+    // Strings are referenced by their byte offset in the string table,
+    // or -1 for no string. Each string is stored as an int length
+    // followed by that many UTF-16 characters, and identical strings
+    // are only stored once.
+    //
+    // Readers must use RecordSize as the stride, so that fields can be
+    // appended to a record type without breaking older readers.
+
+    [StructLayout(LayoutKind.Sequential, Pack = 4)]
+    public struct DumpTableHeader
+    {
+        public static readonly int SizeOf = Marshal.SizeOf(typeof(DumpTableHeader));
+
+        public const int MagicValue = 0x31425444; // DTB1
+
+        public int Magic;
+        public int RecordSize;
+        public int RecordCount;
+        public int StringsOffset;
+        public int StringsLength;
+    }
+
+    [StructLayout(LayoutKind.Sequential, Pack = 4)]
+    public struct DumpHandleRecord
+    {
+        public static readonly int SizeOf = Marshal.SizeOf(typeof(DumpHandleRecord));
+
+        public long Object;
+        public int Handle;
+        public int Flags;
+        public int GrantedAccess;
+        public int TypeName;
+        public int ObjectName;
+    }
+
+    [StructLayout(LayoutKind.Sequential, Pack = 4)]
+    public struct DumpModuleRecord
+    {
+        public static readonly int SizeOf = Marshal.SizeOf(typeof(DumpModuleRecord));
+
+        public long BaseAddress;
+        public int Size;
+        public int Flags;
+        public int Name;
+        public int FileName;
+        public int FileDescription;
+        public int FileCompanyName;
+        public int FileVersion;
+    }
+
+    /// <summary>
+    /// Builds a record table in memory.
+    /// </summary>
+    public unsafe sealed class DumpTableWriter
+    {
+        private readonly int _recordSize;
+        private byte[] _records;
+        private int _recordCount;
+        private byte[] _strings = new byte[0x100];
+        private int _stringsLength;
+        private readonly Dictionary<string, int> _stringOffsets = new Dictionary<string, int>();
+
+        public DumpTableWriter(int recordSize)
+            : this(recordSize, 16)
+        { }
+
+        public DumpTableWriter(int recordSize, int capacity)
+        {
+            _recordSize = recordSize;
+            _records = new byte[recordSize * Math.Max(capacity, 1)];
+        }
+
+        public int RecordCount
+        {
+            get { return _recordCount; }
+        }
+
+        /// <summary>
+        /// Copies a record into the table.
+        /// </summary>
+        /// <param name="record">A pointer to the record.</param>
+        public void AddRecord(void* record)
+        {
+            int offset = _recordCount * _recordSize;
+
+            if (offset + _recordSize > _records.Length)
+                Array.Resize(ref _records, _records.Length * 2);
+
+            Marshal.Copy(new IntPtr(record), _records, offset, _recordSize);
+            _recordCount++;
+        }
+
+        /// <summary>
+        /// Adds a string to the string table.
+        /// </summary>
+        /// <returns>The offset of the string, or -1 if the string is null.</returns>
+        public int AddString(string s)
+        {
+            int offset;
+
+            if (s == null)
+                return -1;
+
+            s = s.Replace("\0", "");
+
+            if (_stringOffsets.TryGetValue(s, out offset))
+                return offset;
+
+            int length = sizeof(int) + s.Length * sizeof(char);
+
+            while (_stringsLength + length > _strings.Length)
+                Array.Resize(ref _strings, _strings.Length * 2);
+
+            offset = _stringsLength;
+
+            fixed (byte* strings = _strings)
+            {
+                *(int*)(strings + offset) = s.Length;
+
+                fixed (char* chars = s)
+                {
+                    char* dest = (char*)(strings + offset + sizeof(int));
+
+                    for (int i = 0; i < s.Length; i++)
+                        dest[i] = chars[i];
+                }
+            }
+
+            _stringsLength += length;
+            _stringOffsets.Add(s, offset);
+
+            return offset;
+        }
+
+        /// <summary>
+        /// Creates the binary representation of the table.
+        /// </summary>
+        public byte[] ToArray()
+        {
+            int headerSize = DumpTableHeader.SizeOf;
+            int recordsLength = _recordCount * _recordSize;
+            byte[] data = new byte[headerSize + recordsLength + _stringsLength];
+
+            fixed (byte* dataPtr = data)
+            {
+                DumpTableHeader* header = (DumpTableHeader*)dataPtr;
+
+                header->Magic = DumpTableHeader.MagicValue;
+                header->RecordSize = _recordSize;
+                header->RecordCount = _recordCount;
+                header->StringsOffset = headerSize + recordsLength;
+                header->StringsLength = _stringsLength;
+            }
+
+            Array.Copy(_records, 0, data, headerSize, recordsLength);
+            Array.Copy(_strings, 0, data, headerSize + recordsLength, _stringsLength);
+
+            return data;
+        }
+    }
+
+    /// <summary>
+    /// Provides access to the records of a table read from a dump object.
+    /// </summary>
+    /// <remarks>
+    /// The table is read into a pinned buffer once and records are
+    /// accessed by casting the pointer returned by GetRecord; nothing
+    /// is parsed until a string is requested.
+    /// </remarks>
+    public unsafe sealed class DumpTableReader : IDisposable
+    {
+        /// <summary>
+        /// Reads a table from a dump object.
+        /// </summary>
+        /// <param name="mo">The dump object.</param>
+        /// <param name="minimumRecordSize">The size of the record type the caller expects.</param>
+        /// <returns>A table reader, or null if the object does not contain a valid table.</returns>
+        public static DumpTableReader Open(MemoryObject mo, int minimumRecordSize)
+        {
+            return Open(mo.ReadData(), minimumRecordSize);
+        }
+
+        /// <summary>
+        /// Reads a table from its binary representation.
+        /// </summary>
+        /// <param name="data">The data created by <see cref="DumpTableWriter.ToArray"/>.</param>
+        /// <param name="minimumRecordSize">The size of the record type the caller expects.</param>
+        /// <returns>A table reader, or null if the data is not a valid table.</returns>
+        public static DumpTableReader Open(byte[] data, int minimumRecordSize)
+        {
+            if (data.Length < DumpTableHeader.SizeOf)
+                return null;
+
+            fixed (byte* dataPtr = data)
+            {
+                DumpTableHeader* header = (DumpTableHeader*)dataPtr;
+
+                if (
+                    header->Magic != DumpTableHeader.MagicValue ||
+                    header->RecordSize < minimumRecordSize ||
+                    header->RecordCount < 0 ||
+                    header->StringsOffset < DumpTableHeader.SizeOf ||
+                    header->StringsLength < 0 ||
+                    (long)header->StringsOffset + header->StringsLength > data.Length ||
+                    // The records lie between the header and the strings.
+                    DumpTableHeader.SizeOf + (long)header->RecordSize * header->RecordCount > header->StringsOffset
+                    )
+                    return null;
+            }
+
+            return new DumpTableReader(data);
+        }
+
+        private readonly byte[] _data;
+        private GCHandle _dataHandle;
+        private byte* _records;
+        private readonly int _recordSize;
+        private readonly int _recordCount;
+        private byte* _strings;
+        private readonly int _stringsLength;
+        private readonly Dictionary<int, string> _stringCache = new Dictionary<int, string>();
+
+        private DumpTableReader(byte[] data)
+        {
+            DumpTableHeader* header;
+
+            _data = data;
+            _dataHandle = GCHandle.Alloc(_data, GCHandleType.Pinned);
+
+            header = (DumpTableHeader*)_dataHandle.AddrOfPinnedObject();
+            _records = (byte*)header + DumpTableHeader.SizeOf;
+            _recordSize = header->RecordSize;
+            _recordCount = header->RecordCount;
+            _strings = (byte*)header + header->StringsOffset;
+            _stringsLength = header->StringsLength;
+        }
+
+        public void Dispose()
+        {
+            if (_dataHandle.IsAllocated)
+            {
+                _dataHandle.Free();
+                _records = null;
+                _strings = null;
+            }
+        }
+
+        public int RecordCount
+        {
+            get { return _recordCount; }
+        }
+
+        /// <summary>
+        /// Gets a pointer to a record. The pointer is only valid until the
+        /// reader is disposed.
+        /// </summary>
+        public void* GetRecord(int index)
+        {
+            if (index < 0 || index >= _recordCount)
+                throw new ArgumentOutOfRangeException("index");
+            if (_records == null)
+                throw new ObjectDisposedException("DumpTableReader");
+
+            return _records + index * _recordSize;
+        }
+
+        /// <summary>
+        /// Gets a string from the string table.
+        /// </summary>
+        /// <param name="offset">The offset stored in a record.</param>
+        /// <returns>The string, or null if the offset is -1 or invalid.</returns>
+        public string GetString(int offset)
+        {
+            string s;
+
+            if (offset < 0 || offset > _stringsLength - sizeof(int))
+                return null;
+            if (_strings == null)
+                throw new ObjectDisposedException("DumpTableReader");
+
+            // Strings such as type names are shared by many records.
+            if (_stringCache.TryGetValue(offset, out s))
+                return s;
+
+            int length = *(int*)(_strings + offset);
+
+            if (length < 0 || length > (_stringsLength - offset - sizeof(int)) / sizeof(char))
+                return null;
+
+            s = new string((char*)(_strings + offset + sizeof(int)), 0, length);
+            _stringCache.Add(offset, s);
+
+            return s;
+        }
+    }
+}
@@ -314,6 +314,39 @@ namespace ProcessHacker
             ServiceProvider = new ServiceProvider();
             NetworkProvider = new NetworkProvider();
 
+            // The history file lives next to the settings file, so it is 
+            // only used when settings are being saved.
+            if (Settings.Instance.PersistHistory && !string.IsNullOrEmpty(Settings.Instance.SettingsFileName))
+            {
+                try
+                {
+                    ProcessProvider.HistoryMaxSize = Settings.Instance.MaxSamples;
+                    ProcessProvider.OpenHistory(System.IO.Path.Combine(
+                        System.IO.Path.GetDirectoryName(Settings.Instance.SettingsFileName),
+                        "history.phh"
+                        ));
+                }
+                catch (Exception ex)
+                {
+                    Logging.Log(ex);
+                }
+            }
+
+            if (!string.IsNullOrEmpty(Settings.Instance.SettingsFileName))
+            {
+                try
+                {
+                    ProcessProvider.OpenVerifyCache(System.IO.Path.Combine(
+                        System.IO.Path.GetDirectoryName(Settings.Instance.SettingsFileName),
+                        "verifycache.bin"
+                        ));
+                }
+                catch (Exception ex)
+                {
+                    Logging.Log(ex);
+                }
+            }
+
             Program.PrimaryProviderThread = new ProviderThread(Settings.Instance.RefreshInterval)                              
             {                             
                 ProcessProvider, 
@@ -964,6 +997,18 @@ namespace ProcessHacker
             info.AppendLine("Freed: " + heapFreedCount.ToString());
             info.AppendLine("Reallocated: " + heapReallocatedCount.ToString());
 
+            info.AppendLine();
+            info.AppendLine("MEMORY POOL");
+
+            MemoryPoolStatistics poolStatistics = MemoryPool.GetStatistics();
+
+            info.AppendLine("Allocations: " + poolStatistics.Allocations.ToString());
+            info.AppendLine("Thread cache hits: " + poolStatistics.ThreadCacheHits.ToString());
+            info.AppendLine("Depot hits: " + poolStatistics.DepotHits.ToString());
+            info.AppendLine("Heap allocations: " + poolStatistics.HeapAllocations.ToString());
+            info.AppendLine("Heap frees: " + poolStatistics.HeapFrees.ToString());
+            info.AppendLine("Depot size: " + Utils.FormatSize(poolStatistics.DepotBytes));
+
             info.AppendLine();
             info.AppendLine("MISCELLANEOUS COUNTERS");
             info.AppendLine("LSA lookup policy handle misses: " + LsaPolicyHandle.LookupPolicyHandleMisses.ToString());
@@ -632,6 +632,13 @@ namespace ProcessHacker
             set { this["PESectionsColumns"] = value; }
         }
 
+        [SettingDefault("True")]
+        public bool PersistHistory
+        {
+            get { return (bool)this["PersistHistory"]; }
+            set { this["PersistHistory"] = value; }
+        }
+
         [SettingDefault("439, 413")]
         public Size PEWindowSize
         {
@@ -670,6 +677,13 @@ namespace ProcessHacker
             set { this["PlotterCPUUserColor"] = _plotterCPUUserColor = value; }
         }
 
+        [SettingDefault("False")]
+        public bool PlotterFitHistory
+        {
+            get { return (bool)this["PlotterFitHistory"]; }
+            set { this["PlotterFitHistory"] = value; }
+        }
+
         private Color? _plotterIOROColor;
         [SettingDefault("Yellow")]
         public Color PlotterIOROColor
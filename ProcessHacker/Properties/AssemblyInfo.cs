@@ -26,3 +26,4 @@ using System.Runtime.InteropServices;
 // Additional assembly options
 
 [assembly: StringFreezing]
+[assembly: InternalsVisibleTo("ProcessHacker.Tests")]
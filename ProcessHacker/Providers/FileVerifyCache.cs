@@ -0,0 +1,326 @@
+﻿/*
+ * Process Hacker -
+ *   persistent cache of signature and packing results
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.Collections.Generic;
+using System.IO;
+using ProcessHacker.Common;
+using ProcessHacker.Native;
+using ProcessHacker.Native.Api;
+using ProcessHacker.Native.Objects;
+
+namespace ProcessHacker
+{
+    /// <summary>
+    /// Identifies a particular version of a file.
+    /// </summary>
+    public struct FileIdentity : IEquatable<FileIdentity>
+    {
+        /// <summary>
+        /// Gets the identity of a file.
+        /// </summary>
+        /// <param name="fileName">The name of the file.</param>
+        /// <returns>The identity of the file.</returns>
+        public static FileIdentity FromFile(string fileName)
+        {
+            FileIdentity identity = new FileIdentity();
+
+            identity.FileName = Path.GetFullPath(fileName).ToLowerInvariant();
+
+            using (FileHandle fhandle = FileHandle.CreateWin32(
+                fileName,
+                ProcessHacker.Native.Security.FileAccess.ReadAttributes,
+                FileShareMode.ReadWriteDelete,
+                FileCreationDispositionWin32.OpenExisting
+                ))
+            {
+                identity.Size = fhandle.FileSize;
+                identity.LastWriteTime = fhandle.BasicInformation.LastWriteTime;
+                identity.FileIndex = fhandle.FileIndex;
+            }
+
+            return identity;
+        }
+
+        public string FileName;
+        public long Size;
+        public long LastWriteTime;
+        public long FileIndex;
+
+        public bool Equals(FileIdentity other)
+        {
+            return
+                this.Size == other.Size &&
+                this.LastWriteTime == other.LastWriteTime &&
+                this.FileIndex == other.FileIndex &&
+                string.Equals(this.FileName, other.FileName, StringComparison.Ordinal);
+        }
+
+        public override bool Equals(object obj)
+        {
+            return obj is FileIdentity && this.Equals((FileIdentity)obj);
+        }
+
+        public override int GetHashCode()
+        {
+            return
+                (this.FileName != null ? this.FileName.GetHashCode() : 0) ^
+                this.Size.GetHashCode() ^
+                this.LastWriteTime.GetHashCode() ^
+                this.FileIndex.GetHashCode();
+        }
+    }
+
+    /// <summary>
+    /// The cached analysis results for a file.
+    /// </summary>
+    public struct FileVerifyEntry
+    {
+        public VerifyResult VerifyResult;
+        public string VerifySignerName;
+        public int ImportModules;
+        public int ImportFunctions;
+        public bool IsPacked;
+    }
+
+    /// <summary>
+    /// Stores signature verification and packing results on disk so that
+    /// they do not need to be recomputed every time Process Hacker starts.
+    /// </summary>
+    /// <remarks>
+    /// Entries are keyed by the file's path, size, last write time and
+    /// file system index, so a file which is replaced or modified is
+    /// analyzed again. This class is thread-safe.
+    /// </remarks>
+    public sealed class FileVerifyCache
+    {
+        private const int Magic = 0x00435650; // PVC
+        private const int Version = 1;
+        private const int MaxEntries = 4096;
+
+        private class CacheEntry
+        {
+            public FileVerifyEntry Entry;
+            public bool Used;
+        }
+
+        private readonly string _fileName;
+        private readonly Dictionary<FileIdentity, CacheEntry> _entries = new Dictionary<FileIdentity, CacheEntry>();
+        private bool _dirty;
+
+        /// <summary>
+        /// Creates a cache and loads any entries stored in the specified file.
+        /// </summary>
+        /// <param name="fileName">
+        /// The name of the cache file, or null to create a cache which is 
+        /// only kept in memory.
+        /// </param>
+        public FileVerifyCache(string fileName)
+        {
+            _fileName = fileName;
+
+            if (fileName != null && File.Exists(fileName))
+            {
+                try
+                {
+                    if (!this.Load())
+                        this.Discard();
+                }
+                catch (Exception ex)
+                {
+                    Logging.Log(ex);
+                    this.Discard();
+                }
+            }
+        }
+
+        public string FileName
+        {
+            get { return _fileName; }
+        }
+
+        /// <summary>
+        /// Adds or replaces the results for a file.
+        /// </summary>
+        public void Add(FileIdentity identity, FileVerifyEntry entry)
+        {
+            lock (_entries)
+            {
+                _entries[identity] = new CacheEntry { Entry = entry, Used = true };
+                _dirty = true;
+            }
+        }
+
+        /// <summary>
+        /// Looks up the results for a file.
+        /// </summary>
+        public bool TryGetEntry(FileIdentity identity, out FileVerifyEntry entry)
+        {
+            lock (_entries)
+            {
+                CacheEntry cacheEntry;
+
+                if (_entries.TryGetValue(identity, out cacheEntry))
+                {
+                    cacheEntry.Used = true;
+                    entry = cacheEntry.Entry;
+                    return true;
+                }
+            }
+
+            entry = new FileVerifyEntry();
+            return false;
+        }
+
+        /// <summary>
+        /// Removes the cache file after it could not be loaded, so that it is 
+        /// not read again on every start if nothing new is added to the cache.
+        /// </summary>
+        private void Discard()
+        {
+            _entries.Clear();
+
+            try
+            {
+                File.Delete(_fileName);
+            }
+            catch (Exception ex)
+            {
+                Logging.Log(ex);
+            }
+        }
+
+        private bool Load()
+        {
+            using (var br = new BinaryReader(new FileStream(_fileName, FileMode.Open, FileAccess.Read, FileShare.Read)))
+            {
+                int magic = br.ReadInt32();
+                int version = br.ReadInt32();
+
+                if (magic != Magic || version != Version)
+                {
+                    Logging.Log(Logging.Importance.Warning,
+                        "Discarding file verification cache " + _fileName + ": unsupported format " +
+                        magic.ToString("x8") + " version " + version.ToString() + ".");
+                    return false;
+                }
+
+                int count = br.ReadInt32();
+
+                for (int i = 0; i < count; i++)
+                {
+                    FileIdentity identity = new FileIdentity();
+                    FileVerifyEntry entry = new FileVerifyEntry();
+
+                    identity.FileName = br.ReadString();
+                    identity.Size = br.ReadInt64();
+                    identity.LastWriteTime = br.ReadInt64();
+                    identity.FileIndex = br.ReadInt64();
+
+                    entry.VerifyResult = (VerifyResult)br.ReadInt32();
+                    entry.VerifySignerName = br.ReadBoolean() ? br.ReadString() : null;
+                    entry.ImportModules = br.ReadInt32();
+                    entry.ImportFunctions = br.ReadInt32();
+                    entry.IsPacked = br.ReadBoolean();
+
+                    _entries[identity] = new CacheEntry { Entry = entry };
+                }
+            }
+
+            return true;
+        }
+
+        /// <summary>
+        /// Writes the cache to disk if it has changed.
+        /// </summary>
+        /// <remarks>
+        /// If there are too many entries, entries which were not used
+        /// during this session are discarded first.
+        /// </remarks>
+        public void Save()
+        {
+            List<KeyValuePair<FileIdentity, CacheEntry>> entries = new List<KeyValuePair<FileIdentity, CacheEntry>>();
+
+            if (_fileName == null)
+                return;
+
+            lock (_entries)
+            {
+                if (!_dirty)
+                    return;
+
+                foreach (var pair in _entries)
+                {
+                    if (pair.Value.Used)
+                        entries.Add(pair);
+                }
+
+                foreach (var pair in _entries)
+                {
+                    if (entries.Count >= MaxEntries)
+                        break;
+                    if (!pair.Value.Used)
+                        entries.Add(pair);
+                }
+
+                _dirty = false;
+            }
+
+            if (entries.Count > MaxEntries)
+                entries.RemoveRange(MaxEntries, entries.Count - MaxEntries);
+
+            // Write to a temporary file first so that a crash never leaves
+            // a truncated cache behind.
+            string tempFileName = _fileName + ".tmp";
+
+            using (var bw = new BinaryWriter(new FileStream(tempFileName, FileMode.Create, FileAccess.Write, FileShare.None)))
+            {
+                bw.Write(Magic);
+                bw.Write(Version);
+                bw.Write(entries.Count);
+
+                foreach (var pair in entries)
+                {
+                    FileVerifyEntry entry = pair.Value.Entry;
+
+                    bw.Write(pair.Key.FileName);
+                    bw.Write(pair.Key.Size);
+                    bw.Write(pair.Key.LastWriteTime);
+                    bw.Write(pair.Key.FileIndex);
+
+                    bw.Write((int)entry.VerifyResult);
+                    bw.Write(entry.VerifySignerName != null);
+                    if (entry.VerifySignerName != null)
+                        bw.Write(entry.VerifySignerName);
+                    bw.Write(entry.ImportModules);
+                    bw.Write(entry.ImportFunctions);
+                    bw.Write(entry.IsPacked);
+                }
+            }
+
+            if (File.Exists(_fileName))
+                File.Replace(tempFileName, _fileName, null);
+            else
+                File.Move(tempFileName, _fileName);
+        }
+    }
+}
@@ -0,0 +1,398 @@
+﻿/*
+ * Process Hacker -
+ *   reverse DNS resolver
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.Collections.Generic;
+using System.Net;
+using System.Net.Sockets;
+using System.Threading;
+using ProcessHacker.Common;
+
+namespace ProcessHacker
+{
+    /// <summary>
+    /// Resolves IP addresses to host names on its own threads.
+    /// </summary>
+    /// <remarks>
+    /// <para>
+    /// Requests are coalesced by address, so many connections to the same 
+    /// peer cause only one lookup. At most <see cref="MaxConcurrency"/> 
+    /// lookups run at the same time, on dedicated threads, so slow DNS 
+    /// servers do not hold up the global work queue.
+    /// </para>
+    /// <para>
+    /// Results are cached in a bounded LRU cache. Failed lookups are also 
+    /// cached, with a shorter lifetime, so that unresolvable peers are not 
+    /// queried again every time they reappear. A request whose callers 
+    /// have all cancelled before the lookup starts is dropped.
+    /// </para>
+    /// </remarks>
+    public sealed class HostNameResolver : IDisposable
+    {
+        /// <summary>
+        /// Called when an address has been resolved, on a resolver thread 
+        /// (or on the calling thread if the result was already cached).
+        /// </summary>
+        /// <param name="address">The address.</param>
+        /// <param name="hostName">The host name, or null if the address could not be resolved.</param>
+        /// <param name="context">The context passed to <see cref="Resolve"/>.</param>
+        public delegate void HostNameResolvedCallback(IPAddress address, string hostName, object context);
+
+        private struct Subscriber
+        {
+            public object Context;
+            public HostNameResolvedCallback Callback;
+        }
+
+        private class Request
+        {
+            public IPAddress Address;
+            public List<Subscriber> Subscribers = new List<Subscriber>(1);
+        }
+
+        private class CacheEntry
+        {
+            public IPAddress Address;
+            public string HostName;
+            public DateTime Expires;
+        }
+
+        private readonly object _lock = new object();
+        private readonly Func<IPAddress, string> _lookup;
+        private readonly Dictionary<IPAddress, Request> _requests = new Dictionary<IPAddress, Request>();
+        private readonly Queue<Request> _queue = new Queue<Request>();
+        private readonly Dictionary<IPAddress, LinkedListNode<CacheEntry>> _cache = new Dictionary<IPAddress, LinkedListNode<CacheEntry>>();
+        // Most recently used first.
+        private readonly LinkedList<CacheEntry> _lruList = new LinkedList<CacheEntry>();
+        private int _workerCount;
+        private bool _disposed;
+
+        private int _maxConcurrency = 4;
+        private int _capacity = 4096;
+        private TimeSpan _positiveTtl = TimeSpan.FromHours(1);
+        private TimeSpan _negativeTtl = TimeSpan.FromMinutes(5);
+
+        public HostNameResolver()
+            : this(LookupHostName)
+        { }
+
+        /// <summary>
+        /// Creates a resolver which uses the specified function to look up 
+        /// host names.
+        /// </summary>
+        /// <param name="lookup">
+        /// A function which returns the host name for an address, or null 
+        /// if it could not be resolved. The function may block.
+        /// </param>
+        public HostNameResolver(Func<IPAddress, string> lookup)
+        {
+            if (lookup == null)
+                throw new ArgumentNullException("lookup");
+
+            _lookup = lookup;
+        }
+
+        public void Dispose()
+        {
+            lock (_lock)
+            {
+                _disposed = true;
+                _queue.Clear();
+                _requests.Clear();
+            }
+        }
+
+        /// <summary>
+        /// Gets or sets the maximum number of lookups performed at the same time.
+        /// </summary>
+        public int MaxConcurrency
+        {
+            get { return _maxConcurrency; }
+            set { _maxConcurrency = Math.Max(1, value); }
+        }
+
+        /// <summary>
+        /// Gets or sets the maximum number of cached results.
+        /// </summary>
+        public int Capacity
+        {
+            get { return _capacity; }
+            set
+            {
+                lock (_lock)
+                {
+                    _capacity = Math.Max(1, value);
+                    this.TrimCache();
+                }
+            }
+        }
+
+        /// <summary>
+        /// Gets or sets how long host names are cached for.
+        /// </summary>
+        public TimeSpan PositiveTtl
+        {
+            get { return _positiveTtl; }
+            set { _positiveTtl = value; }
+        }
+
+        /// <summary>
+        /// Gets or sets how long failed lookups are cached for.
+        /// </summary>
+        public TimeSpan NegativeTtl
+        {
+            get { return _negativeTtl; }
+            set { _negativeTtl = value; }
+        }
+
+        /// <summary>
+        /// Gets the number of addresses waiting to be resolved or being resolved.
+        /// </summary>
+        public int PendingCount
+        {
+            get { lock (_lock) return _requests.Count; }
+        }
+
+        private static string LookupHostName(IPAddress address)
+        {
+            try
+            {
+                return Dns.GetHostEntry(address).HostName;
+            }
+            catch (SocketException)
+            {
+                // Host was not found.
+                return null;
+            }
+        }
+
+        /// <summary>
+        /// Gets a host name from the cache.
+        /// </summary>
+        /// <param name="address">The address.</param>
+        /// <param name="hostName">
+        /// Receives the host name, or null if the address could not be resolved.
+        /// </param>
+        /// <returns>Whether the address was in the cache.</returns>
+        public bool TryGetCached(IPAddress address, out string hostName)
+        {
+            lock (_lock)
+                return this.TryGetCachedLocked(address, out hostName);
+        }
+
+        private bool TryGetCachedLocked(IPAddress address, out string hostName)
+        {
+            LinkedListNode<CacheEntry> node;
+
+            hostName = null;
+
+            if (!_cache.TryGetValue(address, out node))
+                return false;
+
+            if (node.Value.Expires <= DateTime.UtcNow)
+            {
+                _lruList.Remove(node);
+                _cache.Remove(address);
+
+                return false;
+            }
+
+            _lruList.Remove(node);
+            _lruList.AddFirst(node);
+            hostName = node.Value.HostName;
+
+            return true;
+        }
+
+        /// <summary>
+        /// Resolves an address.
+        /// </summary>
+        /// <param name="address">The address to resolve.</param>
+        /// <param name="context">
+        /// An object passed to the callback which can also be used to cancel 
+        /// the request.
+        /// </param>
+        /// <param name="callback">The function to call when the address has been resolved.</param>
+        public void Resolve(IPAddress address, object context, HostNameResolvedCallback callback)
+        {
+            Request request;
+            string hostName;
+            bool startWorker = false;
+
+            lock (_lock)
+            {
+                if (_disposed)
+                    return;
+
+                if (!this.TryGetCachedLocked(address, out hostName))
+                {
+                    if (!_requests.TryGetValue(address, out request))
+                    {
+                        request = new Request { Address = address };
+                        _requests.Add(address, request);
+                        _queue.Enqueue(request);
+
+                        if (_workerCount < _maxConcurrency)
+                        {
+                            _workerCount++;
+                            startWorker = true;
+                        }
+                    }
+
+                    request.Subscribers.Add(new Subscriber { Context = context, Callback = callback });
+                    hostName = null;
+                    callback = null;
+                }
+            }
+
+            // The result was already cached.
+            if (callback != null)
+                callback(address, hostName, context);
+
+            if (startWorker)
+            {
+                Thread thread = new Thread(this.WorkerThreadStart, Utils.SixteenthStackSize);
+
+                thread.IsBackground = true;
+                thread.Name = "HostNameResolver";
+                thread.Start();
+            }
+        }
+
+        /// <summary>
+        /// Cancels requests made with the specified context. The lookup is 
+        /// abandoned if nobody else is waiting for the result, unless it has 
+        /// already started.
+        /// </summary>
+        /// <param name="address">The address which was being resolved.</param>
+        /// <param name="context">The context passed to <see cref="Resolve"/>.</param>
+        public void Cancel(IPAddress address, object context)
+        {
+            Request request;
+
+            lock (_lock)
+            {
+                if (!_requests.TryGetValue(address, out request))
+                    return;
+
+                request.Subscribers.RemoveAll(subscriber => object.Equals(subscriber.Context, context));
+            }
+        }
+
+        private void AddToCacheLocked(IPAddress address, string hostName)
+        {
+            LinkedListNode<CacheEntry> node;
+            DateTime expires = DateTime.UtcNow + (hostName != null ? _positiveTtl : _negativeTtl);
+
+            if (_cache.TryGetValue(address, out node))
+            {
+                node.Value.HostName = hostName;
+                node.Value.Expires = expires;
+                _lruList.Remove(node);
+                _lruList.AddFirst(node);
+
+                return;
+            }
+
+            node = _lruList.AddFirst(new CacheEntry { Address = address, HostName = hostName, Expires = expires });
+            _cache.Add(address, node);
+            this.TrimCache();
+        }
+
+        private void TrimCache()
+        {
+            while (_cache.Count > _capacity)
+            {
+                _cache.Remove(_lruList.Last.Value.Address);
+                _lruList.RemoveLast();
+            }
+        }
+
+        private void WorkerThreadStart()
+        {
+            while (true)
+            {
+                Request request = null;
+
+                lock (_lock)
+                {
+                    while (_queue.Count != 0)
+                    {
+                        request = _queue.Dequeue();
+
+                        // Drop requests which have been cancelled.
+                        if (request.Subscribers.Count != 0)
+                            break;
+
+                        _requests.Remove(request.Address);
+                        request = null;
+                    }
+
+                    if (request == null)
+                    {
+                        _workerCount--;
+                        return;
+                    }
+                }
+
+                string hostName = null;
+
+                try
+                {
+                    hostName = _lookup(request.Address);
+                }
+                catch (Exception ex)
+                {
+                    Logging.Log(ex);
+                }
+
+                if (string.IsNullOrEmpty(hostName))
+                    hostName = null;
+
+                lock (_lock)
+                {
+                    if (_disposed)
+                    {
+                        _workerCount--;
+                        return;
+                    }
+
+                    this.AddToCacheLocked(request.Address, hostName);
+                    // Nobody can subscribe to or cancel the request after this.
+                    _requests.Remove(request.Address);
+                }
+
+                foreach (Subscriber subscriber in request.Subscribers)
+                {
+                    try
+                    {
+                        subscriber.Callback(request.Address, hostName, subscriber.Context);
+                    }
+                    catch (Exception ex)
+                    {
+                        Logging.Log(ex);
+                    }
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,470 @@
+﻿/*
+ * Process Hacker -
+ *   image analysis queue
+ *
+ * Copyright (C) 2011 wj32
+ *
+ * This file is part of Process Hacker.
+ *
+ * Process Hacker is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * Process Hacker is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with Process Hacker.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+using System;
+using System.Collections.Generic;
+using ProcessHacker.Common;
+using ProcessHacker.Native;
+using ProcessHacker.Native.Image;
+
+namespace ProcessHacker
+{
+    /// <summary>
+    /// Determines whether images are packed and verifies their signatures.
+    /// </summary>
+    /// <remarks>
+    /// <para>
+    /// Requests are coalesced by image, so processes which share an image
+    /// (e.g. svchost.exe) only cause the image to be analyzed once. Each
+    /// image goes through two phases: the import table is parsed to
+    /// determine whether the image is packed, then the signature is
+    /// verified. The phases are reported separately because verification
+    /// can take a very long time.
+    /// </para>
+    /// <para>
+    /// Images requested by processes which are currently visible are
+    /// processed first. The number of images being verified at the same
+    /// time is limited so that verification does not starve the other work
+    /// queue items.
+    /// </para>
+    /// </remarks>
+    public sealed class ImageAnalysisQueue
+    {
+        public delegate void ImageAnalyzedDelegate(int pid, bool isPacked, int importModules, int importFunctions);
+        public delegate void ImageVerifiedDelegate(int pid, VerifyResult verifyResult, string verifySignerName);
+
+        private class ImageJob
+        {
+            public string Key;
+            public string FileName;
+            public bool Forced;
+            public bool Priority;
+            public List<int> Pids = new List<int>();
+
+            public FileIdentity Identity;
+            public bool HaveIdentity;
+
+            public bool Analyzed;
+            public bool AnalysisSucceeded;
+            public bool Malformed;
+            public bool IsPacked;
+            public int ImportModules;
+            public int ImportFunctions;
+
+            public bool Verified;
+            public VerifyResult VerifyResult;
+            public string VerifySignerName;
+        }
+
+        private readonly object _lock = new object();
+        private readonly Dictionary<string, ImageJob> _jobs = new Dictionary<string, ImageJob>();
+        private readonly List<ImageJob> _pendingAnalysis = new List<ImageJob>();
+        private readonly List<ImageJob> _pendingVerification = new List<ImageJob>();
+        private Dictionary<int, object> _visiblePids = new Dictionary<int, object>();
+        private int _analyzingCount;
+        private int _verifyingCount;
+        private int _maxAnalyzing = Environment.ProcessorCount;
+        private int _maxVerifying = 2;
+        private FileVerifyCache _cache;
+
+        public ImageAnalysisQueue(FileVerifyCache cache)
+        {
+            _cache = cache;
+        }
+
+        /// <summary>
+        /// Raised on a worker thread when the import table of an image has
+        /// been analyzed. It is raised once for each process using the image.
+        /// </summary>
+        public event ImageAnalyzedDelegate ImageAnalyzed;
+
+        /// <summary>
+        /// Raised on a worker thread when the signature of an image has been
+        /// verified. It is raised once for each process using the image.
+        /// </summary>
+        public event ImageVerifiedDelegate ImageVerified;
+
+        /// <summary>
+        /// Gets or sets the cache used to store results between sessions.
+        /// </summary>
+        public FileVerifyCache Cache
+        {
+            get { return _cache; }
+            set { _cache = value; }
+        }
+
+        /// <summary>
+        /// Gets or sets the maximum number of images parsed at the same time.
+        /// </summary>
+        public int MaxAnalyzing
+        {
+            get { return _maxAnalyzing; }
+            set { _maxAnalyzing = Math.Max(1, value); }
+        }
+
+        /// <summary>
+        /// Gets or sets the maximum number of images verified at the same time.
+        /// </summary>
+        public int MaxVerifying
+        {
+            get { return _maxVerifying; }
+            set { _maxVerifying = Math.Max(1, value); }
+        }
+
+        /// <summary>
+        /// Gets the number of images which have not been completely processed.
+        /// </summary>
+        public int PendingCount
+        {
+            get { lock (_lock) return _jobs.Count; }
+        }
+
+        /// <summary>
+        /// Requests that an image be analyzed on behalf of a process.
+        /// </summary>
+        /// <param name="pid">The ID of the process.</param>
+        /// <param name="fileName">The file name of the image.</param>
+        /// <param name="forced">
+        /// Whether to ignore cached results. Requests for an image which is
+        /// already being processed are always coalesced.
+        /// </param>
+        public void Request(int pid, string fileName, bool forced)
+        {
+            string key;
+            bool analyzed = false;
+            ImageJob job;
+
+            try
+            {
+                key = System.IO.Path.GetFullPath(fileName).ToLowerInvariant();
+            }
+            catch
+            {
+                return;
+            }
+
+            lock (_lock)
+            {
+                if (_jobs.TryGetValue(key, out job))
+                {
+                    if (!job.Pids.Contains(pid))
+                        job.Pids.Add(pid);
+                    if (_visiblePids.ContainsKey(pid))
+                        job.Priority = true;
+
+                    // The import table has already been parsed, so report
+                    // the result for this process straight away.
+                    analyzed = job.Analyzed && job.AnalysisSucceeded;
+                }
+                else
+                {
+                    job = new ImageJob
+                    {
+                        Key = key,
+                        FileName = fileName,
+                        Forced = forced,
+                        Priority = _visiblePids.ContainsKey(pid)
+                    };
+                    job.Pids.Add(pid);
+
+                    _jobs.Add(key, job);
+                    _pendingAnalysis.Add(job);
+                }
+            }
+
+            if (analyzed)
+                this.OnImageAnalyzed(job, pid);
+
+            this.Pump();
+        }
+
+        /// <summary>
+        /// Sets the processes which are currently visible. Images used by
+        /// these processes are processed before any others.
+        /// </summary>
+        /// <param name="pids">The IDs of the visible processes.</param>
+        public void SetVisibleProcesses(IEnumerable<int> pids)
+        {
+            Dictionary<int, object> visiblePids = new Dictionary<int, object>();
+
+            foreach (int pid in pids)
+                visiblePids[pid] = null;
+
+            lock (_lock)
+            {
+                _visiblePids = visiblePids;
+
+                foreach (ImageJob job in _jobs.Values)
+                {
+                    job.Priority = false;
+
+                    foreach (int pid in job.Pids)
+                    {
+                        if (visiblePids.ContainsKey(pid))
+                        {
+                            job.Priority = true;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+
+        private static ImageJob Dequeue(List<ImageJob> list)
+        {
+            int index = 0;
+
+            for (int i = 0; i < list.Count; i++)
+            {
+                if (list[i].Priority)
+                {
+                    index = i;
+                    break;
+                }
+            }
+
+            ImageJob job = list[index];
+
+            list.RemoveAt(index);
+
+            return job;
+        }
+
+        private void Pump()
+        {
+            lock (_lock)
+            {
+                while (_analyzingCount < _maxAnalyzing && _pendingAnalysis.Count > 0)
+                {
+                    _analyzingCount++;
+                    WorkQueue.GlobalQueueWorkItemTag(
+                        new Action<ImageJob>(this.Analyze),
+                        "image-analysis",
+                        Dequeue(_pendingAnalysis)
+                        );
+                }
+
+                while (_verifyingCount < _maxVerifying && _pendingVerification.Count > 0)
+                {
+                    _verifyingCount++;
+                    WorkQueue.GlobalQueueWorkItemTag(
+                        new Action<ImageJob>(this.Verify),
+                        "image-verification",
+                        Dequeue(_pendingVerification)
+                        );
+                }
+            }
+        }
+
+        private void Analyze(ImageJob job)
+        {
+            bool cached = false;
+
+            try
+            {
+                cached = this.AnalyzeImage(job);
+            }
+            catch (Exception ex)
+            {
+                Logging.Log(ex);
+            }
+
+            lock (_lock)
+            {
+                _analyzingCount--;
+                job.Analyzed = true;
+
+                // Images that could not be read are still verified; only 
+                // their packing result is missing.
+                if (cached)
+                    _jobs.Remove(job.Key);
+                else
+                    _pendingVerification.Add(job);
+            }
+
+            if (job.AnalysisSucceeded)
+            {
+                foreach (int pid in this.GetPids(job))
+                    this.OnImageAnalyzed(job, pid);
+            }
+
+            if (cached)
+            {
+                foreach (int pid in this.GetPids(job))
+                    this.OnImageVerified(job, pid);
+            }
+
+            this.Pump();
+        }
+
+        private bool AnalyzeImage(ImageJob job)
+        {
+            FileVerifyCache cache = _cache;
+
+            try
+            {
+                job.Identity = FileIdentity.FromFile(job.FileName);
+                job.HaveIdentity = true;
+            }
+            catch
+            { }
+
+            // The image hasn't changed since we last looked at it, so
+            // there is no need to map it or verify it again.
+            if (job.HaveIdentity && !job.Forced && cache != null)
+            {
+                FileVerifyEntry entry;
+
+                if (cache.TryGetEntry(job.Identity, out entry))
+                {
+                    job.AnalysisSucceeded = true;
+                    job.IsPacked = entry.IsPacked;
+                    job.ImportModules = entry.ImportModules;
+                    job.ImportFunctions = entry.ImportFunctions;
+                    job.Verified = true;
+                    job.VerifyResult = entry.VerifyResult;
+                    job.VerifySignerName = entry.VerifySignerName;
+
+                    return true;
+                }
+            }
+
+            // Find out if it's packed.
+            // An image is packed if:
+            // 1. It references less than 3 libraries
+            // 2. It imports less than 5 functions
+            // or:
+            // 1. The function-to-library ratio is lower than 4
+            //   (on average less than 4 functions are imported from each library)
+            // 2. It references more than 3 libraries but less than 30 libraries.
+            // The image is read rather than mapped, so its size doesn't 
+            // matter and malformed import tables can't cause access violations.
+            try
+            {
+                using (ImageReader reader = new ImageReader(job.FileName))
+                {
+                    int libraryTotal = reader.Imports.Count;
+                    int funcTotal = 0;
+
+                    for (int i = 0; i < reader.Imports.Count; i++)
+                        funcTotal += reader.Imports[i].Count;
+
+                    job.ImportModules = libraryTotal;
+                    job.ImportFunctions = funcTotal;
+
+                    if (
+                        libraryTotal < 3 && funcTotal < 5 ||
+                        ((float)funcTotal / libraryTotal < 4) && libraryTotal > 3 && libraryTotal < 30
+                        )
+                        job.IsPacked = true;
+                }
+
+                job.AnalysisSucceeded = true;
+            }
+            catch (System.IO.IOException ex)
+            {
+                Logging.Log(ex);
+            }
+            catch (UnauthorizedAccessException ex)
+            {
+                Logging.Log(ex);
+            }
+            catch (Exception ex)
+            {
+                // The image could be read but its headers are invalid, which 
+                // counts as packed except for the System and Idle processes.
+                Logging.Log(ex);
+                job.Malformed = true;
+                job.IsPacked = true;
+                job.AnalysisSucceeded = true;
+            }
+
+            return false;
+        }
+
+        private void Verify(ImageJob job)
+        {
+            try
+            {
+                job.VerifyResult = Cryptography.VerifyFile(job.FileName, out job.VerifySignerName);
+                job.Verified = true;
+            }
+            catch
+            {
+                job.VerifyResult = VerifyResult.NoSignature;
+            }
+
+            FileVerifyCache cache = _cache;
+
+            // Only remember complete results. Failures may be transient, and 
+            // whether a malformed image counts as packed depends on the process.
+            if (job.Verified && job.AnalysisSucceeded && !job.Malformed &&
+                job.HaveIdentity && cache != null)
+            {
+                cache.Add(job.Identity, new FileVerifyEntry
+                {
+                    VerifyResult = job.VerifyResult,
+                    VerifySignerName = job.VerifySignerName,
+                    ImportModules = job.ImportModules,
+                    ImportFunctions = job.ImportFunctions,
+                    IsPacked = job.IsPacked
+                });
+            }
+
+            lock (_lock)
+            {
+                _verifyingCount--;
+                _jobs.Remove(job.Key);
+            }
+
+            foreach (int pid in this.GetPids(job))
+                this.OnImageVerified(job, pid);
+
+            this.Pump();
+        }
+
+        private int[] GetPids(ImageJob job)
+        {
+            lock (_lock)
+                return job.Pids.ToArray();
+        }
+
+        private void OnImageAnalyzed(ImageJob job, int pid)
+        {
+            if (this.ImageAnalyzed != null)
+            {
+                this.ImageAnalyzed(
+                    pid,
+                    job.IsPacked && (!job.Malformed || pid > 4),
+                    job.ImportModules,
+                    job.ImportFunctions
+                    );
+            }
+        }
+
+        private void OnImageVerified(ImageJob job, int pid)
+        {
+            if (this.ImageVerified != null)
+                this.ImageVerified(pid, job.VerifyResult, job.VerifySignerName);
+        }
+    }
+}
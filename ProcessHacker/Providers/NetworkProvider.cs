@@ -26,10 +26,8 @@
 using System;
 using System.Collections.Generic;
 using System.Net;
-using System.Net.Sockets;
 using ProcessHacker.Common;
 using ProcessHacker.Common.Messaging;
-using ProcessHacker.Common.Threading;
 using ProcessHacker.Native;
 
 namespace ProcessHacker
@@ -43,6 +41,7 @@ namespace ProcessHacker
 
         public int Tag;
         public string Id;
+        public NetworkConnectionKey Key;
         public NetworkConnection Connection;
         public string LocalString;
         public string RemoteString;
@@ -51,29 +50,43 @@ namespace ProcessHacker
         public bool JustProcessed;
     }
 
-    public class NetworkProvider : Provider<string, NetworkItem>
+    public class NetworkProvider : Provider<NetworkConnectionKey, NetworkItem>
     {
         private class AddressResolveMessage : Message
         {
-            public string Id;
+            public NetworkConnectionKey Key;
             public bool Remote;
             public string HostName;
         }
 
         private readonly MessageQueue _messageQueue = new MessageQueue();
-        private readonly Dictionary<IPAddress, string> _resolveCache = new Dictionary<IPAddress, string>();
-        private readonly FastResourceLock _resolveCacheLock = new FastResourceLock();
+        private readonly HostNameResolver _resolver = new HostNameResolver();
+        private readonly HostNameResolver.HostNameResolvedCallback _localResolvedCallback;
+        private readonly HostNameResolver.HostNameResolvedCallback _remoteResolvedCallback;
+        // Reused on every update.
+        private readonly NetworkConnectionTable _table = new NetworkConnectionTable();
+        private int _nextId;
 
         public NetworkProvider()
         {
             this.Name = "NetworkProvider";
+            this.Disposed += provider =>
+            {
+                _table.Dispose();
+                _resolver.Dispose();
+            };
+
+            _localResolvedCallback = (address, hostName, context) =>
+                this.OnAddressResolved((NetworkItem)context, false, hostName);
+            _remoteResolvedCallback = (address, hostName, context) =>
+                this.OnAddressResolved((NetworkItem)context, true, hostName);
 
             _messageQueue.AddListener(new MessageQueueListener<AddressResolveMessage>(message =>
             {
-                if (Dictionary.ContainsKey(message.Id))
-                {
-                    var item = Dictionary[message.Id];
+                NetworkItem item;
 
+                if (Dictionary.TryGetValue(message.Key, out item))
+                {
                     if (message.Remote)
                         item.RemoteString = message.HostName;
                     else
@@ -86,160 +99,72 @@ namespace ProcessHacker
 
         protected override void Update()
         {
-            var networkDict = Windows.GetNetworkConnections();
-            var preKeyDict = new Dictionary<string, KeyValuePair<int, NetworkConnection>>();
-            var keyDict = new Dictionary<string, NetworkItem>();
-            Dictionary<string, NetworkItem> newDict =
-                new Dictionary<string, NetworkItem>(this.Dictionary);
-
-            // Flattens list, assigns IDs and counts
-            foreach (var list in networkDict.Values)
+            // Connections are identified by value, so nothing needs to be 
+            // allocated for connections we already know about.
+            _table.Update();
+
+            NetworkConnectionRow[] rows = _table.Rows;
+            int count = _table.Count;
+            bool hideOwn = Settings.Instance.HideProcessHackerNetworkConnections;
+            int currentPid = Program.CurrentProcessId;
+            Dictionary<NetworkConnectionKey, NetworkItem> newDict =
+                new Dictionary<NetworkConnectionKey, NetworkItem>(this.Dictionary);
+
+            foreach (var item in this.Dictionary.Values)
             {
-                foreach (var connection in list)
+                if (_table.Find(ref item.Key) == -1 || (hideOwn && item.Key.Pid == currentPid))
                 {
-                    if (connection.Pid == Program.CurrentProcessId &&
-                        Settings.Instance.HideProcessHackerNetworkConnections)
-                        continue;
-
-                    string id = connection.Pid.ToString() + "-" + connection.Local.ToString() + "-" +
-                        (connection.Remote != null ? connection.Remote.ToString() : "") + "-" + connection.Protocol.ToString();
-
-                    if (preKeyDict.ContainsKey(id))
-                        preKeyDict[id] = new KeyValuePair<int, NetworkConnection>(
-                            preKeyDict[id].Key + 1, preKeyDict[id].Value);
-                    else
-                        preKeyDict.Add(id, new KeyValuePair<int, NetworkConnection>(1, connection));
-                }
-            }
-
-            // Merges counts into IDs
-            foreach (string s in preKeyDict.Keys)
-            {
-                var connection = preKeyDict[s].Value;
-                NetworkItem item = new NetworkItem
-                {
-                    Id = s + "-" + preKeyDict[s].Key.ToString(), 
-                    Connection = connection
-                };
-
-                keyDict.Add(s + "-" + preKeyDict[s].Key.ToString(), item);
-            }
-
-            foreach (var connection in this.Dictionary.Values)
-            {
-                if (!keyDict.ContainsKey(connection.Id))
-                {
-                    OnDictionaryRemoved(connection);
-                    newDict.Remove(connection.Id);
+                    // Don't bother resolving addresses nobody will see.
+                    if (item.LocalString == null && !item.Key.IsLocalAddressEmpty)
+                        _resolver.Cancel(item.Connection.Local.Address, item);
+                    if (item.RemoteString == null && item.Key.HasRemote && !item.Key.IsRemoteAddressEmpty)
+                        _resolver.Cancel(item.Connection.Remote.Address, item);
+
+                    OnDictionaryRemoved(item);
+                    newDict.Remove(item.Key);
                 }
             }
 
             // Get resolve results.
             _messageQueue.Listen();
 
-            foreach (var connection in keyDict.Values)
+            for (int i = 0; i < count; i++)
             {
-                if (!this.Dictionary.ContainsKey(connection.Id))
-                {
-                    connection.Tag = this.RunCount;
+                NetworkItem item;
 
-                    // Resolve the IP addresses.
-                    if (connection.Connection.Local != null)
-                    {
-                        if (!connection.Connection.Local.Address.GetAddressBytes().IsEmpty())
-                        {
-                            bool queue = false;
+                if (hideOwn && rows[i].Key.Pid == currentPid)
+                    continue;
 
-                            // See if IP address is in the cache.
-
-                            _resolveCacheLock.AcquireShared();
-
-                            try
-                            {
-                                if (_resolveCache.ContainsKey(connection.Connection.Local.Address))
-                                {
-                                    // We have the resolved address.
-                                    connection.LocalString = _resolveCache[connection.Connection.Local.Address];
-                                }
-                                else
-                                {
-                                    queue = true;
-                                }
-                            }
-                            finally
-                            {
-                                _resolveCacheLock.ReleaseShared();
-                            }
-
-                            if (queue)
-                            {
-                                // Queue for resolve.
-                                WorkQueue.GlobalQueueWorkItemTag(
-                                    new Action<string, bool, IPAddress>(this.ResolveAddresses),
-                                    "network-resolve-local",
-                                    connection.Id,
-                                    false,
-                                    connection.Connection.Local.Address
-                                    );
-                            }
-                        }
-                    }
-
-                    if (connection.Connection.Remote != null)
+                if (!this.Dictionary.TryGetValue(rows[i].Key, out item))
+                {
+                    item = new NetworkItem
                     {
-                        if (!connection.Connection.Remote.Address.GetAddressBytes().IsEmpty())
-                        {
-                            bool queue = false;
+                        Id = (_nextId++).ToString(),
+                        Key = rows[i].Key,
+                        Connection = rows[i].ToNetworkConnection(),
+                        Tag = this.RunCount
+                    };
 
-                            _resolveCacheLock.AcquireShared();
-
-                            try
-                            {
-                                if (_resolveCache.ContainsKey(connection.Connection.Remote.Address))
-                                {
-                                    // We have the resolved address.
-                                    connection.RemoteString = _resolveCache[connection.Connection.Remote.Address];
-                                }
-                                else
-                                {
-                                    queue = true;
-                                }
-                            }
-                            finally
-                            {
-                                _resolveCacheLock.ReleaseShared();
-                            }
-
-                            if (queue)
-                            {
-                                WorkQueue.GlobalQueueWorkItemTag(
-                                    new Action<string, bool, IPAddress>(this.ResolveAddresses),
-                                    "network-resolve-remote",
-                                    connection.Id,
-                                    true,
-                                    connection.Connection.Remote.Address
-                                    );
-                            }
-                        }
-                    }
+                    // Resolve the IP addresses.
+                    if (!item.Key.IsLocalAddressEmpty)
+                        item.LocalString = this.ResolveAddress(item, false, item.Connection.Local.Address);
+                    if (item.Key.HasRemote && !item.Key.IsRemoteAddressEmpty)
+                        item.RemoteString = this.ResolveAddress(item, true, item.Connection.Remote.Address);
 
                     // Update the dictionary.
-                    newDict.Add(connection.Id, connection);
-                    OnDictionaryAdded(connection);
+                    newDict.Add(item.Key, item);
+                    OnDictionaryAdded(item);
                 }
                 else
                 {
-                    if (
-                        connection.Connection.State != Dictionary[connection.Id].Connection.State ||
-                        Dictionary[connection.Id].JustProcessed
-                        )
+                    if (rows[i].State != item.Connection.State || item.JustProcessed)
                     {
-                        NetworkItem oldConnection = Dictionary[connection.Id].Clone() as NetworkItem;
+                        NetworkItem oldItem = item.Clone() as NetworkItem;
 
-                        newDict[connection.Id].Connection.State = connection.Connection.State;
-                        newDict[connection.Id].JustProcessed = false;
+                        item.Connection.State = rows[i].State;
+                        item.JustProcessed = false;
 
-                        OnDictionaryModified(oldConnection, newDict[connection.Id]);
+                        OnDictionaryModified(oldItem, item);
                     }
                 }
             }
@@ -247,63 +172,32 @@ namespace ProcessHacker
             this.Dictionary = newDict;
         }
 
-        private void ResolveAddresses(string id, bool remote, IPAddress address)
+        /// <summary>
+        /// Gets the host name for an address from the cache, or queues the 
+        /// address to be resolved.
+        /// </summary>
+        /// <returns>The host name, or null if it is not available yet.</returns>
+        private string ResolveAddress(NetworkItem item, bool remote, IPAddress address)
         {
-            string hostName = null;
-            bool inCache = false;
+            string hostName;
 
-            // Last minute check of the cache.
+            if (_resolver.TryGetCached(address, out hostName))
+                return hostName;
 
-            _resolveCacheLock.AcquireShared();
-
-            try
-            {
-                if (_resolveCache.ContainsKey(address))
-                {
-                    hostName = _resolveCache[address];
-                    inCache = true;
-                }
-            }
-            finally
-            {
-                _resolveCacheLock.ReleaseShared();
-            }
+            _resolver.Resolve(address, item, remote ? _remoteResolvedCallback : _localResolvedCallback);
 
-            // If it wasn't in the cache, resolve the address.
-            if (!inCache)
-            {
-                try
-                {
-                    hostName = Dns.GetHostEntry(address).HostName;
-                }
-                catch (SocketException)
-                {
-                    // Host was not found.
-                    return;
-                }
-
-                // Update the cache.
-
-                _resolveCacheLock.AcquireExclusive();
+            return null;
+        }
 
-                try
-                {
-                    // Add the name if not present already.
-                    if (!string.IsNullOrEmpty(hostName))
-                    {
-                        if (!_resolveCache.ContainsKey(address))
-                            _resolveCache.Add(address, hostName);
-                    }
-                }
-                finally
-                {
-                    _resolveCacheLock.ReleaseExclusive();
-                }
-            }
+        private void OnAddressResolved(NetworkItem item, bool remote, string hostName)
+        {
+            // The address couldn't be resolved.
+            if (hostName == null)
+                return;
 
             _messageQueue.Enqueue(new AddressResolveMessage
             {
-                Id = id,
+                Key = item.Key,
                 Remote = remote,
                 HostName = hostName
             });
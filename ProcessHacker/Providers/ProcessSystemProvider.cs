@@ -118,6 +118,8 @@ namespace ProcessHacker
         public CircularBuffer<long> IoReadOtherHistory;
         public CircularBuffer<long> PrivateMemoryHistory;
         public CircularBuffer<long> WorkingSetHistory;
+
+        public int HistorySeries;
     }
 
     public class ProcessSystemProvider : Provider<int, ProcessItem>
@@ -152,6 +154,33 @@ namespace ProcessHacker
 
         public delegate void ProcessQueryDelegate(int stage, int pid);
 
+        // History file layout. The system series uses all metrics, each 
+        // per-CPU series uses the first three and each process series uses 
+        // the first eight.
+        private const int HistorySeriesCapacity = 512;
+        private const int HistoryMetricCount = 10;
+        private const int SystemHistoryId = -100;
+
+        private const int HistoryCpuKernel = 0;
+        private const int HistoryCpuUser = 1;
+        private const int HistoryCpuOther = 2;
+        private const int HistoryIoRead = 3;
+        private const int HistoryIoWrite = 4;
+        private const int HistoryIoOther = 5;
+        private const int HistoryIoReadOther = 6;
+        private const int HistoryCommit = 7;
+        private const int HistoryPhysicalMemory = 8;
+        private const int HistoryTime = 9;
+
+        private const int HistoryProcessCpuKernel = 0;
+        private const int HistoryProcessCpuUser = 1;
+        private const int HistoryProcessIoRead = 2;
+        private const int HistoryProcessIoWrite = 3;
+        private const int HistoryProcessIoOther = 4;
+        private const int HistoryProcessIoReadOther = 5;
+        private const int HistoryProcessPrivateMemory = 6;
+        private const int HistoryProcessWorkingSet = 7;
+
         public event ProcessQueryDelegate ProcessQueryComplete;
         public event ProcessQueryDelegate ProcessQueryReceived;
 
@@ -217,7 +246,7 @@ namespace ProcessHacker
         private delegate ProcessQueryMessage QueryProcessDelegate(int pid, string fileName, bool useCache);
 
         private readonly MessageQueue _messageQueue = new MessageQueue();
-        private readonly Dictionary<string, VerifyResult> _fileResults = new Dictionary<string, VerifyResult>();
+        private readonly ImageAnalysisQueue _imageAnalysis = new ImageAnalysisQueue(new FileVerifyCache(null));
 
         private Int64Delta _ioReadDelta;
         private Int64Delta _ioWriteDelta;
@@ -246,6 +275,13 @@ namespace ProcessHacker
         private readonly CircularBuffer<string> _cpuMostUsageHistory;
         private readonly CircularBuffer<string> _ioMostUsageHistory;
 
+        private readonly object _historyFileLock = new object();
+        private bool _historyFullLogged;
+        private HistoryFile _historyFile;
+        private int _systemHistorySeries = -1;
+        private int[] _cpusHistorySeries;
+        private bool _historySweepPending;
+
         private SystemProcess _dpcs = new SystemProcess
         {
             Name = "DPCs",
@@ -284,6 +320,9 @@ namespace ProcessHacker
                 }
             }));
 
+            _imageAnalysis.ImageAnalyzed += imageAnalysis_ImageAnalyzed;
+            _imageAnalysis.ImageVerified += imageAnalysis_ImageVerified;
+
             SystemBasicInformation basic;
             int retLen;
 
@@ -356,6 +395,32 @@ namespace ProcessHacker
             _physicalMemoryHistory.Add(0);
         }
 
+        protected override void DisposeObject(bool disposing)
+        {
+            lock (_historyFileLock)
+            {
+                if (_historyFile != null)
+                {
+                    _historyFile.Dispose();
+                    _historyFile = null;
+                }
+            }
+
+            if (_imageAnalysis.Cache != null)
+            {
+                try
+                {
+                    _imageAnalysis.Cache.Save();
+                }
+                catch (Exception ex)
+                {
+                    Logging.Log(ex);
+                }
+            }
+
+            base.DisposeObject(disposing);
+        }
+
         public SystemProcess DpcsProcess
         {
             get { return _dpcs; }
@@ -366,6 +431,282 @@ namespace ProcessHacker
             get { return _interrupts; }
         }
 
+        /// <summary>
+        /// Opens or creates a verification cache. Signature and packing 
+        /// results for files which have not changed are taken from the 
+        /// cache instead of being computed again.
+        /// </summary>
+        /// <param name="fileName">The name of the cache file.</param>
+        public void OpenVerifyCache(string fileName)
+        {
+            if (_imageAnalysis.Cache != null && _imageAnalysis.Cache.FileName != null)
+                throw new InvalidOperationException("A verification cache is already open.");
+
+            _imageAnalysis.Cache = new FileVerifyCache(fileName);
+        }
+
+        /// <summary>
+        /// Sets the processes which are currently visible to the user. 
+        /// The files of these processes are verified first.
+        /// </summary>
+        /// <param name="pids">The IDs of the visible processes.</param>
+        public void SetVisibleProcesses(IEnumerable<int> pids)
+        {
+            _imageAnalysis.SetVisibleProcesses(pids);
+        }
+
+        /// <summary>
+        /// Opens or creates a history file. Any history stored in the file 
+        /// is loaded immediately, and new samples are appended to the file 
+        /// on every update.
+        /// </summary>
+        /// <param name="fileName">The name of the history file.</param>
+        public void OpenHistory(string fileName)
+        {
+            lock (_historyFileLock)
+            {
+                if (_historyFile != null)
+                    throw new InvalidOperationException("A history file is already open.");
+
+                HistoryFile historyFile = new HistoryFile(
+                    fileName,
+                    _historyMaxSize,
+                    HistoryMetricCount,
+                    HistorySeriesCapacity
+                    );
+
+                try
+                {
+                    _systemHistorySeries = historyFile.AttachSeries(SystemHistoryId, 0);
+
+                    if (_systemHistorySeries != -1)
+                        this.LoadSystemHistory(historyFile);
+                    else
+                        _systemHistorySeries = this.AllocateHistorySeries(historyFile, SystemHistoryId, 0);
+
+                    _cpusHistorySeries = new int[this.System.NumberOfProcessors];
+
+                    for (int i = 0; i < _cpusHistorySeries.Length; i++)
+                    {
+                        int index = historyFile.AttachSeries(SystemHistoryId - 1 - i, 0);
+
+                        if (index != -1)
+                        {
+                            this.LoadCb(historyFile, index, HistoryCpuKernel, _cpusKernelHistory[i]);
+                            this.LoadCb(historyFile, index, HistoryCpuUser, _cpusUserHistory[i]);
+                            this.LoadCb(historyFile, index, HistoryCpuOther, _cpusOtherHistory[i]);
+                        }
+                        else
+                        {
+                            index = this.AllocateHistorySeries(historyFile, SystemHistoryId - 1 - i, 0);
+                        }
+
+                        _cpusHistorySeries[i] = index;
+                    }
+                }
+                catch
+                {
+                    historyFile.Dispose();
+                    throw;
+                }
+
+                // Processes which exited while the file was closed are 
+                // freed after the first update.
+                _historySweepPending = true;
+                _historyFile = historyFile;
+            }
+        }
+
+        private void LoadCb(HistoryFile historyFile, int series, int metric, CircularBuffer<float> cb)
+        {
+            if (cb.Size != _historyMaxSize)
+                cb.Resize(_historyMaxSize);
+
+            cb.Clear();
+            historyFile.Load(series, metric, cb);
+        }
+
+        private void LoadCb(HistoryFile historyFile, int series, int metric, CircularBuffer<long> cb)
+        {
+            if (cb.Size != _historyMaxSize)
+                cb.Resize(_historyMaxSize);
+
+            cb.Clear();
+            historyFile.Load(series, metric, cb);
+        }
+
+        private void LoadSystemHistory(HistoryFile historyFile)
+        {
+            int series = _systemHistorySeries;
+            long[] buffer = new long[historyFile.GetSampleCount(series)];
+            int count;
+
+            this.LoadCb(historyFile, series, HistoryCpuKernel, _cpuKernelHistory);
+            this.LoadCb(historyFile, series, HistoryCpuUser, _cpuUserHistory);
+            this.LoadCb(historyFile, series, HistoryCpuOther, _cpuOtherHistory);
+            this.LoadCb(historyFile, series, HistoryIoRead, _ioReadHistory);
+            this.LoadCb(historyFile, series, HistoryIoWrite, _ioWriteHistory);
+            this.LoadCb(historyFile, series, HistoryIoOther, _ioOtherHistory);
+            this.LoadCb(historyFile, series, HistoryIoReadOther, _ioReadOtherHistory);
+
+            // The lists and the time history are filled oldest first.
+
+            count = historyFile.Read(series, HistoryCommit, buffer);
+            _commitHistory.Clear();
+
+            for (int i = count - 1; i >= 0; i--)
+                this.UpdateList(_commitHistory, (int)buffer[i]);
+
+            count = historyFile.Read(series, HistoryPhysicalMemory, buffer);
+            _physicalMemoryHistory.Clear();
+
+            for (int i = count - 1; i >= 0; i--)
+                this.UpdateList(_physicalMemoryHistory, (int)buffer[i]);
+
+            count = historyFile.Read(series, HistoryTime, buffer);
+            _timeHistory.Clear();
+            _cpuMostUsageHistory.Clear();
+            _ioMostUsageHistory.Clear();
+
+            for (int i = count - 1; i >= 0; i--)
+            {
+                // We don't store the most-active process strings, but they 
+                // need to stay aligned with the time history.
+                this.UpdateCb(_timeHistory, DateTime.FromBinary(buffer[i]));
+                this.UpdateCb(_cpuMostUsageHistory, string.Empty);
+                this.UpdateCb(_ioMostUsageHistory, string.Empty);
+            }
+        }
+
+        private void AttachProcessHistory(ProcessItem item)
+        {
+            lock (_historyFileLock)
+            {
+                if (_historyFile == null)
+                    return;
+
+                item.HistorySeries = _historyFile.AttachSeries(item.Pid, item.Process.CreateTime);
+
+                if (item.HistorySeries != -1)
+                {
+                    this.LoadCb(_historyFile, item.HistorySeries, HistoryProcessCpuKernel, item.CpuKernelHistory);
+                    this.LoadCb(_historyFile, item.HistorySeries, HistoryProcessCpuUser, item.CpuUserHistory);
+                    this.LoadCb(_historyFile, item.HistorySeries, HistoryProcessIoRead, item.IoReadHistory);
+                    this.LoadCb(_historyFile, item.HistorySeries, HistoryProcessIoWrite, item.IoWriteHistory);
+                    this.LoadCb(_historyFile, item.HistorySeries, HistoryProcessIoOther, item.IoOtherHistory);
+                    this.LoadCb(_historyFile, item.HistorySeries, HistoryProcessIoReadOther, item.IoReadOtherHistory);
+                    this.LoadCb(_historyFile, item.HistorySeries, HistoryProcessPrivateMemory, item.PrivateMemoryHistory);
+                    this.LoadCb(_historyFile, item.HistorySeries, HistoryProcessWorkingSet, item.WorkingSetHistory);
+                }
+                else
+                {
+                    item.HistorySeries = this.AllocateHistorySeries(_historyFile, item.Pid, item.Process.CreateTime);
+                }
+            }
+        }
+
+        private int AllocateHistorySeries(HistoryFile historyFile, int id, long key)
+        {
+            int index = historyFile.AllocateSeries(id, key);
+
+            if (index == -1)
+            {
+                // Only log once until a series can be allocated again, 
+                // otherwise every new process would be logged.
+                if (!_historyFullLogged)
+                {
+                    Logging.Log(Logging.Importance.Warning, "History file is full (" +
+                        historyFile.SeriesCapacity.ToString() + " series), history will not be saved for new processes");
+                    _historyFullLogged = true;
+                }
+            }
+            else
+            {
+                _historyFullLogged = false;
+            }
+
+            return index;
+        }
+
+        private void DetachProcessHistory(ProcessItem item)
+        {
+            lock (_historyFileLock)
+            {
+                if (_historyFile != null && item.HistorySeries != -1)
+                    _historyFile.FreeSeries(item.HistorySeries);
+
+                item.HistorySeries = -1;
+            }
+        }
+
+        private void WriteProcessHistory(ProcessItem item)
+        {
+            lock (_historyFileLock)
+            {
+                if (_historyFile == null || item.HistorySeries == -1)
+                    return;
+
+                _historyFile.Write(item.HistorySeries, HistoryProcessCpuKernel, item.CpuKernelHistory[0]);
+                _historyFile.Write(item.HistorySeries, HistoryProcessCpuUser, item.CpuUserHistory[0]);
+                _historyFile.Write(item.HistorySeries, HistoryProcessIoRead, item.IoReadHistory[0]);
+                _historyFile.Write(item.HistorySeries, HistoryProcessIoWrite, item.IoWriteHistory[0]);
+                _historyFile.Write(item.HistorySeries, HistoryProcessIoOther, item.IoOtherHistory[0]);
+                _historyFile.Write(item.HistorySeries, HistoryProcessIoReadOther, item.IoReadOtherHistory[0]);
+                _historyFile.Write(item.HistorySeries, HistoryProcessPrivateMemory, item.PrivateMemoryHistory[0]);
+                _historyFile.Write(item.HistorySeries, HistoryProcessWorkingSet, item.WorkingSetHistory[0]);
+                _historyFile.Publish(item.HistorySeries);
+            }
+        }
+
+        private void WriteSystemHistory()
+        {
+            lock (_historyFileLock)
+            {
+                if (_historyFile == null)
+                    return;
+
+                if (_systemHistorySeries != -1)
+                {
+                    int series = _systemHistorySeries;
+
+                    _historyFile.Write(series, HistoryCpuKernel, _cpuKernelHistory[0]);
+                    _historyFile.Write(series, HistoryCpuUser, _cpuUserHistory[0]);
+                    _historyFile.Write(series, HistoryCpuOther, _cpuOtherHistory[0]);
+                    _historyFile.Write(series, HistoryIoRead, _ioReadHistory[0]);
+                    _historyFile.Write(series, HistoryIoWrite, _ioWriteHistory[0]);
+                    _historyFile.Write(series, HistoryIoOther, _ioOtherHistory[0]);
+                    _historyFile.Write(series, HistoryIoReadOther, _ioReadOtherHistory[0]);
+                    _historyFile.Write(series, HistoryCommit, (long)_commitHistory[_commitHistory.Count - 1]);
+                    _historyFile.Write(series, HistoryPhysicalMemory, (long)_physicalMemoryHistory[_physicalMemoryHistory.Count - 1]);
+                    _historyFile.Write(series, HistoryTime, _timeHistory[0].ToBinary());
+                    _historyFile.Publish(series);
+                }
+
+                for (int i = 0; i < _cpusHistorySeries.Length; i++)
+                {
+                    int series = _cpusHistorySeries[i];
+
+                    if (series == -1)
+                        continue;
+
+                    _historyFile.Write(series, HistoryCpuKernel, _cpusKernelHistory[i][0]);
+                    _historyFile.Write(series, HistoryCpuUser, _cpusUserHistory[i][0]);
+                    _historyFile.Write(series, HistoryCpuOther, _cpusOtherHistory[i][0]);
+                    _historyFile.Publish(series);
+                }
+
+                if (_historySweepPending)
+                {
+                    // Every series which is still alive has been attached or 
+                    // written to by now.
+                    _historyFile.FreeStaleSeries(_historyFile.Sequence, _systemHistorySeries);
+                    _historySweepPending = false;
+                }
+
+                _historyFile.EndTick();
+            }
+        }
+
         private void UpdateCb<T>(CircularBuffer<T> cb, T value)
         {
             if (cb.Size != _historyMaxSize)
@@ -559,11 +900,7 @@ namespace ProcessHacker
                 "process-stage1a",
                 pid, fileName, forced
                 );
-            WorkQueue.GlobalQueueWorkItemTag(
-                new QueryProcessDelegate(this.QueryProcessStage2),
-                "process-stage2",
-                pid, fileName, forced
-                );
+            this.QueryProcessStage2(pid, fileName, forced);
 
             if (this.ProcessQueryComplete != null)
                 this.ProcessQueryComplete(fpResult.Stage, pid);
@@ -602,111 +939,64 @@ namespace ProcessHacker
         }
 
         /// <summary>
-        /// Stage 2 Process Querying - gets whether the process file is packed or signed.
+        /// Stage 2 Process Querying - queues the process file to find out whether 
+        /// it is packed or signed.
         /// </summary>
-        private ProcessQueryMessage QueryProcessStage2(int pid, string fileName, bool forced)
+        private void QueryProcessStage2(int pid, string fileName, bool forced)
         {
-            ProcessQueryMessage fpResult = new ProcessQueryMessage
-            {
-                Pid = pid, 
-                Stage = 0x2, 
-                IsPacked = false
-            };
-
             if (string.IsNullOrEmpty(fileName))
-                return null;
+                return;
 
-            // Don't process the file if it is too big (above 32MB).
-            try
+            if (Settings.Instance.VerifySignatures || forced)
             {
-                if ((new System.IO.FileInfo(fileName)).Length > 32 * 1024 * 1024)
-                    return null;
+                _imageAnalysis.Request(pid, fileName, forced);
             }
-            catch
-            {
-                return null;
-            }
-
-            // Find out if it's packed.
-            // An image is packed if:
-            // 1. It references less than 3 libraries
-            // 2. It imports less than 5 functions
-            // or:
-            // 1. The function-to-library ratio is lower than 4
-            //   (on average less than 4 functions are imported from each library)
-            // 2. It references more than 3 libraries but less than 14 libraries.
-            if (!string.IsNullOrEmpty(fileName) && (Settings.Instance.VerifySignatures || forced))
+            else
             {
-                try
-                {
-                    using (MappedImage mappedImage = new MappedImage(fileName))
-                    {
-                        int libraryTotal = mappedImage.Imports.Count;
-                        int funcTotal = 0;
-
-                        for (int i = 0; i < mappedImage.Imports.Count; i++)
-                            funcTotal += mappedImage.Imports[i].Count;
-
-                        fpResult.ImportModules = libraryTotal;
-                        fpResult.ImportFunctions = funcTotal;
-
-                        if (
-                            libraryTotal < 3 && funcTotal < 5 ||
-                            ((float)funcTotal / libraryTotal < 4) && libraryTotal > 3 && libraryTotal < 30
-                            )
-                            fpResult.IsPacked = true;
-                    }
-                }
-                catch (AccessViolationException)
+                this.PostProcessQuery(new ProcessQueryMessage
                 {
-                    if (pid > 4)
-                        fpResult.IsPacked = true;
-                }
-                catch
-                { }
+                    Pid = pid,
+                    Stage = 0x2,
+                    IsPacked = false
+                });
             }
+        }
 
-            try
+        /// <summary>
+        /// Stage 2 - the process file has been checked for packing.
+        /// </summary>
+        private void imageAnalysis_ImageAnalyzed(int pid, bool isPacked, int importModules, int importFunctions)
+        {
+            this.PostProcessQuery(new ProcessQueryMessage
             {
-                if (Settings.Instance.VerifySignatures || forced)
-                {
-                    if (!string.IsNullOrEmpty(fileName))
-                    {
-                        string uniName = global::System.IO.Path.GetFullPath(fileName).ToLowerInvariant();
-
-                        // No lock needed; verify results are never removed, only added.
-                        if (!forced && _fileResults.ContainsKey(uniName))
-                        {
-                            fpResult.VerifyResult = _fileResults[uniName];
-                        }
-                        else
-                        {
-                            try
-                            {
-                                fpResult.VerifyResult = Cryptography.VerifyFile(fileName, out fpResult.VerifySignerName);
-                            }
-                            catch
-                            {
-                                fpResult.VerifyResult = VerifyResult.NoSignature;
-                            }
+                Pid = pid,
+                Stage = 0x2,
+                IsPacked = isPacked,
+                ImportModules = importModules,
+                ImportFunctions = importFunctions
+            });
+        }
 
-                            if (!_fileResults.ContainsKey(uniName))
-                                _fileResults.Add(uniName, fpResult.VerifyResult);
-                            else
-                                _fileResults[uniName] = fpResult.VerifyResult;
-                        }
-                    }
-                }
-            }
-            catch
-            { }
+        /// <summary>
+        /// Stage 2A - the process file's signature has been verified.
+        /// </summary>
+        private void imageAnalysis_ImageVerified(int pid, VerifyResult verifyResult, string verifySignerName)
+        {
+            this.PostProcessQuery(new ProcessQueryMessage
+            {
+                Pid = pid,
+                Stage = 0x2a,
+                VerifyResult = verifyResult,
+                VerifySignerName = verifySignerName
+            });
+        }
 
-            _messageQueue.Enqueue(fpResult);
+        private void PostProcessQuery(ProcessQueryMessage message)
+        {
+            _messageQueue.Enqueue(message);
 
             if (this.ProcessQueryComplete != null)
-                this.ProcessQueryComplete(fpResult.Stage, pid);
-
-            return fpResult;
+                this.ProcessQueryComplete(message.Stage, message.Pid);
         }
 
         private static string GetFileName(int pid)
@@ -814,11 +1104,13 @@ namespace ProcessHacker
                     break;
                 case 0x2:
                     item.IsPacked = !(item.IsDotNet || result.IsDotNet) && result.IsPacked;
-                    item.VerifyResult = result.VerifyResult;
-                    item.VerifySignerName = result.VerifySignerName;
                     item.ImportFunctions = result.ImportFunctions;
                     item.ImportModules = result.ImportModules;
                     break;
+                case 0x2a:
+                    item.VerifyResult = result.VerifyResult;
+                    item.VerifySignerName = result.VerifySignerName;
+                    break;
                 default:
                     Logging.Log(Logging.Importance.Warning, "Unknown stage " + result.Stage.ToString("x"));
                     break;
@@ -944,6 +1236,8 @@ namespace ProcessHacker
                     if (item.LargeIcon != null)
                         Win32.DestroyIcon(item.LargeIcon.Handle);
 
+                    this.DetachProcessHistory(item);
+
                     newdictionary.Remove(pid);
                 }
             }
@@ -980,9 +1274,12 @@ namespace ProcessHacker
                         IoOtherHistory = new CircularBuffer<long>(this._historyMaxSize),
                         IoReadOtherHistory = new CircularBuffer<long>(this._historyMaxSize),
                         PrivateMemoryHistory = new CircularBuffer<long>(this._historyMaxSize),
-                        WorkingSetHistory = new CircularBuffer<long>(this._historyMaxSize)
+                        WorkingSetHistory = new CircularBuffer<long>(this._historyMaxSize),
+                        HistorySeries = -1
                     };
 
+                    this.AttachProcessHistory(item);
+
                     try
                     {
                         item.ProcessQueryHandle = new ProcessHandle(pid, (ProcessAccess)StandardRights.MaximumAllowed);
@@ -1155,6 +1452,8 @@ namespace ProcessHacker
                     UpdateCb(item.PrivateMemoryHistory, processInfo.VirtualMemoryCounters.PrivatePageCount.ToInt64());
                     UpdateCb(item.WorkingSetHistory, processInfo.VirtualMemoryCounters.WorkingSetSize.ToInt64());
 
+                    this.WriteProcessHistory(item);
+
                     // Update the struct.
                     item.Process = processInfo;
 
@@ -1210,11 +1509,7 @@ namespace ProcessHacker
                     {
                         if (item.IsPacked && item.ProcessingAttempts < 3)
                         {
-                            WorkQueue.GlobalQueueWorkItemTag(
-                                new QueryProcessDelegate(this.QueryProcessStage2),
-                                "process-stage2",
-                                pid, item.FileName, true
-                                );
+                            this.QueryProcessStage2(pid, item.FileName, true);
                             item.ProcessingAttempts++;
                         }
                     }
@@ -1259,6 +1554,8 @@ namespace ProcessHacker
 
             UpdateCb(_timeHistory, DateTime.Now);
 
+            this.WriteSystemHistory();
+
             Dictionary = newdictionary;
 
             if (wtsEnumData.Memory != null)